@@ -9,6 +9,7 @@
 #include "drawextra.h"
 #include <meshing/PointCloud.h>
 #include <meshing/VolumeGrid.h>
+#include <meshing/SparseVolumeGrid.h>
 #include <meshing/Expand.h>
 #include <geometry/Conversions.h>
 #include "Timer.h"
@@ -276,6 +277,9 @@ void GeometryAppearance::Set(const Geometry::AnyCollisionGeometry3D& _geom)
   else if(geom->type == AnyGeometry3D::PointCloud) {
     Set(*geom);
   }
+  else if(geom->type == AnyGeometry3D::ConvexHull) {
+    Set(*geom);
+  }
   else if(geom->type == AnyGeometry3D::Group) {
     if(!_geom.CollisionDataInitialized()) {
       const std::vector<Geometry::AnyGeometry3D>& subgeoms = _geom.AsGroup();
@@ -313,9 +317,11 @@ void GeometryAppearance::Set(const AnyGeometry3D& _geom)
 {
   geom = &_geom;
   if(geom->type == AnyGeometry3D::ImplicitSurface) {
-    const Meshing::VolumeGrid* g = &geom->AsImplicitSurface();
     if(!implicitSurfaceMesh) implicitSurfaceMesh.reset(new Meshing::TriMesh);
-    ImplicitSurfaceToMesh(*g,*implicitSurfaceMesh);
+    if(geom->IsSparseImplicitSurface())
+      ImplicitSurfaceToMesh(geom->AsSparseImplicitSurface(),*implicitSurfaceMesh);
+    else
+      ImplicitSurfaceToMesh(geom->AsImplicitSurface(),*implicitSurfaceMesh);
     drawFaces = true;
   }
   else if(geom->type == AnyGeometry3D::PointCloud) {
@@ -383,6 +389,11 @@ void GeometryAppearance::Set(const AnyGeometry3D& _geom)
       PointCloudToMesh(pc,*implicitSurfaceMesh,*this,0.02);
     }
   }
+  else if(geom->type == AnyGeometry3D::ConvexHull) {
+    if(!implicitSurfaceMesh) implicitSurfaceMesh.reset(new Meshing::TriMesh);
+    geom->AsConvexHull().GetMesh(*implicitSurfaceMesh);
+    drawFaces = true;
+  }
   else if(geom->type == AnyGeometry3D::Group) {
     const std::vector<Geometry::AnyGeometry3D>& subgeoms = _geom.AsGroup();
     subAppearances.resize(subgeoms.size());
@@ -535,6 +546,8 @@ void GeometryAppearance::DrawGL()
   trimesh = implicitSurfaceMesh.get();
       else if(geom->type == AnyGeometry3D::TriangleMesh) 
 	trimesh = &geom->AsTriangleMesh();
+      else if(geom->type == AnyGeometry3D::ConvexHull) 
+	trimesh = implicitSurfaceMesh.get();
       else if(geom->type == AnyGeometry3D::Primitive) 
   draw(geom->AsPrimitive());
 
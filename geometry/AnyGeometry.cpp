@@ -2,16 +2,25 @@
 #include <KrisLibrary/Logger.h>
 #include "AnyGeometry.h"
 #include "Conversions.h"
+#include "ConvexDecomposition.h"
 #include <math3d/geometry3d.h>
+#include <math3d/interpolate.h>
+#include <math3d/basis.h>
 #include <meshing/VolumeGrid.h>
+#include <meshing/SparseVolumeGrid.h>
 #include <meshing/Voxelize.h>
 #include <GLdraw/GeometryAppearance.h>
 #include "CollisionPointCloud.h"
 #include "CollisionImplicitSurface.h"
 #include <utils/stringutils.h>
+#include <utils/fileutils.h>
 #include <meshing/IO.h>
+#include <utils/threadutils.h>
+#include <utils/unionfind.h>
 #include <Timer.h>
+#include <myfile.h>
 #include <fstream>
+#include <sstream>
 #include <stdlib.h>
 #include <string.h>
 
@@ -93,14 +102,174 @@ int PointIndex(const CollisionImplicitSurface& s,const Vector3& ptworld)
   Vector3 plocal;
   s.currentTransform.mulInverse(ptworld,plocal);
   IntTriple cell;
-  s.baseGrid.GetIndex(plocal,cell);
+  s.GetIndex(plocal,cell);
+  IntTriple size = s.GetSize();
   if(cell.a < 0) cell.a = 0;
-  if(cell.a >= s.baseGrid.value.m) cell.a = s.baseGrid.value.m-1;
+  if(cell.a >= size.a) cell.a = size.a-1;
   if(cell.b < 0) cell.b = 0;
-  if(cell.b >= s.baseGrid.value.n) cell.b = s.baseGrid.value.n-1;
+  if(cell.b >= size.b) cell.b = size.b-1;
   if(cell.c < 0) cell.c = 0;
-  if(cell.c >= s.baseGrid.value.p) cell.c = s.baseGrid.value.p-1;
-  return cell.a*s.baseGrid.value.n*s.baseGrid.value.p + cell.b*s.baseGrid.value.p + cell.c;
+  if(cell.c >= size.c) cell.c = size.c-1;
+  return cell.a*size.b*size.c + cell.b*size.c + cell.c;
+}
+
+//Represents a convex primitive as the hull of its vertices fattened by
+//radius.  Returns false for primitives that have no finite vertex set.
+bool PrimitiveToHull(const GeometricPrimitive3D& g,ConvexHull3D& hull,Real& radius)
+{
+  radius = 0;
+  hull.points.resize(0);
+  hull.tris.resize(0);
+  hull.neighbors.resize(0);
+  switch(g.type) {
+  case GeometricPrimitive3D::Point:
+    hull.points.push_back(*AnyCast_Raw<Vector3>(&g.data));
+    return true;
+  case GeometricPrimitive3D::Sphere:
+    {
+      const Sphere3D* s = AnyCast_Raw<Sphere3D>(&g.data);
+      hull.points.push_back(s->center);
+      radius = s->radius;
+      return true;
+    }
+  case GeometricPrimitive3D::Segment:
+    {
+      const Segment3D* s = AnyCast_Raw<Segment3D>(&g.data);
+      hull.points.push_back(s->a);
+      hull.points.push_back(s->b);
+      return true;
+    }
+  case GeometricPrimitive3D::Triangle:
+    {
+      const Triangle3D* t = AnyCast_Raw<Triangle3D>(&g.data);
+      hull.points.push_back(t->a);
+      hull.points.push_back(t->b);
+      hull.points.push_back(t->c);
+      return true;
+    }
+  case GeometricPrimitive3D::Polygon:
+    hull.points = AnyCast_Raw<Polygon3D>(&g.data)->vertices;
+    return true;
+  case GeometricPrimitive3D::AABB:
+    {
+      const AABB3D* bb = AnyCast_Raw<AABB3D>(&g.data);
+      for(int i=0;i<8;i++)
+        hull.points.push_back(Vector3(i&1 ? bb->bmax.x : bb->bmin.x,
+                                      i&2 ? bb->bmax.y : bb->bmin.y,
+                                      i&4 ? bb->bmax.z : bb->bmin.z));
+      return true;
+    }
+  case GeometricPrimitive3D::Box:
+    {
+      const Box3D* b = AnyCast_Raw<Box3D>(&g.data);
+      for(int i=0;i<8;i++) {
+        Vector3 p = b->origin;
+        if(i&1) p.madd(b->xbasis,b->dims.x);
+        if(i&2) p.madd(b->ybasis,b->dims.y);
+        if(i&4) p.madd(b->zbasis,b->dims.z);
+        hull.points.push_back(p);
+      }
+      return true;
+    }
+  default:
+    return false;
+  }
+}
+
+//Signed distance from ptworld to hull h with transform T.  cp is the
+//closest point on the hull boundary and dir the outward direction at cp,
+//both in world coordinates.
+Real HullPointDistance(const ConvexHull3D& h,const RigidTransform& T,const Vector3& ptworld,Vector3& cp,Vector3& dir)
+{
+  Vector3 plocal;
+  T.mulInverse(ptworld,plocal);
+  if(h.Contains(plocal)) {
+    //inside, the nearest face plane gives the penetration
+    Real dmax = -Inf;
+    Vector3 n,nbest;
+    for(size_t i=0;i<h.tris.size();i++) {
+      const Vector3& a = h.points[h.tris[i].a];
+      n.setCross(h.points[h.tris[i].b]-a,h.points[h.tris[i].c]-a);
+      Real len = n.norm();
+      if(len == 0) continue;
+      n /= len;
+      Real d = n.dot(plocal-a);
+      if(d > dmax) { dmax = d; nbest = n; }
+    }
+    cp = plocal;
+    cp.madd(nbest,-dmax);
+    cp = T*cp;
+    dir = T.R*nbest;
+    return dmax;
+  }
+  ConvexHull3D pthull;
+  pthull.points.resize(1,plocal);
+  RigidTransform Tident;
+  Tident.setIdentity();
+  GJKSimplex simplex;
+  Vector3 temp;
+  Real d = GJKDistance(h,Tident,pthull,Tident,simplex,cp,temp);
+  if(d > 0) dir = (plocal-cp)/d;
+  else dir.setZero();
+  cp = T*cp;
+  dir = T.R*dir;
+  return d;
+}
+
+//What hull queries need from a ConvexHull geometry with initialized
+//collision data
+struct ConvexHullData
+{
+  explicit ConvexHullData(const AnyCollisionGeometry3D& g)
+    :hull(g.AsConvexHull()),mesh(g.ConvexHullCollisionData()),T(g.GetTransform())
+  {}
+  const ConvexHull3D& hull;
+  const CollisionMesh& mesh;
+  RigidTransform T;
+};
+
+//If g is a convex hull or a convex primitive, returns its hull in the
+//local frame of g and the radius it is fattened by, including g's margin.
+//temp is used as storage for primitives.
+bool GetConvex(const AnyCollisionGeometry3D& g,ConvexHull3D& temp,const ConvexHull3D*& hull,Real& radius)
+{
+  if(g.type == AnyGeometry3D::ConvexHull) {
+    hull = &g.AsConvexHull();
+    radius = g.margin;
+    return !hull->Empty();
+  }
+  if(g.type == AnyGeometry3D::Primitive && PrimitiveToHull(g.AsPrimitive(),temp,radius)) {
+    hull = &temp;
+    radius += g.margin;
+    return !hull->Empty();
+  }
+  return false;
+}
+
+//Signed distance between convex objects, using GJK when separated and EPA
+//when penetrating
+AnyDistanceQueryResult ConvexDistance(const ConvexHull3D& a,const RigidTransform& Ta,Real ra,
+                                      const ConvexHull3D& b,const RigidTransform& Tb,Real rb,
+                                      GJKSimplex& simplex)
+{
+  AnyDistanceQueryResult res;
+  res.hasPenetration = true;
+  res.hasElements = true;
+  res.hasClosestPoints = true;
+  res.hasDirections = true;
+  res.elem1 = 0;
+  res.elem2 = 0;
+  res.d = GJKDistance(a,Ta,b,Tb,simplex,res.cp1,res.cp2);
+  if(res.d > 0) {
+    res.dir1 = (res.cp2-res.cp1)/res.d;
+  }
+  else {
+    res.d = -EPAPenetration(a,Ta,b,Tb,simplex,res.cp1,res.cp2,res.dir1);
+  }
+  res.dir2.setNegative(res.dir1);
+  Offset1(res,ra);
+  Offset2(res,rb);
+  return res;
 }
 
 AnyDistanceQueryResult::AnyDistanceQueryResult()
@@ -133,10 +302,18 @@ AnyGeometry3D::AnyGeometry3D(const Meshing::VolumeGrid& grid)
   :type(ImplicitSurface),data(grid)
 {}
 
+AnyGeometry3D::AnyGeometry3D(const Meshing::SparseVolumeGrid& grid)
+  :type(ImplicitSurface),data(grid)
+{}
+
 AnyGeometry3D::AnyGeometry3D(const vector<AnyGeometry3D>& group)
   :type(Group),data(group)
 {}
 
+AnyGeometry3D::AnyGeometry3D(const ConvexHull3D& hull)
+  :type(ConvexHull),data(hull)
+{}
+
 AnyGeometry3D::AnyGeometry3D(const AnyGeometry3D& geom)
   :type(geom.type),data(geom.data),appearanceData(geom.appearanceData)
 {}
@@ -145,12 +322,16 @@ const GeometricPrimitive3D& AnyGeometry3D::AsPrimitive() const { return *AnyCast
 const Meshing::TriMesh& AnyGeometry3D::AsTriangleMesh() const { return *AnyCast_Raw<Meshing::TriMesh>(&data); }
 const Meshing::PointCloud3D& AnyGeometry3D::AsPointCloud() const { return *AnyCast_Raw<Meshing::PointCloud3D>(&data); }
 const Meshing::VolumeGrid& AnyGeometry3D::AsImplicitSurface() const { return *AnyCast_Raw<Meshing::VolumeGrid>(&data); }
+const Meshing::SparseVolumeGrid& AnyGeometry3D::AsSparseImplicitSurface() const { return *AnyCast_Raw<Meshing::SparseVolumeGrid>(&data); }
 const vector<AnyGeometry3D>& AnyGeometry3D::AsGroup() const { return *AnyCast_Raw<vector<AnyGeometry3D> >(&data); }
+const ConvexHull3D& AnyGeometry3D::AsConvexHull() const { return *AnyCast_Raw<ConvexHull3D>(&data); }
 GeometricPrimitive3D& AnyGeometry3D::AsPrimitive() { return *AnyCast_Raw<GeometricPrimitive3D>(&data); }
 Meshing::TriMesh& AnyGeometry3D::AsTriangleMesh() { return *AnyCast_Raw<Meshing::TriMesh>(&data); }
 Meshing::PointCloud3D& AnyGeometry3D::AsPointCloud() { return *AnyCast_Raw<Meshing::PointCloud3D>(&data); }
 Meshing::VolumeGrid& AnyGeometry3D::AsImplicitSurface() { return *AnyCast_Raw<Meshing::VolumeGrid>(&data); }
+Meshing::SparseVolumeGrid& AnyGeometry3D::AsSparseImplicitSurface() { return *AnyCast_Raw<Meshing::SparseVolumeGrid>(&data); }
 vector<AnyGeometry3D>& AnyGeometry3D::AsGroup() { return *AnyCast_Raw<vector<AnyGeometry3D> >(&data); }
+ConvexHull3D& AnyGeometry3D::AsConvexHull() { return *AnyCast_Raw<ConvexHull3D>(&data); }
 
 //appearance casts
 GLDraw::GeometryAppearance* AnyGeometry3D::TriangleMeshAppearanceData() { return AnyCast<GLDraw::GeometryAppearance>(&appearanceData); }
@@ -164,6 +345,7 @@ const char* AnyGeometry3D::TypeName(Type type)
   case PointCloud: return "PointCloud";
   case ImplicitSurface: return "ImplicitSurface";
   case Group: return "Group";
+  case ConvexHull: return "ConvexHull";
   default: return "Error";
   }
 }
@@ -181,6 +363,8 @@ bool AnyGeometry3D::Empty() const
     return false;
   case Group:
     return AsGroup().empty();
+  case ConvexHull:
+    return AsConvexHull().Empty();
   }
   return false;
 }
@@ -202,7 +386,7 @@ void AnyGeometry3D::Merge(const vector<AnyGeometry3D>& geoms)
 	//its' a group type
 	group = true;
       }
-    switch(type) {
+    if(!group) switch(type) {
     case Primitive:
       group = true;
       break;
@@ -222,6 +406,9 @@ void AnyGeometry3D::Merge(const vector<AnyGeometry3D>& geoms)
     case ImplicitSurface:
       group = true;
       break;
+    case ConvexHull:
+      group = true;
+      break;
     case Group:
       //don't need to add an extra level of hierarchy
       {
@@ -247,7 +434,8 @@ bool AnyGeometry3D::Convert(Type restype,AnyGeometry3D& res,double param) const
     res.appearanceData = appearanceData;
     return true;
   }
-  if(restype == Group) return false;
+  //only triangle meshes can be converted to groups, by convex decomposition
+  if(restype == Group && type != TriangleMesh) return false;
   Assert(param >= 0);
   switch(type) {
     case Primitive:
@@ -286,6 +474,15 @@ bool AnyGeometry3D::Convert(Type restype,AnyGeometry3D& res,double param) const
           res = AnyGeometry3D(grid);
           return true;
         }
+        case ConvexHull:
+        {
+          AnyGeometry3D mesh;
+          Convert(TriangleMesh,mesh,param);
+          ConvexHull3D hull;
+          hull.Set(mesh.AsTriangleMesh().verts);
+          res = AnyGeometry3D(hull);
+          return true;
+        }
         default:
           break;
       }
@@ -294,12 +491,15 @@ bool AnyGeometry3D::Convert(Type restype,AnyGeometry3D& res,double param) const
       switch(restype) {
         case TriangleMesh:
         {
+          Meshing::TriMesh mesh;
           if(!AsPointCloud().IsStructured()) {
-            LOG4CXX_WARN(KrisLibrary::logger(),"AnyGeometry3D::Convert: Point cloud is not structured, cannot convert to triangle mesh");
-            return false;
+            //param is the reconstruction resolution
+            PointCloudToMesh_Poisson(AsPointCloud(),mesh,param);
+            if(mesh.tris.empty()) return false;
+            res = AnyGeometry3D(mesh);
+            return true;
           }
           if(param == 0) param = Inf;
-          Meshing::TriMesh mesh;
           PointCloudToMesh(AsPointCloud(),mesh,param);
           res = AnyGeometry3D(mesh);
           return true;
@@ -308,6 +508,13 @@ bool AnyGeometry3D::Convert(Type restype,AnyGeometry3D& res,double param) const
         {
           return false;
         }
+        case ConvexHull:
+        {
+          ConvexHull3D hull;
+          hull.Set(AsPointCloud().points);
+          res = AnyGeometry3D(hull);
+          return true;
+        }
         default:
           break;
       }
@@ -349,6 +556,26 @@ bool AnyGeometry3D::Convert(Type restype,AnyGeometry3D& res,double param) const
           res = AnyGeometry3D(grid);
           return true;
         }
+        case ConvexHull:
+        {
+          ConvexHull3D hull;
+          hull.Set(AsTriangleMesh().verts);
+          res = AnyGeometry3D(hull);
+          return true;
+        }
+        case Group:
+        {
+          //approximate convex decomposition; param is the maximum concavity
+          ConvexDecompositionSettings settings;
+          if(param > 0) settings.maxConcavity = param;
+          vector<ConvexHull3D> hulls;
+          if(!ConvexDecomposition(AsTriangleMesh(),hulls,settings)) return false;
+          vector<AnyGeometry3D> group(hulls.size());
+          for(size_t i=0;i<hulls.size();i++)
+            group[i] = AnyGeometry3D(hulls[i]);
+          res = AnyGeometry3D(group);
+          return true;
+        }
         default:
           break;
       }
@@ -367,14 +594,54 @@ bool AnyGeometry3D::Convert(Type restype,AnyGeometry3D& res,double param) const
         case TriangleMesh:
         {
           //TODO: use offset properly
+          Meshing::TriMesh mesh;
+          if(IsSparseImplicitSurface()) {
+            ImplicitSurfaceToMesh(AsSparseImplicitSurface(),mesh);
+            res = AnyGeometry3D(mesh);
+            return true;
+          }
           const Meshing::VolumeGrid& grid = AsImplicitSurface();
           //if(param != 0) grid.Add(param);
-          Meshing::TriMesh mesh;
           ImplicitSurfaceToMesh(grid,mesh);
           //if(param != 0) grid.Add(-param);
           res = AnyGeometry3D(mesh);
           return true;
         }
+        case ConvexHull:
+        {
+          AnyGeometry3D mesh;
+          Convert(TriangleMesh,mesh,param);
+          ConvexHull3D hull;
+          hull.Set(mesh.AsTriangleMesh().verts);
+          res = AnyGeometry3D(hull);
+          return true;
+        }
+        default:
+          break;
+      }
+      break;
+    case ConvexHull:
+      switch(restype) {
+        case TriangleMesh:
+        {
+          Meshing::TriMesh mesh;
+          AsConvexHull().GetMesh(mesh);
+          res = AnyGeometry3D(mesh);
+          return true;
+        }
+        case PointCloud:
+        {
+          Meshing::PointCloud3D pc;
+          pc.points = AsConvexHull().points;
+          res = AnyGeometry3D(pc);
+          return true;
+        }
+        case ImplicitSurface:
+        {
+          AnyGeometry3D mesh;
+          Convert(TriangleMesh,mesh,param);
+          return mesh.Convert(ImplicitSurface,res,param);
+        }
         default:
           break;
       }
@@ -395,6 +662,70 @@ bool AnyGeometry3D::Convert(Type restype,AnyGeometry3D& res,double param) const
   return false;
 }
 
+bool AnyGeometry3D::IsSparseImplicitSurface() const
+{
+  return type == ImplicitSurface && data.hastype<Meshing::SparseVolumeGrid>();
+}
+
+bool AnyGeometry3D::SetImplicitSurfaceSparse(bool sparse,Real band)
+{
+  if(type != ImplicitSurface) return false;
+  if(sparse == IsSparseImplicitSurface()) return true;
+  if(sparse) {
+    const Meshing::VolumeGrid& dense = AsImplicitSurface();
+    if(band <= 0) band = 4.0*dense.GetCellSize().maxAbsElement();
+    Meshing::SparseVolumeGrid grid;
+    grid.SetFromDense(dense,band);
+    data = grid;
+  }
+  else {
+    Meshing::VolumeGrid grid;
+    AsSparseImplicitSurface().GetDense(grid);
+    data = grid;
+  }
+  return true;
+}
+
+bool AnyGeometry3D::ConvertToSparseImplicitSurface(AnyGeometry3D& res,Real resolution,Real band) const
+{
+  if(resolution <= 0) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"AnyGeometry3D::ConvertToSparseImplicitSurface: resolution must be positive");
+    return false;
+  }
+  bool defaultBand = (band <= 0);
+  if(defaultBand) band = 4.0*resolution;
+  Meshing::SparseVolumeGrid grid;
+  switch(type) {
+  case Primitive:
+    PrimitiveToImplicitSurface(AsPrimitive(),grid,resolution,band);
+    break;
+  case TriangleMesh:
+    {
+      CollisionMesh mesh(AsTriangleMesh());
+      MeshToImplicitSurface_NarrowBand(mesh,grid,resolution,band);
+    }
+    break;
+  case ConvexHull:
+    {
+      AnyGeometry3D mesh;
+      if(!Convert(TriangleMesh,mesh)) return false;
+      return mesh.ConvertToSparseImplicitSurface(res,resolution,band);
+    }
+  case ImplicitSurface:
+    if(IsSparseImplicitSurface()) grid = AsSparseImplicitSurface();
+    else {
+      if(defaultBand) band = 4.0*AsImplicitSurface().GetCellSize().maxAbsElement();
+      grid.SetFromDense(AsImplicitSurface(),band);
+    }
+    break;
+  default:
+    return false;
+  }
+  if(grid.IsEmpty()) return false;
+  res = AnyGeometry3D(grid);
+  return true;
+}
+
 size_t AnyGeometry3D::NumElements() const
 {
   switch(type) {
@@ -407,11 +738,17 @@ size_t AnyGeometry3D::NumElements() const
     return AsPointCloud().points.size();
   case ImplicitSurface:
     {
+      if(IsSparseImplicitSurface()) {
+        const Meshing::SparseVolumeGrid& grid = AsSparseImplicitSurface();
+        return size_t(grid.m)*size_t(grid.n)*size_t(grid.p);
+      }
       IntTriple size = AsImplicitSurface().value.size();
       return size.a*size.b*size.c;
     }
   case Group:
     return AsGroup().size();
+  case ConvexHull:
+    return AsConvexHull().tris.size();
   }
   return 0;
 }
@@ -431,17 +768,25 @@ GeometricPrimitive3D AnyGeometry3D::GetElement(int elem) const
     return AsPrimitive();
   }
   else if(type == ImplicitSurface) {
-    const Meshing::VolumeGrid& grid = AsImplicitSurface();
-    IntTriple size = grid.value.size();
+    bool sparse = IsSparseImplicitSurface();
+    IntTriple size;
+    if(sparse) size.set(AsSparseImplicitSurface().m,AsSparseImplicitSurface().n,AsSparseImplicitSurface().p);
+    else size = AsImplicitSurface().value.size();
     //elem = cell.a*size.b*size.c + cell.b*size.c + cell.c;
     IntTriple cell;
     cell.a = elem/(size.b*size.c);
     cell.b = (elem/size.c)%size.b;
     cell.c = elem%size.c;
     AABB3D bb;
-    grid.GetCell(cell,bb);
+    if(sparse) AsSparseImplicitSurface().GetCell(cell,bb);
+    else AsImplicitSurface().GetCell(cell,bb);
     return GeometricPrimitive3D(bb);
   }
+  else if(type == ConvexHull) {
+    const ConvexHull3D& hull = AsConvexHull();
+    const IntTriple& t = hull.tris[elem];
+    return GeometricPrimitive3D(Math3D::Triangle3D(hull.points[t.a],hull.points[t.b],hull.points[t.c]));
+  }
   else if(type == Group) {
     const vector<AnyGeometry3D>& items = AsGroup();
     if(items[elem].type != Primitive)
@@ -542,7 +887,14 @@ bool AnyGeometry3D::Save(const char* fn) const
     {
     ofstream out(fn,ios::out);
     if(!out) return false;
-    out<<this->AsImplicitSurface();
+    if(IsSparseImplicitSurface()) {
+      //the .vol format is dense
+      Meshing::VolumeGrid grid;
+      AsSparseImplicitSurface().GetDense(grid);
+      out<<grid;
+    }
+    else
+      out<<this->AsImplicitSurface();
     out<<endl;
     out.close();
     return true;
@@ -550,6 +902,8 @@ bool AnyGeometry3D::Save(const char* fn) const
     break;
   case Group:
     break;
+  case ConvexHull:
+    break;
   }
   //default save
   ofstream out(fn,ios::out);
@@ -603,6 +957,11 @@ bool AnyGeometry3D::Load(istream& in)
     data = grp;
     return true;
   }
+  else if(typestr == "ConvexHull") {
+    type = ConvexHull;
+    data = ConvexHull3D();
+    in >> this->AsConvexHull();
+  }
   else {
         LOG4CXX_ERROR(KrisLibrary::logger(),"AnyGeometry::Load(): Unknown type "<<typestr.c_str());
   }
@@ -624,7 +983,13 @@ bool AnyGeometry3D::Save(ostream& out) const
     if(!AsPointCloud().SavePCL(out)) return false;
     break;
   case ImplicitSurface:
-    out<<this->AsImplicitSurface()<<endl;
+    if(IsSparseImplicitSurface()) {
+      Meshing::VolumeGrid grid;
+      AsSparseImplicitSurface().GetDense(grid);
+      out<<grid<<endl;
+    }
+    else
+      out<<this->AsImplicitSurface()<<endl;
     break;
   case Group:
     {
@@ -634,6 +999,9 @@ bool AnyGeometry3D::Save(ostream& out) const
         if(!grp[i].Save(out)) return false;
       return true;
     }
+  case ConvexHull:
+    out<<this->AsConvexHull()<<endl;
+    break;
   }
   return true;
 }
@@ -661,8 +1029,9 @@ void AnyGeometry3D::Transform(const Matrix4& T)
       if(T(0,1) != 0 || T(0,2) != 0 || T(1,2) != 0 || T(1,0) != 0 || T(2,0) != 0 || T(2,1) != 0 ) {
 	FatalError("Cannot transform volume grid except via translation / scale");
       }
-      AsImplicitSurface().bb.bmin = T*AsImplicitSurface().bb.bmin;
-      AsImplicitSurface().bb.bmax = T*AsImplicitSurface().bb.bmax;
+      AABB3D& bb = (IsSparseImplicitSurface() ? AsSparseImplicitSurface().bb : AsImplicitSurface().bb);
+      bb.bmin = T*bb.bmin;
+      bb.bmax = T*bb.bmax;
     }
     break;
   case Group:
@@ -672,6 +1041,9 @@ void AnyGeometry3D::Transform(const Matrix4& T)
 	items[i].Transform(T);
     }
     break;
+  case ConvexHull:
+    AsConvexHull().Transform(T);
+    break;
   }
 }
 
@@ -692,6 +1064,7 @@ AABB3D AnyGeometry3D::GetAABB() const
     AsPointCloud().GetAABB(bb.bmin,bb.bmax);
     return bb;
   case ImplicitSurface:
+    if(IsSparseImplicitSurface()) return AsSparseImplicitSurface().bb;
     return AsImplicitSurface().bb;
     break;
   case Group:
@@ -703,11 +1076,93 @@ AABB3D AnyGeometry3D::GetAABB() const
       }
     }
     break;
+  case ConvexHull:
+    return AsConvexHull().GetAABB();
   }
   return bb;
 }
 
 
+//FNV-1a hash, used for keying collision data caches
+static size_t HashBytes(const void* data,size_t n,size_t h=14695981039346656037ULL)
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  for(size_t i=0;i<n;i++) {
+    h ^= bytes[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+size_t AnyGeometry3D::ContentHash() const
+{
+  size_t h = HashBytes(&type,sizeof(type));
+  switch(type) {
+  case Primitive:
+    {
+      stringstream ss;
+      ss<<AsPrimitive();
+      string str = ss.str();
+      return HashBytes(str.c_str(),str.length(),h);
+    }
+  case TriangleMesh:
+    {
+      const Meshing::TriMesh& mesh = AsTriangleMesh();
+      if(!mesh.verts.empty()) h = HashBytes(&mesh.verts[0],mesh.verts.size()*sizeof(Vector3),h);
+      if(!mesh.tris.empty()) h = HashBytes(&mesh.tris[0],mesh.tris.size()*sizeof(IntTriple),h);
+      return h;
+    }
+  case PointCloud:
+    {
+      const Meshing::PointCloud3D& pc = AsPointCloud();
+      if(!pc.points.empty()) h = HashBytes(&pc.points[0],pc.points.size()*sizeof(Vector3),h);
+      return h;
+    }
+  case ImplicitSurface:
+    if(IsSparseImplicitSurface()) {
+      const Meshing::SparseVolumeGrid& grid = AsSparseImplicitSurface();
+      h = HashBytes("sparse",6,h);
+      h = HashBytes(&grid.bb,sizeof(AABB3D),h);
+      IntTriple size(grid.m,grid.n,grid.p);
+      h = HashBytes(&size,sizeof(IntTriple),h);
+      h = HashBytes(&grid.background,sizeof(Real),h);
+      for(size_t i=0;i<grid.blocks.size();i++) {
+        h = HashBytes(&grid.blocks[i].index,sizeof(IntTriple),h);
+        h = HashBytes(&grid.blocks[i].offset,sizeof(int),h);
+        h = HashBytes(&grid.blocks[i].tileValue,sizeof(Real),h);
+      }
+      if(!grid.values.empty()) h = HashBytes(&grid.values[0],grid.values.size()*sizeof(Real),h);
+      return h;
+    }
+    else {
+      const Meshing::VolumeGrid& grid = AsImplicitSurface();
+      h = HashBytes(&grid.bb,sizeof(AABB3D),h);
+      IntTriple size = grid.value.size();
+      h = HashBytes(&size,sizeof(IntTriple),h);
+      if(!grid.value.empty()) h = HashBytes(grid.value.getData(),size_t(size.a)*size_t(size.b)*size_t(size.c)*sizeof(Real),h);
+      return h;
+    }
+  case Group:
+    {
+      const vector<AnyGeometry3D>& items = AsGroup();
+      for(size_t i=0;i<items.size();i++) {
+        size_t hi = items[i].ContentHash();
+        h = HashBytes(&hi,sizeof(hi),h);
+      }
+      return h;
+    }
+  case ConvexHull:
+    {
+      const ConvexHull3D& hull = AsConvexHull();
+      if(!hull.points.empty()) h = HashBytes(&hull.points[0],hull.points.size()*sizeof(Vector3),h);
+      if(!hull.tris.empty()) h = HashBytes(&hull.tris[0],hull.tris.size()*sizeof(IntTriple),h);
+      return h;
+    }
+  }
+  return h;
+}
+
+
 
 
 AnyCollisionGeometry3D::AnyCollisionGeometry3D()
@@ -740,6 +1195,12 @@ AnyCollisionGeometry3D::AnyCollisionGeometry3D(const Meshing::VolumeGrid& grid)
   currentTransform.setIdentity();
 }
 
+AnyCollisionGeometry3D::AnyCollisionGeometry3D(const Meshing::SparseVolumeGrid& grid)
+  :AnyGeometry3D(grid),margin(0)
+{
+  currentTransform.setIdentity();
+}
+
 
 AnyCollisionGeometry3D::AnyCollisionGeometry3D(const vector<AnyGeometry3D>& items)
   :AnyGeometry3D(items),margin(0)
@@ -748,6 +1209,12 @@ AnyCollisionGeometry3D::AnyCollisionGeometry3D(const vector<AnyGeometry3D>& item
 }
 
 
+AnyCollisionGeometry3D::AnyCollisionGeometry3D(const ConvexHull3D& hull)
+  :AnyGeometry3D(hull),margin(0)
+{
+  currentTransform.setIdentity();
+}
+
 AnyCollisionGeometry3D::AnyCollisionGeometry3D(const AnyGeometry3D& geom)
   :AnyGeometry3D(geom),margin(0)
 {
@@ -778,6 +1245,12 @@ AnyCollisionGeometry3D::AnyCollisionGeometry3D(const AnyCollisionGeometry3D& geo
         collisionData = CollisionPointCloud(cmesh);
       }
       break;
+    case ConvexHull:
+      {
+        const CollisionMesh& cmesh = geom.ConvexHullCollisionData();
+        collisionData = CollisionMesh(cmesh);
+      }
+      break;
     case Group:
       {
         collisionData = vector<AnyCollisionGeometry3D>();
@@ -797,11 +1270,13 @@ AnyCollisionGeometry3D::AnyCollisionGeometry3D(const AnyCollisionGeometry3D& geo
   const CollisionPointCloud& AnyCollisionGeometry3D::PointCloudCollisionData() const { return *AnyCast_Raw<CollisionPointCloud>(&collisionData); }
   const CollisionImplicitSurface& AnyCollisionGeometry3D::ImplicitSurfaceCollisionData() const { return *AnyCast_Raw<CollisionImplicitSurface>(&collisionData); }
   const vector<AnyCollisionGeometry3D>& AnyCollisionGeometry3D::GroupCollisionData() const { return *AnyCast_Raw<vector<AnyCollisionGeometry3D> >(&collisionData); }
+  const CollisionMesh& AnyCollisionGeometry3D::ConvexHullCollisionData() const { return *AnyCast_Raw<CollisionMesh>(&collisionData); }
   RigidTransform& AnyCollisionGeometry3D::PrimitiveCollisionData() { return currentTransform; }
   CollisionMesh& AnyCollisionGeometry3D::TriangleMeshCollisionData() { return *AnyCast_Raw<CollisionMesh>(&collisionData); }
   CollisionPointCloud& AnyCollisionGeometry3D::PointCloudCollisionData() { return *AnyCast_Raw<CollisionPointCloud>(&collisionData); }
   CollisionImplicitSurface& AnyCollisionGeometry3D::ImplicitSurfaceCollisionData() { return *AnyCast_Raw<CollisionImplicitSurface>(&collisionData); }
   vector<AnyCollisionGeometry3D>& AnyCollisionGeometry3D::GroupCollisionData() { return *AnyCast_Raw<vector<AnyCollisionGeometry3D> >(&collisionData); }
+  CollisionMesh& AnyCollisionGeometry3D::ConvexHullCollisionData() { return *AnyCast_Raw<CollisionMesh>(&collisionData); }
 
 void AnyCollisionGeometry3D::InitCollisionData()
 {
@@ -817,7 +1292,10 @@ void AnyCollisionGeometry3D::ReinitCollisionData()
     collisionData = int(0);
     break;
   case ImplicitSurface:
-    collisionData = CollisionImplicitSurface(AsImplicitSurface());
+    if(IsSparseImplicitSurface())
+      collisionData = CollisionImplicitSurface(AsSparseImplicitSurface());
+    else
+      collisionData = CollisionImplicitSurface(AsImplicitSurface());
     break;
   case TriangleMesh:
     collisionData = CollisionMesh(AsTriangleMesh());
@@ -841,61 +1319,225 @@ void AnyCollisionGeometry3D::ReinitCollisionData()
         Assert(bitems[i].CollisionDataInitialized());
     }
     break;
+  case ConvexHull:
+    {
+      Meshing::TriMesh mesh;
+      AsConvexHull().GetMesh(mesh);
+      collisionData = CollisionMesh(mesh);
+    }
+    break;
   }
   SetTransform(T);
   assert(!collisionData.empty());
 }
 
-bool AnyCollisionGeometry3D::Convert(Type restype,AnyCollisionGeometry3D& res,double param)
+//version number of the collision data cache format
+static const char kCollisionCacheMagic[4] = {'K','L','C','D'};
+static const int kCollisionCacheVersion = 2;
+
+bool AnyCollisionGeometry3D::SaveCollisionData(const char* fn) const
 {
-  if(type == TriangleMesh && restype == ImplicitSurface) {
-    Assert(CollisionDataInitialized());
-    Assert(!TriangleMeshCollisionData().triNeighbors.empty());
-    if(param == 0) {
-      const Meshing::TriMesh& mesh = AsTriangleMesh();
-      if(mesh.tris.empty()) return false;
-      Real sumlengths = 0;
-      for(size_t i=0;i<mesh.tris.size();i++) {
-        sumlengths += mesh.verts[mesh.tris[i].a].distance(mesh.verts[mesh.tris[i].b]);
-        sumlengths += mesh.verts[mesh.tris[i].b].distance(mesh.verts[mesh.tris[i].c]);
-        sumlengths += mesh.verts[mesh.tris[i].c].distance(mesh.verts[mesh.tris[i].a]);
-      }
-      Real avglength = sumlengths / (3*mesh.tris.size());
-      param = avglength/2;
-      Vector3 bmin,bmax;
-      mesh.GetAABB(bmin,bmax);
-      param = Min(param,0.25*(bmax.x - bmin.x));
-      param = Min(param,0.25*(bmax.y - bmin.y));
-      param = Min(param,0.25*(bmax.z - bmin.z));
-      cout<<"Auto-determined grid resolution "<<param<<endl;
-    }
-    Meshing::VolumeGrid grid;
-    RigidTransform Torig,Tident; 
-    Tident.setIdentity();
-    CollisionMesh& mesh = TriangleMeshCollisionData();
-    mesh.GetTransform(Torig);
-    mesh.UpdateTransform(Tident);
-    MeshToImplicitSurface_FMM(mesh,grid,param);
-    //MeshToImplicitSurface_SpaceCarving(TriangleMeshCollisionData(),grid,param,40);
-    mesh.UpdateTransform(Torig);
-    res = AnyCollisionGeometry3D(grid);
-    cout<<"Grid bb "<<grid.bb<<endl;
-    res.SetTransform(GetTransform());
-    return true;
+  if(collisionData.empty()) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"AnyCollisionGeometry3D::SaveCollisionData: collision data is not initialized");
+    return false;
+  }
+  File f;
+  if(!f.Open(fn,FILEWRITE)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"AnyCollisionGeometry3D::SaveCollisionData: could not open "<<fn<<" for writing");
+    return false;
+  }
+  if(!f.WriteData(kCollisionCacheMagic,4)) return false;
+  if(!WriteFile(f,kCollisionCacheVersion)) return false;
+  size_t hash = ContentHash();
+  if(!WriteFile(f,hash)) return false;
+  return WriteCollisionData(f);
+}
+
+bool AnyCollisionGeometry3D::LoadCollisionData(const char* fn)
+{
+  File f;
+  if(!f.Open(fn,FILEREAD)) return false;
+  char magic[4];
+  int version;
+  size_t hash;
+  if(!f.ReadData(magic,4) || memcmp(magic,kCollisionCacheMagic,4) != 0) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"AnyCollisionGeometry3D::LoadCollisionData: "<<fn<<" is not a collision data file");
+    return false;
+  }
+  if(!ReadFile(f,version) || version != kCollisionCacheVersion) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"AnyCollisionGeometry3D::LoadCollisionData: "<<fn<<" has an incompatible version");
+    return false;
+  }
+  if(!ReadFile(f,hash) || hash != ContentHash()) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"AnyCollisionGeometry3D::LoadCollisionData: "<<fn<<" was saved for different geometry");
+    return false;
+  }
+  if(!ReadCollisionData(f)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"AnyCollisionGeometry3D::LoadCollisionData: error reading "<<fn);
+    ClearCollisionData();
+    return false;
   }
-  if(!AnyGeometry3D::Convert(restype,res,param)) return false;
-  res.SetTransform(GetTransform());
   return true;
 }
 
-AABB3D AnyCollisionGeometry3D::GetAABBTight() const
+void AnyCollisionGeometry3D::InitCollisionDataCached(const char* cacheDir)
 {
+  if(!collisionData.empty()) return;
+  char buf[32];
+  snprintf(buf,32,"%016llx.klcd",(unsigned long long)ContentHash());
+  string fn = string(cacheDir) + "/" + buf;
+  if(FileUtils::Exists(fn.c_str()) && LoadCollisionData(fn.c_str()))
+    return;
+  ReinitCollisionData();
+  if(!FileUtils::IsDirectory(cacheDir)) FileUtils::MakeDirectoryRecursive(cacheDir);
+  SaveCollisionData(fn.c_str());
+}
+
+bool AnyCollisionGeometry3D::ReadCollisionData(File& f)
+{
+  int ftype;
+  if(!ReadFile(f,ftype)) return false;
+  if(ftype != (int)type) return false;
+  RigidTransform T = GetTransform();
   switch(type) {
   case Primitive:
-  case ImplicitSurface:
-    return GetAABB();
+    collisionData = int(0);
     break;
-  case TriangleMesh:
+  case ImplicitSurface:
+    {
+      collisionData = CollisionImplicitSurface();
+      CollisionImplicitSurface& s = ImplicitSurfaceCollisionData();
+      if(IsSparseImplicitSurface()) s.sparseGrid = AsSparseImplicitSurface();
+      else s.baseGrid = AsImplicitSurface();
+      if(!s.ReadCollisions(f)) return false;
+    }
+    break;
+  case TriangleMesh:
+    {
+      collisionData = CollisionMesh();
+      CollisionMesh& m = TriangleMeshCollisionData();
+      m.verts = AsTriangleMesh().verts;
+      m.tris = AsTriangleMesh().tris;
+      if(!m.ReadCollisions(f)) return false;
+    }
+    break;
+  case PointCloud:
+    {
+      collisionData = CollisionPointCloud();
+      CollisionPointCloud& pc = PointCloudCollisionData();
+      (Meshing::PointCloud3D&)pc = AsPointCloud();
+      if(!pc.ReadCollisions(f)) return false;
+    }
+    break;
+  case Group:
+    {
+      vector<AnyGeometry3D>& items = AsGroup();
+      int n;
+      if(!ReadFile(f,n)) return false;
+      if(n != (int)items.size()) return false;
+      collisionData = vector<AnyCollisionGeometry3D>();
+      vector<AnyCollisionGeometry3D>& colitems = GroupCollisionData();
+      colitems.resize(items.size());
+      for(size_t i=0;i<items.size();i++) {
+        colitems[i] = AnyCollisionGeometry3D(items[i]);
+        if(!colitems[i].ReadCollisionData(f)) return false;
+      }
+    }
+    break;
+  case ConvexHull:
+    {
+      collisionData = CollisionMesh();
+      CollisionMesh& m = ConvexHullCollisionData();
+      m.verts = AsConvexHull().points;
+      m.tris = AsConvexHull().tris;
+      if(!m.ReadCollisions(f)) return false;
+    }
+    break;
+  }
+  SetTransform(T);
+  return true;
+}
+
+bool AnyCollisionGeometry3D::WriteCollisionData(File& f) const
+{
+  Assert(!collisionData.empty());
+  int itype = (int)type;
+  if(!WriteFile(f,itype)) return false;
+  switch(type) {
+  case Primitive:
+    return true;
+  case ImplicitSurface:
+    return ImplicitSurfaceCollisionData().WriteCollisions(f);
+  case TriangleMesh:
+    return TriangleMeshCollisionData().WriteCollisions(f);
+  case PointCloud:
+    return PointCloudCollisionData().WriteCollisions(f);
+  case Group:
+    {
+      const vector<AnyCollisionGeometry3D>& colitems = GroupCollisionData();
+      int n = (int)colitems.size();
+      if(!WriteFile(f,n)) return false;
+      for(size_t i=0;i<colitems.size();i++)
+        if(!colitems[i].WriteCollisionData(f)) return false;
+      return true;
+    }
+  case ConvexHull:
+    return ConvexHullCollisionData().WriteCollisions(f);
+  }
+  return false;
+}
+
+bool AnyCollisionGeometry3D::Convert(Type restype,AnyCollisionGeometry3D& res,double param)
+{
+  if(type == TriangleMesh && restype == ImplicitSurface) {
+    Assert(CollisionDataInitialized());
+    Assert(!TriangleMeshCollisionData().triNeighbors.empty());
+    if(param == 0) {
+      const Meshing::TriMesh& mesh = AsTriangleMesh();
+      if(mesh.tris.empty()) return false;
+      Real sumlengths = 0;
+      for(size_t i=0;i<mesh.tris.size();i++) {
+        sumlengths += mesh.verts[mesh.tris[i].a].distance(mesh.verts[mesh.tris[i].b]);
+        sumlengths += mesh.verts[mesh.tris[i].b].distance(mesh.verts[mesh.tris[i].c]);
+        sumlengths += mesh.verts[mesh.tris[i].c].distance(mesh.verts[mesh.tris[i].a]);
+      }
+      Real avglength = sumlengths / (3*mesh.tris.size());
+      param = avglength/2;
+      Vector3 bmin,bmax;
+      mesh.GetAABB(bmin,bmax);
+      param = Min(param,0.25*(bmax.x - bmin.x));
+      param = Min(param,0.25*(bmax.y - bmin.y));
+      param = Min(param,0.25*(bmax.z - bmin.z));
+      cout<<"Auto-determined grid resolution "<<param<<endl;
+    }
+    Meshing::VolumeGrid grid;
+    RigidTransform Torig,Tident; 
+    Tident.setIdentity();
+    CollisionMesh& mesh = TriangleMeshCollisionData();
+    mesh.GetTransform(Torig);
+    mesh.UpdateTransform(Tident);
+    MeshToImplicitSurface_FMM(mesh,grid,param);
+    //MeshToImplicitSurface_SpaceCarving(TriangleMeshCollisionData(),grid,param,40);
+    mesh.UpdateTransform(Torig);
+    res = AnyCollisionGeometry3D(grid);
+    cout<<"Grid bb "<<grid.bb<<endl;
+    res.SetTransform(GetTransform());
+    return true;
+  }
+  if(!AnyGeometry3D::Convert(restype,res,param)) return false;
+  res.SetTransform(GetTransform());
+  return true;
+}
+
+AABB3D AnyCollisionGeometry3D::GetAABBTight() const
+{
+  switch(type) {
+  case Primitive:
+  case ImplicitSurface:
+    return GetAABB();
+    break;
+  case TriangleMesh:
+  case ConvexHull:
     {
       const CollisionMesh& m = TriangleMeshCollisionData();
       AABB3D bb;
@@ -960,6 +1602,7 @@ AABB3D AnyCollisionGeometry3D::GetAABB() const
   case TriangleMesh:
   case PointCloud:
   case ImplicitSurface:
+  case ConvexHull:
     {
       AABB3D bb;
       Box3D b = GetBB();
@@ -1004,7 +1647,7 @@ Box3D AnyCollisionGeometry3D::GetBB() const
       ::GetBB(PointCloudCollisionData(),b);
       break;
     case ImplicitSurface:
-      b.setTransformed(AsImplicitSurface().bb,ImplicitSurfaceCollisionData().currentTransform);
+      b.setTransformed(ImplicitSurfaceCollisionData().GetBB(),ImplicitSurfaceCollisionData().currentTransform);
       break;
     case Group:
       {
@@ -1012,6 +1655,9 @@ Box3D AnyCollisionGeometry3D::GetBB() const
 	b.set(bb);
       }
       break;
+    case ConvexHull:
+      ::GetBB(ConvexHullCollisionData(),b);
+      break;
     }
   }
   //expand by the margin
@@ -1050,6 +1696,9 @@ void AnyCollisionGeometry3D::SetTransform(const RigidTransform& T)
 	  items[i].SetTransform(T);
       }
       break;
+    case ConvexHull:
+      ConvexHullCollisionData().UpdateTransform(T);
+      break;
     }
   }
 }
@@ -1100,6 +1749,11 @@ Real AnyCollisionGeometry3D::Distance(const Vector3& pt)
 	dmin = Min(dmin,items[i].Distance(pt));
       return Min(Sqrt(dmin)-margin,0.0);
     }
+  case ConvexHull:
+    {
+      Vector3 cp,dir;
+      return HullPointDistance(AsConvexHull(),GetTransform(),pt,cp,dir)-margin;
+    }
   }
   return Inf;
 }
@@ -1172,6 +1826,16 @@ AnyDistanceQueryResult AnyCollisionGeometry3D::Distance(const Vector3& pt,const
       Offset1(res,margin);
       return res;
     }
+  case ConvexHull:
+    {
+      res.elem1 = 0;
+      res.hasPenetration = true;
+      res.hasDirections = true;
+      res.d = HullPointDistance(AsConvexHull(),GetTransform(),pt,res.cp1,res.dir1);
+      res.dir2.setNegative(res.dir1);
+      Offset1(res,margin);
+      return res;
+    }
   }
   return res;
 }
@@ -1264,6 +1928,8 @@ bool Collides(const CollisionPointCloud& a,Real margin,AnyCollisionGeometry3D& b
         vector<int>& elements1,vector<int>& elements2,size_t maxContacts);
 bool Collides(const CollisionImplicitSurface& a,Real margin,AnyCollisionGeometry3D& b,
         vector<int>& elements1,vector<int>& elements2,size_t maxContacts);
+bool Collides(const ConvexHullData& a,Real margin,AnyCollisionGeometry3D& b,
+        vector<int>& elements1,vector<int>& elements2,size_t maxContacts);
 
 template <class T>
 bool Collides(const T& a,vector<AnyCollisionGeometry3D>& bitems,Real margin,
@@ -1364,6 +2030,10 @@ inline Real Volume(const BV& b)
   return 8.0*b.d[0]*b.d[1]*b.d[2];
 }
 
+//Dual traversal of a point cloud's octree and a mesh's PQP BVH, reporting
+//(point,triangle) pairs within the margin.  The top of the traversal is
+//expanded breadth-first into a frontier of node pairs, and the subtrees
+//under the frontier are traversed in parallel.
 class PointMeshCollider
 {
 public:
@@ -1372,9 +2042,18 @@ public:
   RigidTransform Tba,Twa,Tab;
   Real margin;
   size_t maxContacts;
+  int numThreads;
   vector<int> pcpoints,meshtris;
+  //number of contacts found by all threads, for early termination
+  std::atomic<size_t> numFound;
+
+  struct Contacts
+  {
+    vector<int> pcpoints,meshtris;
+  };
+
   PointMeshCollider(const CollisionPointCloud& a,const CollisionMesh& b,Real _margin)
-    :pc(a),mesh(b),margin(_margin),maxContacts(1)
+    :pc(a),mesh(b),margin(_margin),maxContacts(1),numThreads(0),numFound(0)
   {
     Twa.setInverse(a.currentTransform);
     Tba.mul(Twa,b.currentTransform);
@@ -1383,10 +2062,67 @@ public:
   bool Recurse(size_t _maxContacts=1)
   {
     maxContacts=_maxContacts;
-    _Recurse(0,0);
+    pcpoints.resize(0);
+    meshtris.resize(0);
+    numFound = 0;
+    if(maxContacts == 0 || pc.points.empty() || mesh.tris.empty()) return false;
+    Assert(pc.octree != NULL);
+    //small clouds aren't worth starting threads for
+    int nthreads = numThreads;
+    if(nthreads <= 0) nthreads = NumHardwareThreads();
+    if(pc.points.size() < 4096) nthreads = 1;
+    if(nthreads <= 1) {
+      Contacts res;
+      _Recurse(0,0,res);
+      pcpoints.swap(res.pcpoints);
+      meshtris.swap(res.meshtris);
+      return !pcpoints.empty();
+    }
+    //expand the frontier
+    vector<pair<int,int> > frontier,next;
+    frontier.push_back(pair<int,int>(0,0));
+    size_t target = 8*(size_t)nthreads;
+    while(frontier.size() < target) {
+      next.resize(0);
+      bool split = false;
+      for(size_t i=0;i<frontier.size();i++) {
+        int pcnode = frontier[i].first, meshnode = frontier[i].second;
+        if(Prune(pc.octree->Node(pcnode),mesh.pqpModel->b[meshnode])) continue;
+        int which = SplitChoice(pcnode,meshnode);
+        if(which == 0) next.push_back(frontier[i]);
+        else if(which == 1) {
+          int c1=mesh.pqpModel->b[meshnode].first_child;
+          next.push_back(pair<int,int>(pcnode,c1));
+          next.push_back(pair<int,int>(pcnode,c1+1));
+          split = true;
+        }
+        else {
+          const OctreeNode& n = pc.octree->Node(pcnode);
+          for(int c=0;c<8;c++)
+            next.push_back(pair<int,int>(n.childIndices[c],meshnode));
+          split = true;
+        }
+      }
+      frontier.swap(next);
+      if(!split) break;
+    }
+    vector<Contacts> results(frontier.size());
+    ParallelFor((int)frontier.size(),[&](int i) {
+        _Recurse(frontier[i].first,frontier[i].second,results[i]);
+      },nthreads);
+    for(size_t i=0;i<results.size();i++) {
+      pcpoints.insert(pcpoints.end(),results[i].pcpoints.begin(),results[i].pcpoints.end());
+      meshtris.insert(meshtris.end(),results[i].meshtris.begin(),results[i].meshtris.end());
+    }
+    if(pcpoints.size() > maxContacts) {
+      pcpoints.resize(maxContacts);
+      meshtris.resize(maxContacts);
+    }
     return !pcpoints.empty();
   }
   bool Prune(const OctreeNode& pcnode,const BV& meshnode) {
+    //empty leaves have inverted boxes
+    if(pcnode.bb.bmin.x > pcnode.bb.bmax.x) return true;
     Box3D meshbox,meshbox_pc;
     BVToBox(meshnode,meshbox);
     meshbox_pc.setTransformed(meshbox,Tba);
@@ -1399,72 +2135,60 @@ public:
       return !meshbox_pc.intersects(expanded_bb);
     }
   }
-  bool _Recurse(int pcOctreeNode,int meshBVHNode) {
+  //returns 0 if both nodes are leaves, 1 to split the mesh node, 2 to split
+  //the octree node
+  int SplitChoice(int pcOctreeNode,int meshBVHNode) {
+    const OctreeNode& pcnode = pc.octree->Node(pcOctreeNode);
+    const BV& meshnode = mesh.pqpModel->b[meshBVHNode];
+    bool pcleaf = pc.octree->IsLeaf(pcnode), meshleaf = meshnode.Leaf();
+    if(pcleaf && meshleaf) return 0;
+    if(pcleaf) return 1;
+    if(meshleaf) return 2;
+    //split the larger node
+    return (Volume(pcnode) < Volume(meshnode) ? 1 : 2);
+  }
+  //returns false to stop recursing
+  bool _Recurse(int pcOctreeNode,int meshBVHNode,Contacts& res) {
+    if(numFound >= maxContacts) return false;
     const OctreeNode& pcnode = pc.octree->Node(pcOctreeNode);
     const BV& meshnode = mesh.pqpModel->b[meshBVHNode];
-    //returns true to keep recursing
     if(Prune(pcnode,meshnode))
       return true;
-    if(pc.octree->IsLeaf(pcnode)) {
-      if(meshnode.Leaf()) {
-	int t = -meshnode.first_child-1;
-	Triangle3D tri;
-	Copy(mesh.pqpModel->tris[t].p1,tri.a);
-	Copy(mesh.pqpModel->tris[t].p2,tri.b);
-	Copy(mesh.pqpModel->tris[t].p3,tri.c);
-	tri.a = Tba * tri.a;
-	tri.b = Tba * tri.b;
-	tri.c = Tba * tri.c;
-	//collide the triangle and points
-	vector<Vector3> pts;
-	vector<int> pcids;
-	pc.octree->GetPoints(pcOctreeNode,pts);
-	pc.octree->GetPointIDs(pcOctreeNode,pcids);
-	Sphere3D temp;
-	temp.radius = margin;
-	for(size_t i=0;i<pts.size();i++) {
-	  temp.center = pts[i];
-	  if(Collide(tri,temp)) {
-	    pcpoints.push_back(pcids[i]);
-	    meshtris.push_back(mesh.pqpModel->tris[t].id);
-	    if(pcpoints.size() >= maxContacts) return false;
-	  }
-	}
-	//continue
-	return true;
-      }
-      else {
-	//split mesh BVH
-	return _RecurseSplitMesh(pcOctreeNode,meshBVHNode);
-      }
+    int which = SplitChoice(pcOctreeNode,meshBVHNode);
+    if(which == 1) {
+      int c1=meshnode.first_child;
+      if(!_Recurse(pcOctreeNode,c1,res)) return false;
+      return _Recurse(pcOctreeNode,c1+1,res);
+    }
+    else if(which == 2) {
+      for(int i=0;i<8;i++)
+        if(!_Recurse(pcnode.childIndices[i],meshBVHNode,res)) return false;
+      return true;
     }
-    else {
-      if(meshnode.Leaf()) {
-	//split octree node
-	return _RecurseSplitOctree(pcOctreeNode,meshBVHNode);
-      }
-      else {
-	//determine which BVH to split
-	Real vpc = Volume(pcnode);
-	Real vmesh = Volume(meshnode);
-	if(vpc < vmesh)
-	  return _RecurseSplitMesh(pcOctreeNode,meshBVHNode);
-	else
-	  return _RecurseSplitOctree(pcOctreeNode,meshBVHNode);
+    //collide the triangle and points
+    int t = -meshnode.first_child-1;
+    Triangle3D tri;
+    Copy(mesh.pqpModel->tris[t].p1,tri.a);
+    Copy(mesh.pqpModel->tris[t].p2,tri.b);
+    Copy(mesh.pqpModel->tris[t].p3,tri.c);
+    tri.a = Tba * tri.a;
+    tri.b = Tba * tri.b;
+    tri.c = Tba * tri.c;
+    AABB3D tribb;
+    tri.getAABB(tribb);
+    tribb.bmin -= Vector3(margin);
+    tribb.bmax += Vector3(margin);
+    Real margin2 = Sqr(margin);
+    const vector<int>& pindices = pc.octree->PointIndices(pcOctreeNode);
+    for(size_t i=0;i<pindices.size();i++) {
+      const Vector3& pt = pc.octree->Point(pindices[i]);
+      if(!tribb.contains(pt)) continue;
+      if(tri.closestPoint(pt).distanceSquared(pt) <= margin2) {
+        res.pcpoints.push_back(pc.octree->PointID(pindices[i]));
+        res.meshtris.push_back(mesh.pqpModel->tris[t].id);
+        if(++numFound >= maxContacts) return false;
       }
     }
-  }
-  bool _RecurseSplitMesh(int pcOctreeNode,int meshBVHNode) {
-    int c1=mesh.pqpModel->b[meshBVHNode].first_child;
-    int c2=c1+1;
-    if(!_Recurse(pcOctreeNode,c1)) return false;
-    if(!_Recurse(pcOctreeNode,c2)) return false;
-    return true;
-  }
-  bool _RecurseSplitOctree(int pcOctreeNode,int meshBVHNode) {
-    const OctreeNode& pcnode = pc.octree->Node(pcOctreeNode);
-    for(int i=0;i<8;i++)
-      if(!_Recurse(pcnode.childIndices[i],meshBVHNode)) return false;
     return true;
   }
 };
@@ -1499,6 +2223,85 @@ bool Collides(const CollisionPointCloud& a,Real margin,const CollisionImplicitSu
   return res;
 }
 
+//bw is given in world coordinates.  A cylinder has no exact hull, so it is
+//tested conservatively as a circumscribed prism.  Ellipsoids can't be
+//transformed to world coordinates, so they never get here.
+bool Collides(const ConvexHullData& a,const GeometricPrimitive3D& bw,Real margin)
+{
+  RigidTransform Tident;
+  Tident.setIdentity();
+  GJKSimplex simplex;
+  ConvexHull3D bhull;
+  Real brad;
+  if(PrimitiveToHull(bw,bhull,brad))
+    return GJKCollide(a.hull,a.T,bhull,Tident,simplex,margin+brad);
+  if(bw.type == GeometricPrimitive3D::Cylinder) {
+    const Cylinder3D* c = AnyCast_Raw<Cylinder3D>(&bw.data);
+    const int numSides = 16;
+    Real r = c->radius/Cos(Pi/numSides);
+    Vector3 u,v,p;
+    GetCanonicalBasis(c->axis,u,v);
+    for(int i=0;i<numSides;i++) {
+      Real theta = 2*Pi*i/numSides;
+      p = c->center;
+      p.madd(u,r*Cos(theta));
+      p.madd(v,r*Sin(theta));
+      bhull.points.push_back(p);
+      p.madd(c->axis,c->height);
+      bhull.points.push_back(p);
+    }
+    return GJKCollide(a.hull,a.T,bhull,Tident,simplex,margin);
+  }
+  return false;
+}
+
+bool Collides(const ConvexHullData& a,Real margin,const CollisionMesh& b,
+	      vector<int>& elements1,vector<int>& elements2,size_t maxContacts)
+{
+  if(::Collides(a.mesh,b,margin,elements1,elements2,maxContacts)) return true;
+  //no surface contact, so each connected piece of the mesh lies entirely
+  //inside or outside of the hull; test one vertex of each
+  UnionFind pieces((int)b.verts.size());
+  for(size_t t=0;t<b.tris.size();t++) {
+    pieces.Union(b.tris[t].a,b.tris[t].b);
+    pieces.Union(b.tris[t].a,b.tris[t].c);
+  }
+  vector<bool> tested(b.verts.size(),false);
+  Vector3 p,plocal;
+  for(size_t t=0;t<b.tris.size();t++) {
+    int piece = pieces.FindSet(b.tris[t].a);
+    if(tested[piece]) continue;
+    tested[piece] = true;
+    p = b.currentTransform*b.verts[b.tris[t].a];
+    a.T.mulInverse(p,plocal);
+    if(a.hull.Contains(plocal,margin)) {
+      elements1.push_back(0);
+      elements2.push_back((int)t);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Collides(const ConvexHullData& a,Real margin,const CollisionPointCloud& b,
+	      vector<int>& elements1,vector<int>& elements2,size_t maxContacts)
+{
+  Box3D bb;
+  bb.setTransformed(a.hull.GetAABB(),a.T);
+  vector<int> candidates;
+  NearbyPoints(b,GeometricPrimitive3D(bb),margin,candidates);
+  Vector3 cp,dir;
+  for(size_t i=0;i<candidates.size();i++) {
+    Vector3 pw = b.currentTransform*b.points[candidates[i]];
+    if(HullPointDistance(a.hull,a.T,pw,cp,dir) <= margin) {
+      elements1.push_back(0);
+      elements2.push_back(candidates[i]);
+      if(elements2.size() >= maxContacts) return true;
+    }
+  }
+  return !elements2.empty();
+}
+
 
 
 bool Collides(const GeometricPrimitive3D& a,Real margin,AnyCollisionGeometry3D& b,
@@ -1540,6 +2343,13 @@ bool Collides(const GeometricPrimitive3D& a,Real margin,AnyCollisionGeometry3D&
       vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
       return ::Collides(a,bitems,margin+b.margin,elements1,elements2,maxContacts);
     }
+  case AnyCollisionGeometry3D::ConvexHull:
+    if(::Collides(ConvexHullData(b),a,margin+b.margin)) {
+      elements1.push_back(0);
+      elements2.push_back(0);
+      return true;
+    }
+    return false;
   default:
     FatalError("Invalid type");
   }
@@ -1590,6 +2400,9 @@ bool Collides(const CollisionImplicitSurface& a,Real margin,AnyCollisionGeometry
       vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
       return ::Collides(a,bitems,margin+b.margin,elements1,elements2,maxContacts);
     }
+  case AnyCollisionGeometry3D::ConvexHull:
+    FatalError("Volume grid to convex hull collisions not done\n");
+    return false;
   default:
     FatalError("Invalid type");
   }
@@ -1621,6 +2434,8 @@ bool Collides(const CollisionMesh& a,Real margin,AnyCollisionGeometry3D& b,
       vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
       return ::Collides(a,bitems,margin+b.margin,elements1,elements2,maxContacts);
     }
+  case AnyCollisionGeometry3D::ConvexHull:
+    return ::Collides(ConvexHullData(b),margin+b.margin,a,elements2,elements1,maxContacts);
   default:
     FatalError("Invalid type");
   }
@@ -1643,17 +2458,17 @@ bool Collides(const CollisionPointCloud& a,Real margin,AnyCollisionGeometry3D& b
     }
   case AnyCollisionGeometry3D::TriangleMesh:
     {
-      bool res=::Collides(a,margin,b.TriangleMeshCollisionData(),elements1,elements2,maxContacts);
+      bool res=::Collides(a,margin+b.margin,b.TriangleMeshCollisionData(),elements1,elements2,maxContacts);
       return res;
     }
   case AnyCollisionGeometry3D::PointCloud:
     {
-      bool res=::Collides(a,margin,b.PointCloudCollisionData(),elements1,elements2,maxContacts);
+      bool res=::Collides(a,margin+b.margin,b.PointCloudCollisionData(),elements1,elements2,maxContacts);
       return res;
     }
   case AnyCollisionGeometry3D::ImplicitSurface:
     {
-      bool res=::Collides(a,margin,b.ImplicitSurfaceCollisionData(),elements1,elements2,maxContacts);
+      bool res=::Collides(a,margin+b.margin,b.ImplicitSurfaceCollisionData(),elements1,elements2,maxContacts);
       return res;
     }
   case AnyCollisionGeometry3D::Group:
@@ -1661,6 +2476,51 @@ bool Collides(const CollisionPointCloud& a,Real margin,AnyCollisionGeometry3D& b
       vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
       return ::Collides(a,bitems,margin+b.margin,elements1,elements2,maxContacts);
     }
+  case AnyCollisionGeometry3D::ConvexHull:
+    return ::Collides(ConvexHullData(b),margin+b.margin,a,elements2,elements1,maxContacts);
+  default:
+    FatalError("Invalid type");
+  }
+  return false;
+}
+
+bool Collides(const ConvexHullData& a,Real margin,AnyCollisionGeometry3D& b,
+	      vector<int>& elements1,vector<int>& elements2,size_t maxContacts)
+{
+  switch(b.type) {
+  case AnyCollisionGeometry3D::Primitive:
+    {
+      GeometricPrimitive3D bw=b.AsPrimitive();
+      bw.Transform(b.GetTransform());
+      if(::Collides(a,bw,margin+b.margin)) {
+	elements1.push_back(0);
+	elements2.push_back(0);
+	return true;
+      }
+      return false;
+    }
+  case AnyCollisionGeometry3D::ImplicitSurface:
+    FatalError("Convex hull to volume grid collisions not done\n");
+    return false;
+  case AnyCollisionGeometry3D::TriangleMesh:
+    return ::Collides(a,margin+b.margin,b.TriangleMeshCollisionData(),elements1,elements2,maxContacts);
+  case AnyCollisionGeometry3D::PointCloud:
+    return ::Collides(a,margin+b.margin,b.PointCloudCollisionData(),elements1,elements2,maxContacts);
+  case AnyCollisionGeometry3D::Group:
+    {
+      vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
+      return ::Collides(a,bitems,margin+b.margin,elements1,elements2,maxContacts);
+    }
+  case AnyCollisionGeometry3D::ConvexHull:
+    {
+      GJKSimplex simplex;
+      if(GJKCollide(a.hull,a.T,b.AsConvexHull(),b.GetTransform(),simplex,margin+b.margin)) {
+	elements1.push_back(0);
+	elements2.push_back(0);
+	return true;
+      }
+      return false;
+    }
   default:
     FatalError("Invalid type");
   }
@@ -1713,6 +2573,8 @@ bool AnyCollisionGeometry3D::Collides(AnyCollisionGeometry3D& geom,
     return ::Collides(PointCloudCollisionData(),margin,geom,elements1,elements2,maxContacts);
   case Group:
     return ::Collides(GroupCollisionData(),margin,geom,elements1,elements2,maxContacts);
+  case ConvexHull:
+    return ::Collides(ConvexHullData(*this),margin,geom,elements1,elements2,maxContacts);
   default:
     FatalError("Invalid type");
   }
@@ -1789,11 +2651,52 @@ AnyDistanceQueryResult Distance(const CollisionMesh& a,const CollisionMesh& b,co
   return res;
 }
 
+//bw is given in world coordinates
+AnyDistanceQueryResult Distance(const ConvexHullData& a,const GeometricPrimitive3D& bw,const AnyDistanceQuerySettings& settings)
+{
+  ConvexHull3D bhull;
+  Real brad;
+  if(!PrimitiveToHull(bw,bhull,brad)) {
+    fprintf(stderr,"Unable to do convex hull/%s distance yet\n",bw.TypeName());
+    return AnyDistanceQueryResult();
+  }
+  RigidTransform Tident;
+  Tident.setIdentity();
+  GJKSimplex simplex;
+  return ConvexDistance(a.hull,a.T,0,bhull,Tident,brad,simplex);
+}
+
+//O(n) running time
+AnyDistanceQueryResult Distance(const ConvexHullData& a,const CollisionPointCloud& b,const AnyDistanceQuerySettings& settings)
+{
+  AnyDistanceQueryResult res;
+  res.hasElements = true;
+  res.hasPenetration = true;
+  res.hasClosestPoints = true;
+  res.hasDirections = true;
+  res.elem1 = 0;
+  Vector3 cp,dir;
+  for(size_t i=0;i<b.points.size();i++) {
+    Vector3 pw = b.currentTransform*b.points[i];
+    Real d = HullPointDistance(a.hull,a.T,pw,cp,dir);
+    if(d < res.d) {
+      res.d = d;
+      res.elem2 = (int)i;
+      res.cp1 = cp;
+      res.cp2 = pw;
+      res.dir1 = dir;
+    }
+  }
+  res.dir2.setNegative(res.dir1);
+  return res;
+}
+
 //advance declarations
 AnyDistanceQueryResult Distance(const GeometricPrimitive3D& a,const AnyCollisionGeometry3D& b,const AnyDistanceQuerySettings& settings);
 AnyDistanceQueryResult Distance(const CollisionImplicitSurface& a,const AnyCollisionGeometry3D& b,const AnyDistanceQuerySettings& settings);
 AnyDistanceQueryResult Distance(const CollisionMesh& a,const AnyCollisionGeometry3D& b,const AnyDistanceQuerySettings& settings);
 AnyDistanceQueryResult Distance(const CollisionPointCloud& a,const AnyCollisionGeometry3D& b,const AnyDistanceQuerySettings& settings);
+AnyDistanceQueryResult Distance(const ConvexHullData& a,const AnyCollisionGeometry3D& b,const AnyDistanceQuerySettings& settings);
 
 //note modifies settings
 template <class T>
@@ -1827,6 +2730,7 @@ AnyDistanceQueryResult Distance(const GeometricPrimitive3D& a,const AnyCollision
       res = Distance(a,bw,modsettings);
       Offset2(res,b.margin);
     }
+    break;
   case AnyCollisionGeometry3D::ImplicitSurface:
     {
       res = Distance(a,b.ImplicitSurfaceCollisionData(),modsettings);
@@ -1849,6 +2753,13 @@ AnyDistanceQueryResult Distance(const GeometricPrimitive3D& a,const AnyCollision
       Offset2(res,b.margin);
       return res;
     }
+  case AnyCollisionGeometry3D::ConvexHull:
+    {
+      res = Distance(ConvexHullData(b),a,modsettings);
+      Flip(res);
+      Offset2(res,b.margin);
+    }
+    break;
   default:
     FatalError("Invalid type");
   }
@@ -1877,6 +2788,9 @@ AnyDistanceQueryResult Distance(const CollisionImplicitSurface& a,const AnyColli
   case AnyCollisionGeometry3D::TriangleMesh:
     fprintf(stderr,"Unable to do implicit surface/triangle mesh distance yet\n");
     break;
+  case AnyCollisionGeometry3D::ConvexHull:
+    fprintf(stderr,"Unable to do implicit surface/convex hull distance yet\n");
+    break;
   case AnyCollisionGeometry3D::PointCloud:
     {
       res = Distance(a,b.PointCloudCollisionData(),modsettings);
@@ -1917,6 +2831,12 @@ AnyDistanceQueryResult Distance(const CollisionMesh& a,const AnyCollisionGeometr
   case AnyCollisionGeometry3D::PointCloud:
     fprintf(stderr,"Unable to do triangle mesh/point cloud distance yet\n");
     break;
+  case AnyCollisionGeometry3D::ConvexHull:
+    {
+      res = Distance(a,b.ConvexHullCollisionData(),modsettings);
+      Offset2(res,b.margin);
+      return res;
+    }
   case AnyCollisionGeometry3D::Group:
     {
       const vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
@@ -1966,6 +2886,62 @@ AnyDistanceQueryResult Distance(const CollisionPointCloud& a,const AnyCollisionG
       Offset2(res,b.margin);
       return res;
     }
+  case AnyCollisionGeometry3D::ConvexHull:
+    {
+      res = ::Distance(ConvexHullData(b),a,modsettings);
+      Flip(res);
+      Offset2(res,b.margin);
+      return res;
+    }
+  case AnyCollisionGeometry3D::Group:
+    {
+      const vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
+      res = ::Distance_Group(a,bitems,modsettings);
+      Offset2(res,b.margin);
+      return res;
+    }
+  default:
+    FatalError("Invalid type");
+  }
+  return res;
+}
+
+AnyDistanceQueryResult Distance(const ConvexHullData& a,const AnyCollisionGeometry3D& b,const AnyDistanceQuerySettings& settings)
+{
+  AnyDistanceQueryResult res;
+  AnyDistanceQuerySettings modsettings = settings;
+  modsettings.upperBound += b.margin;
+  switch(b.type) {
+  case AnyCollisionGeometry3D::Primitive:
+    {
+      GeometricPrimitive3D bw=b.AsPrimitive();
+      bw.Transform(b.GetTransform());
+      res = ::Distance(a,bw,modsettings);
+      Offset2(res,b.margin);
+      return res;
+    }
+  case AnyCollisionGeometry3D::ImplicitSurface:
+    fprintf(stderr,"Unable to do convex hull/implicit surface distance yet\n");
+    break;
+  case AnyCollisionGeometry3D::TriangleMesh:
+    {
+      res = ::Distance(a.mesh,b.TriangleMeshCollisionData(),modsettings);
+      Offset2(res,b.margin);
+      return res;
+    }
+  case AnyCollisionGeometry3D::PointCloud:
+    {
+      res = ::Distance(a,b.PointCloudCollisionData(),modsettings);
+      Offset2(res,b.margin);
+      return res;
+    }
+  case AnyCollisionGeometry3D::ConvexHull:
+    {
+      GJKSimplex simplex;
+      res = ConvexDistance(a.hull,a.T,0,b.AsConvexHull(),b.GetTransform(),0,simplex);
+      Offset2(res,b.margin);
+      return res;
+    }
   case AnyCollisionGeometry3D::Group:
     {
       const vector<AnyCollisionGeometry3D>& bitems = b.GroupCollisionData();
@@ -1982,7 +2958,7 @@ AnyDistanceQueryResult Distance(const CollisionPointCloud& a,const AnyCollisionG
 AnyDistanceQueryResult Distance(vector<AnyCollisionGeometry3D>& group,AnyCollisionGeometry3D& b,const AnyDistanceQuerySettings& settings)
 {
   AnyDistanceQueryResult res;
-  AnyDistanceQuerySettings modsettings = modsettings;
+  AnyDistanceQuerySettings modsettings = settings;
   for(size_t i=0;i<group.size();i++) {
     AnyDistanceQueryResult ires=group[i].Distance(b,modsettings);
     if(ires.d < res.d) {
@@ -2035,6 +3011,10 @@ AnyDistanceQueryResult AnyCollisionGeometry3D::Distance(AnyCollisionGeometry3D&
     result = ::Distance(GroupCollisionData(),geom,modsettings);
     Offset1(result,margin);
     return result;
+  case ConvexHull:
+    result = ::Distance(ConvexHullData(*this),geom,modsettings);
+    Offset1(result,margin);
+    return result;
   default:
     FatalError("Invalid type");
   }
@@ -2065,6 +3045,8 @@ bool AnyCollisionGeometry3D::WithinDistance(AnyCollisionGeometry3D& geom,Real to
     return ::Collides(PointCloudCollisionData(),margin+tol,geom,elements1,elements2,maxContacts);
   case Group:
     return ::Collides(GroupCollisionData(),margin+tol,geom,elements1,elements2,maxContacts);
+  case ConvexHull:
+    return ::Collides(ConvexHullData(*this),margin+tol,geom,elements1,elements2,maxContacts);
   default:
     FatalError("Invalid type");
   }
@@ -2094,8 +3076,16 @@ bool AnyCollisionGeometry3D::RayCast(const Ray3D& r,Real* distance,int* element)
     }
     break;
   case ImplicitSurface:
-    FatalError("Can't ray-cast implicit surfaces yet\n");
-    break;
+    {
+      const CollisionImplicitSurface& s = ImplicitSurfaceCollisionData();
+      Vector3 worldpt;
+      if(::RayCast(s,margin,r,worldpt)) {
+	if(distance) *distance = worldpt.distance(r.source);
+	if(element) *element = PointIndex(s,worldpt);
+	return true;
+      }
+      return false;
+    }
   case TriangleMesh:
     {
       Vector3 worldpt;
@@ -2119,7 +3109,7 @@ bool AnyCollisionGeometry3D::RayCast(const Ray3D& r,Real* distance,int* element)
       if(res < 0) return false;
       if(distance) {
 	Vector3 temp;
-	*distance = r.closestPoint(pt,temp);
+	*distance = r.closestPoint(pt,temp)*r.direction.norm();
       }
       if(element) *element = res;
       return true;
@@ -2141,23 +3131,286 @@ bool AnyCollisionGeometry3D::RayCast(const Ray3D& r,Real* distance,int* element)
       if(distance) *distance = closest;
       return !IsInf(closest);
     }
+  case ConvexHull:
+    {
+      Vector3 worldpt;
+      int tri = ::RayCast(ConvexHullCollisionData(),r,worldpt);
+      if(tri >= 0) {
+	if(distance) {
+	  *distance = worldpt.distance(r.source);
+	  *distance -= margin;
+	}
+	if(element) *element = tri;
+	return true;
+      }
+      return false;
+    }
   }  
   return false;
 }
 
+void AnyCollisionGeometry3D::RayCast(const vector<Ray3D>& rays,vector<Real>& distances,vector<int>& elements,vector<Vector3>& points,int numThreads)
+{
+  InitCollisionData();
+  distances.resize(rays.size());
+  elements.resize(rays.size());
+  points.resize(rays.size());
+  switch(type) {
+  case TriangleMesh:
+  case ConvexHull:
+    {
+      const CollisionMesh& m = (type == TriangleMesh ? TriangleMeshCollisionData() : ConvexHullCollisionData());
+      ::RayCast(m,rays,distances,elements,points,numThreads);
+      //TODO: this isn't perfect if the margin is > 0 -- will miss silhouettes
+      if(margin != 0) {
+	for(size_t i=0;i<rays.size();i++)
+	  if(elements[i] >= 0) distances[i] -= margin;
+      }
+    }
+    break;
+  case PointCloud:
+    ::RayCast(PointCloudCollisionData(),margin,rays,distances,elements,points,numThreads);
+    break;
+  case ImplicitSurface:
+    ::RayCast(ImplicitSurfaceCollisionData(),margin,rays,distances,elements,points,numThreads);
+    break;
+  case Group:
+    {
+      vector<AnyCollisionGeometry3D>& items = GroupCollisionData();
+      fill(distances.begin(),distances.end(),Inf);
+      fill(elements.begin(),elements.end(),-1);
+      vector<Real> idistances;
+      vector<int> ielements;
+      vector<Vector3> ipoints;
+      for(size_t i=0;i<items.size();i++) {
+	items[i].RayCast(rays,idistances,ielements,ipoints,numThreads);
+	for(size_t j=0;j<rays.size();j++) {
+	  if(idistances[j] < distances[j]) {
+	    distances[j] = idistances[j];
+	    elements[j] = (int)i;
+	    points[j] = ipoints[j];
+	  }
+	}
+      }
+    }
+    break;
+  default:
+    ParallelFor((int)rays.size(),[&](int i) {
+	Real d;
+	int elem;
+	if(RayCast(rays[i],&d,&elem)) {
+	  distances[i] = d;
+	  elements[i] = elem;
+	  points[i] = rays[i].source;
+	  points[i].madd(rays[i].direction,d/rays[i].direction.norm());
+	}
+	else {
+	  distances[i] = Inf;
+	  elements[i] = -1;
+	  points[i].setZero();
+	}
+      },numThreads,64);
+    break;
+  }
+}
+
 AnyCollisionQuery::AnyCollisionQuery()
-  :a(NULL),b(NULL)
-{}
+  :a(NULL),b(NULL),coherent(true)
+{
+  ClearCache();
+}
 
 AnyCollisionQuery::AnyCollisionQuery(AnyCollisionGeometry3D& _a,AnyCollisionGeometry3D& _b)
-  :a(&_a),b(&_b)
+  :a(&_a),b(&_b),coherent(true)
 {
+  ClearCache();
 }
 
 AnyCollisionQuery::AnyCollisionQuery(const AnyCollisionQuery& q)
-  :a(q.a),b(q.b),qmesh(q.qmesh)
+  :a(q.a),b(q.b),qmesh(q.qmesh),simplex(q.simplex),coherent(q.coherent),
+   cacheCollide1(q.cacheCollide1),cacheCollide2(q.cacheCollide2),
+   cacheClosest1(q.cacheClosest1),cacheClosest2(q.cacheClosest2),
+   numCacheQueries(q.numCacheQueries),numCacheHits(q.numCacheHits)
 {}
 
+void AnyCollisionQuery::ClearCache()
+{
+  simplex.Clear();
+  cacheCollide1 = cacheCollide2 = -1;
+  cacheClosest1 = cacheClosest2 = -1;
+  numCacheQueries = numCacheHits = 0;
+}
+
+Real AnyCollisionQuery::CacheHitRate() const
+{
+  if(numCacheQueries == 0) return 0;
+  return Real(numCacheHits)/Real(numCacheQueries);
+}
+
+//The part of a geometry that a cached element refers to.  Elements of
+//primitives, meshes and point clouds are single primitives in world
+//coordinates, elements of groups are the group items, and implicit surfaces
+//and hulls are kept whole.
+struct CachedElement
+{
+  bool Set(AnyCollisionGeometry3D& g,int elem);
+  void SetWhole(AnyCollisionGeometry3D& g);
+  bool Supports(const GeometricPrimitive3D& p,bool distance) const;
+
+  AnyCollisionGeometry3D* geom;  //NULL if the element is prim
+  GeometricPrimitive3D prim;
+  Real margin;
+};
+
+bool CachedElement::Set(AnyCollisionGeometry3D& g,int elem)
+{
+  if(elem < 0 || elem >= (int)g.NumElements()) return false;
+  switch(g.type) {
+  case AnyCollisionGeometry3D::Primitive:
+  case AnyCollisionGeometry3D::TriangleMesh:
+  case AnyCollisionGeometry3D::PointCloud:
+    geom = NULL;
+    margin = g.margin;
+    prim = g.GetElement(elem);
+    prim.Transform(g.GetTransform());
+    return true;
+  case AnyCollisionGeometry3D::Group:
+    geom = &g.GroupCollisionData()[elem];
+    margin = g.margin;
+    return true;
+  default:
+    SetWhole(g);
+    return true;
+  }
+}
+
+void CachedElement::SetWhole(AnyCollisionGeometry3D& g)
+{
+  geom = &g;
+  margin = 0;
+}
+
+//whether the primitive p can be tested against geom, for collision or for
+//distance
+bool CachedElement::Supports(const GeometricPrimitive3D& p,bool distance) const
+{
+  switch(geom->type) {
+  case AnyCollisionGeometry3D::Primitive:
+    return geom->AsPrimitive().SupportsDistance(p.type);
+  case AnyCollisionGeometry3D::ImplicitSurface:
+    return p.type == GeometricPrimitive3D::Point || p.type == GeometricPrimitive3D::Sphere;
+  case AnyCollisionGeometry3D::TriangleMesh:
+    return !distance && (p.type == GeometricPrimitive3D::Point || p.type == GeometricPrimitive3D::Sphere);
+  case AnyCollisionGeometry3D::PointCloud:
+  case AnyCollisionGeometry3D::ConvexHull:
+    return true;
+  default:
+    return false;
+  }
+}
+
+//Sets up the cached elements e1, e2 of the pair a, b.  An element primitive
+//that can't be tested against the other side's item or whole geometry is
+//replaced by its whole geometry, and there is nothing to gain if both sides
+//end up whole.
+bool GetCachedPair(AnyCollisionGeometry3D& a,int elem1,AnyCollisionGeometry3D& b,int elem2,bool distance,CachedElement& e1,CachedElement& e2)
+{
+  if(!e1.Set(a,elem1) || !e2.Set(b,elem2)) return false;
+  if(e1.geom && !e2.geom && !e1.Supports(e2.prim,distance)) e2.SetWhole(b);
+  if(e2.geom && !e1.geom && !e2.Supports(e1.prim,distance)) e1.SetWhole(a);
+  if(e1.geom == &a && e2.geom == &b) return false;
+  return true;
+}
+
+//Returns 1 if the cached elements are within distance tol, 0 if not, and -1
+//if the pair can't be tested
+int CachedPairCollides(CachedElement& e1,CachedElement& e2,Real tol)
+{
+  Real margin = e1.margin+e2.margin+tol;
+  vector<int> elem1,elem2;
+  if(!e1.geom && !e2.geom) {
+    if(e1.prim.type == GeometricPrimitive3D::Triangle && e2.prim.type == GeometricPrimitive3D::Triangle && margin > 0) {
+      const Triangle3D& t1 = *AnyCast_Raw<Triangle3D>(&e1.prim.data);
+      const Triangle3D& t2 = *AnyCast_Raw<Triangle3D>(&e2.prim.data);
+      Vector3 p,q;
+      return (t1.distance(t2,p,q) <= margin ? 1 : 0);
+    }
+    if(e1.prim.SupportsDistance(e2.prim.type))
+      return (e1.prim.Distance(e2.prim) <= margin ? 1 : 0);
+    if(margin == 0 && e1.prim.SupportsCollides(e2.prim.type) && e2.prim.SupportsCollides(e1.prim.type))
+      return (e1.prim.Collides(e2.prim) ? 1 : 0);
+    return -1;
+  }
+  if(!e1.geom)
+    return (::Collides(e1.prim,margin,*e2.geom,elem1,elem2,1) ? 1 : 0);
+  if(!e2.geom)
+    return (::Collides(e2.prim,margin,*e1.geom,elem2,elem1,1) ? 1 : 0);
+  return (e1.geom->WithinDistance(*e2.geom,margin,elem1,elem2,1) ? 1 : 0);
+}
+
+//Computes the distance between the cached elements, which is an upper bound
+//on the distance between the geometries.  Returns false if the pair can't be
+//tested.
+bool CachedPairDistance(CachedElement& e1,CachedElement& e2,AnyDistanceQueryResult& res)
+{
+  AnyDistanceQuerySettings settings;
+  if(!e1.geom && !e2.geom) {
+    if(e1.prim.type == GeometricPrimitive3D::Triangle && e2.prim.type == GeometricPrimitive3D::Triangle) {
+      const Triangle3D& t1 = *AnyCast_Raw<Triangle3D>(&e1.prim.data);
+      const Triangle3D& t2 = *AnyCast_Raw<Triangle3D>(&e2.prim.data);
+      res.d = t1.distance(t2,res.cp1,res.cp2);
+      res.hasClosestPoints = true;
+    }
+    else {
+      if(!e1.prim.SupportsDistance(e2.prim.type)) return false;
+      res = ::Distance(e1.prim,e2.prim,settings);
+    }
+  }
+  else if(!e1.geom)
+    res = ::Distance(e1.prim,*e2.geom,settings);
+  else if(!e2.geom) {
+    res = ::Distance(e2.prim,*e1.geom,settings);
+    Flip(res);
+  }
+  else
+    res = e1.geom->Distance(*e2.geom,settings);
+  Offset1(res,e1.margin);
+  Offset2(res,e2.margin);
+  return true;
+}
+
+//Checks the cached colliding pair of q.  On success, the pair is stored in
+//q's elements.
+bool CachedCollide(AnyCollisionQuery* q,Real tol)
+{
+  if(!q->coherent || q->cacheCollide1 < 0) return false;
+  CachedElement e1,e2;
+  if(!GetCachedPair(*q->a,q->cacheCollide1,*q->b,q->cacheCollide2,false,e1,e2)) return false;
+  q->numCacheQueries++;
+  if(CachedPairCollides(e1,e2,tol) <= 0) return false;
+  q->numCacheHits++;
+  q->elements1.push_back(q->cacheCollide1);
+  q->elements2.push_back(q->cacheCollide2);
+  return true;
+}
+
+void UpdateCollideCache(AnyCollisionQuery* q)
+{
+  if(q->elements1.empty() || q->elements2.empty()) return;
+  q->cacheCollide1 = q->elements1[0];
+  q->cacheCollide2 = q->elements2[0];
+}
+
+//Convex pairs that involve at least one hull are handled by GJK / EPA with
+//the query's warm start simplex.  Primitive-primitive pairs are left to the
+//primitive routines.
+bool GetConvexPair(AnyCollisionQuery* q,ConvexHull3D& temp1,ConvexHull3D& temp2,
+                   const ConvexHull3D*& h1,const ConvexHull3D*& h2,Real& r1,Real& r2)
+{
+  if(q->a->type != AnyGeometry3D::ConvexHull && q->b->type != AnyGeometry3D::ConvexHull) return false;
+  return GetConvex(*q->a,temp1,h1,r1) && GetConvex(*q->b,temp2,h2,r2);
+}
+
 
 bool UpdateQMesh(AnyCollisionQuery* q) 
 {
@@ -2187,13 +3440,31 @@ bool AnyCollisionQuery::Collide()
   points1.resize(0);
   points2.resize(0);
   if(UpdateQMesh(this)) {
+    if(CachedCollide(this,0)) return true;
     if(qmesh.Collide()) {
       qmesh.CollisionPairs(elements1,elements2);
+      UpdateCollideCache(this);
+      return true;
+    }
+    return false;
+  }
+  ConvexHull3D temp1,temp2;
+  const ConvexHull3D *h1,*h2;
+  Real r1,r2;
+  if(GetConvexPair(this,temp1,temp2,h1,h2,r1,r2)) {
+    if(GJKCollide(*h1,a->GetTransform(),*h2,b->GetTransform(),simplex,r1+r2)) {
+      elements1.push_back(0);
+      elements2.push_back(0);
       return true;
     }
     return false;
   }
-  return a->Collides(*b,elements1,elements2,1);
+  if(CachedCollide(this,0)) return true;
+  if(a->Collides(*b,elements1,elements2,1)) {
+    UpdateCollideCache(this);
+    return true;
+  }
+  return false;
 }
 
 bool AnyCollisionQuery::CollideAll()
@@ -2206,11 +3477,27 @@ bool AnyCollisionQuery::CollideAll()
   if(UpdateQMesh(this)) {
     if(qmesh.CollideAll()) {
       qmesh.CollisionPairs(elements1,elements2);
+      UpdateCollideCache(this);
       return true;
     }
     return false;
   }
-  return a->Collides(*b,elements1,elements2);
+  ConvexHull3D temp1,temp2;
+  const ConvexHull3D *h1,*h2;
+  Real r1,r2;
+  if(GetConvexPair(this,temp1,temp2,h1,h2,r1,r2)) {
+    if(GJKCollide(*h1,a->GetTransform(),*h2,b->GetTransform(),simplex,r1+r2)) {
+      elements1.push_back(0);
+      elements2.push_back(0);
+      return true;
+    }
+    return false;
+  }
+  if(a->Collides(*b,elements1,elements2)) {
+    UpdateCollideCache(this);
+    return true;
+  }
+  return false;
 }
 
 bool AnyCollisionQuery::WithinDistance(Real d)
@@ -2221,6 +3508,7 @@ bool AnyCollisionQuery::WithinDistance(Real d)
   points1.resize(0);
   points2.resize(0);
   if(UpdateQMesh(this)) {
+    if(CachedCollide(this,d)) return true;
     if(qmesh.WithinDistance(d)) {
       elements1.resize(1);
       elements2.resize(1);
@@ -2228,11 +3516,28 @@ bool AnyCollisionQuery::WithinDistance(Real d)
       points2.resize(1);
       qmesh.TolerancePair(elements1[0],elements2[0]);
       qmesh.TolerancePoints(points1[0],points2[0]);
+      UpdateCollideCache(this);
       return true;
     }
     return false;
   }
-  return a->WithinDistance(*b,d,elements1,elements2,1);
+  ConvexHull3D temp1,temp2;
+  const ConvexHull3D *h1,*h2;
+  Real r1,r2;
+  if(GetConvexPair(this,temp1,temp2,h1,h2,r1,r2)) {
+    if(GJKCollide(*h1,a->GetTransform(),*h2,b->GetTransform(),simplex,r1+r2+d)) {
+      elements1.push_back(0);
+      elements2.push_back(0);
+      return true;
+    }
+    return false;
+  }
+  if(CachedCollide(this,d)) return true;
+  if(a->WithinDistance(*b,d,elements1,elements2,1)) {
+    UpdateCollideCache(this);
+    return true;
+  }
+  return false;
 }
 
 bool AnyCollisionQuery::WithinDistanceAll(Real d)
@@ -2257,6 +3562,19 @@ Real AnyCollisionQuery::PenetrationDepth()
   if(UpdateQMesh(this)) {
     return qmesh.PenetrationDepth();
   }
+  ConvexHull3D temp1,temp2;
+  const ConvexHull3D *h1,*h2;
+  Real r1,r2;
+  if(GetConvexPair(this,temp1,temp2,h1,h2,r1,r2)) {
+    AnyDistanceQueryResult res = ConvexDistance(*h1,a->GetTransform(),r1,*h2,b->GetTransform(),r2,simplex);
+    elements1.resize(1,0);
+    elements2.resize(1,0);
+    points1.resize(1);
+    points2.resize(1);
+    a->GetTransform().mulInverse(res.cp1,points1[0]);
+    b->GetTransform().mulInverse(res.cp2,points2[0]);
+    return -res.d;
+  }
   return -a->Distance(*b);
 }
 
@@ -2270,16 +3588,62 @@ Real AnyCollisionQuery::Distance(Real absErr,Real relErr,Real bound)
   if(UpdateQMesh(this)) {
     points1.resize(1);
     points2.resize(1);
-    Real res = qmesh.Distance(absErr,relErr,bound);
+    Real res;
+    bool useCache = (coherent && cacheClosest1 >= 0);
+    if(useCache) {
+      //PQP seeds the search with the last closest triangles
+      numCacheQueries++;
+      res = qmesh.Distance_Coherent(absErr,relErr,bound);
+    }
+    else
+      res = qmesh.Distance(absErr,relErr,bound);
     qmesh.ClosestPair(elements1[0],elements2[0]);
     qmesh.ClosestPoints(points1[0],points2[0]);
+    if(useCache && elements1[0] == cacheClosest1 && elements2[0] == cacheClosest2)
+      numCacheHits++;
+    cacheClosest1 = elements1[0];
+    cacheClosest2 = elements2[0];
     return res;
   }
+  ConvexHull3D temp1,temp2;
+  const ConvexHull3D *h1,*h2;
+  Real r1,r2;
+  if(GetConvexPair(this,temp1,temp2,h1,h2,r1,r2)) {
+    AnyDistanceQueryResult res = ConvexDistance(*h1,a->GetTransform(),r1,*h2,b->GetTransform(),r2,simplex);
+    elements1[0] = elements2[0] = 0;
+    points1.resize(1);
+    points2.resize(1);
+    a->GetTransform().mulInverse(res.cp1,points1[0]);
+    b->GetTransform().mulInverse(res.cp2,points2[0]);
+    return res.d;
+  }
   AnyDistanceQuerySettings settings;
   settings.absErr = absErr;
   settings.relErr = relErr;
   settings.upperBound = bound;
+  //the cached closest pair bounds the distance from above
+  AnyDistanceQueryResult cached;
+  CachedElement e1,e2;
+  bool hasCached = false;
+  if(coherent && cacheClosest1 >= 0 && GetCachedPair(*a,cacheClosest1,*b,cacheClosest2,true,e1,e2)) {
+    numCacheQueries++;
+    if(CachedPairDistance(e1,e2,cached) && cached.d < settings.upperBound) {
+      hasCached = true;
+      cached.hasElements = true;
+      cached.elem1 = cacheClosest1;
+      cached.elem2 = cacheClosest2;
+      settings.upperBound = cached.d;
+    }
+  }
   AnyDistanceQueryResult res = a->Distance(*b,settings);
+  if(hasCached && !(res.d < cached.d)) {
+    numCacheHits++;
+    res = cached;
+  }
+  if(res.hasElements && res.elem1 >= 0 && res.elem2 >= 0) {
+    cacheClosest1 = res.elem1;
+    cacheClosest2 = res.elem2;
+  }
   if(res.hasElements) {
     elements1[0] = res.elem1;
     elements2[0] = res.elem2;
@@ -2293,6 +3657,61 @@ Real AnyCollisionQuery::Distance(Real absErr,Real relErr,Real bound)
   return res.d;
 }
 
+//upper bound on the rate of motion of any point on g w.r.t. u, when its
+//transform is interpolated from Ta to Tb
+static Real MotionBound(const AnyGeometry3D& g,const RigidTransform& Ta,const RigidTransform& Tb)
+{
+  AABB3D bb = g.GetAABB();
+  Vector3 extreme(Max(Abs(bb.bmin.x),Abs(bb.bmax.x)),Max(Abs(bb.bmin.y),Abs(bb.bmax.y)),Max(Abs(bb.bmin.z),Abs(bb.bmax.z)));
+  Matrix3 Rrel;
+  Rrel.mulTransposeA(Ta.R,Tb.R);
+  Real theta = Acos(Clamp(Half*(Rrel.trace()-One),-One,One));
+  return Ta.t.distance(Tb.t) + theta*extreme.norm();
+}
+
+Real AnyCollisionQuery::FirstContactTime(const RigidTransform& Ta0,const RigidTransform& Ta1,
+					 const RigidTransform& Tb0,const RigidTransform& Tb1,
+					 Real tol,int maxIters)
+{
+  if(!a || !b) return -1;
+  elements1.resize(0);
+  elements2.resize(0);
+  points1.resize(0);
+  points2.resize(0);
+  if(UpdateQMesh(this)) {
+    return Geometry::FirstContactTime(*qmesh.m1,Ta0,Ta1,*qmesh.m2,Tb0,Tb1,tol,a->margin+b->margin,maxIters);
+  }
+  //conservative advancement using the generic distance query
+  RigidTransform Tainit = a->GetTransform(), Tbinit = b->GetTransform();
+  Real mu = MotionBound(*a,Ta0,Ta1) + MotionBound(*b,Tb0,Tb1);
+  AnyDistanceQuerySettings settings;
+  settings.absErr = Half*tol;
+  RigidTransform Ta,Tb;
+  Real u = 0, tcontact = -1;
+  int iters;
+  for(iters=0;iters<maxIters;iters++) {
+    interpolate(Ta0,Ta1,u,Ta);
+    interpolate(Tb0,Tb1,u,Tb);
+    a->SetTransform(Ta);
+    b->SetTransform(Tb);
+    Real d = a->Distance(*b,settings).d;
+    if(d <= tol) {
+      tcontact = u;
+      break;
+    }
+    if(u >= One || mu <= 0) break;
+    u += (d-settings.absErr)/mu;
+    if(u > One) u = One;
+  }
+  if(iters == maxIters) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"AnyCollisionQuery::FirstContactTime: maximum of "<<maxIters<<" iterations reached at u="<<u);
+    tcontact = u;
+  }
+  a->SetTransform(Tainit);
+  b->SetTransform(Tbinit);
+  return tcontact;
+}
+
 void AnyCollisionQuery::InteractingPairs(std::vector<int>& t1,std::vector<int>& t2) const
 {
   t1 = elements1;
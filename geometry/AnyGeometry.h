@@ -3,11 +3,13 @@
 
 #include <KrisLibrary/utils/AnyValue.h>
 #include "CollisionMesh.h"
+#include "ConvexHull3D.h"
 
 class TiXmlElement;
+class File;
 
 //forward declarations
-namespace Meshing { class VolumeGrid; class PointCloud3D; }
+namespace Meshing { class VolumeGrid; class SparseVolumeGrid; class PointCloud3D; }
 namespace Geometry { class CollisionPointCloud; class CollisionImplicitSurface; }
 namespace Math3D { class GeometricPrimitive3D; }
 namespace GLDraw { class GeometryAppearance; }
@@ -39,17 +41,21 @@ class AnyGeometry3D
    * - Primitive: GeometricPrimitive3D
    * - TriangleMesh: TriMesh
    * - PointCloud: PointCloud3D
-   * - ImplicitSurface: VolumeGrid
+   * - ImplicitSurface: VolumeGrid, or SparseVolumeGrid if stored sparsely
+   *   (see IsSparseImplicitSurface)
    * - Group: vector<AnyGeometry3D>
+   * - ConvexHull: ConvexHull3D
    */
-  enum Type { Primitive, TriangleMesh, PointCloud, ImplicitSurface, Group };
+  enum Type { Primitive, TriangleMesh, PointCloud, ImplicitSurface, Group, ConvexHull };
 
   AnyGeometry3D();
   AnyGeometry3D(const GeometricPrimitive3D& primitive);
   AnyGeometry3D(const Meshing::TriMesh& mesh);
   AnyGeometry3D(const Meshing::PointCloud3D& pc);
   AnyGeometry3D(const Meshing::VolumeGrid& grid);
+  AnyGeometry3D(const Meshing::SparseVolumeGrid& grid);
   AnyGeometry3D(const vector<AnyGeometry3D>& items);
+  AnyGeometry3D(const ConvexHull3D& hull);
   AnyGeometry3D(const AnyGeometry3D& geom);
   static const char* TypeName(Type type);
   const char* TypeName() const { return AnyGeometry3D::TypeName(type); }
@@ -57,12 +63,16 @@ class AnyGeometry3D
   const Meshing::TriMesh& AsTriangleMesh() const;
   const Meshing::PointCloud3D& AsPointCloud() const;
   const Meshing::VolumeGrid& AsImplicitSurface() const;
+  const Meshing::SparseVolumeGrid& AsSparseImplicitSurface() const;
   const vector<AnyGeometry3D>& AsGroup() const;
+  const ConvexHull3D& AsConvexHull() const;
   GeometricPrimitive3D& AsPrimitive();
   Meshing::TriMesh& AsTriangleMesh();
   Meshing::PointCloud3D& AsPointCloud();
   Meshing::VolumeGrid& AsImplicitSurface();
+  Meshing::SparseVolumeGrid& AsSparseImplicitSurface();
   vector<AnyGeometry3D>& AsGroup();
+  ConvexHull3D& AsConvexHull();
   GLDraw::GeometryAppearance* TriangleMeshAppearanceData();
   const GLDraw::GeometryAppearance* TriangleMeshAppearanceData() const;
   static bool CanLoadExt(const char* ext);
@@ -77,10 +87,23 @@ class AnyGeometry3D
   size_t NumElements() const;
   GeometricPrimitive3D GetElement(int elem) const;
   AABB3D GetAABB() const;
+  ///Returns a hash of the geometry's content.  Used to key collision data
+  ///caches, see AnyCollisionGeometry3D::LoadCollisionData.
+  size_t ContentHash() const;
   void Transform(const RigidTransform& T);
   void Transform(const Matrix4& mat);
   void Merge(const vector<AnyGeometry3D>& geoms);
   bool Convert(Type restype,AnyGeometry3D& res,double param=0) const;
+  ///Returns true if this is an ImplicitSurface stored as a SparseVolumeGrid
+  bool IsSparseImplicitSurface() const;
+  ///Switches the storage of an ImplicitSurface between dense and sparse.
+  ///Going to sparse, only blocks within band of the surface are stored;
+  ///band = 0 uses 4 times the largest cell size.
+  bool SetImplicitSurfaceSparse(bool sparse,Real band=0);
+  ///Converts to a sparsely stored ImplicitSurface with the given resolution,
+  ///keeping values only within band of the surface; band = 0 uses 4 times
+  ///the cell size.
+  bool ConvertToSparseImplicitSurface(AnyGeometry3D& res,Real resolution,Real band=0) const;
 
   Type type;
   ///The data, according to the type
@@ -100,8 +123,10 @@ class AnyCollisionGeometry3D : public AnyGeometry3D
   AnyCollisionGeometry3D(const Meshing::TriMesh& mesh);
   AnyCollisionGeometry3D(const Meshing::PointCloud3D& pc);
   AnyCollisionGeometry3D(const Meshing::VolumeGrid& grid);
+  AnyCollisionGeometry3D(const Meshing::SparseVolumeGrid& grid);
   AnyCollisionGeometry3D(const AnyGeometry3D& geom);
   AnyCollisionGeometry3D(const vector<AnyGeometry3D>& group);
+  AnyCollisionGeometry3D(const ConvexHull3D& hull);
   AnyCollisionGeometry3D(const AnyCollisionGeometry3D& geom);
   ///If the collision detection data structure isn't initialized yet,
   ///this initializes it.  Constructors DO NOT call this, meaning that
@@ -114,16 +139,35 @@ class AnyCollisionGeometry3D : public AnyGeometry3D
   bool CollisionDataInitialized() const { return !collisionData.empty(); }
   ///Clears the current collision data
   void ClearCollisionData() { collisionData = AnyValue(); }
+  ///Saves the initialized collision data to a binary cache file, tagged
+  ///with the geometry's ContentHash.  The format is native-endian and meant
+  ///for caching on the same machine, not for exchange.
+  bool SaveCollisionData(const char* fn) const;
+  ///Loads collision data saved by SaveCollisionData, skipping the cost of
+  ///InitCollisionData.  Returns false and leaves the collision data empty
+  ///if the file is missing, has a different version, or was saved for
+  ///different geometry.
+  bool LoadCollisionData(const char* fn);
+  ///Initializes the collision data from a cache file in cacheDir named by
+  ///the geometry's ContentHash.  If no valid cache file exists, the
+  ///collision data is computed and the cache file is written.
+  void InitCollisionDataCached(const char* cacheDir);
+  ///Binary I/O of the collision data without the file header.  The
+  ///geometry must already be set before ReadCollisionData is called.
+  bool ReadCollisionData(File& f);
+  bool WriteCollisionData(File& f) const;
   const RigidTransform& PrimitiveCollisionData() const;
   const CollisionMesh& TriangleMeshCollisionData() const;
   const CollisionPointCloud& PointCloudCollisionData() const;
   const CollisionImplicitSurface& ImplicitSurfaceCollisionData() const;
   const vector<AnyCollisionGeometry3D>& GroupCollisionData() const;
+  const CollisionMesh& ConvexHullCollisionData() const;
   RigidTransform& PrimitiveCollisionData();
   CollisionMesh& TriangleMeshCollisionData();
   CollisionPointCloud& PointCloudCollisionData();
   CollisionImplicitSurface& ImplicitSurfaceCollisionData();
   vector<AnyCollisionGeometry3D>& GroupCollisionData();
+  CollisionMesh& ConvexHullCollisionData();
   ///Performs a type conversion, also copying the active transform.  May be a bit faster than
   ///AnyGeometry3D.Convert for some conversions (TriangleMesh->VolumeGrid, specifically)
   bool Convert(Type restype,AnyCollisionGeometry3D& res,double param=0);
@@ -158,13 +202,21 @@ class AnyCollisionGeometry3D : public AnyGeometry3D
   bool WithinDistance(AnyCollisionGeometry3D& geom,Real d);
   bool WithinDistance(AnyCollisionGeometry3D& geom,Real d,vector<int>& elements1,vector<int>& elements2,size_t maxcollisions=INT_MAX);
   bool RayCast(const Ray3D& r,Real* distance=NULL,int* element=NULL);
+  ///Casts a batch of rays.  On return, distances[i] is the distance to the
+  ///first hit along rays[i] (Inf if none), elements[i] is the element hit
+  ///(-1 if none), and points[i] is the hit point.  Meshes, hulls, point
+  ///clouds, and implicit surfaces use coherent batch traversal; all types
+  ///split the work across numThreads threads (0 uses all hardware threads).
+  void RayCast(const std::vector<Ray3D>& rays,std::vector<Real>& distances,std::vector<int>& elements,std::vector<Vector3>& points,int numThreads=0);
 
   /** The collision data structure, according to the type.
    * - Primitive: null
    * - TriangleMesh: CollisionMesh
    * - PointCloud: CollisionPointCloud
-   * - VolumeGrid: CollisionImplicitSurface
+   * - VolumeGrid / SparseVolumeGrid: CollisionImplicitSurface
    * - Group: vector<AnyCollisionGeometry3D>
+   * - ConvexHull: CollisionMesh of the hull surface, used for queries
+   *   against non-convex types.  Convex-convex queries use GJK / EPA.
    */
   AnyValue collisionData;
   ///Amount by which the underlying geometry is "fattened"
@@ -197,6 +249,21 @@ class AnyCollisionQuery
   ///Computes the distance with max absolute error absErr, relative error relErr,
   ///and if bound is given, will terminate early if distance > bound
   Real Distance(Real absErr,Real relErr,Real bound=Inf);
+  ///Continuous collision check as a moves from Ta0 to Ta1 and b moves from
+  ///Tb0 to Tb1, with translations interpolated linearly and rotations along
+  ///the geodesic.  Returns the first time u in [0,1] at which the objects
+  ///come within tol of one another, or -1 if they stay separated.  Uses
+  ///conservative advancement, which for mesh pairs runs over the PQP
+  ///hierarchy.  The transforms of a and b are left unchanged.
+  Real FirstContactTime(const RigidTransform& Ta0,const RigidTransform& Ta1,
+			const RigidTransform& Tb0,const RigidTransform& Tb1,
+			Real tol=1e-3,int maxIters=1000);
+
+  ///Clears the temporal coherence cache and its statistics
+  void ClearCache();
+  ///Returns the fraction of queries that consulted the cache and were
+  ///answered by it
+  Real CacheHitRate() const;
 
   //extracts the pairs of interacting features on a previous call to Collide[All], WithinDistance[All], PenetrationDepth, or Distance
   void InteractingPairs(std::vector<int>& t1,std::vector<int>& t2) const;
@@ -207,6 +274,19 @@ class AnyCollisionQuery
   AnyCollisionGeometry3D *a, *b;
 
   CollisionMeshQueryEnhanced qmesh;
+  ///Warm start state for GJK / EPA queries between convex hulls and
+  ///convex primitives
+  GJKSimplex simplex;
+  ///If true (default), the element pair found by the last Collide or
+  ///WithinDistance call, and the closest pair found by the last Distance
+  ///call, are checked first on the next query.  Along a trajectory these
+  ///usually remain valid, so Collide and WithinDistance can return
+  ///immediately and Distance starts with a tight upper bound.
+  bool coherent;
+  ///The cached element pairs, or -1 if nothing is cached
+  int cacheCollide1,cacheCollide2,cacheClosest1,cacheClosest2;
+  ///Number of queries that consulted the cache, and number answered by it
+  int numCacheQueries,numCacheHits;
   std::vector<int> elements1,elements2; 
   std::vector<Vector3> points1,points2;
 };
@@ -1,9 +1,13 @@
 #include "CollisionImplicitSurface.h"
 #include "CollisionPointCloud.h"
+#include "RayBatch.h"
 #include <spline/TimeSegmentation.h>
 #include <structs/Heap.h>
 #include <KrisLibrary/Logger.h>
 #include <Timer.h>
+#include <myfile.h>
+#include <utils/ioutils.h>
+#include <utils/threadutils.h>
 
 //switch to brute force when # points drops below 1000
 #define DEBUG_DISTANCE_CHECKING 0
@@ -19,23 +23,82 @@ using namespace std;
 
 namespace Geometry {
 
-void GetMinMax(const Meshing::VolumeGrid* mingrid,const Meshing::VolumeGrid* maxgrid,const AABB3D& bb,Real& vmin,Real& vmax)
+//Cell index of pt in a grid with bounding box bb and size m x n x p, as
+//in VolumeGrid::GetIndex
+static void GetIndex(const AABB3D& bb,int m,int n,int p,const Vector3& pt,IntTriple& index)
+{
+  Real u=(pt.x - bb.bmin.x)/(bb.bmax.x-bb.bmin.x);
+  Real v=(pt.y - bb.bmin.y)/(bb.bmax.y-bb.bmin.y);
+  Real w=(pt.z - bb.bmin.z)/(bb.bmax.z-bb.bmin.z);
+  index.a = (int)Floor(u*m);
+  index.b = (int)Floor(v*n);
+  index.c = (int)Floor(w*p);
+}
+
+template <class T>
+void GetMinMax(const Array3D<T>& minvalue,const Array3D<T>& maxvalue,const AABB3D& gridbb,const AABB3D& bb,Real& vmin,Real& vmax)
 {
   vmin = Inf;
   vmax = -Inf;
   IntTriple imin,imax;
-  mingrid->GetIndexRange(bb,imin,imax);
+  GetIndex(gridbb,minvalue.m,minvalue.n,minvalue.p,bb.bmin,imin);
+  GetIndex(gridbb,minvalue.m,minvalue.n,minvalue.p,bb.bmax,imax);
   if(imax.a < 0) imax.a = 0;
-  if(imin.a >= mingrid->value.m) imin.a = mingrid->value.m-1;
+  if(imin.a >= minvalue.m) imin.a = minvalue.m-1;
   if(imax.b < 0) imax.b = 0;
-  if(imin.b >= mingrid->value.n) imin.b = mingrid->value.n-1;
+  if(imin.b >= minvalue.n) imin.b = minvalue.n-1;
   if(imax.c < 0) imax.c = 0;
-  if(imin.c >= mingrid->value.p) imin.c = mingrid->value.p-1;
-  for(int i=max(imin.a,0);i<=min(imax.a,mingrid->value.m-1);i++) {
-    for(int j=max(imin.b,0);j<=min(imax.b,mingrid->value.n-1);j++) {
-      for(int k=max(imin.c,0);k<=min(imax.c,mingrid->value.p-1);k++) {
-        vmin = Min(vmin,mingrid->value(i,j,k));
-        vmax = Max(vmax,maxgrid->value(i,j,k));
+  if(imin.c >= minvalue.p) imin.c = minvalue.p-1;
+  for(int i=max(imin.a,0);i<=min(imax.a,minvalue.m-1);i++) {
+    for(int j=max(imin.b,0);j<=min(imax.b,minvalue.n-1);j++) {
+      for(int k=max(imin.c,0);k<=min(imax.c,minvalue.p-1);k++) {
+        vmin = Min(vmin,Real(minvalue(i,j,k)));
+        vmax = Max(vmax,Real(maxvalue(i,j,k)));
+      }
+    }
+  }
+}
+
+void GetMinMax(const Meshing::VolumeGrid* mingrid,const Meshing::VolumeGrid* maxgrid,const AABB3D& bb,Real& vmin,Real& vmax)
+{
+  GetMinMax(mingrid->value,maxgrid->value,mingrid->bb,bb,vmin,vmax);
+}
+
+//Same as above, for the base values of a sparse grid.  Blocks that aren't
+//stored or are tiles count once, with their constant value.
+void GetMinMax(const Meshing::SparseVolumeGrid& grid,const AABB3D& bb,Real& vmin,Real& vmax)
+{
+  vmin = Inf;
+  vmax = -Inf;
+  IntTriple imin,imax;
+  grid.GetIndexRange(bb,imin,imax);
+  imin.a = Max(Min(imin.a,grid.m-1),0);
+  imin.b = Max(Min(imin.b,grid.n-1),0);
+  imin.c = Max(Min(imin.c,grid.p-1),0);
+  imax.a = Min(Max(imax.a,0),grid.m-1);
+  imax.b = Min(Max(imax.b,0),grid.n-1);
+  imax.c = Min(Max(imax.c,0),grid.p-1);
+  IntTriple bmin = Meshing::SparseVolumeGrid::BlockIndex(imin.a,imin.b,imin.c);
+  IntTriple bmax = Meshing::SparseVolumeGrid::BlockIndex(imax.a,imax.b,imax.c);
+  IntTriple b;
+  for(b.a=bmin.a;b.a<=bmax.a;b.a++) {
+    for(b.b=bmin.b;b.b<=bmax.b;b.b++) {
+      for(b.c=bmin.c;b.c<=bmax.c;b.c++) {
+        int k = grid.FindBlock(b);
+        if(k < 0 || grid.blocks[k].offset < 0) {
+          Real v = (k < 0 ? grid.background : grid.blocks[k].tileValue);
+          vmin = Min(vmin,v);
+          vmax = Max(vmax,v);
+          continue;
+        }
+        const Real* vals = &grid.values[grid.blocks[k].offset];
+        for(int i=Max(imin.a,b.a*8);i<=Min(imax.a,b.a*8+7);i++)
+          for(int j=Max(imin.b,b.b*8);j<=Min(imax.b,b.b*8+7);j++)
+            for(int l=Max(imin.c,b.c*8);l<=Min(imax.c,b.c*8+7);l++) {
+              Real v = vals[((i&7)*8+(j&7))*8+(l&7)];
+              vmin = Min(vmin,v);
+              vmax = Max(vmax,v);
+            }
       }
     }
   }
@@ -54,22 +117,30 @@ CollisionImplicitSurface::CollisionImplicitSurface(const Meshing::VolumeGrid& vg
   InitCollisions();
 }
 
+CollisionImplicitSurface::CollisionImplicitSurface(const Meshing::SparseVolumeGrid& vg)
+:sparseGrid(vg)
+{
+  currentTransform.setIdentity();
+  InitCollisions();
+}
+
 CollisionImplicitSurface::CollisionImplicitSurface(const CollisionImplicitSurface& vg)
-:baseGrid(vg.baseGrid),currentTransform(vg.currentTransform),minHierarchy(vg.minHierarchy),maxHierarchy(vg.maxHierarchy),resolutionMap(vg.resolutionMap)
+:baseGrid(vg.baseGrid),sparseGrid(vg.sparseGrid),currentTransform(vg.currentTransform),minHierarchy(vg.minHierarchy),maxHierarchy(vg.maxHierarchy),resolutionMap(vg.resolutionMap),floatGrid(vg.floatGrid)
 {}
 
 void CollisionImplicitSurface::InitCollisions()
 {
-  Vector3 dims = baseGrid.bb.bmax-baseGrid.bb.bmin;
+  //baseGrid was set again after switching to float storage
+  bool refloat = (IsFloat() && !baseGrid.IsEmpty());
+  if(refloat) floatGrid.clear();
+  const AABB3D& gridbb = GetBB();
+  Vector3 dims = gridbb.bmax-gridbb.bmin;
   Real maxdim = Max(dims.x,dims.y,dims.z);
-  Vector3 res = dims;
-  res.x /= (baseGrid.value.m);
-  res.y /= (baseGrid.value.n);
-  res.z /= (baseGrid.value.p);
+  Vector3 res = GetCellSize();
   Real h = Min(res.x,res.y,res.z);
   Assert(h > 0);
-  h = h*2;
-  Real h0 = h;
+  //the first level of a sparse grid's hierarchy is at block resolution
+  h = h*(IsSparse() ? 8 : 2);
   //first resize
   resolutionMap.resize(0);
   while(int(maxdim / h) >= 2) {
@@ -89,9 +160,9 @@ void CollisionImplicitSurface::InitCollisions()
   maxHierarchy.resize(resolutionMap.size()-1);
   for(size_t i=0;i+1<resolutionMap.size();i++) {
     Real res = resolutionMap[i];
-    minHierarchy[i].bb = baseGrid.bb;
+    minHierarchy[i].bb = gridbb;
     minHierarchy[i].ResizeByResolution(Vector3(res));
-    maxHierarchy[i].bb = baseGrid.bb;
+    maxHierarchy[i].bb = gridbb;
     maxHierarchy[i].ResizeByResolution(Vector3(res));
   }
   Meshing::VolumeGrid *minprev = &baseGrid, *maxprev = &baseGrid;
@@ -102,7 +173,12 @@ void CollisionImplicitSurface::InitCollisions()
     Real vmin,vmax;
     while(!itmin.isDone()) {
       itmin.getCell(bb);
-      GetMinMax(minprev,maxprev,bb,vmin,vmax);
+      if(i == 0 && IsSparse())
+        GetMinMax(sparseGrid,bb,vmin,vmax);
+      else if(i == 0 && IsFloat())
+        GetMinMax(floatGrid,floatGrid,baseGrid.bb,bb,vmin,vmax);
+      else
+        GetMinMax(minprev,maxprev,bb,vmin,vmax);
       *itmin = vmin;
       *itmax = vmax;
       ++itmin;
@@ -111,6 +187,57 @@ void CollisionImplicitSurface::InitCollisions()
     minprev = &minHierarchy[i];
     maxprev = &maxHierarchy[i];
   }
+  if(refloat) SetFloatStorage(true);
+}
+
+void CollisionImplicitSurface::SetFloatStorage(bool enabled)
+{
+  if(enabled == IsFloat()) return;
+  if(!enabled) {
+    baseGrid.value.resize(floatGrid.m,floatGrid.n,floatGrid.p);
+    const float* src = floatGrid.getData();
+    Real* dst = baseGrid.value.getData();
+    int num = floatGrid.m*floatGrid.n*floatGrid.p;
+    for(int i=0;i<num;i++) dst[i] = (Real)src[i];
+    floatGrid.clear();
+    return;
+  }
+  if(IsSparse()) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"CollisionImplicitSurface::SetFloatStorage: not supported for sparse grids");
+    return;
+  }
+  if(baseGrid.IsEmpty()) return;
+  floatGrid.resize(baseGrid.value.m,baseGrid.value.n,baseGrid.value.p);
+  const Real* src = baseGrid.value.getData();
+  float* dst = floatGrid.getData();
+  int num = baseGrid.value.m*baseGrid.value.n*baseGrid.value.p;
+  for(int i=0;i<num;i++) dst[i] = (float)src[i];
+  baseGrid.value.clear();
+}
+
+
+bool CollisionImplicitSurface::ReadCollisions(File& f)
+{
+  if(!ReadFile(f,resolutionMap)) return false;
+  if(resolutionMap.empty()) return false;
+  minHierarchy.resize(resolutionMap.size()-1);
+  maxHierarchy.resize(resolutionMap.size()-1);
+  for(size_t i=0;i<minHierarchy.size();i++) {
+    minHierarchy[i].bb = maxHierarchy[i].bb = GetBB();
+    if(!minHierarchy[i].value.Read(f)) return false;
+    if(!maxHierarchy[i].value.Read(f)) return false;
+  }
+  return true;
+}
+
+bool CollisionImplicitSurface::WriteCollisions(File& f) const
+{
+  if(!WriteFile(f,resolutionMap)) return false;
+  for(size_t i=0;i<minHierarchy.size();i++) {
+    if(!minHierarchy[i].value.Write(f)) return false;
+    if(!maxHierarchy[i].value.Write(f)) return false;
+  }
+  return true;
 }
 
 
@@ -122,6 +249,14 @@ void CollisionImplicitSurface::DistanceRangeLocal(const AABB3D& bb,Real& vmin,Re
   IntTriple imin,imax;
   if(resolutionMap.empty() || res < resolutionMap[0]) {
     //just look it up in the base grid
+    if(IsSparse()) {
+      GetMinMax(sparseGrid,bb,vmin,vmax);
+      return;
+    }
+    if(IsFloat()) {
+      GetMinMax(floatGrid,floatGrid,baseGrid.bb,bb,vmin,vmax);
+      return;
+    }
   }
   else {
     int index=Spline::TimeSegmentation::Map(resolutionMap,res);
@@ -138,13 +273,74 @@ void CollisionImplicitSurface::DistanceRangeLocal(const AABB3D& bb,Real& vmin,Re
   GetMinMax(chosenMin,chosenMax,bb,vmin,vmax);
 }
 
+template <class T>
+static void TrilinearBatch(const T* values,int m,int n,int p,const AABB3D& bb,int num,const Real* x,const Real* y,const Real* z,Real* res,Real* gx,Real* gy,Real* gz);
+
+bool CollisionImplicitSurface::IsEmpty() const
+{
+  if(IsSparse() || IsFloat()) return false;
+  return baseGrid.IsEmpty();
+}
+
+const AABB3D& CollisionImplicitSurface::GetBB() const
+{
+  if(IsSparse()) return sparseGrid.bb;
+  return baseGrid.bb;
+}
+
+IntTriple CollisionImplicitSurface::GetSize() const
+{
+  if(IsSparse()) return IntTriple(sparseGrid.m,sparseGrid.n,sparseGrid.p);
+  if(IsFloat()) return IntTriple(floatGrid.m,floatGrid.n,floatGrid.p);
+  return baseGrid.value.size();
+}
+
+Vector3 CollisionImplicitSurface::GetCellSize() const
+{
+  if(IsSparse()) return sparseGrid.GetCellSize();
+  if(IsFloat()) {
+    Vector3 size = baseGrid.bb.bmax-baseGrid.bb.bmin;
+    return Vector3(size.x/floatGrid.m,size.y/floatGrid.n,size.z/floatGrid.p);
+  }
+  return baseGrid.GetCellSize();
+}
+
+void CollisionImplicitSurface::GetIndex(const Vector3& ptlocal,IntTriple& index) const
+{
+  if(IsSparse()) sparseGrid.GetIndex(ptlocal,index);
+  else if(IsFloat()) Geometry::GetIndex(baseGrid.bb,floatGrid.m,floatGrid.n,floatGrid.p,ptlocal,index);
+  else baseGrid.GetIndex(ptlocal,index);
+}
+
+Real CollisionImplicitSurface::TrilinearInterpolate(const Vector3& ptlocal) const
+{
+  if(IsSparse()) return sparseGrid.TrilinearInterpolate(ptlocal);
+  if(IsFloat()) {
+    Real res;
+    TrilinearBatch(floatGrid.getData(),floatGrid.m,floatGrid.n,floatGrid.p,baseGrid.bb,1,&ptlocal.x,&ptlocal.y,&ptlocal.z,&res,NULL,NULL,NULL);
+    return res;
+  }
+  return baseGrid.TrilinearInterpolate(ptlocal);
+}
+
+void CollisionImplicitSurface::Gradient(const Vector3& ptlocal,Vector3& grad) const
+{
+  if(IsSparse()) sparseGrid.Gradient(ptlocal,grad);
+  else if(IsFloat()) {
+    //gradient of the interpolant
+    Real res;
+    TrilinearBatch(floatGrid.getData(),floatGrid.m,floatGrid.n,floatGrid.p,baseGrid.bb,1,&ptlocal.x,&ptlocal.y,&ptlocal.z,&res,&grad.x,&grad.y,&grad.z);
+  }
+  else baseGrid.Gradient(ptlocal,grad);
+}
+
 Real Distance(const CollisionImplicitSurface& s,const Vector3& pt)
 {
   Vector3 ptlocal;
   s.currentTransform.mulInverse(pt,ptlocal);
-  Real sdf_value = s.baseGrid.TrilinearInterpolate(ptlocal);
+  Real sdf_value = s.TrilinearInterpolate(ptlocal);
   Vector3 pt_clamped;
-  Real d_bb = s.baseGrid.bb.distance(ptlocal,pt_clamped);
+  Real d_bb = s.GetBB().distance(ptlocal,pt_clamped);
   return sdf_value + d_bb;
 }
 
@@ -153,11 +349,11 @@ Real Distance(const CollisionImplicitSurface& s,const Vector3& pt,Vector3& surfa
 {
   Vector3 ptlocal;
   s.currentTransform.mulInverse(pt,ptlocal);
-  Real sdf_value = s.baseGrid.TrilinearInterpolate(ptlocal);
+  Real sdf_value = s.TrilinearInterpolate(ptlocal);
   Vector3 pt_clamped;
-  Real d_bb = s.baseGrid.bb.distance(ptlocal,pt_clamped);
+  Real d_bb = s.GetBB().distance(ptlocal,pt_clamped);
  
-  s.baseGrid.Gradient(pt_clamped,direction);
+  s.Gradient(pt_clamped,direction);
   //cout<<"Gradient is "<<direction<<endl;
   direction.inplaceNormalize();
   surfacePt = pt_clamped - direction*sdf_value;
@@ -173,6 +369,135 @@ Real Distance(const CollisionImplicitSurface& s,const Vector3& pt,Vector3& surfa
   return sdf_value + d_bb;
 }
 
+//Trilinear interpolation of a grid of values sampled at cell centers (laid
+//out as in Array3D) at num points given in the grid's frame, optionally
+//with the gradient of the interpolant.  Indices are clamped with selects
+//rather than branches, so the loop has no data-dependent control flow.
+template <class T>
+static void TrilinearBatch(const T* values,int m,int n,int p,const AABB3D& bb,int num,const Real* x,const Real* y,const Real* z,Real* res,Real* gx,Real* gy,Real* gz)
+{
+  //continuous index relative to cell centers, e.g., u = (x-bmin.x)*m/dims.x - 0.5
+  Real sx = Real(m)/(bb.bmax.x-bb.bmin.x), sy = Real(n)/(bb.bmax.y-bb.bmin.y), sz = Real(p)/(bb.bmax.z-bb.bmin.z);
+  Real ox = -bb.bmin.x*sx-0.5, oy = -bb.bmin.y*sy-0.5, oz = -bb.bmin.z*sz-0.5;
+  Real umax = m-1, vmax = n-1, wmax = p-1;
+  int imax = Max(m-2,0), jmax = Max(n-2,0), kmax = Max(p-2,0);
+  int si = n*p, sj = p;
+  //offsets to the second cell along each axis
+  int di = (m > 1 ? si : 0), dj = (n > 1 ? sj : 0), dk = (p > 1 ? 1 : 0);
+  for(int q=0;q<num;q++) {
+    Real u = x[q]*sx+ox, v = y[q]*sy+oy, w = z[q]*sz+oz;
+    //written so that NaNs clamp to 0
+    Real cu = (u > 0 ? u : 0), cv = (v > 0 ? v : 0), cw = (w > 0 ? w : 0);
+    cu = (cu < umax ? cu : umax);
+    cv = (cv < vmax ? cv : vmax);
+    cw = (cw < wmax ? cw : wmax);
+    int i = (int)cu, j = (int)cv, k = (int)cw;
+    i = (i < imax ? i : imax);
+    j = (j < jmax ? j : jmax);
+    k = (k < kmax ? k : kmax);
+    Real fu = cu-i, fv = cv-j, fw = cw-k;
+    const T* c = values + i*si + j*sj + k;
+    Real v000 = c[0], v001 = c[dk], v010 = c[dj], v011 = c[dj+dk];
+    Real v100 = c[di], v101 = c[di+dk], v110 = c[di+dj], v111 = c[di+dj+dk];
+    Real v00 = v000 + fw*(v001-v000);
+    Real v01 = v010 + fw*(v011-v010);
+    Real v10 = v100 + fw*(v101-v100);
+    Real v11 = v110 + fw*(v111-v110);
+    Real v0 = v00 + fv*(v01-v00);
+    Real v1 = v10 + fv*(v11-v10);
+    res[q] = v0 + fu*(v1-v0);
+    if(gx) {
+      //the interpolant is constant along clamped axes
+      Real du = (u > 0 && u < umax ? sx : 0);
+      Real dv = (v > 0 && v < vmax ? sy : 0);
+      Real dw = (w > 0 && w < wmax ? sz : 0);
+      Real e00 = v001-v000, e01 = v011-v010, e10 = v101-v100, e11 = v111-v110;
+      Real e0 = e00 + fv*(e01-e00), e1 = e10 + fv*(e11-e10);
+      gx[q] = (v1-v0)*du;
+      gy[q] = ((v01-v00) + fu*((v11-v10)-(v01-v00)))*dv;
+      gz[q] = (e0 + fu*(e1-e0))*dw;
+    }
+  }
+}
+
+//number of points transformed and sampled at once by the batch queries
+static const int kDistanceBatchBlock = 256;
+
+static void DistanceBatch(const CollisionImplicitSurface& s,int n,const Real* x,const Real* y,const Real* z,Real* dist,Real* gx,Real* gy,Real* gz,int numThreads)
+{
+  if(n <= 0) return;
+  const Meshing::VolumeGrid& g = s.baseGrid;
+  Assert(!s.IsEmpty());
+  const AABB3D& bb = s.GetBB();
+  const Matrix3& R = s.currentTransform.R;
+  const Vector3& t = s.currentTransform.t;
+  IntTriple size = s.GetSize();
+  int numBlocks = (n+kDistanceBatchBlock-1)/kDistanceBatchBlock;
+  ParallelFor(numBlocks,[&](int b) {
+      Real lx[kDistanceBatchBlock],ly[kDistanceBatchBlock],lz[kDistanceBatchBlock],dbb[kDistanceBatchBlock];
+      Real lgx[kDistanceBatchBlock],lgy[kDistanceBatchBlock],lgz[kDistanceBatchBlock];
+      int start = b*kDistanceBatchBlock;
+      int num = Min(kDistanceBatchBlock,n-start);
+      //local coordinates are R^T (p - t)
+      for(int q=0;q<num;q++) {
+        Real px = x[start+q]-t.x, py = y[start+q]-t.y, pz = z[start+q]-t.z;
+        lx[q] = R(0,0)*px + R(1,0)*py + R(2,0)*pz;
+        ly[q] = R(0,1)*px + R(1,1)*py + R(2,1)*pz;
+        lz[q] = R(0,2)*px + R(1,2)*py + R(2,2)*pz;
+      }
+      Real* bgx = (gx ? lgx : NULL);
+      if(s.IsSparse()) {
+        for(int q=0;q<num;q++) {
+          Vector3 plocal(lx[q],ly[q],lz[q]);
+          dist[start+q] = s.sparseGrid.TrilinearInterpolate(plocal);
+          if(bgx) {
+            Vector3 grad;
+            s.sparseGrid.Gradient(plocal,grad);
+            lgx[q] = grad.x; lgy[q] = grad.y; lgz[q] = grad.z;
+          }
+        }
+      }
+      else if(s.IsFloat())
+        TrilinearBatch(s.floatGrid.getData(),size.a,size.b,size.c,bb,num,lx,ly,lz,dist+start,bgx,lgy,lgz);
+      else
+        TrilinearBatch(g.value.getData(),size.a,size.b,size.c,bb,num,lx,ly,lz,dist+start,bgx,lgy,lgz);
+      //add the distance to the bounding box
+      for(int q=0;q<num;q++) {
+        Real cx = (lx[q] < bb.bmin.x ? bb.bmin.x : (lx[q] > bb.bmax.x ? bb.bmax.x : lx[q]));
+        Real cy = (ly[q] < bb.bmin.y ? bb.bmin.y : (ly[q] > bb.bmax.y ? bb.bmax.y : ly[q]));
+        Real cz = (lz[q] < bb.bmin.z ? bb.bmin.z : (lz[q] > bb.bmax.z ? bb.bmax.z : lz[q]));
+        lx[q] -= cx;
+        ly[q] -= cy;
+        lz[q] -= cz;
+        dbb[q] = Sqrt(lx[q]*lx[q] + ly[q]*ly[q] + lz[q]*lz[q]);
+        dist[start+q] += dbb[q];
+      }
+      if(!gx) return;
+      for(int q=0;q<num;q++) {
+        Real dx = lgx[q], dy = lgy[q], dz = lgz[q];
+        if(dbb[q] > 0) {
+          Real scale = 1.0/dbb[q];
+          dx += lx[q]*scale;
+          dy += ly[q]*scale;
+          dz += lz[q]*scale;
+        }
+        gx[start+q] = R(0,0)*dx + R(0,1)*dy + R(0,2)*dz;
+        gy[start+q] = R(1,0)*dx + R(1,1)*dy + R(1,2)*dz;
+        gz[start+q] = R(2,0)*dx + R(2,1)*dy + R(2,2)*dz;
+      }
+    },numThreads);
+}
+
+void Distance(const CollisionImplicitSurface& s,int n,const Real* x,const Real* y,const Real* z,Real* dist,int numThreads)
+{
+  DistanceBatch(s,n,x,y,z,dist,NULL,NULL,NULL,numThreads);
+}
+
+void Distance(const CollisionImplicitSurface& s,int n,const Real* x,const Real* y,const Real* z,Real* dist,Real* gx,Real* gy,Real* gz,int numThreads)
+{
+  DistanceBatch(s,n,x,y,z,dist,gx,gy,gz,numThreads);
+}
+
 Real Distance(const CollisionImplicitSurface& grid,const GeometricPrimitive3D& a,Vector3& gridclosest,Vector3& geomclosest,Vector3& direction)
 {
   if(a.type == GeometricPrimitive3D::Point) {
@@ -200,7 +525,7 @@ bool Collides(const CollisionImplicitSurface& s,const CollisionPointCloud& pc,Re
   Box3D pcbb;
   GetBB(pc,pcbb);
   Box3D sbb;
-  sbb.setTransformed(s.baseGrid.bb,s.currentTransform);
+  sbb.setTransformed(s.GetBB(),s.currentTransform);
   Box3D sbbexpanded = sbb;
   sbbexpanded.dims += Vector3(margin*2.0);
   sbbexpanded.origin -= margin*(sbb.xbasis+sbb.ybasis+sbb.zbasis);
@@ -294,7 +619,7 @@ Real DistanceLowerBound(const CollisionImplicitSurface& s,const CollisionPointCl
   AABB3D orientedBB;
   orientedBB.setTransform(n.bb,Mpc_s);
   s.DistanceRangeLocal(orientedBB,dmin,dmax);
-  return dmin+orientedBB.distance(s.baseGrid.bb) - BOUNDING_VOLUME_FUZZ;
+  return dmin+orientedBB.distance(s.GetBB()) - BOUNDING_VOLUME_FUZZ;
   */
   //method2: put everything in a sphere, assume the value of the baseGrid is an SDF
   Vector3 c=(n.bb.bmin+n.bb.bmax)*0.5;
@@ -307,8 +632,8 @@ Real DistanceLowerBound(const CollisionImplicitSurface& s,const CollisionPointCl
 
   Vector3 clocal;
   Mpc_s.mulPoint(c,clocal);
-  Real dc = s.baseGrid.TrilinearInterpolate(clocal);
-  Real d_bb = s.baseGrid.bb.distance(clocal);
+  Real dc = s.TrilinearInterpolate(clocal);
+  Real d_bb = s.GetBB().distance(clocal);
   return d_bb + dc - rad - BOUNDING_VOLUME_FUZZ;
 }
 
@@ -332,9 +657,9 @@ Real Distance(const CollisionImplicitSurface& s,const CollisionPointCloud& pc,in
       Vector3 ptlocal;
       Tpc_s.mul(pc.points[i],ptlocal);
       Vector3 pt_clamped;
-      Real sdf_value = s.baseGrid.TrilinearInterpolate(ptlocal);
+      Real sdf_value = s.TrilinearInterpolate(ptlocal);
       if(sdf_value < bruteForceDmin) {
-        Real d_bb = s.baseGrid.bb.distance(ptlocal,pt_clamped);
+        Real d_bb = s.GetBB().distance(ptlocal,pt_clamped);
         if(sdf_value + d_bb < bruteForceDmin) {
           bruteForceClosestPoint = (int)i;
           bruteForceDmin = sdf_value + d_bb;
@@ -406,9 +731,9 @@ Real Distance(const CollisionImplicitSurface& s,const CollisionPointCloud& pc,in
         Vector3 ptlocal;
         Tpc_s.mul(pc.points[id],ptlocal);
         Vector3 pt_clamped;
-        Real sdf_value = s.baseGrid.TrilinearInterpolate(ptlocal);
+        Real sdf_value = s.TrilinearInterpolate(ptlocal);
         if(sdf_value < mindist) {
-          Real d_bb = s.baseGrid.bb.distance(ptlocal,pt_clamped);
+          Real d_bb = s.GetBB().distance(ptlocal,pt_clamped);
           Real d = d_bb + sdf_value;
           if(d < mindist) {
             //debugging
@@ -446,4 +771,96 @@ Real Distance(const CollisionImplicitSurface& s,const CollisionPointCloud& pc,in
   return mindist;
 }
 
-} //namespace Geometry
\ No newline at end of file
+//Signed distance in the local frame, extended outside the grid by the
+//distance to its bounding box
+static Real LocalDistance(const CollisionImplicitSurface& s,const Vector3& ptlocal)
+{
+  Vector3 pt_clamped;
+  Real d_bb = s.GetBB().distance(ptlocal,pt_clamped);
+  return s.TrilinearInterpolate(ptlocal) + d_bb;
+}
+
+bool RayCastLocal(const CollisionImplicitSurface& s,Real margin,const Ray3D& r,Vector3& pt)
+{
+  if(s.IsEmpty()) return false;
+  Real len = r.direction.norm();
+  if(len == 0) return false;
+  Ray3D rn;
+  rn.source = r.source;
+  rn.direction = r.direction/len;
+  AABB3D bb = s.GetBB();
+  if(margin > 0) {
+    bb.bmin -= Vector3(margin);
+    bb.bmax += Vector3(margin);
+  }
+  Real tmin=0,tmax=Inf;
+  if(!((const Line3D&)rn).intersects(bb,tmin,tmax)) return false;
+  Vector3 h = s.GetCellSize();
+  Real minStep = Half*Min(h.x,Min(h.y,h.z));
+  Real t = tmin, tprev = tmin, vprev = Inf;
+  while(true) {
+    Real v = LocalDistance(s,rn.source+t*rn.direction) - margin;
+    if(v <= 0) {
+      if(!IsInf(vprev)) {
+        //refine the crossing in [tprev,t] by false position
+        Real a = tprev, fa = vprev, b = t, fb = v;
+        for(int iters=0;iters<8;iters++) {
+          Real c = a + (b-a)*fa/(fa-fb);
+          Real fc = LocalDistance(s,rn.source+c*rn.direction) - margin;
+          if(fc > 0) { a = c; fa = fc; }
+          else { b = c; fb = fc; }
+        }
+        t = b;
+      }
+      pt = rn.source + t*rn.direction;
+      return true;
+    }
+    if(t >= tmax) return false;
+    tprev = t;
+    vprev = v;
+    t += Max(v,minStep);
+    if(t > tmax) t = tmax;
+  }
+  return false;
+}
+
+bool RayCast(const CollisionImplicitSurface& s,Real margin,const Ray3D& r,Vector3& pt)
+{
+  Ray3D rlocal;
+  s.currentTransform.mulInverse(r.source,rlocal.source);
+  s.currentTransform.R.mulTranspose(r.direction,rlocal.direction);
+  if(!RayCastLocal(s,margin,rlocal,pt)) return false;
+  pt = s.currentTransform*pt;
+  return true;
+}
+
+void RayCast(const CollisionImplicitSurface& s,Real margin,const vector<Ray3D>& rays,vector<Real>& distances,vector<int>& cells,vector<Vector3>& pts,int numThreads)
+{
+  distances.resize(rays.size());
+  cells.resize(rays.size());
+  pts.resize(rays.size());
+  vector<int> order;
+  CoherentRayOrder(rays,order);
+  IntTriple size = s.GetSize();
+  ParallelFor((int)rays.size(),[&](int k) {
+      int i = order[k];
+      Vector3 ptlocal;
+      if(RayCast(s,margin,rays[i],pts[i])) {
+        distances[i] = pts[i].distance(rays[i].source);
+        s.currentTransform.mulInverse(pts[i],ptlocal);
+        IntTriple cell;
+        s.GetIndex(ptlocal,cell);
+        cell.a = Max(0,Min(cell.a,size.a-1));
+        cell.b = Max(0,Min(cell.b,size.b-1));
+        cell.c = Max(0,Min(cell.c,size.c-1));
+        cells[i] = (cell.a*size.b + cell.b)*size.c + cell.c;
+      }
+      else {
+        pts[i].setZero();
+        distances[i] = Inf;
+        cells[i] = -1;
+      }
+    },numThreads,RAY_PACKET_SIZE*8);
+}
+
+} //namespace Geometry
@@ -2,6 +2,7 @@
 #define COLLISION_IMPLICIT_SURFACE_H
 
 #include <KrisLibrary/meshing/VolumeGrid.h>
+#include <KrisLibrary/meshing/SparseVolumeGrid.h>
 #include <KrisLibrary/math3d/geometry3d.h>
 
 namespace Geometry {
@@ -12,29 +13,65 @@ namespace Geometry {
 
 /** @brief An implicit surface (usually signed-distance function) with a fast collision
  * detection data structure.
+ *
+ * The values are stored either densely in baseGrid or sparsely in
+ * sparseGrid.  Queries should go through the accessors below, which work
+ * with either storage.  For sparse storage the min / max hierarchy starts
+ * at the resolution of sparseGrid's 8x8x8 blocks.
  */
 class CollisionImplicitSurface
 {
  public:
   CollisionImplicitSurface();
   CollisionImplicitSurface(const Meshing::VolumeGrid& vg);
+  CollisionImplicitSurface(const Meshing::SparseVolumeGrid& vg);
   CollisionImplicitSurface(const CollisionImplicitSurface& vg);
   ///Sets up the collision detection data structures.  This is automatically
   ///called during initialization, and needs to be called any time the implicit
   ///surface changes
   void InitCollisions();
+  ///Reads / writes the data structures computed by InitCollisions (the
+  ///min / max hierarchy) in a native binary format.  baseGrid or sparseGrid
+  ///must already be set before ReadCollisions is called.
+  bool ReadCollisions(File& f);
+  bool WriteCollisions(File& f) const;
 
   ///O(1) call to get a range of minimum and maximum implicit surface values within a bounding box,
   ///expressed in local frame
   void DistanceRangeLocal(const AABB3D& bb,Real& vmin,Real& vmax) const;
-
-  ///The original implicit surface
+  ///Returns true if the values are stored in sparseGrid
+  inline bool IsSparse() const { return !sparseGrid.IsEmpty(); }
+  bool IsEmpty() const;
+  ///Bounding box and number of cells of the grid, in the local frame
+  const AABB3D& GetBB() const;
+  IntTriple GetSize() const;
+  Vector3 GetCellSize() const;
+  void GetIndex(const Vector3& ptlocal,IntTriple& index) const;
+  ///Trilinear interpolation of the values at a point in the local frame
+  Real TrilinearInterpolate(const Vector3& ptlocal) const;
+  ///Gradient of the interpolation at a point in the local frame
+  void Gradient(const Vector3& ptlocal,Vector3& grad) const;
+  ///Switches the dense values between double (baseGrid.value) and float32
+  ///(floatGrid) storage.  In float mode baseGrid.value is freed and only
+  ///baseGrid.bb is kept, which halves the memory of the grid.  Gradients
+  ///near the grid boundary then follow the interpolant rather than
+  ///VolumeGrid's centered differences.  Not supported for sparse grids.
+  void SetFloatStorage(bool enabled);
+  ///Returns true if the values are stored in floatGrid
+  inline bool IsFloat() const { return !floatGrid.empty(); }
+
+  ///The original implicit surface, if stored densely.  In float mode only
+  ///bb is set and the values are in floatGrid.
   Meshing::VolumeGrid baseGrid;
+  ///The original implicit surface, if stored sparsely (baseGrid is empty)
+  Meshing::SparseVolumeGrid sparseGrid;
   ///The transformation of the implicit surface in space 
   RigidTransform currentTransform;
   ///A hierarchy of volume grids of decreasing resolution
   std::vector<Meshing::VolumeGrid> minHierarchy,maxHierarchy;
   std::vector<Real> resolutionMap;
+  ///The dense values in float32, if enabled by SetFloatStorage
+  Array3D<float> floatGrid;
 };
 
 
@@ -53,6 +90,18 @@ Real Distance(const CollisionImplicitSurface& s,const Vector3& pt);
 ///Inputs and outputs are all in world coordinates.
 Real Distance(const CollisionImplicitSurface& s,const Vector3& pt,Vector3& surfacePt,Vector3& direction);
 
+///Batch version of Distance(s,pt) for n points given as separate x, y, z
+///arrays, in world coordinates.  Points are processed in blocks split
+///across numThreads threads (0 uses all hardware threads).
+void Distance(const CollisionImplicitSurface& s,int n,const Real* x,const Real* y,const Real* z,Real* dist,int numThreads=0);
+
+///Same as above, but also returns the gradient of the distance in world
+///coordinates in (gx[i],gy[i],gz[i]).  The gradient is that of the
+///trilinear interpolant, so it is consistent with the returned distances
+///(it is not normalized, and its component along a clamped axis outside
+///the grid comes from the distance to the bounding box).
+void Distance(const CollisionImplicitSurface& s,int n,const Real* x,const Real* y,const Real* z,Real* dist,Real* gx,Real* gy,Real* gz,int numThreads=0);
+
 ///Same as above, except that 
 ///- geomPt is the closest/deepest point on geom.
 ///- direction is the unit normal of decreasing distance, in that if geom is moved in this direction, the distance decreases.
@@ -67,6 +116,23 @@ bool Collides(const CollisionImplicitSurface& s,const CollisionPointCloud& pc,Re
 ///Returns the distance and closest point to a CollisionPointCloud
 Real Distance(const CollisionImplicitSurface& s,const CollisionPointCloud& pc,int& closestPoint,Real upperBound=Inf);
 
+///Casts a ray at the level set s = margin, assuming s is a signed distance
+///field.  Returns true if the ray hits, with the hit point in pt.  Uses
+///sphere tracing with steps of at least half a cell.  Input and output are
+///in world coordinates.
+bool RayCast(const CollisionImplicitSurface& s,Real margin,const Ray3D& r,Vector3& pt);
+
+///Same as RayCast, but the ray (and hit point) are in the local frame of s
+bool RayCastLocal(const CollisionImplicitSurface& s,Real margin,const Ray3D& r,Vector3& pt);
+
+///Casts a batch of rays at the level set s = margin.  On return,
+///distances[i] is the distance along rays[i] to the hit (Inf if none),
+///cells[i] is the index of the grid cell containing the hit (-1 if none),
+///indexed as in AnyGeometry3D::GetElement, and pts[i] is the hit point.
+///Rays are processed in a coherent order split across numThreads threads
+///(0 uses all hardware threads).
+void RayCast(const CollisionImplicitSurface& s,Real margin,const std::vector<Ray3D>& rays,std::vector<Real>& distances,std::vector<int>& cells,std::vector<Vector3>& pts,int numThreads=0);
+
 
 } //namespace Geometry
 
@@ -1,8 +1,12 @@
 #include <log4cxx/logger.h>
 #include <KrisLibrary/Logger.h>
 #include "CollisionMesh.h"
+#include "RayBatch.h"
 #include "PenetrationDepth.h"
 #include <math3d/clip.h>
+#include <math3d/interpolate.h>
+#include <utils/threadutils.h>
+#include <myfile.h>
 #include <iostream>
 using namespace Meshing;
 using namespace std;
@@ -128,6 +132,67 @@ void CopyPQPModel(const PQP_Model* source, PQP_Model* dest)
     dest->b[i] = source->b[i];
 }
 
+bool CollisionMesh::ReadCollisions(File& f)
+{
+  SafeDelete(pqpModel);
+  int ntris,nbvs;
+  if(!ReadFile(f,ntris)) return false;
+  if(!ReadFile(f,nbvs)) return false;
+  if(ntris != (int)tris.size()) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"CollisionMesh::ReadCollisions: file has "<<ntris<<" triangles, mesh has "<<tris.size());
+    return false;
+  }
+  if(ntris > 0) {
+    pqpModel = new PQP_Model;
+    if(!ReadFile(f,pqpModel->build_state)) return false;
+    pqpModel->num_tris = pqpModel->num_tris_alloced = ntris;
+    pqpModel->tris = new ::Tri[ntris];
+    if(!f.ReadData(pqpModel->tris,sizeof(::Tri)*ntris)) return false;
+    pqpModel->num_bvs = pqpModel->num_bvs_alloced = nbvs;
+    pqpModel->b = new BV[nbvs];
+    if(!f.ReadData(pqpModel->b,sizeof(BV)*nbvs)) return false;
+  }
+  //vertex neighbors, in compressed row format
+  ClearTopology();
+  int nverts;
+  if(!ReadFile(f,nverts)) return false;
+  if(nverts == 0) return true;
+  if(nverts != (int)verts.size()) return false;
+  vector<int> offsets(nverts+1);
+  if(!ReadArrayFile(f,&offsets[0],nverts+1)) return false;
+  vector<int> adj(offsets.back());
+  if(!adj.empty() && !ReadArrayFile(f,&adj[0],(int)adj.size())) return false;
+  vertexNeighbors.resize(nverts);
+  for(int i=0;i<nverts;i++)
+    vertexNeighbors[i].assign(adj.begin()+offsets[i],adj.begin()+offsets[i+1]);
+  return true;
+}
+
+bool CollisionMesh::WriteCollisions(File& f) const
+{
+  int ntris = (pqpModel ? pqpModel->num_tris : 0);
+  int nbvs = (pqpModel ? pqpModel->num_bvs : 0);
+  if(!WriteFile(f,ntris)) return false;
+  if(!WriteFile(f,nbvs)) return false;
+  if(pqpModel) {
+    if(!WriteFile(f,pqpModel->build_state)) return false;
+    if(!f.WriteData(pqpModel->tris,sizeof(::Tri)*ntris)) return false;
+    if(!f.WriteData(pqpModel->b,sizeof(BV)*nbvs)) return false;
+  }
+  int nverts = (int)vertexNeighbors.size();
+  if(!WriteFile(f,nverts)) return false;
+  if(nverts == 0) return true;
+  vector<int> offsets(nverts+1),adj;
+  offsets[0] = 0;
+  for(int i=0;i<nverts;i++) {
+    adj.insert(adj.end(),vertexNeighbors[i].begin(),vertexNeighbors[i].end());
+    offsets[i+1] = (int)adj.size();
+  }
+  if(!WriteArrayFile(f,&offsets[0],nverts+1)) return false;
+  if(!adj.empty() && !WriteArrayFile(f,&adj[0],(int)adj.size())) return false;
+  return true;
+}
+
 const CollisionMesh& CollisionMesh::operator = (const CollisionMesh& model)
 {
   SafeDelete(pqpModel);
@@ -1446,7 +1511,65 @@ bool Collide(const CollisionMesh& m1,const CollisionMesh& m2)
   return (collide.Colliding()!=0);
 }
 
+//upper bound on the distance from the local origin of m to any point on m,
+//computed from the root OBB
+static Real BoundingRadius(const CollisionMesh& m)
+{
+  const BV& root = m.pqpModel->b[0];
+  Vector3 c,d;
+  Copy(root.To,c);
+  Copy(root.d,d);
+  return c.norm() + d.norm();
+}
+
+//upper bound on the rate of motion of any point on m w.r.t. u, when the
+//transform is interpolated from Ta to Tb
+static Real MotionBound(const CollisionMesh& m,const RigidTransform& Ta,const RigidTransform& Tb)
+{
+  Matrix3 Rrel;
+  Rrel.mulTransposeA(Ta.R,Tb.R);
+  Real theta = Acos(Clamp(Half*(Rrel.trace()-One),-One,One));
+  return Ta.t.distance(Tb.t) + theta*BoundingRadius(m);
+}
 
+Real FirstContactTime(const CollisionMesh& m1,const RigidTransform& T1a,const RigidTransform& T1b,
+		      const CollisionMesh& m2,const RigidTransform& T2a,const RigidTransform& T2b,
+		      Real tol,Real margin,int maxIters)
+{
+  if(m1.tris.empty() || m2.tris.empty()) return -1;
+  if(m1.pqpModel == NULL || m2.pqpModel == NULL) return -1;
+  Assert(tol > 0);
+  Real mu = MotionBound(m1,T1a,T1b) + MotionBound(m2,T2a,T2b);
+  //PQP returns a distance at most absErr above the true distance
+  Real absErr = Half*tol;
+  RigidTransform T1,T2;
+  PQP_REAL R1[3][3],t1[3],R2[3][3],t2[3];
+  PQP_DistanceResult distance;
+  distance.t1 = distance.t2 = 0;
+  Real u = 0;
+  for(int iters=0;iters<maxIters;iters++) {
+    interpolate(T1a,T1b,u,T1);
+    interpolate(T2a,T2b,u,T2);
+    RigidTransformToPQP(T1,R1,t1);
+    RigidTransformToPQP(T2,R2,t2);
+    //the closest pair from the last step gives a good initial bound
+    int res = PQP_Distance(&distance,
+			   R1,t1,m1.pqpModel,
+			   R2,t2,m2.pqpModel,
+			   0,absErr,
+			   2,-1);
+    Assert(res == PQP_OK);
+    Real d = distance.Distance() - margin;
+    if(d <= tol) return u;
+    if(u >= One || mu <= 0) return -1;
+    //no point can travel further than mu*du, so the meshes can't touch
+    //before u+(d-absErr)/mu
+    u += (d-absErr)/mu;
+    if(u > One) u = One;
+  }
+  LOG4CXX_WARN(KrisLibrary::logger(),"FirstContactTime: maximum of "<<maxIters<<" iterations reached at u="<<u);
+  return u;
+}
 
 
 void CollideAll(const CollisionMesh& m,const Sphere3D& s,vector<int>& tris,int max)
@@ -1767,6 +1890,147 @@ int RayCastLocal(const CollisionMesh& mesh,const Ray3D& r,Vector3& pt)
   return callback.closestTri;
 }
 
+//Casts a packet of up to RAY_PACKET_SIZE rays, given in the local frame of
+//the model, down the BV hierarchy together.  A node is expanded if any ray
+//in the packet may hit it before that ray's closest hit so far.
+struct RayPacketCallback
+{
+  RayPacketCallback(const PQP_Model& _mesh)
+    :m(_mesh),n(0)
+  {}
+
+  void Add(const Ray3D& r) {
+    Assert(n < RAY_PACKET_SIZE);
+    rays[n] = r;
+    n++;
+  }
+
+  void Compute() {
+    for(int i=0;i<n;i++) {
+      closestParam[i] = Inf;
+      closestTri[i] = -1;
+    }
+    if(m.num_bvs==0) return;  //empty model
+    Real p[RAY_PACKET_SIZE];
+    if(!Entry(0,p)) return;
+    Recurse(0,p);
+  }
+
+  //computes the entry parameters of each ray into bv b, and returns true
+  //if any ray enters it before its closest hit.  Rays that are inactive in
+  //the parent (entry parameter pparent[i] beyond their closest hit) are
+  //skipped.
+  bool Entry(int b,Real* p,const Real* pparent=NULL) const {
+    bool any = false;
+    for(int i=0;i<n;i++) {
+      if(pparent && !(pparent[i] < closestParam[i])) {
+	p[i] = Inf;
+	continue;
+      }
+      p[i] = BVRayCollision(m.b[b],rays[i]);
+      if(p[i] < closestParam[i]) any = true;
+    }
+    return any;
+  }
+
+  bool Any(const Real* p) const {
+    for(int i=0;i<n;i++)
+      if(p[i] < closestParam[i]) return true;
+    return false;
+  }
+
+  void Recurse(int b,const Real* p)
+  {
+    if(m.b[b].Leaf()) {
+      int t=-m.b[b].first_child-1;
+      Triangle3D tri;
+      Copy(m.tris[t].p1,tri.a);
+      Copy(m.tris[t].p2,tri.b);
+      Copy(m.tris[t].p3,tri.c);
+      Real param,u,v;
+      for(int i=0;i<n;i++) {
+	if(!(p[i] < closestParam[i])) continue;
+	if(tri.rayIntersects(rays[i],&param,&u,&v)) {
+	  if(param < closestParam[i]) {
+	    closestParam[i] = param;
+	    closestPoint[i] = tri.planeCoordsToPoint(Vector2(u,v));
+	    closestTri[i] = m.tris[t].id;
+	  }
+	}
+      }
+    }
+    else {
+      int c1=m.b[b].first_child;
+      int c2=c1+1;
+      Real p1[RAY_PACKET_SIZE],p2[RAY_PACKET_SIZE];
+      bool hit1 = Entry(c1,p1,p);
+      bool hit2 = Entry(c2,p2,p);
+      Real min1=Inf,min2=Inf;
+      for(int i=0;i<n;i++) {
+	min1 = Min(min1,p1[i]);
+	min2 = Min(min2,p2[i]);
+      }
+      //the child hit first by the packet is more likely to shorten the
+      //others' closest hits
+      if(min1 <= min2) {
+	if(hit1) Recurse(c1,p1);
+	if(hit2 && Any(p2)) Recurse(c2,p2);
+      }
+      else {
+	if(hit2) Recurse(c2,p2);
+	if(hit1 && Any(p1)) Recurse(c1,p1);
+      }
+    }
+  }
+
+  const PQP_Model& m;
+  int n;
+  Ray3D rays[RAY_PACKET_SIZE];
+  Real closestParam[RAY_PACKET_SIZE];
+  int closestTri[RAY_PACKET_SIZE];
+  Vector3 closestPoint[RAY_PACKET_SIZE];
+};
+
+void RayCast(const CollisionMesh& mesh,const vector<Ray3D>& rays,vector<Real>& distances,vector<int>& tris,vector<Vector3>& pts,int numThreads)
+{
+  distances.resize(rays.size());
+  tris.resize(rays.size());
+  pts.resize(rays.size());
+  if(mesh.pqpModel == NULL || mesh.tris.empty()) {
+    fill(distances.begin(),distances.end(),Inf);
+    fill(tris.begin(),tris.end(),-1);
+    return;
+  }
+  vector<int> order;
+  CoherentRayOrder(rays,order);
+  int numPackets = ((int)rays.size()+RAY_PACKET_SIZE-1)/RAY_PACKET_SIZE;
+  ParallelFor(numPackets,[&](int packet) {
+      RayPacketCallback callback(*mesh.pqpModel);
+      int start = packet*RAY_PACKET_SIZE;
+      int end = Min(start+RAY_PACKET_SIZE,(int)rays.size());
+      for(int k=start;k<end;k++) {
+	const Ray3D& r = rays[order[k]];
+	Ray3D rLocal;
+	mesh.currentTransform.mulPointInverse(r.source,rLocal.source);
+	mesh.currentTransform.mulVectorInverse(r.direction,rLocal.direction);
+	callback.Add(rLocal);
+      }
+      callback.Compute();
+      for(int k=start;k<end;k++) {
+	int i = order[k];
+	tris[i] = callback.closestTri[k-start];
+	if(tris[i] >= 0) {
+	  pts[i] = mesh.currentTransform*callback.closestPoint[k-start];
+	  distances[i] = pts[i].distance(rays[i].source);
+	}
+	else {
+	  pts[i].setZero();
+	  distances[i] = Inf;
+	}
+      }
+    },numThreads,4);
+}
+
 void GetBB(const CollisionMesh& m,Box3D& bb)
 {
   BVToBox(m.pqpModel->b[0],bb);
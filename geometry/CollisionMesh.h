@@ -7,6 +7,7 @@
 
 class PQP_Model;
 class PQP_Results;
+class File;
 
 namespace Geometry {
 
@@ -33,6 +34,11 @@ class CollisionMesh : public Meshing::TriMeshWithTopology
   ~CollisionMesh();
   const CollisionMesh& operator = (const CollisionMesh& model);
   void InitCollisions();
+  ///Reads / writes the data structures computed by InitCollisions (the PQP
+  ///hierarchy and vertex neighbors) in a native binary format.  The mesh
+  ///verts and tris must already be set before ReadCollisions is called.
+  bool ReadCollisions(File& f);
+  bool WriteCollisions(File& f) const;
   inline void UpdateTransform(const RigidTransform& f) {currentTransform = f;}
   void GetTransform(RigidTransform& f) const {f=currentTransform; }
 
@@ -148,6 +154,14 @@ int RayCast(const CollisionMesh& m,const Ray3D& r,Vector3& pt);
 ///frame of the mesh
 int RayCastLocal(const CollisionMesh& m,const Ray3D& r,Vector3& pt);
 
+///Casts a batch of rays at the mesh.  On return, distances[i] is the
+///distance from rays[i].source to the first hit (Inf if none), tris[i] is
+///the triangle hit (-1 if none), and pts[i] is the hit point.  Rays are
+///sorted into coherent packets that traverse the BV hierarchy together,
+///and packets are split across numThreads threads (0 uses all hardware
+///threads).
+void RayCast(const CollisionMesh& m,const std::vector<Ray3D>& rays,std::vector<Real>& distances,std::vector<int>& tris,std::vector<Vector3>& pts,int numThreads=0);
+
 /// Computes a list of triangles that overlap the geometry
 void CollideAll(const CollisionMesh& m,const Sphere3D& s,std::vector<int>& tris,int max=INT_MAX);
 void CollideAll(const CollisionMesh& m,const Segment3D& s,std::vector<int>& tris,int max=INT_MAX);
@@ -177,6 +191,19 @@ int ClosestPoint(const CollisionMesh& m,const Vector3& p,Vector3& cp);
 /// Convenience function to compute closest points between two meshes
 void ClosestPoints(const CollisionMesh& m1,const CollisionMesh& m2,Real absErr,Real relErr,Vector3& v1,Vector3& v2);
 
+/// Continuous collision check between two moving meshes.  m1 moves from
+/// T1a to T1b and m2 moves from T2a to T2b as u goes from 0 to 1, with
+/// translations interpolated linearly and rotations along the geodesic
+/// (as in Math3D::interpolate).  Uses conservative advancement with PQP
+/// distance queries.  Returns the first u at which the meshes come within
+/// margin+tol of one another, or -1 if they stay separated.  tol must be
+/// positive.  If maxIters is exceeded, the current u is returned as a
+/// conservative contact time.
+/// The meshes' current transforms are not used or modified.
+Real FirstContactTime(const CollisionMesh& m1,const RigidTransform& T1a,const RigidTransform& T1b,
+		      const CollisionMesh& m2,const RigidTransform& T2a,const RigidTransform& T2b,
+		      Real tol=1e-3,Real margin=0,int maxIters=1000);
+
 ///Returns the point on the mesh that minimizes
 ///   pWeight||p-x||^2 + nWeight||n-nx||^2.
 ///The point x is returned in cp, and the triangle index is the return value.
@@ -1,18 +1,23 @@
 #include <log4cxx/logger.h>
 #include <KrisLibrary/Logger.h>
 #include "CollisionPointCloud.h"
+#include "RayBatch.h"
+#include <utils/threadutils.h>
+#include <structs/Heap.h>
 #include <Timer.h>
+#include <myfile.h>
+#include <algorithm>
 
 namespace Geometry {
 
 CollisionPointCloud::CollisionPointCloud()
-  :gridResolution(0),grid(3)
+  :gridResolution(0)
 {
   currentTransform.setIdentity();
 }
 
 CollisionPointCloud::CollisionPointCloud(const Meshing::PointCloud3D& _pc)
-  :Meshing::PointCloud3D(_pc),gridResolution(0),grid(3)
+  :Meshing::PointCloud3D(_pc),gridResolution(0)
 {
   currentTransform.setIdentity();
   InitCollisions();
@@ -27,7 +32,7 @@ CollisionPointCloud::CollisionPointCloud(const CollisionPointCloud& _pc)
 void CollisionPointCloud::InitCollisions()
 {
   bblocal.minimize();
-  grid.buckets.clear();
+  grid.Clear();
   octree = NULL;
   if(points.empty()) 
     return;
@@ -52,31 +57,26 @@ void CollisionPointCloud::InitCollisions()
     }
     res = h;
   }
-  grid.hinv.set(1.0/res);
-  int validptcount = 0;
-  for(size_t i=0;i<points.size();i++) {
-    if(IsFinite(points[i].x)) {
-      Vector p(3,points[i]);
-      GridSubdivision::Index ind;
-      grid.PointToIndex(p,ind);
-      grid.Insert(ind,&points[i]);
-      validptcount++;
-    }
+  if(!(res > 0)) {
+    //degenerate (e.g., planar or single-point) clouds
+    Vector3 dims = bblocal.bmax-bblocal.bmin;
+    res = Max(dims.x,dims.y,dims.z);
+    if(!(res > 0)) res = 1;
   }
+  grid.Build(points,res);
+  int validptcount = (int)grid.pointIndices.size();
   LOG4CXX_INFO(KrisLibrary::logger(),"CollisionPointCloud::InitCollisions: "<<validptcount<<" valid points, res "<<res<<", time "<<timer.ElapsedTime());
   //print stats
   int nmax = 0;
-  for(GridSubdivision::HashTable::const_iterator i=grid.buckets.begin();i!=grid.buckets.end();i++)
-    nmax = Max(nmax,(int)i->second.size());
-  LOG4CXX_INFO(KrisLibrary::logger(),"  "<<grid.buckets.size()<<" nonempty grid buckets, max size "<<nmax<<", avg "<<Real(points.size())/grid.buckets.size());
+  for(size_t k=0;k<grid.NumCells();k++)
+    nmax = Max(nmax,grid.CellSize((int)k));
+  LOG4CXX_INFO(KrisLibrary::logger(),"  "<<grid.NumCells()<<" nonempty grid buckets, max size "<<nmax<<", avg "<<Real(validptcount)/grid.NumCells());
   timer.Reset();
 
-  //initialize the octree, 10 points per cell, res is minimum cell size
+  //initialize the octree, 10 points per cell, res is minimum cell size.
+  //Build sorts the points in bulk and skips non-finite ones.
   octree = make_shared<OctreePointSet>(bblocal,10,res);
-  for(size_t i=0;i<points.size();i++) {
-    if(IsFinite(points[i].x))
-      octree->Add(points[i],(int)i);
-  }
+  octree->Build(points);
   LOG4CXX_INFO(KrisLibrary::logger(),"  octree initialized in time "<<timer.ElapsedTime()<<"s, "<<octree->Size()<<" nodes, depth "<<octree->MaxDepth());
   //TEST: should we fit to points
   octree->FitToPoints();
@@ -93,21 +93,48 @@ void CollisionPointCloud::InitCollisions()
   */
 }
 
-void GetBB(const CollisionPointCloud& pc,Box3D& b)
+bool CollisionPointCloud::ReadCollisions(File& f)
 {
-  b.setTransformed(pc.bblocal,pc.currentTransform);
+  int npoints;
+  if(!ReadFile(f,npoints)) return false;
+  if(npoints != (int)points.size()) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"CollisionPointCloud::ReadCollisions: file has "<<npoints<<" points, cloud has "<<points.size());
+    return false;
+  }
+  if(!bblocal.Read(f)) return false;
+  if(!ReadFile(f,gridResolution)) return false;
+  if(!grid.Read(f)) return false;
+  for(size_t i=0;i<grid.pointIndices.size();i++)
+    if(grid.pointIndices[i] < 0 || grid.pointIndices[i] >= npoints) return false;
+  bool hasOctree;
+  if(!ReadFile(f,hasOctree)) return false;
+  if(!hasOctree) {
+    octree = NULL;
+    return true;
+  }
+  octree = make_shared<OctreePointSet>(bblocal);
+  return octree->Read(f);
 }
 
-static Real gWithinDistanceTestThreshold = 0;
-static GeometricPrimitive3D* gWithinDistanceTestObject = NULL;
-bool withinDistanceTest(void* obj)
+bool CollisionPointCloud::WriteCollisions(File& f) const
 {
-  Point3D* p = reinterpret_cast<Point3D*>(obj);
-  if(gWithinDistanceTestObject->Distance(*p) <= gWithinDistanceTestThreshold)
-    return false;
+  int npoints = (int)points.size();
+  if(!WriteFile(f,npoints)) return false;
+  if(!bblocal.Write(f)) return false;
+  if(!WriteFile(f,gridResolution)) return false;
+  if(!grid.Write(f)) return false;
+  bool hasOctree = (octree != NULL);
+  if(!WriteFile(f,hasOctree)) return false;
+  if(hasOctree)
+    return octree->Write(f);
   return true;
 }
 
+void GetBB(const CollisionPointCloud& pc,Box3D& b)
+{
+  b.setTransformed(pc.bblocal,pc.currentTransform);
+}
+
 bool WithinDistance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,Real tol)
 {
   Box3D bb;
@@ -120,45 +147,19 @@ bool WithinDistance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,
   Tinv.setInverse(pc.currentTransform);
   glocal.Transform(Tinv);
 
-  AABB3D gbb = glocal.GetAABB();  
+  AABB3D gbb = glocal.GetAABB();
+  gbb.bmin -= Vector3(tol);
+  gbb.bmax += Vector3(tol);
   gbb.setIntersection(pc.bblocal);
-
-  //octree overlap method
-  vector<Vector3> points;
-  vector<int> ids;
-  pc.octree->BoxQuery(gbb.bmin-Vector3(tol),gbb.bmax+Vector3(tol),points,ids);
-  for(size_t i=0;i<points.size();i++) 
-    if(glocal.Distance(points[i]) <= tol) return true;
-  return false;
-
-  /*
-  //grid enumeration method
-  GridSubdivision::Index imin,imax;
-  pc.grid.PointToIndex(Vector(3,gbb.bmin),imin);
-  pc.grid.PointToIndex(Vector(3,gbb.bmax),imax);
-  int numCells = (imax[0]-imin[0]+1)*(imax[1]-imin[1]+1)*(imax[2]-imin[2]+1);
-  if(numCells > (int)pc.points.size()) {
-    //test all points, linearly
-    for(size_t i=0;i<pc.points.size();i++)
-      if(glocal.Distance(pc.points[i]) <= tol) return true;
-    return false;
-  }
-  else {
-    gWithinDistanceTestThreshold = tol;
-    gWithinDistanceTestObject = &glocal;
-    bool collisionFree = pc.grid.IndexQuery(imin,imax,withinDistanceTest);
-    return !collisionFree;
-  }
-  */
-}
-
-static Real gDistanceTestValue = 0;
-static GeometricPrimitive3D* gDistanceTestObject = NULL;
-bool distanceTest(void* obj)
-{
-  Point3D* p = reinterpret_cast<Point3D*>(obj);
-  gDistanceTestValue = Min(gDistanceTestValue,gDistanceTestObject->Distance(*p));
-  return true;
+  bool found = false;
+  pc.grid.BoxQuery(gbb.bmin,gbb.bmax,[&](int i) {
+      if(glocal.Distance(pc.points[i]) <= tol) {
+        found = true;
+        return false;
+      }
+      return true;
+    });
+  return found;
 }
 
 Real Distance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g)
@@ -177,62 +178,51 @@ Real Distance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,int& c
   if(!IsInf(upperBound) && glocal.Distance(pc.bblocal) > upperBound) {
     return upperBound;
   }
-  bool doBoundsTest= (g.type != GeometricPrimitive3D::Point && g.type != GeometricPrimitive3D::Sphere && g.type != GeometricPrimitive3D::AABB);
-  if(doBoundsTest) {
-    AABB3D gbb = glocal.GetAABB();
-    Sphere3D sbb;
-    sbb.center = 0.5*(gbb.bmin+gbb.bmax);
-    sbb.radius = sbb.center.distance(gbb.bmin);
-    /*
-    gDistanceTestValue = Inf;
-    gDistanceTestObject = &glocal;
-    pc.grid.BoxQuery(Vector(3,gbb.bmin),Vector(3,gbb.bmax),distanceTest);
-    return gDistanceTestValue;
-    */
-    Real radius0 = sbb.radius;
-    sbb.radius += upperBound;
-    //AABB3D bb0 = gbb;
-    //gbb.bmin -= Vector3(upperBound);
-    //gbb.bmax += Vector3(upperBound);
-    //test all points, linearly
-    Real dmax = upperBound;
-    for(size_t i=0;i<pc.points.size();i++) {
-      if(sbb.contains(pc.points[i])) {
-        Real d = glocal.Distance(pc.points[i]);
+  //distance is 1-Lipschitz, so the distance at a node's bounding box center
+  //minus the box's half-diagonal bounds the distance to any point in it.
+  //Visit octree nodes best-first by this bound and stop when it exceeds the
+  //closest distance.
+  Real dmax = upperBound;
+  if(!pc.octree) {
+    for(size_t i=0;i<pc.grid.pointIndices.size();i++) {
+      int pt = pc.grid.pointIndices[i];
+      Real d = glocal.Distance(pc.points[pt]);
+      if(d < dmax) {
+        closestPoint = pt;
+        dmax = d;
+      }
+    }
+    return dmax;
+  }
+  const OctreePointSet& octree = *pc.octree;
+  Heap<int,Real> heap;
+  const OctreeNode& root = octree.Node(0);
+  Real lb = glocal.Distance((root.bb.bmin+root.bb.bmax)*0.5) - 0.5*root.bb.bmin.distance(root.bb.bmax);
+  //empty (minimized) boxes give NaN bounds and are skipped
+  if(lb < dmax) heap.push(0,-lb);
+  while(!heap.empty()) {
+    if(-heap.topPriority() >= dmax) break;
+    const OctreeNode& n = octree.Node(heap.top());
+    heap.pop();
+    if(octree.IsLeaf(n)) {
+      const vector<int>& pts = octree.PointIndices(octree.Index(n));
+      for(size_t i=0;i<pts.size();i++) {
+        Real d = glocal.Distance(octree.Point(pts[i]));
         if(d < dmax) {
-          closestPoint = (int)i;
+          closestPoint = octree.PointID(pts[i]);
           dmax = d;
-          sbb.radius = radius0 + dmax;
         }
       }
     }
-    return dmax;
-  }
-  else {
-    Real dmax = upperBound;
-    //bounds testing not worth it
-    for(size_t i=0;i<pc.points.size();i++) {
-      Real d = glocal.Distance(pc.points[i]);
-      if(d < dmax) {
-        closestPoint = (int)i;
-        dmax = d;
+    else {
+      for(int c=0;c<8;c++) {
+        const OctreeNode& child = octree.Node(n.childIndices[c]);
+        lb = glocal.Distance((child.bb.bmin+child.bb.bmax)*0.5) - 0.5*child.bb.bmin.distance(child.bb.bmax);
+        if(lb < dmax) heap.push(n.childIndices[c],-lb);
       }
     }
-    return dmax;
   }
-}
-
-static Real gNearbyTestThreshold = 0;
-static GeometricPrimitive3D* gNearbyTestObject = NULL;
-static std::vector<Point3D*> gNearbyTestResults;
-static size_t gNearbyTestBranch = 0;
-bool nearbyTest(void* obj)
-{
-  Point3D* p = reinterpret_cast<Point3D*>(obj);
-  if(gNearbyTestObject->Distance(*p) <= gNearbyTestThreshold)
-    gNearbyTestResults.push_back(p);
-  if(gNearbyTestResults.size() >= gNearbyTestBranch) return false;
-  return true;
+  return dmax;
 }
 
 void NearbyPoints(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,Real tol,std::vector<int>& pointIds,size_t maxContacts)
@@ -248,46 +238,16 @@ void NearbyPoints(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,Re
   glocal.Transform(Tinv);
 
   AABB3D gbb = glocal.GetAABB();
+  gbb.bmin -= Vector3(tol);
+  gbb.bmax += Vector3(tol);
   gbb.setIntersection(pc.bblocal);
-
-  //octree overlap method
-  vector<Vector3> points;
-  vector<int> ids;
-  pc.octree->BoxQuery(gbb.bmin-Vector3(tol),gbb.bmax+Vector3(tol),points,ids);
-  for(size_t i=0;i<points.size();i++) 
-    if(glocal.Distance(points[i]) <= tol) {
-      pointIds.push_back(ids[i]);
-      if(pointIds.size()>=maxContacts) return;
-    }
-  return;
-
-  /*
-  //grid enumeration method
-  GridSubdivision::Index imin,imax;
-  pc.grid.PointToIndex(Vector(3,gbb.bmin),imin);
-  pc.grid.PointToIndex(Vector(3,gbb.bmax),imax);
-  int numCells = (imax[0]-imin[0]+1)*(imax[1]-imin[1]+1)*(imax[2]-imin[2]+1);
-  if(numCells > (int)pc.points.size()) {
-    LOG4CXX_INFO(KrisLibrary::logger(),"Testing all points\n");
-    //test all points, linearly
-    for(size_t i=0;i<pc.points.size();i++)
+  pc.grid.BoxQuery(gbb.bmin,gbb.bmax,[&](int i) {
       if(glocal.Distance(pc.points[i]) <= tol) {
-	pointIds.push_back(int(i));
-	if(pointIds.size()>=maxContacts) return;
+        pointIds.push_back(i);
+        if(pointIds.size()>=maxContacts) return false;
       }
-  }
-  else {
-    LOG4CXX_INFO(KrisLibrary::logger(),"Testing points in BoxQuery\n");
-    gNearbyTestThreshold = tol;
-    gNearbyTestResults.resize(0);
-    gNearbyTestObject = &glocal;
-    gNearbyTestBranch = maxContacts;
-    pc.grid.BoxQuery(Vector(3,gbb.bmin),Vector(3,gbb.bmax),nearbyTest);
-    pointIds.resize(gNearbyTestResults.size());
-    for(size_t i=0;i<points.size();i++)
-      pointIds[i] = gNearbyTestResults[i] - &pc.points[0];
-  }
-  */
+      return true;
+    });
 }
 
 int RayCast(const CollisionPointCloud& pc,Real rad,const Ray3D& r,Vector3& pt)
@@ -302,6 +262,28 @@ int RayCast(const CollisionPointCloud& pc,Real rad,const Ray3D& r,Vector3& pt)
   return res;
 }
 
+void RayCast(const CollisionPointCloud& pc,Real rad,const std::vector<Ray3D>& rays,std::vector<Real>& distances,std::vector<int>& points,std::vector<Vector3>& pts,int numThreads)
+{
+  distances.resize(rays.size());
+  points.resize(rays.size());
+  pts.resize(rays.size());
+  std::vector<int> order;
+  CoherentRayOrder(rays,order);
+  ParallelFor((int)rays.size(),[&](int k) {
+      int i = order[k];
+      points[i] = RayCast(pc,rad,rays[i],pts[i]);
+      if(points[i] >= 0) {
+	Vector3 temp;
+	Real t = rays[i].closestPoint(pts[i],temp);
+	distances[i] = t*rays[i].direction.norm();
+      }
+      else {
+	pts[i].setZero();
+	distances[i] = Inf;
+      }
+    },numThreads,RAY_PACKET_SIZE*8);
+}
+
 int RayCastLocal(const CollisionPointCloud& pc,Real rad,const Ray3D& r,Vector3& pt)
 {
   Real tmin=0,tmax=Inf;
@@ -373,124 +355,50 @@ int RayCastLocal(const CollisionPointCloud& pc,Real rad,const Ray3D& r,Vector3&
   */
 }
 
-inline Real Volume(const AABB3D& bb)
-{
-  Vector3 d = bb.bmax-bb.bmin;
-  return d.x*d.y*d.z;
-}
-
-inline Real Volume(const OctreeNode& n)
-{
-  return Volume(n.bb);
-}
-
-class PointPointCollider
+bool Collides(const CollisionPointCloud& a,const CollisionPointCloud& b,Real margin,std::vector<int>& apoints,std::vector<int>& bpoints,size_t maxContacts)
 {
-public:
-  const CollisionPointCloud& a;
-  const CollisionPointCloud& b;
-  RigidTransform Tba,Twa,Tab;
-  Real margin;
-  size_t maxContacts;
-  vector<int> acollisions,bcollisions;
-  PointPointCollider(const CollisionPointCloud& _a,const CollisionPointCloud& _b,Real _margin)
-    :a(_a),b(_b),margin(_margin),maxContacts(1)
-  {
-    Twa.setInverse(a.currentTransform);
-    Tba.mul(Twa,b.currentTransform);
-    Tab.setInverse(Tba);
-  }
-  bool Recurse(size_t _maxContacts=1)
-  {
-    maxContacts=_maxContacts;
-    _Recurse(0,0);
-    return !acollisions.empty();
-  }
-  bool Prune(const OctreeNode& anode,const OctreeNode& bnode) {
-    Box3D meshbox_pc;
-    meshbox_pc.setTransformed(bnode.bb,Tba);
-    if(margin==0)
-      return !meshbox_pc.intersects(anode.bb);
-    else {
-      AABB3D expanded_bb = anode.bb;
-      expanded_bb.bmin -= Vector3(margin);
-      expanded_bb.bmax += Vector3(margin);
-      return !meshbox_pc.intersects(expanded_bb);
-    }
-  }
-  bool _Recurse(int aindex,int bindex) {
-    const OctreeNode& anode = a.octree->Node(aindex);
-    const OctreeNode& bnode = b.octree->Node(bindex);
-    //returns true to keep recursing
-    if(Prune(anode,bnode))
-      return true;
-    if(a.octree->IsLeaf(anode)) {
-      if(b.octree->IsLeaf(bnode)) {
-        //collide the two points contained within
-        vector<Vector3> apts,bpts;
-        vector<int> aids,bids;
-        a.octree->GetPoints(aindex,apts);
-        b.octree->GetPoints(bindex,bpts);
-        a.octree->GetPointIDs(aindex,aids);
-        b.octree->GetPointIDs(bindex,bids);
-        for(size_t i=0;i<apts.size();i++) {
-          for(size_t j=0;j<bpts.size();j++) {
-            if(apts[i].distanceSquared(bpts[j]) <= Sqr(margin)) {
-              acollisions.push_back(aids[i]);
-              acollisions.push_back(bids[i]);
-              if(acollisions.size() >= maxContacts) return false;
+  apoints.resize(0);
+  bpoints.resize(0);
+  if(maxContacts == 0) return false;
+  //iterate over the cells of b, and test their points against the points
+  //of a in nearby cells
+  RigidTransform Twa,Tba;
+  Twa.setInverse(a.currentTransform);
+  Tba.mul(Twa,b.currentTransform);
+  Real margin2 = Sqr(margin);
+  const PointGrid3D& agrid = a.grid;
+  const PointGrid3D& bgrid = b.grid;
+  AABB3D cellbb;
+  Box3D cellbox;
+  vector<Vector3> bpts_a;
+  for(size_t k=0;k<bgrid.NumCells();k++) {
+    bgrid.CellBounds(bgrid.cells[k],cellbb);
+    cellbox.setTransformed(cellbb,Tba);
+    AABB3D query;
+    cellbox.getAABB(query);
+    query.bmin -= Vector3(margin);
+    query.bmax += Vector3(margin);
+    if(!query.intersects(a.bblocal)) continue;
+    query.setIntersection(a.bblocal);
+    bpts_a.resize(0);
+    for(int j=bgrid.cellStart[k];j<bgrid.cellStart[k+1];j++)
+      bpts_a.push_back(Tba*b.points[bgrid.pointIndices[j]]);
+    bool done = !agrid.CellQuery(query.bmin,query.bmax,[&](int acell) {
+        for(int i=agrid.cellStart[acell];i<agrid.cellStart[acell+1];i++) {
+          const Vector3& pa = a.points[agrid.pointIndices[i]];
+          for(size_t j=0;j<bpts_a.size();j++) {
+            if(pa.distanceSquared(bpts_a[j]) <= margin2) {
+              apoints.push_back(agrid.pointIndices[i]);
+              bpoints.push_back(bgrid.pointIndices[bgrid.cellStart[k]+j]);
+              if(apoints.size() >= maxContacts) return false;
             }
           }
         }
-        //continue
         return true;
-      }
-      else {
-        //split b
-        return _RecurseSplitB(aindex,bindex);
-      }
-    }
-    else {
-      if(b.octree->IsLeaf(bnode)) {
-        //split a
-        return _RecurseSplitA(aindex,bindex);
-      }
-      else {
-        //determine which BVH to split
-        Real va = Volume(anode);
-        Real vb = Volume(bnode);
-        if(va < vb)
-          return _RecurseSplitB(aindex,bindex);
-        else
-          return _RecurseSplitA(aindex,bindex);
-      }
-    }
-  }
-  bool _RecurseSplitA(int aindex,int bindex) {
-    const OctreeNode& anode = a.octree->Node(aindex);
-    for(int i=0;i<8;i++)
-      if(!_Recurse(anode.childIndices[i],bindex)) return false;
-    return true;
-  }
-  bool _RecurseSplitB(int aindex,int bindex) {
-    const OctreeNode& bnode = b.octree->Node(bindex);
-    for(int i=0;i<8;i++)
-      if(!_Recurse(aindex,bnode.childIndices[i])) return false;
-    return true;
-  }
-};
-
-
-bool Collides(const CollisionPointCloud& a,const CollisionPointCloud& b,Real margin,std::vector<int>& apoints,std::vector<int>& bpoints,size_t maxContacts)
-{
-  PointPointCollider collider(a,b,margin);
-  bool res=collider.Recurse(maxContacts);
-  if(res) {
-    apoints=collider.acollisions;
-    bpoints=collider.bcollisions;
-    return true;
+      });
+    if(done) break;
   }
-  return false;
+  return !apoints.empty();
 }
 
 } //namespace Geometry
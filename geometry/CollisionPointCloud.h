@@ -5,7 +5,7 @@
 #include <KrisLibrary/math3d/geometry3d.h>
 #include <memory>
 #include <limits>
-#include "GridSubdivision.h"
+#include "PointGrid.h"
 #include "Octree.h"
 
 namespace Geometry {
@@ -24,13 +24,18 @@ class CollisionPointCloud : public Meshing::PointCloud3D
   ///called during initialization, and needs to be called any time the point
   ///cloud changes
   void InitCollisions();
+  ///Reads / writes the data structures computed by InitCollisions (bounding
+  ///box, grid, and octree) in a native binary format.  The points must
+  ///already be set before ReadCollisions is called.
+  bool ReadCollisions(File& f);
+  bool WriteCollisions(File& f) const;
 
   ///The local bounding box of the point cloud
   AABB3D bblocal;
   ///The transformation of the point cloud in space 
   RigidTransform currentTransform;
   Real gridResolution; ///< default value is 0, which auto-determines from point cloud
-  GridSubdivision grid;
+  PointGrid3D grid;
   shared_ptr<OctreePointSet> octree;
 };
 
@@ -41,9 +46,11 @@ void GetBB(const CollisionPointCloud& pc,Box3D& b);
 ///primitive g. O(min(n,c)) running time, where c is the number of grid
 ///cells within distance tol of the bounding box of g.
 bool WithinDistance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,Real tol);
-///Returns the nearest distance from any point in pc to g.  O(n) running time.
+///Returns the nearest distance from any point in pc to g.  Grid cells are
+///visited in order of a lower bound on their distance, so usually only the
+///points in a few cells are tested.
 Real Distance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g);
-///Returns the nearest distance from any point in pc to g.  O(n) running time.  Saves the closest
+///Returns the nearest distance from any point in pc to g.  Saves the closest
 ///point index into closestPoint, and if upperBound is given, then if no point is closer than upperBound,
 ///this may return upperBound as the return value and closestPoint=-1.
 Real Distance(const CollisionPointCloud& pc,const GeometricPrimitive3D& g,int& closestPoint,Real upperBound=Inf);
@@ -66,6 +73,13 @@ int RayCast(const CollisionPointCloud& pc,Real rad,const Ray3D& r,Vector3& pt);
 ///frame of the point cloud
 int RayCastLocal(const CollisionPointCloud& pc,Real rad,const Ray3D& r,Vector3& pt);
 
+///Casts a batch of rays at the point cloud.  On return, distances[i] is the
+///distance along rays[i] to the first point hit (Inf if none), points[i] is
+///its index (-1 if none), and pts[i] is the point.  Rays are processed in a
+///coherent order split across numThreads threads (0 uses all hardware
+///threads).
+void RayCast(const CollisionPointCloud& pc,Real rad,const std::vector<Ray3D>& rays,std::vector<Real>& distances,std::vector<int>& points,std::vector<Vector3>& pts,int numThreads=0);
+
 } //namespace Geometry
 
 #endif
@@ -4,16 +4,25 @@
 #include "CollisionMesh.h"
 #include <KrisLibrary/GLdraw/GeometryAppearance.h>
 #include <KrisLibrary/meshing/VolumeGrid.h>
+#include <KrisLibrary/meshing/SparseVolumeGrid.h>
 #include <KrisLibrary/meshing/PointCloud.h>
 #include <KrisLibrary/meshing/MeshPrimitives.h>
 #include <KrisLibrary/meshing/MarchingCubes.h>
 #include <KrisLibrary/meshing/Voxelize.h>
 #include <KrisLibrary/math3d/random.h>
 #include <KrisLibrary/math3d/basis.h>
+#include <KrisLibrary/utils/threadutils.h>
+#include <KrisLibrary/math/SparseMatrixTemplate.h>
+#include <KrisLibrary/math/conjgrad.h>
+#include "KDTree.h"
+#include "Fitting.h"
+#include <algorithm>
 
 namespace Geometry {
 	
-void SubdivideAdd(const Triangle3D& t,Meshing::PointCloud3D& pc,Real maxDispersion2)
+//Adds the midpoints of the edges of t to pts until each triangle is covered
+//by balls of radius sqrt(maxDispersion2) around its vertices
+static void SubdivideAdd(const Triangle3D& t,vector<Vector3>& pts,Real maxDispersion2)
 {
 	Vector3 c = (t.a+t.b+t.c)/3.0;
 	if(c.distanceSquared(t.a) > maxDispersion2 || c.distanceSquared(t.b) > maxDispersion2 || c.distanceSquared(t.c) > maxDispersion2) {
@@ -24,7 +33,7 @@ void SubdivideAdd(const Triangle3D& t,Meshing::PointCloud3D& pc,Real maxDispersi
 		Real maxLen = bc;
 		if(ab > maxLen) {
 			maxEdge = 2;
-			maxLen = bc;
+			maxLen = ab;
 		}
 		if(ca > maxLen) {
 			maxEdge = 1;
@@ -32,7 +41,7 @@ void SubdivideAdd(const Triangle3D& t,Meshing::PointCloud3D& pc,Real maxDispersi
 		}
 		Segment3D s = t.edge(maxEdge);
 		Vector3 center = (s.a+s.b)*0.5;
-		pc.points.push_back(center);
+		pts.push_back(center);
 		Triangle3D tc1,tc2;
 		tc1.a = center;
 		tc1.b = t.vertex(maxEdge);
@@ -40,29 +49,63 @@ void SubdivideAdd(const Triangle3D& t,Meshing::PointCloud3D& pc,Real maxDispersi
 		tc2.a = center;
 		tc2.b = s.b;
 		tc2.c = t.vertex(maxEdge);
-		SubdivideAdd(tc1,pc,maxDispersion2);
-		SubdivideAdd(tc2,pc,maxDispersion2);
+		SubdivideAdd(tc1,pts,maxDispersion2);
+		SubdivideAdd(tc2,pts,maxDispersion2);
 	}
 }
 
-void MeshToPointCloud(const Meshing::TriMesh& mesh,Meshing::PointCloud3D& pc,Real maxDispersion,bool wantNormals)
+//number of triangles subdivided per parallel task
+static const int kSubdivideBlockSize = 1024;
+
+void MeshToPointCloud(const Meshing::TriMesh& mesh,Meshing::PointCloud3D& pc,Real maxDispersion,bool wantNormals,int numThreads)
 {
-	if(wantNormals) FatalError("Sampling normals not done yet");
 	pc.Clear();
 	pc.points = mesh.verts;
-	if(IsInf(maxDispersion)) return;
-
-	Real maxDispersion2 = Sqr(maxDispersion);
-	for(size_t i=0;i<mesh.tris.size();i++) {
-		Triangle3D t;
-		mesh.GetTriangle(i,t);
-		SubdivideAdd(t,pc,maxDispersion2);
+	vector<Vector3> normals;
+	if(wantNormals) {
+		//area-weighted vertex normals
+		normals.resize(mesh.verts.size(),Vector3(Zero));
+		for(size_t i=0;i<mesh.tris.size();i++) {
+			const IntTriple& t = mesh.tris[i];
+			Vector3 n = cross(mesh.verts[t.b]-mesh.verts[t.a],mesh.verts[t.c]-mesh.verts[t.a]);
+			normals[t.a] += n;
+			normals[t.b] += n;
+			normals[t.c] += n;
+		}
+		for(size_t i=0;i<normals.size();i++) {
+			Real len = normals[i].norm();
+			if(len > 0) normals[i] /= len;
+		}
 	}
+	if(!IsInf(maxDispersion)) {
+		//subdivide blocks of triangles in parallel, then concatenate the
+		//blocks in order so the result doesn't depend on the number of threads
+		Real maxDispersion2 = Sqr(maxDispersion);
+		int numBlocks = ((int)mesh.tris.size()+kSubdivideBlockSize-1)/kSubdivideBlockSize;
+		vector<vector<Vector3> > blockPts(numBlocks),blockNormals(numBlocks);
+		ParallelFor(numBlocks,[&](int b) {
+				int end = Min((b+1)*kSubdivideBlockSize,(int)mesh.tris.size());
+				for(int i=b*kSubdivideBlockSize;i<end;i++) {
+					Triangle3D t;
+					mesh.GetTriangle(i,t);
+					SubdivideAdd(t,blockPts[b],maxDispersion2);
+					if(wantNormals)
+						blockNormals[b].resize(blockPts[b].size(),mesh.TriangleNormal(i));
+				}
+			},numThreads);
+		for(int b=0;b<numBlocks;b++) {
+			pc.points.insert(pc.points.end(),blockPts[b].begin(),blockPts[b].end());
+			if(wantNormals)
+				normals.insert(normals.end(),blockNormals[b].begin(),blockNormals[b].end());
+		}
+	}
+	if(wantNormals) pc.SetNormals(normals);
 }
 
-void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,GLDraw::GeometryAppearance& appearance,Real depthDiscontinuity)
+void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,GLDraw::GeometryAppearance& appearance,Real depthDiscontinuity,int numThreads)
 {
-	PointCloudToMesh(pc,mesh,depthDiscontinuity);
+	PointCloudToMesh(pc,mesh,depthDiscontinuity,numThreads);
+	if(!pc.IsStructured()) return;
 	vector<Vector4> colors;
 	if(pc.GetColors(colors)) {
 		appearance.vertexColors.resize(colors.size());
@@ -75,64 +118,76 @@ void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,GLD
 	}
 }
 
-void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,Real depthDiscontinuity)
+void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,Real depthDiscontinuity,int numThreads)
 {
 	if(!pc.IsStructured()) {
-				LOG4CXX_ERROR(KrisLibrary::logger(),"PointCloudToMesh: TODO: convert unstructured point clouds to meshes\n");
+		PointCloudToMesh_Poisson(pc,mesh,0,numThreads);
 		return;
 	}
 	mesh.verts = pc.points;
-	mesh.tris.reserve(pc.points.size()*2);
-	mesh.tris.resize(0);
 	int w = pc.GetStructuredWidth();
 	int h = pc.GetStructuredHeight();
-	int k=0;
-	for(int i=0;i<h;i++) {
-		for(int j=0;j<w;j++,k++) {
-			if(i+1 ==h || j+1 == w) continue;
-			int v11=k;
-			int v12=k+1;
-			int v21=k+w;
-			int v22=k+w+1;
-			const Vector3& p11=pc.points[v11];
-			const Vector3& p12=pc.points[v12];
-			const Vector3& p21=pc.points[v21];
-			const Vector3& p22=pc.points[v22];
-			//TODO: use origin / viewport
-			Real z11 = p11.z;
-			Real z12 = p12.z;
-			Real z21 = p21.z;
-			Real z22 = p22.z;
-			bool d1x = (Abs(z11 - z12) > depthDiscontinuity*Abs(z11+z12)) || (z11 == 0 || z12 == 0 || IsNaN(z11) || IsNaN(z12));
-			bool d1y = (Abs(z11 - z21) > depthDiscontinuity*Abs(z11+z21)) || (z11 == 0 || z21 == 0 || IsNaN(z11) || IsNaN(z21));
-			bool d2x = (Abs(z22 - z21) > depthDiscontinuity*Abs(z22+z21)) || (z22 == 0 || z21 == 0 || IsNaN(z22) || IsNaN(z12));
-			bool d2y = (Abs(z22 - z12) > depthDiscontinuity*Abs(z22+z12)) || (z22 == 0 || z12 == 0 || IsNaN(z22) || IsNaN(z21));
-			bool dupperleft = (d1x || d1y);
-			bool dupperright = (d1x || d2y);
-			bool dlowerleft = (d2x || d1y);
-			bool dlowerright = (d2x || d2y);
-
-
-			if(dupperleft && !dlowerright) 
-			  //only draw lower right corner
-			  mesh.tris.push_back(IntTriple(v12,v21,v22));
-			else if(!dupperleft && dlowerright) 
-			  //only draw upper left corner
-			  mesh.tris.push_back(IntTriple(v11,v21,v12));
-			else if(!dupperright && dlowerleft) 
-			  //only draw upper right corner
-			  mesh.tris.push_back(IntTriple(v11,v22,v12));
-			else if(dupperright && !dlowerleft) 
-			  //only draw lower left corner
-			  mesh.tris.push_back(IntTriple(v11,v21,v22));
-			else if (!dupperleft && !dlowerright) {
-			  //fully connected -- should draw better conditioned edge, but whatever
-			  mesh.tris.push_back(IntTriple(v12,v21,v22));
-			  mesh.tris.push_back(IntTriple(v11,v21,v12));
-			}
-
-		}
+	if(w < 2 || h < 2) {
+		mesh.tris.resize(0);
+		return;
 	}
+	//each row of quads fills its own slots, 2 per quad, and unused slots are
+	//removed afterwards so the result doesn't depend on the number of threads
+	const IntTriple empty(-1,-1,-1);
+	int rowSlots = 2*(w-1);
+	mesh.tris.resize(size_t(h-1)*rowSlots);
+	ParallelFor(h-1,[&](int i) {
+			IntTriple* slots = &mesh.tris[size_t(i)*rowSlots];
+			for(int j=0;j+1<w;j++) {
+				int k = i*w+j;
+				int v11=k;
+				int v12=k+1;
+				int v21=k+w;
+				int v22=k+w+1;
+				const Vector3& p11=pc.points[v11];
+				const Vector3& p12=pc.points[v12];
+				const Vector3& p21=pc.points[v21];
+				const Vector3& p22=pc.points[v22];
+				//TODO: use origin / viewport
+				Real z11 = p11.z;
+				Real z12 = p12.z;
+				Real z21 = p21.z;
+				Real z22 = p22.z;
+				bool d1x = (Abs(z11 - z12) > depthDiscontinuity*Abs(z11+z12)) || (z11 == 0 || z12 == 0 || IsNaN(z11) || IsNaN(z12));
+				bool d1y = (Abs(z11 - z21) > depthDiscontinuity*Abs(z11+z21)) || (z11 == 0 || z21 == 0 || IsNaN(z11) || IsNaN(z21));
+				bool d2x = (Abs(z22 - z21) > depthDiscontinuity*Abs(z22+z21)) || (z22 == 0 || z21 == 0 || IsNaN(z22) || IsNaN(z21));
+				bool d2y = (Abs(z22 - z12) > depthDiscontinuity*Abs(z22+z12)) || (z22 == 0 || z12 == 0 || IsNaN(z22) || IsNaN(z12));
+				bool dupperleft = (d1x || d1y);
+				bool dupperright = (d1x || d2y);
+				bool dlowerleft = (d2x || d1y);
+				bool dlowerright = (d2x || d2y);
+
+				IntTriple& t1 = slots[2*j];
+				IntTriple& t2 = slots[2*j+1];
+				t1 = t2 = empty;
+				if(dupperleft && !dlowerright) 
+				  //only draw lower right corner
+				  t1.set(v12,v21,v22);
+				else if(!dupperleft && dlowerright) 
+				  //only draw upper left corner
+				  t1.set(v11,v21,v12);
+				else if(!dupperright && dlowerleft) 
+				  //only draw upper right corner
+				  t1.set(v11,v22,v12);
+				else if(dupperright && !dlowerleft) 
+				  //only draw lower left corner
+				  t1.set(v11,v21,v22);
+				else if (!dupperleft && !dlowerright) {
+				  //fully connected -- should draw better conditioned edge, but whatever
+				  t1.set(v12,v21,v22);
+				  t2.set(v11,v21,v12);
+				}
+			}
+		},numThreads,16);
+	size_t n=0;
+	for(size_t i=0;i<mesh.tris.size();i++)
+		if(mesh.tris[i].a >= 0) mesh.tris[n++] = mesh.tris[i];
+	mesh.tris.resize(n);
 }
 
 void PrimitiveToMesh(const GeometricPrimitive3D& primitive,Meshing::TriMesh& mesh,int numDivs)
@@ -140,20 +195,28 @@ void PrimitiveToMesh(const GeometricPrimitive3D& primitive,Meshing::TriMesh& mes
 	Meshing::MakeTriMesh(primitive,mesh,numDivs);
 }
 
-void FitGridToBB(const AABB3D& bb,Meshing::VolumeGrid& grid,Real resolution,Real expansion=0.5)
+//Computes the bounds and number of cells of a grid covering bb with cells of
+//the given resolution
+void FitGridToBB(const AABB3D& bb,AABB3D& gridbb,int& m,int& n,int& p,Real resolution,Real expansion=0.5)
 {
 	Vector3 size=bb.bmax-bb.bmin;
 	size += expansion*2*resolution;
-	int m = (int)Ceil(size.x/resolution)+2;
-	int n = (int)Ceil(size.y/resolution)+2;
-	int p = (int)Ceil(size.z/resolution)+2;
+	m = (int)Ceil(size.x/resolution)+2;
+	n = (int)Ceil(size.y/resolution)+2;
+	p = (int)Ceil(size.z/resolution)+2;
 	
 	Vector3 center = (bb.bmax+bb.bmin)*0.5;
 	size.x = m*resolution;
 	size.y = n*resolution;
 	size.z = p*resolution;
-	grid.bb.bmin = center - 0.5*size;
-	grid.bb.bmax = center + 0.5*size;
+	gridbb.bmin = center - 0.5*size;
+	gridbb.bmax = center + 0.5*size;
+}
+
+void FitGridToBB(const AABB3D& bb,Meshing::VolumeGrid& grid,Real resolution,Real expansion=0.5)
+{
+	int m,n,p;
+	FitGridToBB(bb,grid.bb,m,n,p,resolution,expansion);
 	if(m*n*p > 100000000) {
 				LOG4CXX_ERROR(KrisLibrary::logger(),"FitGridToBB: Warning, creating a volume grid of resolution "<<resolution<<" will create "<<m*n*p);
 				LOG4CXX_ERROR(KrisLibrary::logger(),"  Press enter to continue\n");
@@ -177,6 +240,43 @@ void PrimitiveToImplicitSurface(const GeometricPrimitive3D& primitive,Meshing::V
 	}
 }
 
+void PrimitiveToImplicitSurface(const GeometricPrimitive3D& primitive,Meshing::SparseVolumeGrid& grid,Real resolution,Real band,Real expansion)
+{
+	AABB3D aabb = primitive.GetAABB();
+	int m,n,p;
+	FitGridToBB(aabb,grid.bb,m,n,p,resolution);
+	grid.Resize(m,n,p);
+	grid.background = band;
+	//the distance is 1-Lipschitz, so a block is outside the band if its
+	//center is farther than band plus the block's half-diagonal
+	IntTriple b,imin,imax;
+	AABB3D cmin,cmax;
+	Vector3 c;
+	for(b.a=0;b.a*8<m;b.a++) {
+		for(b.b=0;b.b*8<n;b.b++) {
+			for(b.c=0;b.c*8<p;b.c++) {
+				grid.GetBlockRange(b,imin,imax);
+				grid.GetCell(imin,cmin);
+				grid.GetCell(imax,cmax);
+				Real r = 0.5*cmin.bmin.distance(cmax.bmax);
+				Real d = primitive.Distance((cmin.bmin+cmax.bmax)*0.5)-expansion;
+				if(d - r > band) continue;
+				int k = grid.MakeBlock(b);
+				if(d + r < -band) {
+					grid.blocks[k].tileValue = -band;
+					continue;
+				}
+				for(int i=imin.a;i<=imax.a;i++)
+					for(int j=imin.b;j<=imax.b;j++)
+						for(int l=imin.c;l<=imax.c;l++) {
+							grid.GetCellCenter(i,j,l,c);
+							grid.SetValue(i,j,l,primitive.Distance(c)-expansion);
+						}
+			}
+		}
+	}
+}
+
 void Extrema(const AABB3D& bb,const Vector3& dir,Real& a,Real& b)
 {
 	Vector3 p,q;
@@ -347,6 +447,223 @@ void MeshToImplicitSurface_FMM(const CollisionMesh& mesh,Meshing::VolumeGrid& gr
 	Meshing::FastMarchingMethod_Fill(mesh,grid.value,gradient,grid.bb,surfaceCells);
 }
 
+void MeshToImplicitSurface_FMM(const CollisionMesh& mesh,Meshing::SparseVolumeGrid& grid,Real resolution,Real band)
+{
+	MeshToImplicitSurface_NarrowBand(mesh,grid,resolution,band);
+}
+
+//Propagates closest triangles through the grid plane by plane along axis,
+//forward then backward.  A cell takes the triangle of one of its 9 neighbors
+//in the previous plane if it's closer than the cell's own.  Cells in a plane
+//only read the previous plane, so each plane is done in parallel.
+static void SweepClosestTriangles(const CollisionMesh& mesh,Meshing::VolumeGrid& grid,Array3D<int>& closestTri,int axis,int numThreads)
+{
+	int dims[3]={grid.value.m,grid.value.n,grid.value.p};
+	int a1=(axis+1)%3, a2=(axis+2)%3;
+	int len = dims[axis];
+	for(int step=1;step>=-1;step-=2) {
+		for(int s=(step>0?1:len-2);s>=0 && s<len;s+=step) {
+			ParallelFor(dims[a1],[&](int u) {
+				int idx[3],nidx[3];
+				Vector3 c;
+				Triangle3D tri;
+				idx[axis] = s;
+				idx[a1] = u;
+				nidx[axis] = s-step;
+				for(int v=0;v<dims[a2];v++) {
+					idx[a2] = v;
+					int& tcur = closestTri(idx[0],idx[1],idx[2]);
+					Real& dcur = grid.value(idx[0],idx[1],idx[2]);
+					bool haveCenter = false;
+					for(int nu=Max(u-1,0);nu<=Min(u+1,dims[a1]-1);nu++) {
+						nidx[a1] = nu;
+						for(int nv=Max(v-1,0);nv<=Min(v+1,dims[a2]-1);nv++) {
+							nidx[a2] = nv;
+							int t = closestTri(nidx[0],nidx[1],nidx[2]);
+							if(t < 0 || t == tcur) continue;
+							if(!haveCenter) {
+								grid.GetCellCenter(idx[0],idx[1],idx[2],c);
+								haveCenter = true;
+							}
+							mesh.GetTriangle(t,tri);
+							Real d = tri.closestPoint(c).distance(c);
+							if(d < dcur) {
+								dcur = d;
+								tcur = t;
+							}
+						}
+					}
+				}
+			},numThreads);
+		}
+	}
+}
+
+void MeshToImplicitSurface_NarrowBand(const CollisionMesh& mesh,Meshing::VolumeGrid& grid,Real resolution,int numThreads)
+{
+	if(mesh.tris.empty()) {
+		LOG4CXX_ERROR(KrisLibrary::logger(),"MeshToImplicitSurface_NarrowBand: mesh is empty");
+		return;
+	}
+	AABB3D aabb;
+	mesh.GetAABB(aabb.bmin,aabb.bmax);
+	FitGridToBB(aabb,grid,resolution);
+	int m=grid.value.m,n=grid.value.n,p=grid.value.p;
+	grid.value.set(Inf);
+	Array3D<int> closestTri(m,n,p);
+	closestTri.set(-1);
+
+	//the band is the surface cells dilated by one cell
+	BitArray3D surface(m,n,p);
+	Meshing::SurfaceOccupancyGrid(mesh,surface,grid.bb,numThreads);
+	int rowWords = surface.rowWords;
+	vector<vector<IntTriple> > slabCells(m);
+	ParallelFor(m,[&](int i) {
+		vector<uint64_t> r(rowWords);
+		for(int j=0;j<n;j++) {
+			std::fill(r.begin(),r.end(),0);
+			for(int di=Max(i-1,0);di<=Min(i+1,m-1);di++)
+				for(int dj=Max(j-1,0);dj<=Min(j+1,n-1);dj++) {
+					const uint64_t* row = surface.row(di,dj);
+					for(int w=0;w<rowWords;w++) r[w] |= row[w];
+				}
+			for(int w=0;w<rowWords;w++) {
+				uint64_t d = r[w] | (r[w]<<1) | (r[w]>>1);
+				if(w > 0) d |= r[w-1]>>63;
+				if(w+1 < rowWords) d |= r[w+1]<<63;
+				for(int b=0;d!=0;b++,d>>=1) {
+					if(!(d&1)) continue;
+					int k = w*64+b;
+					if(k < p) slabCells[i].push_back(IntTriple(i,j,k));
+				}
+			}
+		}
+	},numThreads);
+	vector<IntTriple> band;
+	for(int i=0;i<m;i++)
+		band.insert(band.end(),slabCells[i].begin(),slabCells[i].end());
+	slabCells.clear();
+
+	//exact distances in the band, using the PQP hierarchy.  ClosestPoint
+	//works in world coordinates and the grid is in local coordinates.
+	ParallelFor((int)band.size(),[&](int b) {
+		const IntTriple& c=band[b];
+		Vector3 x,xworld,cp;
+		grid.GetCellCenter(c.a,c.b,c.c,x);
+		xworld = mesh.currentTransform*x;
+		int t = ClosestPoint(mesh,xworld,cp);
+		grid.value(c.a,c.b,c.c) = cp.distance(x);
+		closestTri(c.a,c.b,c.c) = t;
+	},numThreads,64);
+
+	//fast sweeping of the closest triangles to the rest of the grid
+	for(int axis=0;axis<3;axis++)
+		SweepClosestTriangles(mesh,grid,closestTri,axis,numThreads);
+
+	//sign by the parity of crossings along z
+	BitArray3D inside(m,n,p);
+	Meshing::VolumeOccupancyGrid_Scanline(mesh,inside,grid.bb,numThreads);
+	ParallelFor(m,[&](int i) {
+		for(int j=0;j<n;j++)
+			for(int k=0;k<p;k++)
+				if(inside.get(i,j,k)) grid.value(i,j,k) = -grid.value(i,j,k);
+	},numThreads);
+}
+
+void MeshToImplicitSurface_NarrowBand(const CollisionMesh& mesh,Meshing::SparseVolumeGrid& grid,Real resolution,Real band,int numThreads)
+{
+	Assert(band >= 0);
+	grid.Clear();
+	if(mesh.tris.empty()) {
+		LOG4CXX_ERROR(KrisLibrary::logger(),"MeshToImplicitSurface_NarrowBand: mesh is empty");
+		return;
+	}
+	AABB3D aabb;
+	mesh.GetAABB(aabb.bmin,aabb.bmax);
+	int m,n,p;
+	FitGridToBB(aabb,grid.bb,m,n,p,resolution);
+	grid.Resize(m,n,p);
+	grid.background = band;
+
+	//blocks that the surface touches
+	Meshing::SparseVolumeGrid surface;
+	surface.bb = grid.bb;
+	surface.Resize(m,n,p);
+	Meshing::SurfaceOccupancyGrid(mesh,surface,numThreads);
+	//any cell within band of the surface is within this many blocks of a
+	//surface block
+	Vector3 h = grid.GetCellSize();
+	int bandCells = (int)Ceil(band/Min(h.x,h.y,h.z))+1;
+	int dilation = (bandCells+7)/8;
+	IntTriple nb((m+7)/8,(n+7)/8,(p+7)/8);
+	vector<IntTriple> candidates;
+	for(size_t i=0;i<surface.blocks.size();i++) {
+		const IntTriple& b = surface.blocks[i].index;
+		IntTriple c;
+		for(c.a=Max(b.a-dilation,0);c.a<=Min(b.a+dilation,nb.a-1);c.a++)
+			for(c.b=Max(b.b-dilation,0);c.b<=Min(b.b+dilation,nb.b-1);c.b++)
+				for(c.c=Max(b.c-dilation,0);c.c<=Min(b.c+dilation,nb.c-1);c.c++)
+					candidates.push_back(c);
+	}
+	surface.Clear();
+	sort(candidates.begin(),candidates.end());
+	candidates.erase(unique(candidates.begin(),candidates.end()),candidates.end());
+
+	//sign by the parity of crossings along z, 1 bit per cell
+	BitArray3D inside(m,n,p);
+	Meshing::VolumeOccupancyGrid_Scanline(mesh,inside,grid.bb,numThreads);
+
+	//exact distances in the candidate blocks, using the PQP hierarchy.
+	//ClosestPoint works in world coordinates and the grid is in local
+	//coordinates.
+	vector<vector<Real> > blockValues(candidates.size());
+	vector<char> blockInBand(candidates.size(),0),blockInside(candidates.size(),1);
+	ParallelFor((int)candidates.size(),[&](int c) {
+		IntTriple imin,imax;
+		grid.GetBlockRange(candidates[c],imin,imax);
+		vector<Real>& vals = blockValues[c];
+		vals.assign(512,band);
+		Vector3 x,xworld,cp;
+		for(int i=imin.a;i<=imax.a;i++)
+			for(int j=imin.b;j<=imax.b;j++)
+				for(int k=imin.c;k<=imax.c;k++) {
+					grid.GetCellCenter(i,j,k,x);
+					xworld = mesh.currentTransform*x;
+					ClosestPoint(mesh,xworld,cp);
+					Real d = cp.distance(x);
+					if(inside.get(i,j,k)) d = -d;
+					vals[((i&7)*8+(j&7))*8+(k&7)] = d;
+					if(d >= -band) {
+						blockInside[c] = 0;
+						if(d <= band) blockInBand[c] = 1;
+					}
+				}
+		if(!blockInBand[c]) vector<Real>().swap(vals);
+	},numThreads);
+	for(size_t c=0;c<candidates.size();c++) {
+		if(blockInBand[c]) {
+			int bi = grid.MakeBlock(candidates[c]);
+			grid.MakeBlockFull(bi);
+			std::copy(blockValues[c].begin(),blockValues[c].end(),grid.values.begin()+grid.blocks[bi].offset);
+			vector<Real>().swap(blockValues[c]);
+		}
+		else if(blockInside[c])
+			grid.blocks[grid.MakeBlock(candidates[c])].tileValue = -band;
+	}
+
+	//the other blocks don't touch the surface, so they're entirely inside or
+	//outside
+	IntTriple b,imin,imax;
+	for(b.a=0;b.a<nb.a;b.a++)
+		for(b.b=0;b.b<nb.b;b.b++)
+			for(b.c=0;b.c<nb.c;b.c++) {
+				if(binary_search(candidates.begin(),candidates.end(),b)) continue;
+				grid.GetBlockRange(b,imin,imax);
+				if(inside.get(imin.a,imin.b,imin.c))
+					grid.blocks[grid.MakeBlock(b)].tileValue = -band;
+			}
+}
+
 void MeshToImplicitSurface_SpaceCarving(const CollisionMesh& mesh,Meshing::VolumeGrid& grid,Real resolution,int numViews)
 {
 	AABB3D aabb;
@@ -453,4 +770,261 @@ void ImplicitSurfaceToMesh(const Meshing::VolumeGrid& grid,Meshing::TriMesh& mes
     MarchingCubes(grid.value,0,center_bb,mesh);
 }
 
+void ImplicitSurfaceToMesh(const Meshing::SparseVolumeGrid& grid,Meshing::TriMesh& mesh)
+{
+	MarchingCubes(grid,0,mesh);
+}
+
+//cells of padding around the points in which the indicator function is solved
+static const int kPoissonBand = 4;
+//weight of the screening term
+static const Real kPoissonScreening = 4;
+//triangles farther than this many cells from every point are trimmed
+static const Real kPoissonTrimDistance = 2;
+static const int kPoissonNormalNeighbors = 10;
+static const int kPoissonMaxIters = 1000;
+static const Real kPoissonTolerance = 1e-6;
+
+//Computes y = A*x on numThreads threads
+struct ParallelSparseMatrix
+{
+	const Math::SparseMatrixTemplate_CR<Real>& A;
+	int numThreads;
+	ParallelSparseMatrix(const Math::SparseMatrixTemplate_CR<Real>& _A,int _numThreads) : A(_A),numThreads(_numThreads) {}
+	void mul(const Math::Vector& x,Math::Vector& y) const {
+		y.resize(A.m);
+		ParallelFor(A.m,[&](int i) { y(i) = A.dotRow(i,x); },numThreads,4096);
+	}
+};
+
+//Returns the index of cell (i,j,k) in grid.values, or -1 if it's not in a
+//full block or outside of the grid
+static int FullCellIndex(const Meshing::SparseVolumeGrid& grid,int i,int j,int k)
+{
+	if(i < 0 || j < 0 || k < 0 || i >= grid.m || j >= grid.n || k >= grid.p) return -1;
+	int b = grid.FindBlock(Meshing::SparseVolumeGrid::BlockIndex(i,j,k));
+	if(b < 0 || grid.blocks[b].offset < 0) return -1;
+	return grid.blocks[b].offset + ((((i&7)<<3)|(j&7))<<3 | (k&7));
+}
+
+void PointCloudToMesh_Poisson(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,Real resolution,int numThreads)
+{
+	mesh.verts.resize(0);
+	mesh.tris.resize(0);
+	const vector<Vector3>& pts = pc.points;
+	int N = (int)pts.size();
+	if(N < 3) {
+		LOG4CXX_WARN(KrisLibrary::logger(),"PointCloudToMesh_Poisson: need at least 3 points");
+		return;
+	}
+	vector<Real> coords(size_t(N)*3);
+	for(int i=0;i<N;i++)
+		pts[i].get(coords[i*3],coords[i*3+1],coords[i*3+2]);
+	FlatKDTree tree;
+	tree.Build(&coords[0],N,3,8,numThreads);
+	if(resolution <= 0) {
+		vector<Real> nndist(N);
+		ParallelFor(N,[&](int i) {
+				Real dist[2];
+				int idx[2];
+				tree.KClosestPoints(&coords[size_t(i)*3],2,dist,idx);
+				nndist[i] = dist[1];
+			},numThreads,256);
+		Real sum = 0;
+		for(int i=0;i<N;i++) sum += nndist[i];
+		resolution = 2*sum/N;
+		if(!(resolution > 0)) {
+			LOG4CXX_WARN(KrisLibrary::logger(),"PointCloudToMesh_Poisson: points are all coincident");
+			return;
+		}
+	}
+
+	//get oriented normals
+	vector<Vector3> normals;
+	if(pc.GetNormals(normals)) {
+		for(int i=0;i<N;i++) {
+			Real len = normals[i].norm();
+			if(len > 0) normals[i] /= len;
+		}
+	}
+	else {
+		EstimateNormals(pts,tree,kPoissonNormalNeighbors,normals,numThreads);
+		string viewport;
+		if(pc.settings.get("viewport",viewport)) {
+			Vector3 origin = pc.GetOrigin();
+			for(int i=0;i<N;i++)
+				if(dot(normals[i],origin-pts[i]) < 0) normals[i].inplaceNegative();
+		}
+		else
+			OrientNormals(pts,tree,kPoissonNormalNeighbors,normals);
+	}
+
+	//store full blocks covering the band around the points
+	AABB3D bb;
+	bb.minimize();
+	for(int i=0;i<N;i++) bb.expand(pts[i]);
+	Meshing::SparseVolumeGrid grid;
+	int m,n,p;
+	FitGridToBB(bb,grid.bb,m,n,p,resolution,kPoissonBand);
+	grid.Resize(m,n,p);
+	grid.background = 0;
+	vector<IntTriple> cells(N);
+	for(int i=0;i<N;i++) {
+		grid.GetIndex(pts[i],cells[i]);
+		IntTriple bmin = Meshing::SparseVolumeGrid::BlockIndex(Max(cells[i].a-kPoissonBand,0),Max(cells[i].b-kPoissonBand,0),Max(cells[i].c-kPoissonBand,0));
+		IntTriple bmax = Meshing::SparseVolumeGrid::BlockIndex(Min(cells[i].a+kPoissonBand,m-1),Min(cells[i].b+kPoissonBand,n-1),Min(cells[i].c+kPoissonBand,p-1));
+		IntTriple b;
+		for(b.a=bmin.a;b.a<=bmax.a;b.a++)
+			for(b.b=bmin.b;b.b<=bmax.b;b.b++)
+				for(b.c=bmin.c;b.c<=bmax.c;b.c++) {
+					int k = grid.MakeBlock(b);
+					if(grid.blocks[k].offset < 0) grid.MakeBlockFull(k);
+				}
+	}
+	//the unknowns are the values of the full blocks; values of cells outside
+	//of the grid are fixed at 0
+	int U = (int)grid.values.size();
+	vector<IntTriple> unknownCells(U);
+	vector<char> inGrid(U,0);
+	for(size_t b=0;b<grid.blocks.size();b++) {
+		const Meshing::SparseVolumeGrid::Block& block = grid.blocks[b];
+		for(int l=0;l<512;l++) {
+			IntTriple c(block.index.a*8+(l>>6),block.index.b*8+((l>>3)&7),block.index.c*8+(l&7));
+			unknownCells[block.offset+l] = c;
+			inGrid[block.offset+l] = (c.a < m && c.b < n && c.c < p);
+		}
+	}
+
+	//splat the normals and sample weights onto the cell centers, scaled by
+	//the surface area per point (in cells) so the indicator function jumps
+	//by about 1 across the surface
+	int numOccupied = 0;
+	{
+		vector<char> occupied(U,0);
+		for(int i=0;i<N;i++) {
+			int idx = FullCellIndex(grid,cells[i].a,cells[i].b,cells[i].c);
+			if(idx >= 0 && !occupied[idx]) { occupied[idx] = 1; numOccupied++; }
+		}
+	}
+	Real areaScale = Real(numOccupied)/N;
+	vector<Vector3> V(U,Vector3(Zero));
+	vector<Real> W(U,0.0);
+	for(int i=0;i<N;i++) {
+		Vector3 u = (pts[i]-grid.bb.bmin)/resolution;
+		int i0 = (int)Floor(u.x-0.5), j0 = (int)Floor(u.y-0.5), k0 = (int)Floor(u.z-0.5);
+		Real fx = u.x-0.5-i0, fy = u.y-0.5-j0, fz = u.z-0.5-k0;
+		for(int v=0;v<8;v++) {
+			int di=v>>2, dj=(v>>1)&1, dk=v&1;
+			int idx = FullCellIndex(grid,i0+di,j0+dj,k0+dk);
+			if(idx < 0) continue;
+			Real w = (di ? fx : 1-fx)*(dj ? fy : 1-fy)*(dk ? fz : 1-fz)*areaScale;
+			V[idx].madd(normals[i],w);
+			W[idx] += w;
+		}
+	}
+
+	//assemble (L + alpha W) x = -div V, where L is the negated 7-point
+	//Laplacian with zero-flux boundaries at the edges of the band
+	static const int offsets[6][3] = {{-1,0,0},{1,0,0},{0,-1,0},{0,1,0},{0,0,-1},{0,0,1}};
+	vector<int> nbrs(size_t(U)*6);
+	ParallelFor(U,[&](int r) {
+			const IntTriple& c = unknownCells[r];
+			for(int d=0;d<6;d++)
+				nbrs[size_t(r)*6+d] = (inGrid[r] ? FullCellIndex(grid,c.a+offsets[d][0],c.b+offsets[d][1],c.c+offsets[d][2]) : -1);
+		},numThreads,4096);
+	Math::SparseMatrixTemplate_CR<Real> A;
+	int nnz = 0;
+	for(int r=0;r<U;r++) {
+		nnz++;
+		for(int d=0;d<6;d++)
+			if(nbrs[size_t(r)*6+d] >= 0) nnz++;
+	}
+	A.initialize(U,U,nnz);
+	Math::Vector b(U),x(U,Zero);
+	Math::JacobiPreconditioner<Math::SparseMatrixTemplate_CR<Real> > P;
+	P.diagInv.resize(U);
+	P.isSet = true;
+	int k = 0;
+	for(int r=0;r<U;r++) {
+		A.row_offsets[r] = k;
+		if(!inGrid[r]) {
+			A.col_indices[k] = r;
+			A.val_array[k] = 1;
+			k++;
+			b(r) = 0;
+			P.diagInv(r) = 1;
+			continue;
+		}
+		//columns in increasing order: the -x,-y,-z neighbors have lower
+		//indices within a block but not necessarily across blocks, so
+		//insertion sort the (at most 7) entries
+		pair<int,Real> entries[7];
+		int num = 0;
+		int numNbrs = 0;
+		Real div = 0;
+		for(int d=0;d<6;d++) {
+			int nb = nbrs[size_t(r)*6+d];
+			if(nb < 0) continue;
+			entries[num++] = pair<int,Real>(nb,-1.0);
+			numNbrs++;
+			//central difference of V
+			int axis = d/2;
+			Real sign = (d%2 == 0 ? -0.5 : 0.5);
+			div += sign*V[nb][axis];
+		}
+		Real diag = numNbrs + kPoissonScreening*W[r];
+		entries[num++] = pair<int,Real>(r,diag);
+		for(int e=1;e<num;e++) {
+			pair<int,Real> x = entries[e];
+			int f = e;
+			for(;f > 0 && entries[f-1].first > x.first;f--)
+				entries[f] = entries[f-1];
+			entries[f] = x;
+		}
+		for(int e=0;e<num;e++) {
+			A.col_indices[k] = entries[e].first;
+			A.val_array[k] = entries[e].second;
+			k++;
+		}
+		b(r) = -div;
+		P.diagInv(r) = (diag > 0 ? 1.0/diag : 1.0);
+	}
+	A.row_offsets[U] = k;
+	Assert(k == nnz);
+
+	int maxIters = kPoissonMaxIters;
+	Real tol = kPoissonTolerance;
+	ParallelSparseMatrix Ap(A,numThreads);
+	if(Math::CG(Ap,x,b,P,maxIters,tol) != 0)
+		LOG4CXX_WARN(KrisLibrary::logger(),"PointCloudToMesh_Poisson: conjugate gradient didn't converge, residual "<<tol);
+
+	//extract the level set at the average value at the points
+	for(int r=0;r<U;r++) grid.values[r] = x(r);
+	Real isoValue = 0;
+	for(int i=0;i<N;i++) isoValue += grid.TrilinearInterpolate(pts[i]);
+	isoValue /= N;
+	for(int r=0;r<U;r++) grid.values[r] -= isoValue;
+	grid.background = -isoValue;
+	Meshing::TriMesh raw;
+	MarchingCubes(grid,0,raw);
+
+	//trim triangles far from the points
+	Real trimDistance = kPoissonTrimDistance*resolution;
+	vector<char> nearVert(raw.verts.size());
+	ParallelFor((int)raw.verts.size(),[&](int v) {
+			Real q[3],d;
+			raw.verts[v].get(q[0],q[1],q[2]);
+			tree.ClosestPoint(q,d);
+			nearVert[v] = (d <= trimDistance);
+		},numThreads,256);
+	//the marching cubes vertices are shared, so the trimmed mesh stays welded
+	mesh.verts.swap(raw.verts);
+	for(size_t t=0;t<raw.tris.size();t++) {
+		const IntTriple& tri = raw.tris[t];
+		if(nearVert[tri.a] && nearVert[tri.b] && nearVert[tri.c])
+			mesh.tris.push_back(tri);
+	}
+	mesh.RemoveUnusedVerts();
+}
+
 } //namespace Geometry
\ No newline at end of file
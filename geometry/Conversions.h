@@ -7,6 +7,10 @@ namespace GLDraw {
 	class GeometryAppearance;
 };
 
+namespace Meshing {
+	class SparseVolumeGrid;
+};
+
 /** @file geometry/Conversions.h
  * @ingroup Geometry
  * @brief 3D geometry conversion routines.
@@ -18,21 +22,50 @@ namespace Geometry {
 /** @ingroup Geometry
  * @brief Places points on the vertices of a mesh. 
  * If any triangle has vertices farther away than maxDispersion, the triangle is subdivided until
- * all triangles are covered by balls of radius maxDispersion.
+ * all triangles are covered by balls of radius maxDispersion.  Triangles are subdivided on
+ * numThreads threads (0 uses all hardware threads), and the result doesn't depend on the number
+ * of threads.  If wantNormals is true, the points get normal properties: area-weighted vertex
+ * normals at the vertices and triangle normals at the subdivision points.
  */
-void MeshToPointCloud(const Meshing::TriMesh& mesh,Meshing::PointCloud3D& pc,Real maxDispersion=Inf,bool wantNormals=false);
+void MeshToPointCloud(const Meshing::TriMesh& mesh,Meshing::PointCloud3D& pc,Real maxDispersion=Inf,bool wantNormals=false,int numThreads=0);
 
 /** @ingroup Geometry
  * @brief If a point cloud is structured, this creates a uniform mesh out of it.  If depthDiscontinuity
  * is provided, the mesh is split at the points where the relative depth of adjacent points is greater than
  * depthDiscontinuity * average depth.  (A decent value is 0.02 for typical depth sensors.)
+ * Rows are meshed on numThreads threads.
+ *
+ * Unstructured point clouds are reconstructed with PointCloudToMesh_Poisson at the default resolution.
  */
-void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,Real depthDiscontinuity=Inf);
+void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,Real depthDiscontinuity=Inf,int numThreads=0);
 
 /** @ingroup Geometry
- * @brief Same as normal PointCloudToMesh, but colors and UV coordinates are extracted
+ * @brief Same as normal PointCloudToMesh, but colors and UV coordinates are extracted.  (Only for
+ * structured point clouds, since the vertices of reconstructed meshes aren't the points.)
  */
-void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,GLDraw::GeometryAppearance& appearance,Real depthDiscontinuity=Inf);
+void PointCloudToMesh(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,GLDraw::GeometryAppearance& appearance,Real depthDiscontinuity=Inf,int numThreads=0);
+
+/** @ingroup Geometry
+ * @brief Reconstructs a surface from an unstructured point cloud by screened Poisson
+ * reconstruction (Kazhdan and Hoppe 2013).
+ *
+ * The indicator function of the interior is solved for on a grid of cells of size resolution
+ * (if 0, twice the average distance between neighboring points), stored in a SparseVolumeGrid
+ * that covers a narrow band of blocks around the points.  The point normals, splatted onto the
+ * grid, give the gradient of the indicator function, and the indicator function is screened
+ * toward its iso-value at the points.  The sparse system is solved by preconditioned conjugate
+ * gradient with matrix-vector products on numThreads threads, and the surface is extracted by
+ * marching cubes, which gives a welded mesh that is closed where the points sample a closed
+ * surface.  Triangles farther than 2 cells from every point are trimmed, so unsampled
+ * regions are left open.
+ *
+ * If the point cloud has no normals they're estimated from the nearest neighbors and oriented
+ * toward the viewport origin, if the cloud has one, or otherwise consistently with their neighbors,
+ * starting from upward normals at the top (see OrientNormals in Fitting.h).
+ *
+ * Not thread-safe (Math::CG uses static storage).
+ */
+void PointCloudToMesh_Poisson(const Meshing::PointCloud3D& pc,Meshing::TriMesh& mesh,Real resolution=0,int numThreads=0);
 
 /** @ingroup Geometry
  * @brief Creates a mesh for a geometric primitive.  If the primitive has curved surfaces, they
@@ -46,6 +79,13 @@ void PrimitiveToMesh(const GeometricPrimitive3D& primitive,Meshing::TriMesh& mes
  */
 void PrimitiveToImplicitSurface(const GeometricPrimitive3D& primitive,Meshing::VolumeGrid& grid,Real resolution,Real expansion=0);
 
+/** @ingroup Geometry
+ * @brief Same as above, but only stores the blocks of a sparse grid that
+ * are within band of the surface.  Deep interior blocks become tiles of
+ * -band and the background is band.
+ */
+void PrimitiveToImplicitSurface(const GeometricPrimitive3D& primitive,Meshing::SparseVolumeGrid& grid,Real resolution,Real band,Real expansion=0);
+
 /** @ingroup Geometry
  * @brief Creates an implicit surface for a mesh using a Fast Marching Method.
  *
@@ -54,6 +94,39 @@ void PrimitiveToImplicitSurface(const GeometricPrimitive3D& primitive,Meshing::V
  */
 void MeshToImplicitSurface_FMM(const CollisionMesh& mesh,Meshing::VolumeGrid& grid,Real resolution);
 
+/** @ingroup Geometry
+ * @brief Same as above, but keeps only a band of the given width around the
+ * surface in a sparse grid.  The fast marching method needs a dense grid, so
+ * this uses the sparse MeshToImplicitSurface_NarrowBand instead, which
+ * never allocates one.
+ */
+void MeshToImplicitSurface_FMM(const CollisionMesh& mesh,Meshing::SparseVolumeGrid& grid,Real resolution,Real band);
+
+/** @ingroup Geometry
+ * @brief Creates a signed distance field for a closed mesh.
+ *
+ * Distances to the closest triangle are computed exactly, using the PQP
+ * hierarchy, for the cells within one cell of the surface.  The closest
+ * triangles are then propagated to the rest of the grid by fast sweeping,
+ * and the sign is determined by ray parity.  Each stage runs on numThreads
+ * threads (0 uses all hardware threads).
+ *
+ * Note: the mesh's current transform is NOT taken into account (i.e., the resulting grid
+ * is in local coordinates)
+ */
+void MeshToImplicitSurface_NarrowBand(const CollisionMesh& mesh,Meshing::VolumeGrid& grid,Real resolution,int numThreads=0);
+
+/** @ingroup Geometry
+ * @brief Same as above, but keeps only a band of the given width around the
+ * surface in a sparse grid, which is written directly.
+ *
+ * Exact distances are computed for the blocks within band of the blocks
+ * that the surface touches.  Blocks with no value within band are dropped,
+ * or become tiles of -band if they're inside.  The only dense structure is
+ * the 1 bit per cell inside/outside grid.
+ */
+void MeshToImplicitSurface_NarrowBand(const CollisionMesh& mesh,Meshing::SparseVolumeGrid& grid,Real resolution,Real band,int numThreads=0);
+
 /** @ingroup Geometry
  * @brief Creates an implicit surface for a mesh using a space-carving technique.
  * The grid has resolution no less than resolution on each axis.  numViews views
@@ -73,6 +146,12 @@ void MeshToImplicitSurface_SpaceCarving(const CollisionMesh& mesh,Meshing::Volum
  */
 void ImplicitSurfaceToMesh(const Meshing::VolumeGrid& grid,Meshing::TriMesh& mesh);
 
+/** @ingroup Geometry
+ * @brief Creates a mesh from a sparse implicit surface via Marching Cubes.  Vertices on grid
+ * edges shared between cubes and blocks are emitted once, so the mesh is welded.
+ */
+void ImplicitSurfaceToMesh(const Meshing::SparseVolumeGrid& grid,Meshing::TriMesh& mesh);
+
 
 } //namespace Geometry
 
@@ -0,0 +1,319 @@
+#include <log4cxx/logger.h>
+#include <KrisLibrary/Logger.h>
+#include "ConvexDecomposition.h"
+#include <KrisLibrary/meshing/Voxelize.h>
+#include <KrisLibrary/structs/array3d.h>
+#include <KrisLibrary/utils/threadutils.h>
+#include <limits.h>
+#include <map>
+using namespace Geometry;
+using namespace std;
+
+//weight of the volume imbalance of the halves in the cost of a cut
+static const Real kBalanceWeight = 0.05;
+
+ConvexDecompositionSettings::ConvexDecompositionSettings()
+  :resolution(50),maxConcavity(0.01),maxDepth(10),maxHulls(32),planeSamples(16),numThreads(0)
+{}
+
+Real Geometry::MeshVolume(const Meshing::TriMesh& mesh)
+{
+  Real vol = 0;
+  for(size_t i=0;i<mesh.tris.size();i++) {
+    const IntTriple& t = mesh.tris[i];
+    vol += dot(mesh.verts[t.a],cross(mesh.verts[t.b],mesh.verts[t.c]));
+  }
+  return vol/6;
+}
+
+struct DecompositionVoxels
+{
+  AABB3D bb;
+  Real h;
+  vector<IntTriple> cells;
+};
+
+struct DecompositionPart
+{
+  vector<int> voxels;
+  IntTriple imin,imax;
+  int depth;
+  Real hullVolume;
+};
+
+//Appends to pts the corners of the voxels that can be vertices of the hull
+//of the voxels: the outer corners of the first and last voxel of each row
+//along x.  Voxels between them are in the hull of these corners.  Only the
+//voxels of part for which in(voxel) is true are used.
+template <class Pred>
+static void HullCandidates(const DecompositionVoxels& grid,const DecompositionPart& part,Pred in,vector<Vector3>& pts)
+{
+  int nj = part.imax.b-part.imin.b+1, nk = part.imax.c-part.imin.c+1;
+  vector<int> lo(nj*nk,INT_MAX),hi(nj*nk,INT_MIN);
+  for(size_t v=0;v<part.voxels.size();v++) {
+    const IntTriple& c = grid.cells[part.voxels[v]];
+    if(!in(c)) continue;
+    int row = (c.b-part.imin.b)*nk + (c.c-part.imin.c);
+    lo[row] = Min(lo[row],c.a);
+    hi[row] = Max(hi[row],c.a);
+  }
+  pts.resize(0);
+  for(int j=0;j<nj;j++) {
+    for(int k=0;k<nk;k++) {
+      int row = j*nk+k;
+      if(lo[row] > hi[row]) continue;
+      for(int dj=0;dj<2;dj++)
+        for(int dk=0;dk<2;dk++) {
+          Real y = grid.bb.bmin.y + (part.imin.b+j+dj)*grid.h;
+          Real z = grid.bb.bmin.z + (part.imin.c+k+dk)*grid.h;
+          pts.push_back(Vector3(grid.bb.bmin.x+lo[row]*grid.h,y,z));
+          pts.push_back(Vector3(grid.bb.bmin.x+(hi[row]+1)*grid.h,y,z));
+        }
+    }
+  }
+}
+
+static Real HullVolume(const vector<Vector3>& pts)
+{
+  Meshing::TriMesh hull;
+  if(!ConvexHull3D_QuickHull(pts,hull,0,1)) return 0;
+  return MeshVolume(hull);
+}
+
+static void SetBounds(const DecompositionVoxels& grid,DecompositionPart& part)
+{
+  part.imin.set(INT_MAX,INT_MAX,INT_MAX);
+  part.imax.set(INT_MIN,INT_MIN,INT_MIN);
+  for(size_t v=0;v<part.voxels.size();v++) {
+    const IntTriple& c = grid.cells[part.voxels[v]];
+    for(int k=0;k<3;k++) {
+      part.imin[k] = Min(part.imin[k],c[k]);
+      part.imax[k] = Max(part.imax[k],c[k]);
+    }
+  }
+}
+
+//A candidate cut of a part: voxels with index[axis] < value go to the first
+//half
+struct DecompositionCut
+{
+  int part,axis,value;
+  Real cost;
+  Real hullVolume[2];
+  int count[2];
+};
+
+static void EvaluateCut(const DecompositionVoxels& grid,const DecompositionPart& part,Real totalVolume,DecompositionCut& cut)
+{
+  Real cellVolume = grid.h*grid.h*grid.h;
+  vector<Vector3> pts;
+  cut.cost = 0;
+  for(int side=0;side<2;side++) {
+    int n=0;
+    HullCandidates(grid,part,[&](const IntTriple& c) {
+        bool in = ((c[cut.axis] < cut.value) == (side == 0));
+        if(in) n++;
+        return in;
+      },pts);
+    cut.count[side] = n;
+    cut.hullVolume[side] = HullVolume(pts);
+    cut.cost += (cut.hullVolume[side] - n*cellVolume)/totalVolume;
+  }
+  cut.cost += kBalanceWeight*Abs(Real(cut.count[0]-cut.count[1]))*cellVolume/totalVolume;
+}
+
+//Splits the voxels of the mesh recursively
+static void SplitParts(const DecompositionVoxels& grid,Real totalVolume,const ConvexDecompositionSettings& settings,vector<DecompositionPart>& done)
+{
+  Real cellVolume = grid.h*grid.h*grid.h;
+  vector<DecompositionPart> level(1),next;
+  DecompositionPart& root = level[0];
+  root.voxels.resize(grid.cells.size());
+  for(size_t i=0;i<grid.cells.size();i++) root.voxels[i] = (int)i;
+  root.depth = 0;
+  SetBounds(grid,root);
+  vector<Vector3> pts;
+  HullCandidates(grid,root,[](const IntTriple&) { return true; },pts);
+  root.hullVolume = HullVolume(pts);
+
+  vector<DecompositionCut> cuts;
+  while(!level.empty()) {
+    //parts that are convex enough are done, the others get candidate cuts
+    cuts.resize(0);
+    for(size_t i=0;i<level.size();i++) {
+      DecompositionPart& part = level[i];
+      Real concavity = (part.hullVolume - part.voxels.size()*cellVolume)/totalVolume;
+      if(concavity <= settings.maxConcavity || part.depth >= settings.maxDepth || part.voxels.size() < 2) {
+        done.push_back(DecompositionPart());
+        swap(done.back(),part);
+        continue;
+      }
+      for(int axis=0;axis<3;axis++) {
+        int lo = part.imin[axis], hi = part.imax[axis];
+        int last = lo;
+        for(int s=0;s<settings.planeSamples;s++) {
+          DecompositionCut cut;
+          cut.part = (int)i;
+          cut.axis = axis;
+          cut.value = lo + (int)((long long)(hi-lo+1)*(s+1)/(settings.planeSamples+1));
+          if(cut.value <= last || cut.value > hi) continue;
+          last = cut.value;
+          cuts.push_back(cut);
+        }
+      }
+    }
+    ParallelFor((int)cuts.size(),[&](int c) {
+        EvaluateCut(grid,level[cuts[c].part],totalVolume,cuts[c]);
+      },settings.numThreads);
+    //split each part at its cheapest cut
+    vector<int> best(level.size(),-1);
+    for(size_t c=0;c<cuts.size();c++) {
+      int& b = best[cuts[c].part];
+      if(b < 0 || cuts[c].cost < cuts[b].cost) b = (int)c;
+    }
+    next.resize(0);
+    for(size_t i=0;i<level.size();i++) {
+      if(level[i].voxels.empty()) continue;
+      if(best[i] < 0) {
+        //parts one voxel thick on every axis can't be cut
+        done.push_back(DecompositionPart());
+        swap(done.back(),level[i]);
+        continue;
+      }
+      const DecompositionCut& cut = cuts[best[i]];
+      DecompositionPart halves[2];
+      for(size_t v=0;v<level[i].voxels.size();v++) {
+        int side = (grid.cells[level[i].voxels[v]][cut.axis] < cut.value ? 0 : 1);
+        halves[side].voxels.push_back(level[i].voxels[v]);
+      }
+      for(int side=0;side<2;side++) {
+        if(halves[side].voxels.empty()) continue;
+        halves[side].depth = level[i].depth+1;
+        halves[side].hullVolume = cut.hullVolume[side];
+        SetBounds(grid,halves[side]);
+        next.push_back(DecompositionPart());
+        swap(next.back(),halves[side]);
+      }
+    }
+    swap(level,next);
+  }
+}
+
+//Returns true if the voxel bounds of a and b touch
+static bool PartsAdjacent(const DecompositionPart& a,const DecompositionPart& b)
+{
+  for(int k=0;k<3;k++)
+    if(a.imax[k]+1 < b.imin[k] || b.imax[k]+1 < a.imin[k]) return false;
+  return true;
+}
+
+//Merges the pairs of hulls whose merged hull adds the least volume while
+//there are more than maxHulls or the added volume is at most maxCost.  Only
+//pairs of adjacent parts are considered unless the remaining parts are all
+//separated.
+static void MergeHulls(vector<DecompositionPart>& parts,vector<ConvexHull3D>& hulls,vector<Real>& volumes,int maxHulls,Real maxCost,int numThreads)
+{
+  int n = (int)hulls.size();
+  vector<bool> alive(n,true);
+  int numAlive = n;
+  map<pair<int,int>,Real> costs;
+  vector<pair<int,int> > pending;
+  for(int i=0;i<n;i++)
+    for(int j=i+1;j<n;j++)
+      if(PartsAdjacent(parts[i],parts[j])) pending.push_back(pair<int,int>(i,j));
+  while(numAlive > 1) {
+    if(costs.empty() && pending.empty()) {
+      if(numAlive <= maxHulls) break;
+      for(int i=0;i<n;i++)
+        for(int j=i+1;j<n;j++)
+          if(alive[i] && alive[j]) pending.push_back(pair<int,int>(i,j));
+    }
+    vector<Real> pendingCosts(pending.size());
+    ParallelFor((int)pending.size(),[&](int k) {
+        const ConvexHull3D& a = hulls[pending[k].first];
+        const ConvexHull3D& b = hulls[pending[k].second];
+        vector<Vector3> pts(a.points);
+        pts.insert(pts.end(),b.points.begin(),b.points.end());
+        pendingCosts[k] = HullVolume(pts) - volumes[pending[k].first] - volumes[pending[k].second];
+      },numThreads);
+    for(size_t k=0;k<pending.size();k++)
+      costs[pending[k]] = pendingCosts[k];
+    pending.resize(0);
+    map<pair<int,int>,Real>::iterator best = costs.begin();
+    for(map<pair<int,int>,Real>::iterator it=costs.begin();it!=costs.end();it++)
+      if(it->second < best->second) best = it;
+    if(numAlive <= maxHulls && best->second > maxCost) break;
+    int i = best->first.first, j = best->first.second;
+    //merge j into i
+    vector<Vector3> pts(hulls[i].points);
+    pts.insert(pts.end(),hulls[j].points.begin(),hulls[j].points.end());
+    hulls[i].Set(pts,1);
+    Meshing::TriMesh mesh;
+    hulls[i].GetMesh(mesh);
+    volumes[i] = MeshVolume(mesh);
+    for(int k=0;k<3;k++) {
+      parts[i].imin[k] = Min(parts[i].imin[k],parts[j].imin[k]);
+      parts[i].imax[k] = Max(parts[i].imax[k],parts[j].imax[k]);
+    }
+    alive[j] = false;
+    numAlive--;
+    for(map<pair<int,int>,Real>::iterator it=costs.begin();it!=costs.end();) {
+      if(it->first.first == i || it->first.second == i || it->first.first == j || it->first.second == j)
+        costs.erase(it++);
+      else
+        ++it;
+    }
+    for(int k=0;k<n;k++)
+      if(k != i && alive[k] && PartsAdjacent(parts[i],parts[k]))
+        pending.push_back(pair<int,int>(Min(i,k),Max(i,k)));
+  }
+  int m=0;
+  for(int i=0;i<n;i++)
+    if(alive[i]) swap(hulls[m++],hulls[i]);
+  hulls.resize(m);
+}
+
+bool Geometry::ConvexDecomposition(const Meshing::TriMesh& mesh,vector<ConvexHull3D>& hulls,const ConvexDecompositionSettings& settings)
+{
+  hulls.resize(0);
+  if(mesh.tris.empty()) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"ConvexDecomposition: mesh is empty");
+    return false;
+  }
+  //voxelize with cubic cells and a border of empty cells
+  DecompositionVoxels grid;
+  AABB3D mbb;
+  mesh.GetAABB(mbb.bmin,mbb.bmax);
+  Vector3 size = mbb.bmax-mbb.bmin;
+  grid.h = Max(size.x,Max(size.y,size.z))/Max(settings.resolution,1);
+  if(grid.h <= 0) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"ConvexDecomposition: mesh is degenerate");
+    return false;
+  }
+  int m = (int)Ceil(size.x/grid.h)+2, n = (int)Ceil(size.y/grid.h)+2, p = (int)Ceil(size.z/grid.h)+2;
+  Vector3 center = (mbb.bmin+mbb.bmax)*0.5;
+  grid.bb.bmin = center - 0.5*grid.h*Vector3(m,n,p);
+  grid.bb.bmax = center + 0.5*grid.h*Vector3(m,n,p);
+  Array3D<bool> surface(m,n,p),interior(m,n,p);
+  Meshing::SurfaceOccupancyGrid(mesh,surface,grid.bb,settings.numThreads);
+  Meshing::VolumeOccupancyGrid_Scanline(mesh,interior,grid.bb,settings.numThreads);
+  for(int i=0;i<m;i++)
+    for(int j=0;j<n;j++)
+      for(int k=0;k<p;k++)
+        if(surface(i,j,k) || interior(i,j,k)) grid.cells.push_back(IntTriple(i,j,k));
+  Real totalVolume = grid.cells.size()*grid.h*grid.h*grid.h;
+
+  vector<DecompositionPart> parts;
+  SplitParts(grid,totalVolume,settings,parts);
+
+  hulls.resize(parts.size());
+  vector<Real> volumes(parts.size());
+  ParallelFor((int)parts.size(),[&](int i) {
+      vector<Vector3> pts;
+      HullCandidates(grid,parts[i],[](const IntTriple&) { return true; },pts);
+      hulls[i].Set(pts,1);
+      volumes[i] = parts[i].hullVolume;
+    },settings.numThreads);
+  MergeHulls(parts,hulls,volumes,Max(settings.maxHulls,1),settings.maxConcavity*totalVolume,settings.numThreads);
+  return true;
+}
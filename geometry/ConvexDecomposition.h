@@ -0,0 +1,68 @@
+#ifndef GEOMETRY_CONVEX_DECOMPOSITION_H
+#define GEOMETRY_CONVEX_DECOMPOSITION_H
+
+#include "ConvexHull3D.h"
+#include <vector>
+
+/** @file geometry/ConvexDecomposition.h
+ * @ingroup Geometry
+ * @brief Approximate convex decomposition of triangle meshes.
+ */
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+/** @addtogroup Geometry */
+/*@{*/
+
+/** @brief Settings for ConvexDecomposition.
+ *
+ * - resolution: number of voxels along the longest side of the mesh's
+ *   bounding box.
+ * - maxConcavity: parts whose concavity (the volume of their hull outside
+ *   of their voxels, relative to the volume of the mesh) is below this are
+ *   not split.
+ * - maxDepth: maximum number of times a part is split, so there are at most
+ *   2^maxDepth parts before merging.
+ * - maxHulls: parts are merged, cheapest first, until there are at most
+ *   this many hulls.  Parts are also merged if that adds less than
+ *   maxConcavity to the volume of the hulls.
+ * - planeSamples: number of candidate cutting planes on each axis.
+ * - numThreads: number of threads for voxelizing, evaluating cutting planes
+ *   and evaluating merges (0 uses all hardware threads).
+ */
+struct ConvexDecompositionSettings
+{
+  ConvexDecompositionSettings();
+
+  int resolution;
+  Real maxConcavity;
+  int maxDepth;
+  int maxHulls;
+  int planeSamples;
+  int numThreads;
+};
+
+/** @brief Approximate convex decomposition in the style of V-HACD.
+ *
+ * The mesh, which should be closed, is voxelized, and the voxels are split
+ * recursively by the axis-aligned plane that minimizes the concavity of the
+ * two halves until each part's concavity is below maxConcavity.  Then the
+ * pairs of parts whose merged hull adds the least volume are merged while
+ * there are more than maxHulls or the merge adds less than maxConcavity.
+ * Each hull is the hull of the corners of its part's voxels, so the hulls
+ * cover the mesh.
+ *
+ * Returns false if the mesh is empty.
+ */
+bool ConvexDecomposition(const Meshing::TriMesh& mesh,std::vector<ConvexHull3D>& hulls,const ConvexDecompositionSettings& settings=ConvexDecompositionSettings());
+
+///Returns the volume enclosed by a closed, outward-oriented mesh
+Real MeshVolume(const Meshing::TriMesh& mesh);
+
+/*@}*/
+
+} //namespace Geometry
+
+#endif
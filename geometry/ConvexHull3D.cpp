@@ -0,0 +1,773 @@
+#include <log4cxx/logger.h>
+#include <KrisLibrary/Logger.h>
+#include "ConvexHull3D.h"
+#include <KrisLibrary/utils/threadutils.h>
+#include <errors.h>
+#include <map>
+#include <iostream>
+using namespace std;
+
+namespace Geometry {
+
+//Inputs with more than twice this many points are split into chunks of this
+//size whose hulls are computed in parallel
+static const int kQuickHullChunkSize = 65536;
+
+struct QuickHullFace
+{
+  int v[3];
+  Vector3 n;
+  Real offset;
+  vector<int> outside;
+  bool deleted;
+  int visited;
+};
+
+static void SetPlane(QuickHullFace& f,const vector<Vector3>& pts)
+{
+  f.n.setCross(pts[f.v[1]]-pts[f.v[0]],pts[f.v[2]]-pts[f.v[0]]);
+  Real len = f.n.norm();
+  if(len > 0) f.n /= len;
+  f.offset = f.n.dot(pts[f.v[0]]);
+  f.deleted = false;
+  f.visited = -1;
+}
+
+inline Real PlaneDistance(const QuickHullFace& f,const Vector3& p)
+{
+  return f.n.dot(p) - f.offset;
+}
+
+static void AddFace(vector<QuickHullFace>& faces,map<pair<int,int>,int>& edges,const vector<Vector3>& pts,int a,int b,int c)
+{
+  QuickHullFace f;
+  f.v[0]=a; f.v[1]=b; f.v[2]=c;
+  SetPlane(f,pts);
+  int index = (int)faces.size();
+  faces.push_back(f);
+  edges[pair<int,int>(a,b)] = index;
+  edges[pair<int,int>(b,c)] = index;
+  edges[pair<int,int>(c,a)] = index;
+}
+
+static void ExtremePoints(const vector<Vector3>& pts,int ext[6])
+{
+  for(int k=0;k<6;k++) ext[k]=0;
+  for(size_t i=1;i<pts.size();i++) {
+    for(int k=0;k<3;k++) {
+      if(pts[i][k] < pts[ext[k*2]][k]) ext[k*2]=(int)i;
+      if(pts[i][k] > pts[ext[k*2+1]][k]) ext[k*2+1]=(int)i;
+    }
+  }
+}
+
+static bool QuickHullSequential(const vector<Vector3>& pts,Meshing::TriMesh& hull,Real tol)
+{
+  hull.verts.clear();
+  hull.tris.clear();
+  if(pts.size() < 4) return false;
+  int ext[6];
+  ExtremePoints(pts,ext);
+
+  //initial tetrahedron: the farthest pair of extreme points, the point
+  //farthest from their line, and the point farthest from that plane
+  int i0=ext[0],i1=ext[1];
+  Real dmax = 0;
+  for(int p=0;p<6;p++)
+    for(int q=p+1;q<6;q++) {
+      Real d = pts[ext[p]].distanceSquared(pts[ext[q]]);
+      if(d > dmax) { dmax=d; i0=ext[p]; i1=ext[q]; }
+    }
+  if(Sqrt(dmax) <= tol) return false;
+  Vector3 axis = pts[i1]-pts[i0];
+  axis.inplaceNormalize();
+  int i2=-1;
+  dmax = tol;
+  for(size_t i=0;i<pts.size();i++) {
+    Vector3 d = pts[i]-pts[i0];
+    d.madd(axis,-d.dot(axis));
+    Real dn = d.norm();
+    if(dn > dmax) { dmax=dn; i2=(int)i; }
+  }
+  if(i2 < 0) return false;
+  Vector3 n;
+  n.setCross(pts[i1]-pts[i0],pts[i2]-pts[i0]);
+  n.inplaceNormalize();
+  int i3=-1;
+  dmax = tol;
+  for(size_t i=0;i<pts.size();i++) {
+    Real d = Abs(n.dot(pts[i]-pts[i0]));
+    if(d > dmax) { dmax=d; i3=(int)i; }
+  }
+  if(i3 < 0) return false;
+  //orient the base so its normal points away from i3
+  if(n.dot(pts[i3]-pts[i0]) > 0) swap(i1,i2);
+
+  vector<QuickHullFace> faces;
+  map<pair<int,int>,int> edges;
+  AddFace(faces,edges,pts,i0,i1,i2);
+  AddFace(faces,edges,pts,i0,i3,i1);
+  AddFace(faces,edges,pts,i1,i3,i2);
+  AddFace(faces,edges,pts,i2,i3,i0);
+  for(size_t i=0;i<pts.size();i++) {
+    if((int)i==i0 || (int)i==i1 || (int)i==i2 || (int)i==i3) continue;
+    for(int f=0;f<4;f++)
+      if(PlaneDistance(faces[f],pts[i]) > tol) {
+	faces[f].outside.push_back((int)i);
+	break;
+      }
+  }
+
+  //faces are appended as they are created, so a single pass processes
+  //every face that ever has a nonempty outside set
+  vector<int> stack,visible,orphans,newFaces;
+  vector<pair<int,int> > horizon;
+  for(size_t fi=0;fi<faces.size();fi++) {
+    if(faces[fi].deleted || faces[fi].outside.empty()) continue;
+    //farthest outside point
+    int apex = -1;
+    dmax = -Inf;
+    for(size_t j=0;j<faces[fi].outside.size();j++) {
+      Real d = PlaneDistance(faces[fi],pts[faces[fi].outside[j]]);
+      if(d > dmax) { dmax=d; apex=faces[fi].outside[j]; }
+    }
+    const Vector3& p = pts[apex];
+    //flood fill the faces visible from the apex, recording the horizon
+    visible.resize(0);
+    horizon.resize(0);
+    stack.resize(1);
+    stack[0] = (int)fi;
+    faces[fi].visited = (int)fi;
+    while(!stack.empty()) {
+      int f = stack.back(); stack.pop_back();
+      visible.push_back(f);
+      for(int k=0;k<3;k++) {
+	int a=faces[f].v[k],b=faces[f].v[(k+1)%3];
+	int g = edges[pair<int,int>(b,a)];
+	if(faces[g].visited == (int)fi) continue;
+	if(PlaneDistance(faces[g],p) > tol) {
+	  faces[g].visited = (int)fi;
+	  stack.push_back(g);
+	}
+	else
+	  horizon.push_back(pair<int,int>(a,b));
+      }
+    }
+    orphans.resize(0);
+    for(size_t j=0;j<visible.size();j++) {
+      QuickHullFace& f = faces[visible[j]];
+      for(size_t k=0;k<f.outside.size();k++)
+	if(f.outside[k] != apex) orphans.push_back(f.outside[k]);
+      f.outside.clear();
+      f.deleted = true;
+      for(int k=0;k<3;k++)
+	edges.erase(pair<int,int>(f.v[k],f.v[(k+1)%3]));
+    }
+    newFaces.resize(0);
+    for(size_t j=0;j<horizon.size();j++) {
+      newFaces.push_back((int)faces.size());
+      AddFace(faces,edges,pts,horizon[j].first,horizon[j].second,apex);
+    }
+    //points that are outside none of the new faces are interior
+    for(size_t j=0;j<orphans.size();j++) {
+      for(size_t k=0;k<newFaces.size();k++) {
+	if(PlaneDistance(faces[newFaces[k]],pts[orphans[j]]) > tol) {
+	  faces[newFaces[k]].outside.push_back(orphans[j]);
+	  break;
+	}
+      }
+    }
+  }
+
+  vector<int> vmap(pts.size(),-1);
+  for(size_t i=0;i<faces.size();i++) {
+    if(faces[i].deleted) continue;
+    IntTriple t;
+    for(int k=0;k<3;k++) {
+      int v = faces[i].v[k];
+      if(vmap[v] < 0) {
+	vmap[v] = (int)hull.verts.size();
+	hull.verts.push_back(pts[v]);
+      }
+      t[k] = vmap[v];
+    }
+    hull.tris.push_back(t);
+  }
+  return true;
+}
+
+
+bool ConvexHull3D_QuickHull(const vector<Vector3>& pts,Meshing::TriMesh& hull,Real tol,int numThreads)
+{
+  hull.verts.clear();
+  hull.tris.clear();
+  if(pts.size() < 4) return false;
+
+  if(tol <= 0) {
+    int ext[6];
+    ExtremePoints(pts,ext);
+    Real scale = 0;
+    for(int k=0;k<3;k++)
+      scale += Max(Abs(pts[ext[k*2]][k]),Abs(pts[ext[k*2+1]][k]));
+    tol = scale*1e-10;
+  }
+  if(pts.size() <= 2*(size_t)kQuickHullChunkSize)
+    return QuickHullSequential(pts,hull,tol);
+
+  //the hull of the points is the hull of the vertices of the hulls of the
+  //chunks.  The chunks don't depend on numThreads, so neither does the result.
+  //The final merge is sequential, since the candidates may be no fewer than
+  //the points (e.g., points on a sphere, or degenerate chunks).
+  int numChunks = (int)((pts.size()+kQuickHullChunkSize-1)/kQuickHullChunkSize);
+  vector<Meshing::TriMesh> chunkHulls(numChunks);
+  ParallelFor(numChunks,[&](int c) {
+      size_t begin = size_t(c)*kQuickHullChunkSize;
+      size_t end = Min(begin+kQuickHullChunkSize,pts.size());
+      vector<Vector3> chunk(pts.begin()+begin,pts.begin()+end);
+      //degenerate chunks keep all of their points
+      if(!QuickHullSequential(chunk,chunkHulls[c],tol))
+        chunkHulls[c].verts.swap(chunk);
+    },numThreads);
+  vector<Vector3> candidates;
+  for(int c=0;c<numChunks;c++)
+    candidates.insert(candidates.end(),chunkHulls[c].verts.begin(),chunkHulls[c].verts.end());
+  return QuickHullSequential(candidates,hull,tol);
+}
+
+
+ConvexHull3D::ConvexHull3D()
+{}
+
+void ConvexHull3D::Set(const vector<Vector3>& pts,int numThreads)
+{
+  Meshing::TriMesh mesh;
+  if(ConvexHull3D_QuickHull(pts,mesh,0,numThreads)) {
+    points = mesh.verts;
+    tris = mesh.tris;
+  }
+  else {
+    points = pts;
+    tris.clear();
+  }
+  InitAdjacency();
+}
+
+void ConvexHull3D::SelfTest()
+{
+  //more than two chunks of points on a sphere, which are all hull vertices
+  int n = 2*kQuickHullChunkSize+10000;
+  vector<Vector3> pts(n);
+  Real golden = Pi*(3-Sqrt(Real(5)));
+  for(int i=0;i<n;i++) {
+    Real z = 1-(2*i+1)/Real(n);
+    Real r = Sqrt(1-z*z);
+    pts[i].set(r*Cos(golden*i),r*Sin(golden*i),z);
+  }
+  Meshing::TriMesh hull;
+  Assert(ConvexHull3D_QuickHull(pts,hull));
+  Assert((int)hull.verts.size() == n);
+  Assert((int)hull.tris.size() == 2*n-4);
+  ConvexHull3D h;
+  h.Set(pts);
+  for(int i=0;i<n;i+=997)
+    Assert(h.Contains(pts[i]*0.999));
+
+  //coplanar points are degenerate, in every chunk and overall
+  for(int i=0;i<n;i++)
+    pts[i].set(i%512,i/512,0);
+  Assert(!ConvexHull3D_QuickHull(pts,hull));
+  Assert(hull.verts.empty() && hull.tris.empty());
+  h.Set(pts);
+  Assert(h.tris.empty() && (int)h.points.size() == n);
+  LOG4CXX_INFO(KrisLibrary::logger(),"ConvexHull3D self test passed"<<"\n");
+}
+
+void ConvexHull3D::InitAdjacency()
+{
+  neighbors.resize(0);
+  if(tris.empty()) return;
+  neighbors.resize(points.size());
+  //each undirected edge appears once in each direction on a closed hull
+  for(size_t i=0;i<tris.size();i++)
+    for(int k=0;k<3;k++)
+      neighbors[tris[i][k]].push_back(tris[i][(k+1)%3]);
+}
+
+int ConvexHull3D::Support(const Vector3& dir,int hint) const
+{
+  if(points.empty()) return -1;
+  if(neighbors.empty()) {
+    int best = 0;
+    Real dbest = dir.dot(points[0]);
+    for(size_t i=1;i<points.size();i++) {
+      Real d = dir.dot(points[i]);
+      if(d > dbest) { dbest=d; best=(int)i; }
+    }
+    return best;
+  }
+  int cur = (hint >= 0 && hint < (int)points.size() ? hint : 0);
+  Real dbest = dir.dot(points[cur]);
+  while(true) {
+    int next = -1;
+    for(size_t j=0;j<neighbors[cur].size();j++) {
+      Real d = dir.dot(points[neighbors[cur][j]]);
+      if(d > dbest) { dbest=d; next=neighbors[cur][j]; }
+    }
+    if(next < 0) return cur;
+    cur = next;
+  }
+}
+
+AABB3D ConvexHull3D::GetAABB() const
+{
+  AABB3D bb;
+  bb.minimize();
+  for(size_t i=0;i<points.size();i++)
+    bb.expand(points[i]);
+  return bb;
+}
+
+bool ConvexHull3D::Contains(const Vector3& pt,Real tol) const
+{
+  if(tris.empty()) return false;
+  Vector3 n;
+  for(size_t i=0;i<tris.size();i++) {
+    const Vector3& a = points[tris[i].a];
+    n.setCross(points[tris[i].b]-a,points[tris[i].c]-a);
+    if(n.dot(pt-a) > tol*n.norm()) return false;
+  }
+  return true;
+}
+
+void ConvexHull3D::GetMesh(Meshing::TriMesh& mesh) const
+{
+  mesh.verts = points;
+  mesh.tris = tris;
+}
+
+void ConvexHull3D::Transform(const Matrix4& T)
+{
+  for(size_t i=0;i<points.size();i++) {
+    Vector3 p = points[i];
+    T.mulPoint(p,points[i]);
+  }
+  Matrix3 R;
+  T.get(R);
+  if(R.determinant() < 0) {
+    for(size_t i=0;i<tris.size();i++)
+      swap(tris[i].b,tris[i].c);
+  }
+}
+
+ostream& operator << (ostream& out,const ConvexHull3D& h)
+{
+  out<<h.points.size()<<endl;
+  for(size_t i=0;i<h.points.size();i++)
+    out<<h.points[i]<<endl;
+  out<<h.tris.size()<<endl;
+  for(size_t i=0;i<h.tris.size();i++)
+    out<<h.tris[i]<<endl;
+  return out;
+}
+
+istream& operator >> (istream& in,ConvexHull3D& h)
+{
+  size_t n;
+  in>>n;
+  if(!in) return in;
+  h.points.resize(n);
+  for(size_t i=0;i<n;i++)
+    in>>h.points[i];
+  in>>n;
+  if(!in) return in;
+  h.tris.resize(n);
+  for(size_t i=0;i<n;i++) {
+    in>>h.tris[i];
+    for(int k=0;k<3;k++)
+      if(h.tris[i][k] < 0 || h.tris[i][k] >= (int)h.points.size()) {
+	in.setstate(ios::failbit);
+	return in;
+      }
+  }
+  h.InitAdjacency();
+  return in;
+}
+
+
+
+//A vertex of the Minkowski difference a-b, with the generating points
+struct GJKVertex
+{
+  Vector3 w,p1,p2;
+  int i1,i2;
+};
+
+struct GJKSupport
+{
+  GJKSupport(const ConvexHull3D& _a,const RigidTransform& _Ta,const ConvexHull3D& _b,const RigidTransform& _Tb)
+    :a(_a),Ta(_Ta),b(_b),Tb(_Tb)
+  {}
+  void Eval(int i1,int i2,GJKVertex& v) const {
+    v.i1 = i1;
+    v.i2 = i2;
+    v.p1 = Ta*a.points[i1];
+    v.p2 = Tb*b.points[i2];
+    v.w = v.p1-v.p2;
+  }
+  void operator()(const Vector3& d,GJKVertex& v,int hint1=0,int hint2=0) const {
+    Vector3 da,db;
+    Ta.R.mulTranspose(d,da);
+    Tb.R.mulTranspose(d,db);
+    db.inplaceNegative();
+    Eval(a.Support(da,hint1),b.Support(db,hint2),v);
+  }
+
+  const ConvexHull3D& a;
+  const RigidTransform& Ta;
+  const ConvexHull3D& b;
+  const RigidTransform& Tb;
+};
+
+//Computes the barycentric coordinates l of the point in the affine hull of
+//s[idx[0..m-1]].w closest to the origin.  Returns false if the points are
+//affinely dependent.
+static bool AffineClosest(const GJKVertex* s,const int* idx,int m,Real* l)
+{
+  if(m == 1) {
+    l[0] = 1;
+    return true;
+  }
+  const Vector3& w0 = s[idx[0]].w;
+  Vector3 e[3];
+  for(int k=1;k<m;k++) e[k-1] = s[idx[k]].w - w0;
+  Real mu[3];
+  if(m == 2) {
+    Real g = e[0].normSquared();
+    if(g <= 1e-24) return false;
+    mu[0] = -e[0].dot(w0)/g;
+  }
+  else if(m == 3) {
+    Real g00=e[0].normSquared(),g01=e[0].dot(e[1]),g11=e[1].normSquared();
+    Real det = g00*g11-g01*g01;
+    if(det <= 1e-12*g00*g11 || det <= 0) return false;
+    Real r0=-e[0].dot(w0),r1=-e[1].dot(w0);
+    mu[0] = (r0*g11-r1*g01)/det;
+    mu[1] = (g00*r1-g01*r0)/det;
+  }
+  else {
+    Matrix3 G,Ginv;
+    for(int i=0;i<3;i++)
+      for(int j=0;j<3;j++)
+	G(i,j) = e[i].dot(e[j]);
+    Real det = G.determinant();
+    if(det <= 1e-12*G(0,0)*G(1,1)*G(2,2) || det <= 0) return false;
+    if(!Ginv.setInverse(G)) return false;
+    Vector3 r(-e[0].dot(w0),-e[1].dot(w0),-e[2].dot(w0)),x;
+    Ginv.mul(r,x);
+    mu[0]=x.x; mu[1]=x.y; mu[2]=x.z;
+  }
+  l[0] = 1;
+  for(int k=1;k<m;k++) {
+    l[k] = mu[k-1];
+    l[0] -= mu[k-1];
+  }
+  return true;
+}
+
+//Finds the point v of the simplex s[0..n-1] closest to the origin by
+//checking every face of the simplex.  On return the simplex is reduced to
+//the smallest face containing v, with barycentric coordinates lambda.
+static void ClosestToOrigin(GJKVertex* s,int& n,Real* lambda,Vector3& v)
+{
+  Real dbest = Inf;
+  int mbest = 0;
+  int best[4] = {0,0,0,0};
+  Real lbest[4] = {0,0,0,0};
+  for(int mask=1;mask<(1<<n);mask++) {
+    int idx[4] = {0,0,0,0},m=0;
+    for(int i=0;i<n;i++)
+      if(mask & (1<<i)) idx[m++]=i;
+    Real l[4];
+    if(!AffineClosest(s,idx,m,l)) continue;
+    bool inside = true;
+    for(int k=0;k<m;k++)
+      if(l[k] < 0) { inside=false; break; }
+    if(!inside) continue;
+    Vector3 p(Zero);
+    for(int k=0;k<m;k++) p.madd(s[idx[k]].w,l[k]);
+    Real d = p.normSquared();
+    if(d < dbest || (d == dbest && m < mbest)) {
+      dbest = d;
+      mbest = m;
+      for(int k=0;k<m;k++) { best[k]=idx[k]; lbest[k]=l[k]; }
+    }
+  }
+  if(mbest == 0) {
+    //no face gave a valid point (e.g., NaN coordinates): fall back to the
+    //vertex closest to the origin
+    mbest = 1;
+    lbest[0] = 1;
+    for(int i=1;i<n;i++)
+      if(s[i].w.normSquared() < s[best[0]].w.normSquared()) best[0] = i;
+  }
+  GJKVertex temp[4];
+  v.setZero();
+  for(int k=0;k<mbest;k++) {
+    temp[k] = s[best[k]];
+    lambda[k] = lbest[k];
+    v.madd(temp[k].w,lambda[k]);
+  }
+  for(int k=0;k<mbest;k++) s[k] = temp[k];
+  n = mbest;
+}
+
+//Runs GJK on the Minkowski difference starting from the warm start
+//simplex.  If sepTol >= 0, returns early with a lower bound on the
+//distance once it is known to exceed sepTol.  Returns 0 on overlap.
+static Real GJK(const GJKSupport& sup,GJKSimplex& simplex,GJKVertex* s,int& n,Real* lambda,Real sepTol)
+{
+  const static Real kZeroTol = 1e-14;
+  const static Real kRelTol = 1e-10;
+  const static int kMaxIters = 100;
+  n = 0;
+  for(int i=0;i<simplex.size;i++) {
+    if(simplex.index1[i] < 0 || simplex.index1[i] >= (int)sup.a.points.size() ||
+       simplex.index2[i] < 0 || simplex.index2[i] >= (int)sup.b.points.size()) {
+      n = 0;
+      break;
+    }
+    sup.Eval(simplex.index1[i],simplex.index2[i],s[n]);
+    n++;
+  }
+  if(n == 0) {
+    sup(Vector3(1,0,0),s[0]);
+    n = 1;
+  }
+  Vector3 v;
+  ClosestToOrigin(s,n,lambda,v);
+  Real res = -1;
+  for(int iters=0;iters<kMaxIters;iters++) {
+    Real vv = v.normSquared();
+    if(vv <= kZeroTol || n == 4) { res = 0; break; }
+    GJKVertex w;
+    sup(-v,w,s[0].i1,s[0].i2);
+    Real vw = v.dot(w.w);
+    if(sepTol >= 0 && vw > 0 && vw*vw > sepTol*sepTol*vv) {
+      res = vw/Sqrt(vv);
+      break;
+    }
+    if(vv - vw <= kRelTol*vv) break;
+    bool duplicate = false;
+    for(int i=0;i<n;i++)
+      if(s[i].i1 == w.i1 && s[i].i2 == w.i2) { duplicate=true; break; }
+    if(duplicate) break;
+    s[n++] = w;
+    ClosestToOrigin(s,n,lambda,v);
+  }
+  if(res < 0) res = v.norm();
+  simplex.size = n;
+  for(int i=0;i<n;i++) {
+    simplex.index1[i] = s[i].i1;
+    simplex.index2[i] = s[i].i2;
+  }
+  return res;
+}
+
+Real GJKDistance(const ConvexHull3D& a,const RigidTransform& Ta,
+		 const ConvexHull3D& b,const RigidTransform& Tb,
+		 GJKSimplex& simplex,Vector3& cp1,Vector3& cp2)
+{
+  Assert(!a.Empty() && !b.Empty());
+  GJKSupport sup(a,Ta,b,Tb);
+  GJKVertex s[4];
+  Real lambda[4];
+  int n;
+  Real d = GJK(sup,simplex,s,n,lambda,-1);
+  cp1.setZero();
+  cp2.setZero();
+  for(int i=0;i<n;i++) {
+    cp1.madd(s[i].p1,lambda[i]);
+    cp2.madd(s[i].p2,lambda[i]);
+  }
+  return d;
+}
+
+bool GJKCollide(const ConvexHull3D& a,const RigidTransform& Ta,
+		const ConvexHull3D& b,const RigidTransform& Tb,
+		GJKSimplex& simplex,Real tol)
+{
+  Assert(!a.Empty() && !b.Empty());
+  GJKSupport sup(a,Ta,b,Tb);
+  GJKVertex s[4];
+  Real lambda[4];
+  int n;
+  return GJK(sup,simplex,s,n,lambda,tol) <= tol;
+}
+
+//Grows a lower-dimensional simplex containing the origin into a
+//tetrahedron.  Returns false if the Minkowski difference is flat.
+static bool ExpandSimplex(const GJKSupport& sup,vector<GJKVertex>& verts)
+{
+  const static Real kTol = 1e-10;
+  GJKVertex w;
+  if(verts.size() == 1) {
+    for(int k=0;k<6 && verts.size()==1;k++) {
+      Vector3 d(Zero);
+      d[k/2] = (k%2==0 ? 1.0 : -1.0);
+      sup(d,w);
+      if(w.w.distance(verts[0].w) > kTol) verts.push_back(w);
+    }
+    if(verts.size() == 1) return false;
+  }
+  if(verts.size() == 2) {
+    Vector3 e = verts[1].w-verts[0].w;
+    e.inplaceNormalize();
+    Vector3 axis(Zero);
+    if(Abs(e.x) <= Abs(e.y) && Abs(e.x) <= Abs(e.z)) axis.x = 1;
+    else if(Abs(e.y) <= Abs(e.z)) axis.y = 1;
+    else axis.z = 1;
+    Vector3 d[4];
+    d[0].setCross(e,axis);
+    d[1].setCross(e,d[0]);
+    d[2].setNegative(d[0]);
+    d[3].setNegative(d[1]);
+    for(int k=0;k<4 && verts.size()==2;k++) {
+      sup(d[k],w);
+      Vector3 r = w.w-verts[0].w;
+      r.madd(e,-r.dot(e));
+      if(r.norm() > kTol) verts.push_back(w);
+    }
+    if(verts.size() == 2) return false;
+  }
+  if(verts.size() == 3) {
+    Vector3 nrm;
+    nrm.setCross(verts[1].w-verts[0].w,verts[2].w-verts[0].w);
+    nrm.inplaceNormalize();
+    sup(nrm,w);
+    if(Abs(nrm.dot(w.w-verts[0].w)) <= kTol) {
+      sup(-nrm,w);
+      if(Abs(nrm.dot(w.w-verts[0].w)) <= kTol) return false;
+    }
+    verts.push_back(w);
+  }
+  return true;
+}
+
+struct EPAFace
+{
+  int v[3];
+  Vector3 n;
+  Real dist;
+  bool deleted;
+};
+
+static void MakeEPAFace(const vector<GJKVertex>& verts,int a,int b,int c,EPAFace& f)
+{
+  f.v[0]=a; f.v[1]=b; f.v[2]=c;
+  f.n.setCross(verts[b].w-verts[a].w,verts[c].w-verts[a].w);
+  Real len = f.n.norm();
+  if(len <= 1e-20) {
+    //degenerate sliver, never chosen as the closest face
+    f.dist = Inf;
+  }
+  else {
+    f.n /= len;
+    f.dist = f.n.dot(verts[a].w);
+  }
+  f.deleted = false;
+}
+
+Real EPAPenetration(const ConvexHull3D& a,const RigidTransform& Ta,
+		    const ConvexHull3D& b,const RigidTransform& Tb,
+		    GJKSimplex& simplex,Vector3& cp1,Vector3& cp2,Vector3& n)
+{
+  Assert(!a.Empty() && !b.Empty());
+  const static Real kTol = 1e-8;
+  const static int kMaxIters = 128;
+  GJKSupport sup(a,Ta,b,Tb);
+  GJKVertex s[4];
+  Real lambda[4];
+  int ns;
+  Real d = GJK(sup,simplex,s,ns,lambda,0);
+  cp1.setZero();
+  cp2.setZero();
+  for(int i=0;i<ns;i++) {
+    cp1.madd(s[i].p1,lambda[i]);
+    cp2.madd(s[i].p2,lambda[i]);
+  }
+  n.set(0,0,1);
+  if(d > 0) return 0;
+  vector<GJKVertex> verts(s,s+ns);
+  if(!ExpandSimplex(sup,verts)) return 0;
+
+  Vector3 base;
+  base.setCross(verts[1].w-verts[0].w,verts[2].w-verts[0].w);
+  if(base.dot(verts[3].w-verts[0].w) > 0) swap(verts[1],verts[2]);
+  vector<EPAFace> faces(4);
+  MakeEPAFace(verts,0,1,2,faces[0]);
+  MakeEPAFace(verts,0,3,1,faces[1]);
+  MakeEPAFace(verts,1,3,2,faces[2]);
+  MakeEPAFace(verts,2,3,0,faces[3]);
+
+  int closest = -1;
+  vector<pair<int,int> > horizon;
+  for(int iters=0;iters<kMaxIters;iters++) {
+    closest = -1;
+    for(size_t i=0;i<faces.size();i++)
+      if(!faces[i].deleted && (closest < 0 || faces[i].dist < faces[closest].dist))
+	closest = (int)i;
+    if(closest < 0 || IsInf(faces[closest].dist)) return 0;
+    GJKVertex w;
+    const EPAFace& fc = faces[closest];
+    sup(fc.n,w,verts[fc.v[0]].i1,verts[fc.v[0]].i2);
+    if(fc.n.dot(w.w) - fc.dist <= kTol) break;
+    int wi = (int)verts.size();
+    verts.push_back(w);
+    //remove faces visible from w; edges not shared between two removed
+    //faces form the horizon
+    horizon.resize(0);
+    for(size_t i=0;i<faces.size();i++) {
+      if(faces[i].deleted) continue;
+      if(faces[i].n.dot(w.w-verts[faces[i].v[0]].w) <= 0) continue;
+      faces[i].deleted = true;
+      for(int k=0;k<3;k++) {
+	pair<int,int> e(faces[i].v[k],faces[i].v[(k+1)%3]);
+	bool shared = false;
+	for(size_t j=0;j<horizon.size();j++)
+	  if(horizon[j].first == e.second && horizon[j].second == e.first) {
+	    horizon[j] = horizon.back();
+	    horizon.pop_back();
+	    shared = true;
+	    break;
+	  }
+	if(!shared) horizon.push_back(e);
+      }
+    }
+    for(size_t j=0;j<horizon.size();j++) {
+      faces.resize(faces.size()+1);
+      MakeEPAFace(verts,horizon[j].first,horizon[j].second,wi,faces.back());
+    }
+  }
+  if(closest < 0) return 0;
+
+  //barycentric coordinates of the origin's projection on the closest face
+  const EPAFace& f = faces[closest];
+  const GJKVertex& v0=verts[f.v[0]],&v1=verts[f.v[1]],&v2=verts[f.v[2]];
+  Vector3 p = f.n*f.dist;
+  Vector3 e1=v1.w-v0.w,e2=v2.w-v0.w,r=p-v0.w;
+  Real g11=e1.normSquared(),g12=e1.dot(e2),g22=e2.normSquared();
+  Real det = g11*g22-g12*g12;
+  Real l1=0,l2=0;
+  if(det > 0) {
+    Real r1=e1.dot(r),r2=e2.dot(r);
+    l1 = (r1*g22-r2*g12)/det;
+    l2 = (g11*r2-g12*r1)/det;
+  }
+  Real l0 = 1-l1-l2;
+  cp1 = v0.p1*l0 + v1.p1*l1 + v2.p1*l2;
+  cp2 = v0.p2*l0 + v1.p2*l1 + v2.p2*l2;
+  n = f.n;
+  return f.dist;
+}
+
+} // namespace Geometry
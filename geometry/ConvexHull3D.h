@@ -0,0 +1,117 @@
+#ifndef GEOMETRY_CONVEXHULL3D_H
+#define GEOMETRY_CONVEXHULL3D_H
+
+#include <KrisLibrary/math3d/geometry3d.h>
+#include <KrisLibrary/meshing/TriMesh.h>
+#include <vector>
+#include <iosfwd>
+
+/** @file geometry/ConvexHull3D.h
+ * @ingroup Geometry
+ * @brief 3-D convex hulls and GJK/EPA proximity queries between them
+ */
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+  /** @addtogroup Geometry */
+  /*@{*/
+
+/** @brief Computes the convex hull of a set of 3D points using quickhull.
+ *
+ * On output, hull.verts contains the extreme points and hull.tris the hull
+ * faces, oriented with outward normals.  Points closer than tol to a face
+ * are considered to lie on it; if tol=0 it is determined from the extent
+ * of the points.  Returns false (with an empty hull) if there are fewer than
+ * 4 points that are not coplanar.
+ *
+ * Large point sets are split into fixed-size chunks whose hulls are computed
+ * on numThreads threads (0 uses all hardware threads), and then the hull of
+ * the chunk hulls' vertices is computed.
+ */
+bool ConvexHull3D_QuickHull(const std::vector<Vector3>& pts,Meshing::TriMesh& hull,Real tol=0,int numThreads=0);
+
+/** @brief A convex polyhedron stored as its vertices and outward-facing
+ * triangles.
+ *
+ * Support queries hill-climb along vertex adjacency, starting from a hint
+ * vertex, so queries on nearby directions are cheap.  Degenerate hulls
+ * (fewer than 4 non-coplanar points) keep the points without triangles and
+ * are searched exhaustively.
+ */
+class ConvexHull3D
+{
+public:
+  ConvexHull3D();
+  ///Computes the hull of the given points with ConvexHull3D_QuickHull
+  void Set(const std::vector<Vector3>& pts,int numThreads=0);
+  bool Empty() const { return points.empty(); }
+  ///Returns the index of the vertex farthest in direction dir.  The search
+  ///starts at vertex hint.
+  int Support(const Vector3& dir,int hint=0) const;
+  AABB3D GetAABB() const;
+  ///Returns true if pt is inside the hull or within tol of its boundary.
+  ///Always false for degenerate hulls.
+  bool Contains(const Vector3& pt,Real tol=0) const;
+  void GetMesh(Meshing::TriMesh& mesh) const;
+  ///Applies an affine transform.  The vertex set of the hull is preserved
+  ///under affine maps so the hull need not be recomputed.
+  void Transform(const Matrix4& T);
+  ///Rebuilds the vertex adjacency from tris
+  void InitAdjacency();
+  ///Checks ConvexHull3D_QuickHull on large spherical and coplanar inputs
+  static void SelfTest();
+
+  std::vector<Vector3> points;
+  std::vector<IntTriple> tris;
+  std::vector<std::vector<int> > neighbors;
+};
+
+std::ostream& operator << (std::ostream& out,const ConvexHull3D& h);
+std::istream& operator >> (std::istream& in,ConvexHull3D& h);
+
+/** @brief Warm-start state for GJK / EPA queries between a pair of hulls.
+ *
+ * Stores the vertex indices of the last simplex.  On the next query these
+ * are re-evaluated under the new transforms, so for coherent motion GJK
+ * usually terminates within one or two iterations.
+ */
+class GJKSimplex
+{
+public:
+  GJKSimplex() : size(0) {}
+  void Clear() { size = 0; }
+
+  int size;
+  int index1[4],index2[4];
+};
+
+///Returns the distance between hulls a and b under transforms Ta and Tb,
+///or 0 if they overlap.  cp1 and cp2 are set to the closest points in world
+///coordinates.  simplex is used to warm start the query and on return holds
+///the final simplex.
+Real GJKDistance(const ConvexHull3D& a,const RigidTransform& Ta,
+		 const ConvexHull3D& b,const RigidTransform& Tb,
+		 GJKSimplex& simplex,Vector3& cp1,Vector3& cp2);
+
+///Returns true if hulls a and b are within distance tol.  Faster than
+///GJKDistance for separated objects since it terminates as soon as a
+///separating plane is found.
+bool GJKCollide(const ConvexHull3D& a,const RigidTransform& Ta,
+		const ConvexHull3D& b,const RigidTransform& Tb,
+		GJKSimplex& simplex,Real tol=0);
+
+///Returns the penetration depth of overlapping hulls a and b computed by
+///EPA, or 0 if they do not overlap.  cp1 and cp2 are the deepest points of
+///a in b and b in a, in world coordinates, and translating b by depth*n
+///separates the hulls.
+Real EPAPenetration(const ConvexHull3D& a,const RigidTransform& Ta,
+		    const ConvexHull3D& b,const RigidTransform& Tb,
+		    GJKSimplex& simplex,Vector3& cp1,Vector3& cp2,Vector3& n);
+
+  /*@}*/
+
+} // namespace Geometry
+
+#endif
@@ -0,0 +1,277 @@
+#include <log4cxx/logger.h>
+#include <KrisLibrary/Logger.h>
+#include "DepthRender.h"
+#include "CollisionPointCloud.h"
+#include <KrisLibrary/meshing/Rasterize.h>
+#include <KrisLibrary/meshing/PointCloud.h>
+#include <utils/threadutils.h>
+#include <errors.h>
+using namespace std;
+
+namespace Geometry {
+
+//Rasterizes triangles into the part of a z-buffer covered by one tile.
+//Depth parameters are interpolated linearly in screen space, which is
+//exact for 1/z under a perspective projection and for z under an
+//orthographic one.
+struct TileRasterizer : public Meshing::Rasterizer2D
+{
+  virtual void VisitCell(const Vector3& bary,int i,int j)
+  {
+    if(i < imin || i >= imax || j < jmin || j >= jmax) return;
+    Real d = bary.dot(depthParams);
+    if(perspective) {
+      if(d <= 0) return;
+      d = 1.0/d;
+    }
+    if(d < zmin || d > zmax) return;
+    Real& cell = (*zbuffer)(i,j);
+    if(d < cell) cell = d;
+  }
+
+  Array2D<Real>* zbuffer;
+  int imin,imax,jmin,jmax;
+  bool perspective;
+  Real zmin,zmax;
+  Vector3 depthParams;
+};
+
+DepthRenderer::DepthRenderer()
+  :numThreads(0),tileSize(32)
+{}
+
+void DepthRenderer::Clear()
+{
+  items.clear();
+}
+
+void DepthRenderer::Add(AnyCollisionGeometry3D& geom,Real resolution)
+{
+  geom.InitCollisionData();
+  if(geom.type == AnyGeometry3D::Group) {
+    vector<AnyCollisionGeometry3D>& subitems = geom.GroupCollisionData();
+    for(size_t i=0;i<subitems.size();i++)
+      Add(subitems[i],resolution);
+    return;
+  }
+  items.resize(items.size()+1);
+  Item& item = items.back();
+  item.geom = &geom;
+  item.isPointCloud = (geom.type == AnyGeometry3D::PointCloud);
+  if(item.isPointCloud) return;
+  if(geom.type == AnyGeometry3D::TriangleMesh) {
+    item.mesh = geom.AsTriangleMesh();
+    return;
+  }
+  AnyCollisionGeometry3D converted;
+  if(!geom.Convert(AnyGeometry3D::TriangleMesh,converted,resolution)) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"DepthRenderer::Add: unable to convert "<<geom.TypeName()<<" to a triangle mesh, ignoring");
+    items.resize(items.size()-1);
+    return;
+  }
+  item.mesh = converted.AsTriangleMesh();
+}
+
+//Clips the polygon poly to the halfspace z >= zmin
+static void ClipNear(const vector<Vector3>& poly,Real zmin,vector<Vector3>& res)
+{
+  res.resize(0);
+  for(size_t i=0;i<poly.size();i++) {
+    const Vector3& a = poly[i];
+    const Vector3& b = poly[(i+1)%poly.size()];
+    bool ain = (a.z >= zmin), bin = (b.z >= zmin);
+    if(ain) res.push_back(a);
+    if(ain != bin) {
+      Real u = (zmin-a.z)/(b.z-a.z);
+      res.push_back(a + u*(b-a));
+      res.back().z = zmin;
+    }
+  }
+}
+
+void DepthRenderer::Render(const Camera::Viewport& vp,Array2D<Real>& depth)
+{
+  int w = vp.w, h = vp.h;
+  if(w <= 0 || h <= 0) {
+    depth.clear();
+    return;
+  }
+  depth.resize(w,h,Inf);
+  //the standard camera frame is the OpenGL frame flipped about x
+  RigidTransform Tcam = vp.xform;
+  Tcam.R.setCol2(-Vector3(vp.yDir()));
+  Tcam.R.setCol3(-Vector3(vp.zDir()));
+  RigidTransform Tcaminv;
+  Tcaminv.setInverse(Tcam);
+  Real focal = vp.scale*w;
+  Real cx = 0.5*w, cy = 0.5*h;
+  Real zmin = Max((Real)vp.n,0.0), zmax = vp.f;
+  if(vp.perspective && zmin <= 0) zmin = 1e-6;
+  //pixel (i,j) covers [i,i+1)x[j,j+1) in image coordinates, and the
+  //rasterizer fills cell (i,j) if (i,j) is in the triangle, so raster
+  //coordinates are shifted by half a pixel
+  Real ox = cx - 0.5, oy = cy - 0.5;
+
+  //project triangles and points
+  screenTris.resize(0);
+  screenPoints.resize(0);
+  vector<Vector3> poly(3),clipped;
+  for(size_t k=0;k<items.size();k++) {
+    const Item& item = items[k];
+    RigidTransform T = Tcaminv*item.geom->GetTransform();
+    if(item.isPointCloud) {
+      const Meshing::PointCloud3D& pc = item.geom->AsPointCloud();
+      for(size_t i=0;i<pc.points.size();i++) {
+	Vector3 p = T*pc.points[i];
+	if(p.z < zmin || p.z > zmax) continue;
+	Vector3 s;
+	if(vp.perspective) s.set(ox+focal*p.x/p.z,oy+focal*p.y/p.z,p.z);
+	else s.set(ox+focal*p.x,oy+focal*p.y,p.z);
+	screenPoints.push_back(s);
+      }
+      continue;
+    }
+    const Meshing::TriMesh& mesh = item.mesh;
+    cameraVerts.resize(mesh.verts.size());
+    for(size_t i=0;i<mesh.verts.size();i++)
+      cameraVerts[i] = T*mesh.verts[i];
+    for(size_t t=0;t<mesh.tris.size();t++) {
+      const IntTriple& tri = mesh.tris[t];
+      poly[0] = cameraVerts[tri.a];
+      poly[1] = cameraVerts[tri.b];
+      poly[2] = cameraVerts[tri.c];
+      if(poly[0].z < zmin && poly[1].z < zmin && poly[2].z < zmin) continue;
+      if(poly[0].z > zmax && poly[1].z > zmax && poly[2].z > zmax) continue;
+      const vector<Vector3>* p = &poly;
+      if(poly[0].z < zmin || poly[1].z < zmin || poly[2].z < zmin) {
+	ClipNear(poly,zmin,clipped);
+	p = &clipped;
+      }
+      //project and fan-triangulate
+      Vector2 s[4];
+      Real d[4];
+      for(size_t i=0;i<p->size();i++) {
+	const Vector3& v = (*p)[i];
+	if(vp.perspective) {
+	  s[i].set(ox+focal*v.x/v.z,oy+focal*v.y/v.z);
+	  d[i] = 1.0/v.z;
+	}
+	else {
+	  s[i].set(ox+focal*v.x,oy+focal*v.y);
+	  d[i] = v.z;
+	}
+      }
+      for(size_t i=1;i+1<p->size();i++) {
+	screenTris.resize(screenTris.size()+1);
+	ScreenTriangle& st = screenTris.back();
+	st.tri.a = s[0];
+	st.tri.b = s[i];
+	st.tri.c = s[i+1];
+	st.depthParams.set(d[0],d[i],d[i+1]);
+      }
+    }
+  }
+
+  //bin into tiles
+  int tw = (w+tileSize-1)/tileSize, th = (h+tileSize-1)/tileSize;
+  triBins.resize(tw*th);
+  pointBins.resize(tw*th);
+  for(size_t i=0;i<triBins.size();i++) {
+    triBins[i].resize(0);
+    pointBins[i].resize(0);
+  }
+  for(size_t t=0;t<screenTris.size();t++) {
+    const Triangle2D& tri = screenTris[t].tri;
+    Real xmin = Min(tri.a.x,Min(tri.b.x,tri.c.x)), xmax = Max(tri.a.x,Max(tri.b.x,tri.c.x));
+    Real ymin = Min(tri.a.y,Min(tri.b.y,tri.c.y)), ymax = Max(tri.a.y,Max(tri.b.y,tri.c.y));
+    if(xmax < 0 || ymax < 0 || xmin > w-1 || ymin > h-1) continue;
+    int imin = Max((int)Ceil(xmin),0), imax = Min((int)Floor(xmax),w-1);
+    int jmin = Max((int)Ceil(ymin),0), jmax = Min((int)Floor(ymax),h-1);
+    if(imin > imax || jmin > jmax) continue;
+    for(int tj=jmin/tileSize;tj<=jmax/tileSize;tj++)
+      for(int ti=imin/tileSize;ti<=imax/tileSize;ti++)
+	triBins[tj*tw+ti].push_back((int)t);
+  }
+  for(size_t k=0;k<screenPoints.size();k++) {
+    int i = (int)Floor(screenPoints[k].x+0.5), j = (int)Floor(screenPoints[k].y+0.5);
+    if(i < 0 || j < 0 || i >= w || j >= h) continue;
+    pointBins[(j/tileSize)*tw+i/tileSize].push_back((int)k);
+  }
+
+  //rasterize each tile
+  ParallelFor(tw*th,[&](int tile) {
+      TileRasterizer r;
+      r.zbuffer = &depth;
+      r.perspective = vp.perspective;
+      r.zmin = zmin;
+      r.zmax = zmax;
+      r.imin = (tile%tw)*tileSize;
+      r.jmin = (tile/tw)*tileSize;
+      r.imax = Min(r.imin+tileSize,w);
+      r.jmax = Min(r.jmin+tileSize,h);
+      AABB2D bounds;
+      bounds.bmin.set(r.imin-0.5,r.jmin-0.5);
+      bounds.bmax.set(r.imax-0.5,r.jmax-0.5);
+      const vector<int>& tris = triBins[tile];
+      for(size_t k=0;k<tris.size();k++) {
+	const ScreenTriangle& st = screenTris[tris[k]];
+	r.depthParams = st.depthParams;
+	const Triangle2D& tri = st.tri;
+	//small triangles that straddle the tile boundary are cheaper to
+	//rasterize whole, letting VisitCell discard the outside cells
+	Real xmin = Min(tri.a.x,Min(tri.b.x,tri.c.x)), xmax = Max(tri.a.x,Max(tri.b.x,tri.c.x));
+	Real ymin = Min(tri.a.y,Min(tri.b.y,tri.c.y)), ymax = Max(tri.a.y,Max(tri.b.y,tri.c.y));
+	if(xmax - xmin <= tileSize && ymax - ymin <= tileSize)
+	  r.Rasterize(tri);
+	else if(bounds.contains(tri.a) && bounds.contains(tri.b) && bounds.contains(tri.c))
+	  r.Rasterize(tri);
+	else
+	  r.ClippedRasterize(tri,bounds);
+      }
+      const vector<int>& pts = pointBins[tile];
+      for(size_t k=0;k<pts.size();k++) {
+	const Vector3& s = screenPoints[pts[k]];
+	Real& cell = depth((int)Floor(s.x+0.5),(int)Floor(s.y+0.5));
+	if(s.z < cell) cell = s.z;
+      }
+    },numThreads);
+}
+
+void DepthRenderer::Render(const Camera::Viewport& vp,Meshing::PointCloud3D& pc)
+{
+  Render(vp,zbuffer);
+  int w = vp.w, h = vp.h;
+  RigidTransform Tcam = vp.xform;
+  Tcam.R.setCol2(-Vector3(vp.yDir()));
+  Tcam.R.setCol3(-Vector3(vp.zDir()));
+  pc.Clear();
+  pc.SetStructured(Max(w,0),Max(h,0));
+  pc.SetViewport(Tcam);
+  Real invfocal = 1.0/(vp.scale*w);
+  Real cx = 0.5*w, cy = 0.5*h;
+  ParallelFor(Max(h,0),[&](int j) {
+      Real y = (j+0.5-cy)*invfocal;
+      for(int i=0;i<w;i++) {
+	Vector3& p = pc.points[j*w+i];
+	Real z = zbuffer(i,j);
+	if(IsInf(z)) {
+	  p.setZero();
+	  continue;
+	}
+	Real x = (i+0.5-cx)*invfocal;
+	if(vp.perspective) p.set(x*z,y*z,z);
+	else p.set(x,y,z);
+      }
+    },numThreads,8);
+}
+
+void RenderDepth(const Camera::Viewport& vp,const vector<AnyCollisionGeometry3D*>& geoms,Meshing::PointCloud3D& pc,int numThreads)
+{
+  DepthRenderer renderer;
+  renderer.numThreads = numThreads;
+  for(size_t i=0;i<geoms.size();i++)
+    renderer.Add(*geoms[i]);
+  renderer.Render(vp,pc);
+}
+
+} //namespace Geometry
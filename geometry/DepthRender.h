@@ -0,0 +1,94 @@
+#ifndef GEOMETRY_DEPTH_RENDER_H
+#define GEOMETRY_DEPTH_RENDER_H
+
+#include "AnyGeometry.h"
+#include <KrisLibrary/camera/viewport.h>
+#include <KrisLibrary/meshing/TriMesh.h>
+#include <KrisLibrary/math3d/Triangle2D.h>
+#include <KrisLibrary/structs/array2d.h>
+#include <vector>
+
+/** @file geometry/DepthRender.h
+ * @ingroup Geometry
+ * @brief Software rendering of depth images from collision geometries.
+ */
+
+namespace Meshing { class PointCloud3D; }
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+/** @addtogroup Geometry */
+/*@{*/
+
+/** @brief A CPU depth renderer that simulates a depth camera without an
+ * OpenGL context.
+ *
+ * Geometries are added once with Add(), which caches their surfaces as
+ * triangle meshes (primitives and implicit surfaces are converted) or
+ * points (point clouds).  Each call to Render() reads the geometries'
+ * current transforms, projects their triangles and points into the image,
+ * bins them into square tiles, and rasterizes the tiles in parallel into a
+ * z-buffer with Meshing::Rasterizer2D.
+ *
+ * The image has vp.w x vp.h pixels, and depths outside the viewport's
+ * [n,f] range are discarded.  Geometry margins are not rendered.
+ */
+class DepthRenderer
+{
+ public:
+  DepthRenderer();
+  void Clear();
+  ///Adds a geometry to the scene.  The geometry must remain valid while the
+  ///renderer is in use, and its transform is read at each Render call.
+  ///resolution is passed to AnyGeometry3D::Convert when the geometry must
+  ///be converted to a mesh.
+  void Add(AnyCollisionGeometry3D& geom,Real resolution=0);
+  ///Renders a depth image.  depth(i,j) is the depth along the camera's
+  ///forward axis at column i and row j (counted from the top), or Inf if
+  ///nothing is visible.
+  void Render(const Camera::Viewport& vp,Array2D<Real>& depth);
+  ///Renders a structured point cloud of size vp.w x vp.h, with points in
+  ///the standard camera frame (+x right, +y down, +z forward) and the
+  ///viewpoint set to the camera's pose.  Pixels with no return have the
+  ///point (0,0,0).
+  void Render(const Camera::Viewport& vp,Meshing::PointCloud3D& pc);
+
+  ///Number of threads used in rendering (0 uses all hardware threads)
+  int numThreads;
+  ///Width / height of a rasterization tile, in pixels
+  int tileSize;
+
+  struct Item
+  {
+    const AnyCollisionGeometry3D* geom;
+    Meshing::TriMesh mesh;
+    bool isPointCloud;
+  };
+  std::vector<Item> items;
+
+  //temporary storage reused between frames
+  struct ScreenTriangle
+  {
+    Triangle2D tri;
+    //1/z at the vertices for perspective cameras, z for orthographic
+    Vector3 depthParams;
+  };
+  std::vector<ScreenTriangle> screenTris;
+  std::vector<Vector3> screenPoints;
+  std::vector<std::vector<int> > triBins,pointBins;
+  std::vector<Vector3> cameraVerts;
+  Array2D<Real> zbuffer;
+};
+
+///Convenience function: renders geoms from viewport vp into the
+///structured point cloud pc.  If many frames are rendered, use a
+///DepthRenderer instead so that the conversions are done only once.
+void RenderDepth(const Camera::Viewport& vp,const std::vector<AnyCollisionGeometry3D*>& geoms,Meshing::PointCloud3D& pc,int numThreads=0);
+
+/*@}*/
+
+} //namespace Geometry
+
+#endif
@@ -1,4 +1,5 @@
 #include "Fitting.h"
+#include "KDTree.h"
 #include <errors.h>
 //#include <math3d/LinearAlgebra.h>
 #include <math3d/Circle2D.h>
@@ -8,6 +9,9 @@
 #include <math/matrix.h>
 #include <math/vector.h>
 #include <math/SVDecomposition.h>
+#include <utils/threadutils.h>
+#include <algorithm>
+#include <queue>
 using namespace Math;
 using namespace std;
 
@@ -219,4 +223,80 @@ bool FitCircle(const std::vector<Vector2>& pts,Circle2D& c)
   return true;
 }
 
+void EstimateNormals(const vector<Vector3>& pts,const FlatKDTree& tree,int k,vector<Vector3>& normals,int numThreads)
+{
+  normals.resize(pts.size());
+  k = Min(k,(int)pts.size());
+  ParallelFor((int)pts.size(),[&](int i) {
+      vector<Real> dist(k);
+      vector<int> idx(k);
+      Real x[3];
+      pts[i].get(x[0],x[1],x[2]);
+      tree.KClosestPoints(x,k,&dist[0],&idx[0]);
+      vector<Vector3> nbrs(k);
+      for(int j=0;j<k;j++) nbrs[j] = pts[idx[j]];
+      Plane3D p;
+      if(k >= 3 && FitPlane(nbrs,p)) normals[i] = p.normal;
+      else normals[i].setZero();
+    },numThreads,256);
+}
+
+//orders points by decreasing height
+struct HigherPoint
+{
+  const vector<Vector3>& pts;
+  HigherPoint(const vector<Vector3>& _pts) : pts(_pts) {}
+  bool operator ()(int a,int b) const { return pts[a].z > pts[b].z; }
+};
+
+void OrientNormals(const vector<Vector3>& pts,const FlatKDTree& tree,int k,vector<Vector3>& normals)
+{
+  Assert(normals.size() == pts.size());
+  int n = (int)pts.size();
+  //the point itself is its own nearest neighbor
+  int kq = Min(k+1,n);
+  vector<int> nbrs(size_t(n)*kq);
+  ParallelFor(n,[&](int i) {
+      vector<Real> dist(kq);
+      Real x[3];
+      pts[i].get(x[0],x[1],x[2]);
+      tree.KClosestPoints(x,kq,&dist[0],&nbrs[size_t(i)*kq]);
+    },0,256);
+  //symmetrize the graph
+  vector<vector<int> > adj(n);
+  for(int i=0;i<n;i++) {
+    for(int j=0;j<kq;j++) {
+      int nb = nbrs[size_t(i)*kq+j];
+      if(nb < 0 || nb == i) continue;
+      adj[i].push_back(nb);
+      adj[nb].push_back(i);
+    }
+  }
+  vector<int> order(n);
+  for(int i=0;i<n;i++) order[i] = i;
+  sort(order.begin(),order.end(),HigherPoint(pts));
+  //Prim's algorithm with edge cost 1-|ni.nj|; entries are (-cost,(point,parent))
+  vector<char> visited(n,0);
+  priority_queue<pair<Real,pair<int,int> > > q;
+  for(int s=0;s<n;s++) {
+    int root = order[s];
+    if(visited[root]) continue;
+    if(normals[root].z < 0) normals[root] = -normals[root];
+    q.push(make_pair(Real(0),make_pair(root,root)));
+    while(!q.empty()) {
+      int i = q.top().second.first;
+      int parent = q.top().second.second;
+      q.pop();
+      if(visited[i]) continue;
+      visited[i] = 1;
+      if(dot(normals[i],normals[parent]) < 0) normals[i] = -normals[i];
+      for(size_t j=0;j<adj[i].size();j++) {
+        int nb = adj[i][j];
+        if(!visited[nb])
+          q.push(make_pair(Abs(dot(normals[i],normals[nb]))-1,make_pair(nb,i)));
+      }
+    }
+  }
+}
+
 } //namespace Geometry
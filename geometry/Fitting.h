@@ -17,6 +17,8 @@ namespace Geometry {
 
 using namespace Math3D;
 
+class FlatKDTree;
+
 Vector2 GetMean(const std::vector<Vector2>& pts);
 Vector3 GetMean(const std::vector<Vector3>& pts);
 void GetCovariance(const std::vector<Vector2>& pts,Matrix2& C);
@@ -30,6 +32,15 @@ bool FitLine(const std::vector<Vector3>& pts,Line3D& l);
 bool FitPlane(const std::vector<Vector3>& pts,Plane3D& p);
 
 bool FitCircle(const std::vector<Vector2>& pts,Circle2D& c);
+
+///Estimates unoriented normals of pts by fitting planes to their k nearest
+///neighbors, found in tree (built on pts), on numThreads threads.  Normals
+///that can't be fit are set to zero.
+void EstimateNormals(const std::vector<Vector3>& pts,const FlatKDTree& tree,int k,std::vector<Vector3>& normals,int numThreads=0);
+///Flips normals to be consistently oriented by propagating the orientation
+///along a minimum spanning tree of the k nearest neighbor graph, starting
+///from the highest point of each connected component with an upward normal.
+void OrientNormals(const std::vector<Vector3>& pts,const FlatKDTree& tree,int k,std::vector<Vector3>& normals);
 //bool FitEllipse(const std::vector<Vector2>& pts,Ellipse2D& c);
 
 } //namespace Geometry
@@ -123,7 +123,7 @@ void GridHash::GetRange(Index& imin,Index& imax) const
   for(HashTable::const_iterator i=buckets.begin();i!=buckets.end();i++) {
     const Index& idx=i->first;
     assert((int)idx.size() == hinv.n);
-    for(size_t k=0;k<idx.size();i++) {
+    for(size_t k=0;k<idx.size();k++) {
       if(idx[k] < imin[k]) imin[k] = idx[k];
       else if(idx[k] > imax[k]) imax[k] = idx[k];
     }
@@ -196,14 +196,11 @@ bool GridHash::BallQuery(const Vector& c,Real r,QueryCallback f) const
 {
   //TODO: crop out boxes not intersected by sphere?
   Index imin,imax;
-  Vector u;
-  PointToIndex(c,imin,u);
-  for(int k=0;k<c.n;k++) {
-    int ik=imin[k];
-    Real r_over_h = r*hinv(k);
-    imin[k] = ik - (int)Floor(u(k)-r_over_h);
-    imax[k] = ik + (int)Floor(u(k)+r_over_h);
-  }
+  Vector bmin=c,bmax=c;
+  for(int k=0;k<c.n;k++) bmin[k] -= r;
+  for(int k=0;k<c.n;k++) bmax[k] += r;
+  PointToIndex(bmin,imin);
+  PointToIndex(bmax,imax);
   return IndexQuery(imin,imax,f);
 }
 
@@ -260,15 +257,11 @@ void GridHash::BallItems(const Vector& c,Real r,vector<void*>& objs) const
 {
   //TODO: crop out boxes not intersected by sphere?
   Index imin,imax;
-  Vector u;
-  PointToIndex(c,imin,u);
-  imax = imin;
-  for(int k=0;k<c.n;k++) {
-    int ik=imin[k];
-    Real r_over_h = r*hinv(k);
-    imin[k] = ik - (int)Floor(u(k)-r_over_h);
-    imax[k] = ik + (int)Floor(u(k)+r_over_h);
-  }
+  Vector bmin=c,bmax=c;
+  for(int k=0;k<c.n;k++) bmin[k] -= r;
+  for(int k=0;k<c.n;k++) bmax[k] += r;
+  PointToIndex(bmin,imin);
+  PointToIndex(bmax,imax);
   IndexItems(imin,imax,objs);
 }
 
@@ -441,7 +434,6 @@ bool GridSubdivision::IndexQuery(const Index& imin,const Index& imax,QueryCallba
   for(size_t k=0;k<imin.size();k++)
     numBuckets *= (imax[k]-imin[k]+1);
   if(numBuckets >= (int)buckets.size()) {
-    LOG4CXX_INFO(KrisLibrary::logger(),"GridSubdivision: All-bucket iterating\n");
     for(HashTable::const_iterator i=buckets.begin();i!=buckets.end();i++) {
       bool test = true;
       for(size_t k=0;k<imin.size();k++)
@@ -455,7 +447,6 @@ bool GridSubdivision::IndexQuery(const Index& imin,const Index& imax,QueryCallba
     }
   }
   else {
-    LOG4CXX_INFO(KrisLibrary::logger(),"GridSubdivision: Range iterating\n");
     Index i=imin;
     for(;;) {
       HashTable::const_iterator item = buckets.find(i);
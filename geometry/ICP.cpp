@@ -0,0 +1,221 @@
+#include <log4cxx/logger.h>
+#include <KrisLibrary/Logger.h>
+#include "ICP.h"
+#include "KDTree.h"
+#include "CollisionMesh.h"
+#include "Fitting.h"
+#include <KrisLibrary/meshing/PointCloud.h>
+#include <KrisLibrary/math3d/rotationfit.h>
+#include <KrisLibrary/math3d/rotation.h>
+#include <KrisLibrary/math3d/Plane3D.h>
+#include <KrisLibrary/math/LDL.h>
+#include <KrisLibrary/utils/IntTriple.h>
+#include <KrisLibrary/utils/threadutils.h>
+#include <algorithm>
+using namespace Geometry;
+using namespace std;
+
+//number of neighbors used to estimate target normals
+static const int kNormalNeighbors = 10;
+
+ICPSettings::ICPSettings()
+  :mode(PointToPoint),maxIters(50),maxDistance(Inf),trimFraction(1.0),tolerance(1e-6),numThreads(0)
+{}
+
+ICPStats::ICPStats()
+  :iterations(0),converged(false),rmsError(0),numInliers(0)
+{}
+
+//Replaces the points in each voxel of the given size by their centroid
+static void VoxelCentroids(const vector<Vector3>& pts,Real size,vector<Vector3>& res)
+{
+  vector<pair<IntTriple,int> > keys(pts.size());
+  for(size_t i=0;i<pts.size();i++) {
+    keys[i].first.set((int)Floor(pts[i].x/size),(int)Floor(pts[i].y/size),(int)Floor(pts[i].z/size));
+    keys[i].second = (int)i;
+  }
+  sort(keys.begin(),keys.end());
+  res.resize(0);
+  for(size_t i=0;i<keys.size();) {
+    size_t j=i;
+    Vector3 sum(Zero);
+    for(;j<keys.size() && keys[j].first == keys[i].first;j++)
+      sum += pts[keys[j].second];
+    res.push_back(sum/Real(j-i));
+    i = j;
+  }
+}
+
+//Solves the linearized point-to-plane problem
+//min sum (n.(x+w x x+t-q))^2 over the rotation vector w and translation t,
+//and returns the incremental transform
+static bool PointToPlaneStep(const vector<Vector3>& x,const vector<Vector3>& q,const vector<Vector3>& n,RigidTransform& dT)
+{
+  Matrix A(6,6,Zero);
+  Vector b(6,Zero),row(6),sol(6);
+  for(size_t i=0;i<x.size();i++) {
+    Vector3 c = cross(x[i],n[i]);
+    row(0)=c.x; row(1)=c.y; row(2)=c.z;
+    row(3)=n[i].x; row(4)=n[i].y; row(5)=n[i].z;
+    Real r = dot(n[i],q[i]-x[i]);
+    for(int j=0;j<6;j++) {
+      b(j) += row(j)*r;
+      for(int k=0;k<6;k++) A(j,k) += row(j)*row(k);
+    }
+  }
+  LDLDecomposition<Real> ldl(A);
+  if(!ldl.backSub(b,sol)) return false;
+  MomentRotation m(sol(0),sol(1),sol(2));
+  m.getMatrix(dT.R);
+  dT.t.set(sol(3),sol(4),sol(5));
+  return true;
+}
+
+//Runs ICP on pts at one resolution level.  closest(x,q,n) computes the
+//closest point q on the target to x and the target normal n there, and
+//returns false if there is none.
+template <class Closest>
+static bool ICPLevel(const vector<Vector3>& pts,Closest closest,RigidTransform& T,const ICPSettings& settings,ICPStats& stats)
+{
+  bool plane = (settings.mode == ICPSettings::PointToPlane);
+  int N = (int)pts.size();
+  vector<Vector3> x(N),q(N),n(N);
+  vector<Real> dist(N);
+  vector<char> valid(N);
+  vector<Real> inlierDist;
+  vector<Vector3> a,b,c;
+  stats.converged = false;
+  for(int iter=0;iter<settings.maxIters;iter++) {
+    ParallelFor(N,[&](int i) {
+        x[i] = T*pts[i];
+        valid[i] = closest(x[i],q[i],n[i]);
+        if(valid[i]) {
+          dist[i] = x[i].distance(q[i]);
+          if(dist[i] > settings.maxDistance) valid[i] = 0;
+        }
+      },settings.numThreads,256);
+    //trim to the closest fraction of the correspondences
+    inlierDist.resize(0);
+    for(int i=0;i<N;i++)
+      if(valid[i]) inlierDist.push_back(dist[i]);
+    Real cutoff = Inf;
+    if(settings.trimFraction < 1 && !inlierDist.empty()) {
+      size_t m = (size_t)Floor(settings.trimFraction*(inlierDist.size()-1));
+      nth_element(inlierDist.begin(),inlierDist.begin()+m,inlierDist.end());
+      cutoff = inlierDist[m];
+    }
+    a.resize(0);
+    b.resize(0);
+    c.resize(0);
+    Real sse = 0;
+    for(int i=0;i<N;i++) {
+      if(!valid[i] || dist[i] > cutoff) continue;
+      if(plane) {
+        if(n[i].isZero()) continue;
+        sse += Sqr(dot(n[i],x[i]-q[i]));
+        a.push_back(x[i]);
+        c.push_back(n[i]);
+      }
+      else {
+        sse += Sqr(dist[i]);
+        a.push_back(pts[i]);
+      }
+      b.push_back(q[i]);
+    }
+    stats.iterations++;
+    stats.numInliers = (int)a.size();
+    if(a.size() < (plane ? 6 : 3)) {
+      LOG4CXX_WARN(KrisLibrary::logger(),"ICP: only "<<a.size()<<" correspondences, stopping");
+      return false;
+    }
+    stats.rmsError = Sqrt(sse/a.size());
+    stats.errorHistory.push_back(stats.rmsError);
+
+    RigidTransform Tnew,dT;
+    if(plane) {
+      if(!PointToPlaneStep(a,b,c,dT)) {
+        LOG4CXX_WARN(KrisLibrary::logger(),"ICP: degenerate point-to-plane system, stopping");
+        return false;
+      }
+      Tnew = dT*T;
+      //re-orthogonalize the linearized rotation
+      QuaternionRotation qr;
+      qr.setMatrix(Tnew.R);
+      qr.inplaceNormalize();
+      qr.getMatrix(Tnew.R);
+    }
+    else {
+      TransformFit(a,b,Tnew.R,Tnew.t);
+    }
+    //convergence check on the change in the source's pose
+    RigidTransform Tinv;
+    Tinv.setInverse(T);
+    dT = Tnew*Tinv;
+    T = Tnew;
+    Real cosAngle = Clamp(0.5*(dT.R.trace()-1),-1.0,1.0);
+    if(dT.t.norm() < settings.tolerance && Acos(cosAngle) < settings.tolerance) {
+      stats.converged = true;
+      break;
+    }
+  }
+  return true;
+}
+
+template <class Closest>
+static bool RunICP(const Meshing::PointCloud3D& source,Closest closest,RigidTransform& T,const ICPSettings& settings,ICPStats& stats)
+{
+  stats = ICPStats();
+  vector<Real> levels = settings.voxelSizes;
+  if(levels.empty()) levels.push_back(0);
+  vector<Vector3> pts;
+  for(size_t l=0;l<levels.size();l++) {
+    if(levels[l] > 0) VoxelCentroids(source.points,levels[l],pts);
+    if(!ICPLevel((levels[l] > 0 ? pts : source.points),closest,T,settings,stats))
+      return false;
+  }
+  return true;
+}
+
+bool Geometry::ICP(const Meshing::PointCloud3D& source,const Meshing::PointCloud3D& target,RigidTransform& T,const ICPSettings& settings,ICPStats& stats)
+{
+  const vector<Vector3>& tpts = target.points;
+  if(tpts.empty()) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"ICP: target is empty");
+    return false;
+  }
+  vector<Real> coords(tpts.size()*3);
+  for(size_t i=0;i<tpts.size();i++)
+    tpts[i].get(coords[i*3],coords[i*3+1],coords[i*3+2]);
+  FlatKDTree tree;
+  tree.Build(&coords[0],(int)tpts.size(),3,8,settings.numThreads);
+  vector<Vector3> normals;
+  if(settings.mode == ICPSettings::PointToPlane) {
+    if(!target.GetNormals(normals))
+      EstimateNormals(tpts,tree,kNormalNeighbors,normals,settings.numThreads);
+  }
+  return RunICP(source,[&](const Vector3& x,Vector3& q,Vector3& n) {
+      Real p[3],d;
+      x.get(p[0],p[1],p[2]);
+      int i = tree.ClosestPoint(p,d);
+      if(i < 0) return false;
+      q = tpts[i];
+      if(!normals.empty()) n = normals[i];
+      return true;
+    },T,settings,stats);
+}
+
+bool Geometry::ICP(const Meshing::PointCloud3D& source,const CollisionMesh& target,RigidTransform& T,const ICPSettings& settings,ICPStats& stats)
+{
+  if(target.tris.empty()) {
+    LOG4CXX_WARN(KrisLibrary::logger(),"ICP: target is empty");
+    return false;
+  }
+  return RunICP(source,[&](const Vector3& x,Vector3& q,Vector3& n) {
+      Vector3 cp;
+      int t = ClosestPoint(target,x,cp);
+      if(t < 0) return false;
+      q = target.currentTransform*cp;
+      n = target.currentTransform.R*target.TriangleNormal(t);
+      return true;
+    },T,settings,stats);
+}
@@ -0,0 +1,98 @@
+#ifndef GEOMETRY_ICP_H
+#define GEOMETRY_ICP_H
+
+#include <KrisLibrary/math3d/primitives.h>
+#include <vector>
+
+namespace Meshing {
+  class PointCloud3D;
+} //namespace Meshing
+
+/** @file geometry/ICP.h
+ * @ingroup Geometry
+ * @brief Rigid registration of point clouds by the iterative closest point
+ * algorithm.
+ */
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+  class CollisionMesh;
+
+/** @addtogroup Geometry */
+/*@{*/
+
+/** @brief Settings for ICP.
+ *
+ * - mode: PointToPoint minimizes the distances between corresponding
+ *   points.  PointToPlane minimizes the distances along the target normal,
+ *   which converges faster on smooth surfaces.
+ * - maxIters: maximum number of iterations per resolution level.
+ * - maxDistance: correspondences farther apart than this are rejected.
+ * - trimFraction: only this fraction of the closest correspondences are
+ *   used in each iteration (trimmed ICP).
+ * - tolerance: iteration stops when an update moves the source by less than
+ *   tolerance in translation and in rotation angle (radians).
+ * - voxelSizes: the source is downsampled to the centroids of voxels of
+ *   each of these sizes, coarse to fine, and ICP is run on each level.  A
+ *   size of 0 uses the whole cloud.  Empty means a single full-resolution
+ *   level.
+ * - numThreads: number of threads for the correspondence search (0 uses all
+ *   hardware threads).
+ */
+struct ICPSettings
+{
+  enum Mode { PointToPoint, PointToPlane };
+
+  ICPSettings();
+
+  Mode mode;
+  int maxIters;
+  Real maxDistance;
+  Real trimFraction;
+  Real tolerance;
+  std::vector<Real> voxelSizes;
+  int numThreads;
+};
+
+/** @brief Convergence statistics of an ICP run.
+ *
+ * rmsError and numInliers are for the last iteration, and errorHistory holds
+ * the rms error of the inliers at every iteration.  converged is true if the
+ * last level stopped by meeting the tolerance rather than by running out of
+ * iterations.
+ */
+struct ICPStats
+{
+  ICPStats();
+
+  int iterations;
+  bool converged;
+  Real rmsError;
+  int numInliers;
+  std::vector<Real> errorHistory;
+};
+
+/** @brief Registers source to the target point cloud.
+ *
+ * On input T is the initial guess, and on output it's the transform taking
+ * source points into the target's frame.  Correspondences are found with a
+ * FlatKDTree on the target.  For point-to-plane, the target's normals are
+ * used if it has them, and otherwise estimated from its neighbors.
+ *
+ * Returns false if there are too few correspondences to fit a transform.
+ */
+bool ICP(const Meshing::PointCloud3D& source,const Meshing::PointCloud3D& target,RigidTransform& T,const ICPSettings& settings,ICPStats& stats);
+
+/** @brief Registers source to a mesh, whose current transform is taken into
+ * account.  Correspondences are the closest points on the mesh, found
+ * through its PQP hierarchy, and normals are triangle normals.
+ */
+bool ICP(const Meshing::PointCloud3D& source,const CollisionMesh& target,RigidTransform& T,const ICPSettings& settings,ICPStats& stats);
+
+/*@}*/
+
+} //namespace Geometry
+
+#endif
@@ -5,6 +5,8 @@
 #include <math/random.h>
 #include <utils/arrayutils.h>
 #include <errors.h>
+#include <utils/threadutils.h>
+#include <algorithm>
 using namespace Geometry;
 using namespace std;
 
@@ -448,3 +450,290 @@ void KDTree::_KClosestPoints2(const Vector& pt,int k,Real* dist,int* idx,int& ma
       pos->_KClosestPoints2(pt,k,dist,idx,maxdist,norm,weights);
   }
 }
+
+
+//Chooses the dimension of largest spread of the points perm[node.begin,
+//node.end) and partitions them about its median.  Returns false if all the
+//points are equal.
+static bool SplitFlatNode(const Real* pts,int d,vector<int>& perm,FlatKDTree::Node& node,int& mid)
+{
+  vector<Real> bmin(pts+size_t(perm[node.begin])*d,pts+size_t(perm[node.begin])*d+d),bmax(bmin);
+  for(int i=node.begin+1;i<node.end;i++) {
+    const Real* x = pts+size_t(perm[i])*d;
+    for(int j=0;j<d;j++) {
+      if(x[j] < bmin[j]) bmin[j] = x[j];
+      else if(x[j] > bmax[j]) bmax[j] = x[j];
+    }
+  }
+  int best = -1;
+  Real spread = 0;
+  for(int j=0;j<d;j++)
+    if(bmax[j]-bmin[j] > spread) {
+      spread = bmax[j]-bmin[j];
+      best = j;
+    }
+  if(best < 0) return false;
+  mid = (node.begin+node.end)/2;
+  std::nth_element(perm.begin()+node.begin,perm.begin()+mid,perm.begin()+node.end,[pts,d,best](int a,int b) {
+      return pts[size_t(a)*d+best] < pts[size_t(b)*d+best];
+    });
+  node.splitDim = best;
+  node.splitVal = pts[size_t(perm[mid])*d+best];
+  return true;
+}
+
+//Splits nodes[n] if it has too many points, adding its children to the end
+//of nodes.  Returns true if it was split.
+static bool SplitFlatNode(const Real* pts,int d,int maxLeafPoints,vector<int>& perm,vector<FlatKDTree::Node>& nodes,int n)
+{
+  FlatKDTree::Node node = nodes[n];
+  int mid;
+  if(node.end-node.begin <= maxLeafPoints || !SplitFlatNode(pts,d,perm,node,mid))
+    return false;
+  node.child = (int)nodes.size();
+  nodes[n] = node;
+  FlatKDTree::Node c;
+  c.splitDim = -1;
+  c.splitVal = 0;
+  c.child = -1;
+  c.begin = node.begin;
+  c.end = mid;
+  nodes.push_back(c);
+  c.begin = mid;
+  c.end = node.end;
+  nodes.push_back(c);
+  return true;
+}
+
+static void BuildFlatSubtree(const Real* pts,int d,int maxLeafPoints,vector<int>& perm,vector<FlatKDTree::Node>& nodes,int n)
+{
+  if(!SplitFlatNode(pts,d,maxLeafPoints,perm,nodes,n)) return;
+  int c = nodes[n].child;
+  BuildFlatSubtree(pts,d,maxLeafPoints,perm,nodes,c);
+  BuildFlatSubtree(pts,d,maxLeafPoints,perm,nodes,c+1);
+}
+
+FlatKDTree::FlatKDTree()
+  :dims(0)
+{}
+
+void FlatKDTree::Clear()
+{
+  dims = 0;
+  coords.clear();
+  ids.clear();
+  nodes.clear();
+}
+
+void FlatKDTree::Build(const std::vector<Vector>& pts,int maxLeafPoints,int numThreads)
+{
+  if(pts.empty()) {
+    Clear();
+    return;
+  }
+  int d = pts[0].n;
+  vector<Real> buf(pts.size()*d);
+  for(size_t i=0;i<pts.size();i++) {
+    Assert(pts[i].n == d);
+    for(int j=0;j<d;j++) buf[i*d+j] = pts[i](j);
+  }
+  Build(&buf[0],(int)pts.size(),d,maxLeafPoints,numThreads);
+}
+
+void FlatKDTree::Build(const Real* pts,int numPoints,int d,int maxLeafPoints,int numThreads)
+{
+  Clear();
+  if(numPoints == 0) return;
+  Assert(maxLeafPoints >= 1);
+  dims = d;
+  vector<int> perm(numPoints);
+  for(int i=0;i<numPoints;i++) perm[i] = i;
+  Node root;
+  root.splitDim = -1;
+  root.splitVal = 0;
+  root.child = -1;
+  root.begin = 0;
+  root.end = numPoints;
+  nodes.push_back(root);
+
+  //split the top of the tree breadth-first until there are enough subtrees
+  //to keep the threads busy, then build the subtrees in parallel
+  if(numThreads <= 0) numThreads = NumHardwareThreads();
+  vector<int> frontier(1,0),next;
+  if(numThreads > 1) {
+    size_t target = 8*(size_t)numThreads;
+    while(!frontier.empty() && frontier.size() < target) {
+      next.resize(0);
+      for(size_t i=0;i<frontier.size();i++) {
+        if(SplitFlatNode(pts,d,maxLeafPoints,perm,nodes,frontier[i])) {
+          next.push_back(nodes[frontier[i]].child);
+          next.push_back(nodes[frontier[i]].child+1);
+        }
+      }
+      frontier.swap(next);
+    }
+  }
+  vector<vector<Node> > subtrees(frontier.size());
+  ParallelFor((int)frontier.size(),[&](int i) {
+      subtrees[i].push_back(nodes[frontier[i]]);
+      BuildFlatSubtree(pts,d,maxLeafPoints,perm,subtrees[i],0);
+    },numThreads);
+  //splice the subtrees in; subtree node c>0 goes to base+c-1
+  for(size_t i=0;i<frontier.size();i++) {
+    int base = (int)nodes.size();
+    vector<Node>& sub = subtrees[i];
+    for(size_t j=0;j<sub.size();j++)
+      if(sub[j].child >= 0) sub[j].child += base-1;
+    nodes[frontier[i]] = sub[0];
+    nodes.insert(nodes.end(),sub.begin()+1,sub.end());
+  }
+
+  coords.resize(size_t(numPoints)*d);
+  ParallelFor(numPoints,[&](int i) {
+      std::copy(pts+size_t(perm[i])*d,pts+size_t(perm[i]+1)*d,coords.begin()+size_t(i)*d);
+    },numThreads,1024);
+  ids.swap(perm);
+}
+
+//k-nearest neighbor search.  heap is a max-heap of (squared distance,tree
+//order index) pairs, rd is the squared distance from pt to the node's cell,
+//and off holds the per-dimension offsets making up rd.  Cells are skipped
+//if rd*epsScale isn't closer than the current k'th neighbor.
+static void FlatKNN(const FlatKDTree& tree,int n,const Real* pt,Real rd,Real* off,size_t k,vector<pair<Real,int> >& heap,Real epsScale)
+{
+  const FlatKDTree::Node& node = tree.nodes[n];
+  int d = tree.dims;
+  if(node.splitDim < 0) {
+    for(int i=node.begin;i<node.end;i++) {
+      const Real* x = tree.Point(i);
+      Real d2 = 0;
+      for(int j=0;j<d;j++) d2 += Sqr(x[j]-pt[j]);
+      if(heap.size() < k) {
+        heap.push_back(pair<Real,int>(d2,i));
+        std::push_heap(heap.begin(),heap.end());
+      }
+      else if(d2 < heap.front().first) {
+        std::pop_heap(heap.begin(),heap.end());
+        heap.back() = pair<Real,int>(d2,i);
+        std::push_heap(heap.begin(),heap.end());
+      }
+    }
+    return;
+  }
+  Real diff = pt[node.splitDim]-node.splitVal;
+  int nearChild = (diff <= 0 ? node.child : node.child+1);
+  FlatKNN(tree,nearChild,pt,rd,off,k,heap,epsScale);
+  Real old = off[node.splitDim];
+  Real rdfar = rd - Sqr(old) + Sqr(diff);
+  if(heap.size() < k || rdfar*epsScale < heap.front().first) {
+    off[node.splitDim] = diff;
+    FlatKNN(tree,(diff <= 0 ? node.child+1 : node.child),pt,rdfar,off,k,heap,epsScale);
+    off[node.splitDim] = old;
+  }
+}
+
+static void FlatClosePoints(const FlatKDTree& tree,int n,const Real* pt,Real rd,Real* off,Real r2,vector<Real>& distances,vector<int>& ids)
+{
+  const FlatKDTree::Node& node = tree.nodes[n];
+  int d = tree.dims;
+  if(node.splitDim < 0) {
+    for(int i=node.begin;i<node.end;i++) {
+      const Real* x = tree.Point(i);
+      Real d2 = 0;
+      for(int j=0;j<d;j++) d2 += Sqr(x[j]-pt[j]);
+      if(d2 <= r2) {
+        distances.push_back(Sqrt(d2));
+        ids.push_back(tree.ids[i]);
+      }
+    }
+    return;
+  }
+  Real diff = pt[node.splitDim]-node.splitVal;
+  FlatClosePoints(tree,(diff <= 0 ? node.child : node.child+1),pt,rd,off,r2,distances,ids);
+  Real old = off[node.splitDim];
+  Real rdfar = rd - Sqr(old) + Sqr(diff);
+  if(rdfar <= r2) {
+    off[node.splitDim] = diff;
+    FlatClosePoints(tree,(diff <= 0 ? node.child+1 : node.child),pt,rdfar,off,r2,distances,ids);
+    off[node.splitDim] = old;
+  }
+}
+
+int FlatKDTree::ClosestPoint(const Real* pt,Real& dist,Real eps) const
+{
+  int idx;
+  KClosestPoints(pt,1,&dist,&idx,eps);
+  return idx;
+}
+
+int FlatKDTree::ClosestPoint(const Vector& pt,Real& dist,Real eps) const
+{
+  int idx;
+  KClosestPoints(pt,1,&dist,&idx,eps);
+  return idx;
+}
+
+void FlatKDTree::KClosestPoints(const Real* pt,int k,Real* dist,int* idx,Real eps) const
+{
+  vector<pair<Real,int> > heap;
+  if(!nodes.empty() && k > 0) {
+    heap.reserve(k);
+    vector<Real> off(dims,0);
+    FlatKNN(*this,0,pt,0,&off[0],(size_t)k,heap,Sqr(1+eps));
+    std::sort_heap(heap.begin(),heap.end());
+  }
+  for(int i=0;i<k;i++) {
+    if(i < (int)heap.size()) {
+      dist[i] = Sqrt(heap[i].first);
+      idx[i] = ids[heap[i].second];
+    }
+    else {
+      dist[i] = Inf;
+      idx[i] = -1;
+    }
+  }
+}
+
+void FlatKDTree::KClosestPoints(const Vector& pt,int k,Real* dist,int* idx,Real eps) const
+{
+  Assert(IsEmpty() || pt.n == dims);
+  vector<Real> x(pt.n);
+  for(int j=0;j<pt.n;j++) x[j] = pt(j);
+  KClosestPoints(x.empty() ? NULL : &x[0],k,dist,idx,eps);
+}
+
+void FlatKDTree::ClosePoints(const Real* pt,Real radius,std::vector<Real>& distances,std::vector<int>& _ids) const
+{
+  if(nodes.empty()) return;
+  vector<Real> off(dims,0);
+  FlatClosePoints(*this,0,pt,0,&off[0],Sqr(radius),distances,_ids);
+}
+
+void FlatKDTree::ClosePoints(const Vector& pt,Real radius,std::vector<Real>& distances,std::vector<int>& _ids) const
+{
+  Assert(IsEmpty() || pt.n == dims);
+  vector<Real> x(pt.n);
+  for(int j=0;j<pt.n;j++) x[j] = pt(j);
+  ClosePoints(x.empty() ? NULL : &x[0],radius,distances,_ids);
+}
+
+void FlatKDTree::KClosestPoints(const Real* queries,int numQueries,int k,std::vector<Real>& dist,std::vector<int>& idx,Real eps,int numThreads) const
+{
+  dist.resize(size_t(numQueries)*k);
+  idx.resize(size_t(numQueries)*k);
+  if(k <= 0) return;
+  ParallelFor(numQueries,[&](int i) {
+      KClosestPoints(queries+size_t(i)*dims,k,&dist[size_t(i)*k],&idx[size_t(i)*k],eps);
+    },numThreads,64);
+}
+
+void FlatKDTree::ClosePoints(const Real* queries,int numQueries,Real radius,std::vector<std::vector<Real> >& distances,std::vector<std::vector<int> >& _ids,int numThreads) const
+{
+  distances.resize(numQueries);
+  _ids.resize(numQueries);
+  ParallelFor(numQueries,[&](int i) {
+      distances[i].resize(0);
+      _ids[i].resize(0);
+      ClosePoints(queries+size_t(i)*dims,radius,distances[i],_ids[i]);
+    },numThreads,64);
+}
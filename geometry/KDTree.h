@@ -109,6 +109,76 @@ private:
   int visits;
 };
 
+/** @ingroup Geometry
+ * @brief A static kd-tree stored in flat arrays.
+ *
+ * The points are copied into one contiguous buffer, reordered so that each
+ * leaf holds a contiguous range, and the nodes are stored in a compact array.
+ * This is much faster to build and search than KDTree for large point sets,
+ * but points can't be inserted after Build().
+ *
+ * The query functions mirror those of KDTree and use the Euclidean norm.
+ * Nearest neighbor queries take an optional eps, which makes the search
+ * (1+eps)-approximate: every returned distance is within a factor of 1+eps
+ * of the true k'th nearest distance.
+ */
+class FlatKDTree
+{
+ public:
+  struct Node {
+    ///The split dimension, or -1 for a leaf
+    int splitDim;
+    Real splitVal;
+    ///Index of the first child in nodes (the second is child+1).  The first
+    ///child holds the points with x(splitDim) <= splitVal, the second the
+    ///points with x(splitDim) >= splitVal.
+    int child;
+    ///Range of the node's points in the tree order
+    int begin,end;
+  };
+
+  FlatKDTree();
+  ///Builds the tree on numPoints points of dimension d stored contiguously
+  ///in pts.  Subtrees are built on numThreads threads (0 uses all hardware
+  ///threads).
+  void Build(const Real* pts,int numPoints,int d,int maxLeafPoints=8,int numThreads=0);
+  void Build(const std::vector<Vector>& pts,int maxLeafPoints=8,int numThreads=0);
+  void Clear();
+  inline bool IsEmpty() const { return ids.empty(); }
+  inline int NumPoints() const { return (int)ids.size(); }
+  inline int Dimension() const { return dims; }
+  ///Returns the i'th point in tree order; its index in the input is ids[i]
+  inline const Real* Point(int i) const { return &coords[size_t(i)*dims]; }
+
+  ///returns the index of the closest point to pt, and its distance in dist
+  int ClosestPoint(const Real* pt,Real& dist,Real eps=0) const;
+  int ClosestPoint(const Vector& pt,Real& dist,Real eps=0) const;
+  ///returns the indices and distances of the k closest points to pt, sorted
+  ///by increasing distance.  dist and idx are assumed to point to arrays of
+  ///length k.  If there are fewer than k points the remaining entries are
+  ///Inf and -1.
+  void KClosestPoints(const Real* pt,int k,Real* dist,int* idx,Real eps=0) const;
+  void KClosestPoints(const Vector& pt,int k,Real* dist,int* idx,Real eps=0) const;
+  ///computes the set of points within the given radius, inclusive
+  void ClosePoints(const Real* pt,Real radius,std::vector<Real>& distances,std::vector<int>& ids) const;
+  void ClosePoints(const Vector& pt,Real radius,std::vector<Real>& distances,std::vector<int>& ids) const;
+
+  ///Batch k-nearest neighbors of the numQueries points stored contiguously
+  ///in queries, on numThreads threads.  dist and idx are filled with k
+  ///entries per query.
+  void KClosestPoints(const Real* queries,int numQueries,int k,std::vector<Real>& dist,std::vector<int>& idx,Real eps=0,int numThreads=0) const;
+  ///Batch radius queries
+  void ClosePoints(const Real* queries,int numQueries,Real radius,std::vector<std::vector<Real> >& distances,std::vector<std::vector<int> >& ids,int numThreads=0) const;
+
+  int dims;
+  ///The points in tree order, dims values per point
+  std::vector<Real> coords;
+  ///Index in the input of each point in tree order
+  std::vector<int> ids;
+  ///The nodes; nodes[0] is the root
+  std::vector<Node> nodes;
+};
+
 } //namespace Geometry
 
 #endif
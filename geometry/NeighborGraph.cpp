@@ -1,7 +1,8 @@
 #include <stdlib.h>
 #include "NeighborGraph.h"
-#include "GridSubdivision.h"
 #include "KDTree.h"
+#include <KrisLibrary/utils/threadutils.h>
+#include <algorithm>
 
 namespace Geometry {
 
@@ -12,30 +13,11 @@ void NeighborGraph(const Meshing::PointCloud3D& pc,Real R,Graph::UndirectedGraph
 
 void NeighborGraph(const vector<Vector3>& pc,Real R,Graph::UndirectedGraph<int,int>& G)
 {
-  GridSubdivision grid(3,R);
-  Vector temp(3);
-  GridSubdivision::Index index;
-  for(size_t i=0;i<pc.size();i++) {
-    pc[i].get(temp);
-    grid.PointToIndex(temp,index);
-    grid.Insert(index,(void*)&pc[i]);
-  }
-  G.Resize(pc.size());
-  for(size_t i=0;i<pc.size();i++) 
-    G.nodes[i] = (int)i;
-  for(size_t i=0;i<pc.size();i++) {
-    pc[i].get(temp);
-    GridSubdivision::ObjectSet items;
-    grid.BallItems(temp,R,items);
-    for(GridSubdivision::ObjectSet::const_iterator j=items.begin();j!=items.end();j++) {
-      const Vector3* ptr = (const Vector3*)(*j);
-      if(ptr->distanceSquared(pc[i]) > R*R) continue;
-      int jindex = ptr - &pc[0];
-      if(jindex <= (int)i) continue;
-      G.AddEdge((int)i,jindex,0);
-    }
-  }
+  CSRNeighborGraph csr;
+  NeighborGraph(pc,R,csr);
+  csr.GetGraph(G);
 }
+
 void NearestNeighborGraph(const Meshing::PointCloud3D& pc,int k,Graph::Graph<int,int>& G)
 {
   NearestNeighborGraph(pc.points,k,G);
@@ -43,24 +25,120 @@ void NearestNeighborGraph(const Meshing::PointCloud3D& pc,int k,Graph::Graph<int
 
 void NearestNeighborGraph(const vector<Vector3>& pc,int k,Graph::Graph<int,int>& G)
 {
-  vector<Vector> copy(pc.size());
-  for(size_t i=0;i<copy.size();i++) {
-    copy[i].resize(3);
-    pc[i].get(copy[i]);
+  //here the point itself counts as one of its k nearest neighbors
+  CSRNeighborGraph csr;
+  NearestNeighborGraph(pc,Max(k-1,0),csr);
+  csr.GetGraph(G);
+}
+
+void CSRNeighborGraph::GetGraph(Graph::Graph<int,int>& G) const
+{
+  int n = NumNodes();
+  G.Resize(n);
+  for(int i=0;i<n;i++) {
+    G.nodes[i] = i;
+    for(int e=offsets[i];e<offsets[i+1];e++)
+      G.AddEdge(i,neighbors[e],0);
   }
-  G.Resize(pc.size());
-  for(size_t i=0;i<pc.size();i++) 
-    G.nodes[i] = (int)i;
-  KDTree* tree = KDTree::Create(copy,3,pc.size());
-  vector<Real> dist(k);
-  vector<int> inds(k);
-  for(size_t i=0;i<pc.size();i++) {
-    tree->KClosestPoints(copy[i],k,&dist[0],&inds[0]);
-    for(int j=0;j<k;j++) {
-      if(inds[j] == (int)i) continue;
-      G.AddEdge((int)i,inds[j],0);
+}
+
+void CSRNeighborGraph::GetGraph(Graph::UndirectedGraph<int,int>& G) const
+{
+  int n = NumNodes();
+  G.Resize(n);
+  for(int i=0;i<n;i++) {
+    G.nodes[i] = i;
+    for(int e=offsets[i];e<offsets[i+1];e++) {
+      int j = neighbors[e];
+      if(j > i || (j < i && !G.HasEdge(i,j)))
+        G.AddEdge(i,j,0);
     }
   }
 }
 
+//Number of points whose neighbors are gathered by one task
+static const int kNeighborBlock = 1024;
+
+//Fills G from the points' neighbor lists, which are computed by
+//query(i,dists,ids) for each point in parallel, in blocks of
+//kNeighborBlock.  query appends the neighbors of i, which may include i.
+template <class Query>
+static void BuildCSR(int n,CSRNeighborGraph& G,int numThreads,Query query)
+{
+  int numBlocks = (n+kNeighborBlock-1)/kNeighborBlock;
+  vector<vector<int> > blockIds(numBlocks);
+  vector<vector<Real> > blockDists(numBlocks);
+  G.offsets.resize(n+1);
+  G.offsets[0] = 0;
+  ParallelFor(numBlocks,[&](int b) {
+      vector<Real> d;
+      vector<int> ids;
+      vector<pair<Real,int> > items;
+      for(int i=b*kNeighborBlock;i<Min((b+1)*kNeighborBlock,n);i++) {
+        d.resize(0);
+        ids.resize(0);
+        query(i,d,ids);
+        items.resize(0);
+        for(size_t j=0;j<ids.size();j++)
+          if(ids[j] != i) items.push_back(pair<Real,int>(d[j],ids[j]));
+        std::sort(items.begin(),items.end());
+        for(size_t j=0;j<items.size();j++) {
+          blockDists[b].push_back(items[j].first);
+          blockIds[b].push_back(items[j].second);
+        }
+        //store the degree for now
+        G.offsets[i+1] = (int)items.size();
+      }
+    },numThreads);
+  for(int i=0;i<n;i++)
+    G.offsets[i+1] += G.offsets[i];
+  G.neighbors.resize(G.offsets[n]);
+  G.distances.resize(G.offsets[n]);
+  ParallelFor(numBlocks,[&](int b) {
+      int start = G.offsets[b*kNeighborBlock];
+      std::copy(blockIds[b].begin(),blockIds[b].end(),G.neighbors.begin()+start);
+      std::copy(blockDists[b].begin(),blockDists[b].end(),G.distances.begin()+start);
+    },numThreads);
+}
+
+static void BuildTree(const vector<Vector3>& pc,FlatKDTree& tree,vector<Real>& coords,int numThreads)
+{
+  coords.resize(pc.size()*3);
+  for(size_t i=0;i<pc.size();i++)
+    pc[i].get(coords[i*3],coords[i*3+1],coords[i*3+2]);
+  tree.Build(coords.empty() ? NULL : &coords[0],(int)pc.size(),3,8,numThreads);
+}
+
+void NeighborGraph(const vector<Vector3>& pc,Real R,CSRNeighborGraph& G,int numThreads)
+{
+  FlatKDTree tree;
+  vector<Real> coords;
+  BuildTree(pc,tree,coords,numThreads);
+  BuildCSR((int)pc.size(),G,numThreads,[&](int i,vector<Real>& d,vector<int>& ids) {
+      tree.ClosePoints(&coords[i*3],R,d,ids);
+    });
+}
+
+void NearestNeighborGraph(const vector<Vector3>& pc,int k,CSRNeighborGraph& G,int numThreads)
+{
+  FlatKDTree tree;
+  vector<Real> coords;
+  BuildTree(pc,tree,coords,numThreads);
+  //the point itself is usually its own nearest neighbor
+  int kq = Min(k+1,(int)pc.size());
+  BuildCSR((int)pc.size(),G,numThreads,[&](int i,vector<Real>& d,vector<int>& ids) {
+      d.resize(kq);
+      ids.resize(kq);
+      tree.KClosestPoints(&coords[i*3],kq,&d[0],&ids[0]);
+      //drop the point itself, or the farthest if it isn't found
+      bool found = false;
+      for(int j=0;j<kq;j++)
+        if(ids[j] == i) found = true;
+      if(!found && kq > k) {
+        d.resize(k);
+        ids.resize(k);
+      }
+    });
+}
+
 } //namespace Geometry
@@ -8,6 +8,38 @@ namespace Geometry {
   using namespace std;
   using namespace Math3D;
 
+/** @ingroup Geometry
+ * @brief A neighbor graph over a point set in compressed sparse row form.
+ *
+ * The neighbors of node i are neighbors[offsets[i]],...,
+ * neighbors[offsets[i+1]-1], sorted by increasing distance, and distances
+ * holds the distance to each.
+ */
+struct CSRNeighborGraph
+{
+  inline int NumNodes() const { return offsets.empty() ? 0 : (int)offsets.size()-1; }
+  inline int NumEdges() const { return (int)neighbors.size(); }
+  inline int Degree(int i) const { return offsets[i+1]-offsets[i]; }
+  inline const int* Neighbors(int i) const { return &neighbors[0]+offsets[i]; }
+  inline const Real* Distances(int i) const { return &distances[0]+offsets[i]; }
+  ///Converts to a Graph with an edge i->j for each neighbor j of i
+  void GetGraph(Graph::Graph<int,int>& G) const;
+  ///Converts to an UndirectedGraph with an edge for each pair of neighbors
+  void GetGraph(Graph::UndirectedGraph<int,int>& G) const;
+
+  vector<int> offsets;
+  vector<int> neighbors;
+  vector<Real> distances;
+};
+
+///Computes the graph connecting points within distance R of each other, on
+///numThreads threads (0 uses all hardware threads)
+void NeighborGraph(const vector<Vector3>& pc,Real R,CSRNeighborGraph& G,int numThreads=0);
+
+///Computes the graph connecting each point to its k nearest neighbors, on
+///numThreads threads (0 uses all hardware threads)
+void NearestNeighborGraph(const vector<Vector3>& pc,int k,CSRNeighborGraph& G,int numThreads=0);
+
 ///Computes a graph where each node is an index of a point in the point cloud
 ///and each edge connects points within distance R (in Euclidean space)
 void NeighborGraph(const Meshing::PointCloud3D& pc,Real R,Graph::UndirectedGraph<int,int>& G);
@@ -6,6 +6,10 @@
 #include <errors.h>
 #include <algorithm> //for sort
 #include <Timer.h>
+#include <myfile.h>
+#include <utils/bits.h>
+#include <utils/threadutils.h>
+#include <math/random.h>
 using namespace Geometry;
 using namespace Math3D;
 
@@ -328,6 +332,37 @@ void Octree::DeleteNode(int id)
 }
 
 
+bool Octree::Read(File& f)
+{
+  int n;
+  if(!ReadFile(f,n)) return false;
+  if(n <= 0) return false;
+  nodes.resize(n);
+  if(!f.ReadData(&nodes[0],n*sizeof(OctreeNode))) return false;
+  int nfree;
+  if(!ReadFile(f,nfree)) return false;
+  freeNodes.clear();
+  for(int i=0;i<nfree;i++) {
+    int index;
+    if(!ReadFile(f,index)) return false;
+    freeNodes.push_back(index);
+  }
+  return true;
+}
+
+bool Octree::Write(File& f) const
+{
+  int n=(int)nodes.size();
+  if(!WriteFile(f,n)) return false;
+  if(!f.WriteData(&nodes[0],n*sizeof(OctreeNode))) return false;
+  int nfree=(int)freeNodes.size();
+  if(!WriteFile(f,nfree)) return false;
+  for(list<int>::const_iterator i=freeNodes.begin();i!=freeNodes.end();i++)
+    if(!WriteFile(f,*i)) return false;
+  return true;
+}
+
+
 OctreePointSet::OctreePointSet(const AABB3D& bbox,int _maxPointsPerCell,Real _minCellSize)
   :Octree(bbox),maxPointsPerCell(_maxPointsPerCell),minCellSize(_minCellSize),fit(false)
 {}
@@ -382,6 +417,46 @@ void OctreePointSet::Add(const Vector3& pt,int id)
 }
 
 
+void OctreePointSet::Build(const vector<Vector3>& pts,int numThreads)
+{
+  Build(pts,vector<int>(),numThreads);
+}
+
+void OctreePointSet::Build(const vector<Vector3>& pts,const vector<int>& _ids,int numThreads)
+{
+  LinearOctreePointSet tree;
+  tree.Build(pts,_ids,maxPointsPerCell,minCellSize,numThreads);
+  AABB3D bb = nodes[0].bb;
+  nodes.clear();
+  freeNodes.clear();
+  indexLists.clear();
+  balls.clear();
+  fit = false;
+  AddNode(-1);
+  if(tree.nodes.empty()) {
+    nodes[0].bb = bb;
+    points.clear();
+    ids.clear();
+    return;
+  }
+  nodes[0].bb = tree.bb;
+  points = tree.points;
+  ids = tree.ids;
+  indexLists[0].resize(points.size());
+  for(size_t i=0;i<points.size();i++) indexLists[0][i] = (int)i;
+  //split the nodes that the linear tree splits.  Split distributes the
+  //points, so they always lie in their node's box.
+  vector<pair<int,int> > stack(1,pair<int,int>(0,0));
+  while(!stack.empty()) {
+    int i = stack.back().first, n = stack.back().second;
+    stack.pop_back();
+    if(tree.IsLeaf(i)) continue;
+    Split(n);
+    for(int j=i+1;j<tree.nodes[i].subtreeEnd;j=tree.nodes[j].subtreeEnd)
+      stack.push_back(pair<int,int>(j,nodes[n].childIndices[tree.nodes[j].key&7]));
+  }
+}
+
 int OctreePointSet::AddNode(int parent)
 {
   int res=Octree::AddNode(parent);
@@ -434,8 +509,8 @@ void OctreePointSet::BoxQuery(const Vector3& bmin,const Vector3& bmax,vector<Vec
   for(size_t i=0;i<boxnodes.size();i++) {
     const vector<int>& pindices = indexLists[boxnodes[i]];
     for(size_t k=0;k<pindices.size();k++)
-      if(bb.contains(points[pindices[k]])) {
-	points.push_back(points[pindices[k]]);
+      if(bb.contains(this->points[pindices[k]])) {
+	points.push_back(this->points[pindices[k]]);
 	ids.push_back(this->ids[pindices[k]]);
       }
   }
@@ -513,7 +588,7 @@ int OctreePointSet::RayCast(const Ray3D& r,Real radius) const
       if(pt.distanceSquared(temp) <= r2) {
 	if(t < closest) {
 	  closest = t;
-	  result = ids[k];
+	  result = ids[pindices[k]];
 	}
       }
     }
@@ -682,6 +757,472 @@ void OctreePointSet::Collapse(int maxSize)
 }
 
 
+bool OctreePointSet::Read(File& f)
+{
+  if(!Octree::Read(f)) return false;
+  if(!ReadFile(f,maxPointsPerCell)) return false;
+  if(!ReadFile(f,minCellSize)) return false;
+  if(!ReadFile(f,fit)) return false;
+  int n;
+  if(!ReadFile(f,n)) return false;
+  points.resize(n);
+  ids.resize(n);
+  if(n > 0) {
+    if(!f.ReadData(&points[0],n*sizeof(Vector3))) return false;
+    if(!ReadArrayFile(f,&ids[0],n)) return false;
+  }
+  //index lists are stored as a size array followed by the concatenated lists
+  indexLists.resize(nodes.size());
+  vector<int> sizes(nodes.size());
+  if(!ReadArrayFile(f,&sizes[0],(int)sizes.size())) return false;
+  for(size_t i=0;i<indexLists.size();i++) {
+    indexLists[i].resize(sizes[i]);
+    if(sizes[i] > 0 && !ReadArrayFile(f,&indexLists[i][0],sizes[i])) return false;
+  }
+  if(fit) {
+    balls.resize(nodes.size());
+    if(!f.ReadData(&balls[0],balls.size()*sizeof(Sphere3D))) return false;
+  }
+  else
+    balls.clear();
+  return true;
+}
+
+bool OctreePointSet::Write(File& f) const
+{
+  if(!Octree::Write(f)) return false;
+  if(!WriteFile(f,maxPointsPerCell)) return false;
+  if(!WriteFile(f,minCellSize)) return false;
+  if(!WriteFile(f,fit)) return false;
+  int n=(int)points.size();
+  if(!WriteFile(f,n)) return false;
+  if(n > 0) {
+    if(!f.WriteData(&points[0],n*sizeof(Vector3))) return false;
+    if(!WriteArrayFile(f,&ids[0],n)) return false;
+  }
+  Assert(indexLists.size() == nodes.size());
+  vector<int> sizes(nodes.size());
+  for(size_t i=0;i<indexLists.size();i++)
+    sizes[i] = (int)indexLists[i].size();
+  if(!WriteArrayFile(f,&sizes[0],(int)sizes.size())) return false;
+  for(size_t i=0;i<indexLists.size();i++)
+    if(sizes[i] > 0 && !WriteArrayFile(f,&indexLists[i][0],sizes[i])) return false;
+  if(fit) {
+    Assert(balls.size() == nodes.size());
+    if(!f.WriteData(&balls[0],balls.size()*sizeof(Sphere3D))) return false;
+  }
+  return true;
+}
+
+
+//Morton codes use 21 bits per axis
+static const int kLinearOctreeMaxDepth = 21;
+
+//Stable LSD radix sort of (keys,vals) on the low numBits bits of keys.  Each
+//pass counts digits per chunk in parallel, then scatters each chunk in
+//parallel to the offsets given by the prefix sum over (digit,chunk).
+static void ParallelRadixSort(vector<unsigned long long>& keys,vector<int>& vals,int numBits,int numThreads)
+{
+  int n = (int)keys.size();
+  if(n <= 1 || numBits <= 0) return;
+  if(numThreads <= 0) numThreads = NumHardwareThreads();
+  int numChunks = Max(1,Min(numThreads*4,n/4096));
+  int chunkSize = (n+numChunks-1)/numChunks;
+  vector<unsigned long long> keys2(n);
+  vector<int> vals2(n);
+  vector<int> offsets(numChunks*256);
+  for(int shift=0;shift<numBits;shift+=8) {
+    fill(offsets.begin(),offsets.end(),0);
+    ParallelFor(numChunks,[&](int c) {
+	int* count = &offsets[c*256];
+	int end = Min(n,(c+1)*chunkSize);
+	for(int i=c*chunkSize;i<end;i++)
+	  count[(keys[i]>>shift)&0xff]++;
+      },numThreads);
+    int sum = 0;
+    for(int d=0;d<256;d++)
+      for(int c=0;c<numChunks;c++) {
+	int cnt = offsets[c*256+d];
+	offsets[c*256+d] = sum;
+	sum += cnt;
+      }
+    ParallelFor(numChunks,[&](int c) {
+	int* offset = &offsets[c*256];
+	int end = Min(n,(c+1)*chunkSize);
+	for(int i=c*chunkSize;i<end;i++) {
+	  int k = offset[(keys[i]>>shift)&0xff]++;
+	  keys2[k] = keys[i];
+	  vals2[k] = vals[i];
+	}
+      },numThreads);
+    keys.swap(keys2);
+    vals.swap(vals2);
+  }
+}
+
+//Returns the Morton code of p's cell among the 8^21 cells of bb
+static unsigned long long LinearOctreeCode(const AABB3D& bb,const Vector3& p)
+{
+  const Real cells = Real(1<<kLinearOctreeMaxDepth);
+  unsigned int q[3];
+  for(int k=0;k<3;k++) {
+    Real u = (p[k]-bb.bmin[k])/(bb.bmax[k]-bb.bmin[k])*cells;
+    if(!(u > 0)) q[k] = 0;
+    else if(u >= cells) q[k] = (1<<kLinearOctreeMaxDepth)-1;
+    else q[k] = (unsigned int)u;
+  }
+  return MortonCode3(q[0],q[1],q[2]);
+}
+
+//Adds the node for keys[start,end) at the given depth, and its descendants,
+//in preorder.  keys are codes at depth maxDepth.
+static void LinearOctreeBuild(const vector<unsigned long long>& keys,int maxDepth,int maxPointsPerCell,int start,int end,int depth,vector<LinearOctreePointSet::Node>& nodes)
+{
+  int index = (int)nodes.size();
+  nodes.resize(index+1);
+  nodes[index].key = keys[start] >> (3*(maxDepth-depth));
+  nodes[index].depth = depth;
+  nodes[index].pointStart = start;
+  nodes[index].pointEnd = end;
+  if(end-start > maxPointsPerCell && depth < maxDepth) {
+    //children are runs of equal key prefixes
+    int shift = 3*(maxDepth-depth-1);
+    int s = start;
+    while(s < end) {
+      unsigned long long lastKey = (((keys[s]>>shift)+1)<<shift)-1;
+      int e = int(upper_bound(keys.begin()+s,keys.begin()+end,lastKey)-keys.begin());
+      LinearOctreeBuild(keys,maxDepth,maxPointsPerCell,s,e,depth+1,nodes);
+      s = e;
+    }
+  }
+  nodes[index].subtreeEnd = (int)nodes.size();
+}
+
+LinearOctreePointSet::LinearOctreePointSet()
+{
+  bb.minimize();
+}
+
+void LinearOctreePointSet::Clear()
+{
+  bb.minimize();
+  nodes.clear();
+  points.clear();
+  ids.clear();
+}
+
+void LinearOctreePointSet::Build(const vector<Vector3>& pts,int maxPointsPerCell,Real minCellSize,int numThreads)
+{
+  Build(pts,vector<int>(),maxPointsPerCell,minCellSize,numThreads);
+}
+
+void LinearOctreePointSet::Build(const vector<Vector3>& pts,const vector<int>& _ids,int maxPointsPerCell,Real minCellSize,int numThreads)
+{
+  Assert(_ids.empty() || _ids.size() == pts.size());
+  Clear();
+  vector<int> order;
+  order.reserve(pts.size());
+  for(size_t i=0;i<pts.size();i++) {
+    if(!IsFinite(pts[i].x) || !IsFinite(pts[i].y) || !IsFinite(pts[i].z)) continue;
+    bb.expand(pts[i]);
+    order.push_back((int)i);
+  }
+  if(order.empty()) return;
+  //pad so points on the upper faces fall inside the last cell, and so flat
+  //point sets have nonzero extent
+  Vector3 dims = bb.bmax-bb.bmin;
+  Real maxdim = Max(dims.x,dims.y,dims.z);
+  if(maxdim == 0) maxdim = 1;
+  bb.bmin -= Vector3(1e-6*maxdim);
+  bb.bmax += Vector3(1e-6*maxdim);
+  int maxDepth = kLinearOctreeMaxDepth;
+  if(minCellSize > 0) {
+    maxDepth = 0;
+    while(maxDepth < kLinearOctreeMaxDepth && maxdim*Pow(0.5,maxDepth+1) >= minCellSize)
+      maxDepth++;
+  }
+
+  int n = (int)order.size();
+  vector<unsigned long long> keys(n);
+  ParallelFor(n,[&](int i) {
+      keys[i] = LinearOctreeCode(bb,pts[order[i]]) >> (3*(kLinearOctreeMaxDepth-maxDepth));
+    },numThreads,4096);
+  ParallelRadixSort(keys,order,3*maxDepth,numThreads);
+  points.resize(n);
+  ids.resize(n);
+  for(int i=0;i<n;i++) {
+    points[i] = pts[order[i]];
+    ids[i] = (_ids.empty() ? order[i] : _ids[order[i]]);
+  }
+  LinearOctreeBuild(keys,maxDepth,Max(maxPointsPerCell,1),0,n,0,nodes);
+}
+
+int LinearOctreePointSet::MaxDepth() const
+{
+  int d = 0;
+  for(size_t i=0;i<nodes.size();i++)
+    d = Max(d,nodes[i].depth);
+  return d;
+}
+
+void LinearOctreePointSet::NodeBounds(int node,AABB3D& res) const
+{
+  const Node& n = nodes[node];
+  unsigned int x,y,z;
+  MortonDecode3(n.key,x,y,z);
+  Vector3 size = (bb.bmax-bb.bmin)*Pow(0.5,n.depth);
+  res.bmin.set(bb.bmin.x+x*size.x,bb.bmin.y+y*size.y,bb.bmin.z+z*size.z);
+  res.bmax = res.bmin + size;
+}
+
+//node bounds are recomputed from the keys, so they are expanded a little
+//for pruning to be conservative with respect to rounding
+inline void ExpandForRounding(AABB3D& bb)
+{
+  Vector3 eps = (bb.bmax-bb.bmin)*1e-9;
+  bb.bmin -= eps;
+  bb.bmax += eps;
+}
+
+int LinearOctreePointSet::Lookup(const Vector3& point) const
+{
+  if(nodes.empty() || !bb.contains(point)) return -1;
+  unsigned long long code = LinearOctreeCode(bb,point);
+  int i = 0;
+  while(!IsLeaf(i)) {
+    int depth = nodes[i].depth+1;
+    unsigned long long key = code >> (3*(kLinearOctreeMaxDepth-depth));
+    int j = i+1;
+    while(j < nodes[i].subtreeEnd && nodes[j].key != key)
+      j = nodes[j].subtreeEnd;
+    if(j == nodes[i].subtreeEnd) return -1;
+    i = j;
+  }
+  return i;
+}
+
+void LinearOctreePointSet::GetPoints(int node,vector<Vector3>& pts) const
+{
+  pts.assign(points.begin()+nodes[node].pointStart,points.begin()+nodes[node].pointEnd);
+}
+
+void LinearOctreePointSet::GetPointIDs(int node,vector<int>& res) const
+{
+  res.assign(ids.begin()+nodes[node].pointStart,ids.begin()+nodes[node].pointEnd);
+}
+
+void LinearOctreePointSet::BoxQuery(const Vector3& bmin,const Vector3& bmax,vector<Vector3>& res,vector<int>& resids) const
+{
+  res.resize(0);
+  resids.resize(0);
+  AABB3D q(bmin,bmax),nb;
+  int i = 0;
+  while(i < (int)nodes.size()) {
+    const Node& n = nodes[i];
+    NodeBounds(i,nb);
+    ExpandForRounding(nb);
+    if(!q.intersects(nb)) {
+      i = n.subtreeEnd;
+      continue;
+    }
+    if(IsLeaf(i) || (q.contains(nb.bmin) && q.contains(nb.bmax))) {
+      for(int k=n.pointStart;k<n.pointEnd;k++)
+	if(q.contains(points[k])) {
+	  res.push_back(points[k]);
+	  resids.push_back(ids[k]);
+	}
+      i = n.subtreeEnd;
+    }
+    else i++;
+  }
+}
+
+void LinearOctreePointSet::BallQuery(const Vector3& c,Real r,vector<Vector3>& res,vector<int>& resids) const
+{
+  res.resize(0);
+  resids.resize(0);
+  Real r2 = r*r;
+  AABB3D nb;
+  Vector3 temp;
+  int i = 0;
+  while(i < (int)nodes.size()) {
+    const Node& n = nodes[i];
+    NodeBounds(i,nb);
+    ExpandForRounding(nb);
+    if(nb.distanceSquared(c,temp) > r2) {
+      i = n.subtreeEnd;
+      continue;
+    }
+    //the farthest corner from c
+    Vector3 far;
+    for(int k=0;k<3;k++)
+      far[k] = (c[k]-nb.bmin[k] > nb.bmax[k]-c[k] ? nb.bmin[k] : nb.bmax[k]);
+    if(IsLeaf(i) || far.distanceSquared(c) <= r2) {
+      for(int k=n.pointStart;k<n.pointEnd;k++)
+	if(points[k].distanceSquared(c) <= r2) {
+	  res.push_back(points[k]);
+	  resids.push_back(ids[k]);
+	}
+      i = n.subtreeEnd;
+    }
+    else i++;
+  }
+}
+
+bool LinearOctreePointSet::NearestNeighbor(const Vector3& c,Vector3& closest,int& id) const
+{
+  id = -1;
+  if(nodes.empty()) return false;
+  Real best = Inf;
+  //depth-first, visiting the nearest children first
+  vector<pair<Real,int> > stack,children;
+  stack.push_back(pair<Real,int>(0,0));
+  AABB3D nb;
+  Vector3 temp;
+  while(!stack.empty()) {
+    pair<Real,int> top = stack.back();
+    stack.pop_back();
+    if(top.first >= best) continue;
+    const Node& n = nodes[top.second];
+    if(IsLeaf(top.second)) {
+      for(int k=n.pointStart;k<n.pointEnd;k++) {
+	Real d2 = points[k].distanceSquared(c);
+	if(d2 < best) {
+	  best = d2;
+	  closest = points[k];
+	  id = ids[k];
+	}
+      }
+      continue;
+    }
+    children.resize(0);
+    for(int j=top.second+1;j<n.subtreeEnd;j=nodes[j].subtreeEnd) {
+      NodeBounds(j,nb);
+      ExpandForRounding(nb);
+      Real d2 = nb.distanceSquared(c,temp);
+      if(d2 < best) children.push_back(pair<Real,int>(d2,j));
+    }
+    sort(children.begin(),children.end());
+    for(int j=(int)children.size()-1;j>=0;j--)
+      stack.push_back(children[j]);
+  }
+  return id >= 0;
+}
+
+static void SortedIDs(vector<int>& ids) { sort(ids.begin(),ids.end()); }
+
+void LinearOctreePointSet::SelfTest()
+{
+  for(int test=0;test<5;test++) {
+    vector<Vector3> pts;
+    if(test == 0) pts.resize(1,Vector3(0.5,-0.25,2.0));
+    else if(test == 1) {
+      pts.resize(50);
+      for(size_t i=0;i<pts.size();i++) pts[i].set(Rand(-1,1),Rand(-1,1),Rand(-1,1));
+    }
+    else if(test == 2) {
+      pts.resize(3000);
+      for(size_t i=0;i<pts.size();i++) pts[i].set(Rand(-10,10),Rand(0,1),Rand(-3,5));
+    }
+    else if(test == 3) {
+      //many duplicates
+      pts.resize(500);
+      for(size_t i=0;i<pts.size();i++) pts[i].set(RandInt(4),RandInt(3),0);
+    }
+    else {
+      //tight clusters far apart
+      pts.resize(2000);
+      for(size_t i=0;i<pts.size();i++) {
+        Real o = (i%2 == 0 ? 0 : 100);
+        pts[i].set(o+Rand()*1e-4,o+Rand()*1e-4,Rand()*1e-4);
+      }
+    }
+    LinearOctreePointSet linear;
+    linear.Build(pts,4);
+    Assert(linear.points.size() == pts.size());
+    AABB3D bb;
+    bb.minimize();
+    for(size_t i=0;i<pts.size();i++) bb.expand(pts[i]);
+    bb.bmin -= Vector3(1e-3);
+    bb.bmax += Vector3(1e-3);
+    OctreePointSet added(bb,4),built(bb,4);
+    for(size_t i=0;i<pts.size();i++) added.Add(pts[i],(int)i);
+    built.Build(pts);
+
+    vector<Vector3> qpts;
+    vector<int> bf,r1,r2,r3;
+    for(int q=0;q<50;q++) {
+      const Vector3& p = pts[RandInt((int)pts.size())];
+      Vector3 c = p + Vector3(Rand(-0.5,0.5),Rand(-0.5,0.5),Rand(-0.5,0.5));
+      Real r = (q%2 == 0 ? 0 : Rand(0,2));
+      //box query
+      Vector3 bmin = c - Vector3(r), bmax = c + Vector3(r);
+      if(q%5 == 0) bmin = bmax = p;
+      AABB3D qb(bmin,bmax);
+      bf.resize(0);
+      for(size_t i=0;i<pts.size();i++) if(qb.contains(pts[i])) bf.push_back((int)i);
+      linear.BoxQuery(bmin,bmax,qpts,r1); SortedIDs(r1);
+      added.BoxQuery(bmin,bmax,qpts,r2); SortedIDs(r2);
+      built.BoxQuery(bmin,bmax,qpts,r3); SortedIDs(r3);
+      Assert(r1 == bf && r2 == bf && r3 == bf);
+      //ball query
+      Sphere3D s;
+      s.center = (q%5 == 0 ? p : c);
+      s.radius = r;
+      bf.resize(0);
+      for(size_t i=0;i<pts.size();i++) if(s.contains(pts[i])) bf.push_back((int)i);
+      linear.BallQuery(s.center,r,qpts,r1); SortedIDs(r1);
+      added.BallQuery(s.center,r,qpts,r2); SortedIDs(r2);
+      built.BallQuery(s.center,r,qpts,r3); SortedIDs(r3);
+      Assert(r1 == bf && r2 == bf && r3 == bf);
+      //nearest neighbor
+      Real dmin = Inf;
+      for(size_t i=0;i<pts.size();i++) dmin = Min(dmin,pts[i].distance(c));
+      Vector3 closest;
+      int id;
+      Assert(linear.NearestNeighbor(c,closest,id));
+      Assert(closest.distance(c) == dmin && pts[id] == closest);
+      Assert(added.NearestNeighbor(c,closest,id));
+      Assert(closest.distance(c) == dmin && pts[id] == closest);
+      Assert(built.NearestNeighbor(c,closest,id));
+      Assert(closest.distance(c) == dmin && pts[id] == closest);
+    }
+
+    //scalar field of the samples' x coordinates
+    vector<Real> values(pts.size());
+    for(size_t i=0;i<pts.size();i++) values[i] = pts[i].x;
+    LinearOctreeScalarField field(-1000);
+    field.Build(pts,values,4);
+    for(size_t i=0;i<pts.size();i+=7) {
+      int n = field.tree.Lookup(pts[i]);
+      Assert(n >= 0 && field.tree.IsLeaf(n));
+      const Node& leaf = field.tree.nodes[n];
+      Real sum = 0;
+      for(int k=leaf.pointStart;k<leaf.pointEnd;k++) sum += values[field.tree.ids[k]];
+      Assert(FuzzyEquals(field.Value(pts[i]),sum/(leaf.pointEnd-leaf.pointStart)));
+    }
+    Assert(field.Value(Vector3(1e6)) == -1000);
+    for(int q=0;q<10;q++) {
+      Vector3 c = pts[RandInt((int)pts.size())];
+      Vector3 bmin = c - Vector3(0.5), bmax = c + Vector3(0.5);
+      Real vmin = c.x - 0.25, vmax = c.x + 0.25;
+      vector<int> leaves;
+      field.BoxLookupRange(bmin,bmax,vmin,vmax,leaves);
+      vector<int> bfleaves;
+      AABB3D qb(bmin,bmax),nb;
+      for(int i=0;i<field.NumNodes();i++) {
+        if(!field.tree.IsLeaf(i)) continue;
+        if(field.data[i].valueMax < vmin || field.data[i].valueMin > vmax) continue;
+        field.tree.NodeBounds(i,nb);
+        ExpandForRounding(nb);
+        if(qb.intersects(nb)) bfleaves.push_back(i);
+      }
+      Assert(leaves == bfleaves);
+    }
+  }
+  LOG4CXX_INFO(KrisLibrary::logger(),"LinearOctreePointSet self test passed"<<"\n");
+}
+
 OctreeScalarField::OctreeScalarField(const AABB3D& bb,Real _defaultValue)
   :Octree(bb),defaultValue(_defaultValue)
 {}
@@ -849,3 +1390,98 @@ void OctreeScalarField::Collapse(Real tolerance)
     }
   }
 }
+
+LinearOctreeScalarField::LinearOctreeScalarField(Real _defaultValue)
+  :defaultValue(_defaultValue)
+{}
+
+void LinearOctreeScalarField::Clear()
+{
+  tree.Clear();
+  data.clear();
+}
+
+void LinearOctreeScalarField::Build(const vector<Vector3>& pts,const vector<Real>& values,int maxPointsPerCell,Real minCellSize,int numThreads)
+{
+  Assert(pts.size() == values.size());
+  tree.Build(pts,maxPointsPerCell,minCellSize,numThreads);
+  data.resize(tree.nodes.size());
+  //children come after their parents, so go backwards
+  for(int i=(int)tree.nodes.size()-1;i>=0;i--) {
+    const LinearOctreePointSet::Node& n = tree.nodes[i];
+    Data& d = data[i];
+    d.valueMin = Inf;
+    d.valueMax = -Inf;
+    Real sum = 0;
+    if(tree.IsLeaf(i)) {
+      for(int k=n.pointStart;k<n.pointEnd;k++) {
+        Real v = values[tree.ids[k]];
+        sum += v;
+        d.valueMin = Min(d.valueMin,v);
+        d.valueMax = Max(d.valueMax,v);
+      }
+    }
+    else {
+      for(int j=i+1;j<n.subtreeEnd;j=tree.nodes[j].subtreeEnd) {
+        const LinearOctreePointSet::Node& c = tree.nodes[j];
+        sum += data[j].value*(c.pointEnd-c.pointStart);
+        d.valueMin = Min(d.valueMin,data[j].valueMin);
+        d.valueMax = Max(d.valueMax,data[j].valueMax);
+      }
+    }
+    d.value = sum/(n.pointEnd-n.pointStart);
+  }
+}
+
+Real LinearOctreeScalarField::Value(const Vector3& pt) const
+{
+  int n = tree.Lookup(pt);
+  if(n < 0) return defaultValue;
+  return data[n].value;
+}
+
+bool LinearOctreeScalarField::ValueIn(const Vector3& pt,Real vmin,Real vmax) const
+{
+  Real v = Value(pt);
+  return vmin <= v && v <= vmax;
+}
+
+bool LinearOctreeScalarField::ValueGreater(const Vector3& pt,Real bound) const
+{
+  return Value(pt) > bound;
+}
+
+bool LinearOctreeScalarField::ValueLess(const Vector3& pt,Real bound) const
+{
+  return Value(pt) < bound;
+}
+
+void LinearOctreeScalarField::BoxLookupRange(const Vector3& bmin,const Vector3& bmax,Real valueMin,Real valueMax,vector<int>& nodeIndices,bool inclusive) const
+{
+  AABB3D q(bmin,bmax),nb;
+  int i = 0;
+  while(i < tree.NumNodes()) {
+    const Data& d = data[i];
+    bool miss;
+    if(inclusive) miss = (d.valueMax < valueMin || d.valueMin > valueMax);
+    else miss = (d.valueMax <= valueMin || d.valueMin >= valueMax);
+    tree.NodeBounds(i,nb);
+    ExpandForRounding(nb);
+    if(miss || !q.intersects(nb)) {
+      i = tree.nodes[i].subtreeEnd;
+      continue;
+    }
+    if(tree.IsLeaf(i)) nodeIndices.push_back(i);
+    i++;
+  }
+}
+
+void LinearOctreeScalarField::BoxLookupGreater(const Vector3& bmin,const Vector3& bmax,Real bound,vector<int>& nodeIndices) const
+{
+  BoxLookupRange(bmin,bmax,bound,Inf,nodeIndices,false);
+}
+
+void LinearOctreeScalarField::BoxLookupLess(const Vector3& bmin,const Vector3& bmax,Real bound,vector<int>& nodeIndices) const
+{
+  BoxLookupRange(bmin,bmax,-Inf,bound,nodeIndices,false);
+}
@@ -6,6 +6,7 @@
 #include <KrisLibrary/math3d/Ray3D.h>
 #include <vector>
 #include <list>
+class File;
 
 namespace Geometry {
   using namespace std;
@@ -90,6 +91,10 @@ class Octree
   virtual void Split(int nodeindex);
   ///Joins the given node and all descendants
   virtual void Join(int nodeindex);
+  ///Binary I/O of the octree structure.  The format is native-endian and
+  ///intended for caching, not for exchange between machines.
+  virtual bool Read(File& f);
+  virtual bool Write(File& f) const;
 
  protected:
   virtual int AddNode(int parent=-1);
@@ -101,6 +106,8 @@ class Octree
   list<int> freeNodes;
 };
 
+class LinearOctreePointSet;
+
 /** @brief Stores a point set P on an octree grid.  Allows for O(d) adding,
  * O(d h) range queries and pseudo-O(d) nearest neighbor queries.
  */
@@ -113,7 +120,20 @@ class OctreePointSet : public Octree
   void GetPoints(const OctreeNode& node,vector<Vector3>& pts) const { GetPoints(Index(node),pts); }
   void GetPointIDs(int node,vector<int>& ids) const;
   void GetPointIDs(const OctreeNode& node,vector<int>& ids) const { GetPointIDs(Index(node),ids); }
+  ///Returns the indices of a node's points for use in Point / PointID,
+  ///without copying
+  const vector<int>& PointIndices(int node) const { return indexLists[node]; }
+  const Vector3& Point(int pointIndex) const { return points[pointIndex]; }
+  int PointID(int pointIndex) const { return ids[pointIndex]; }
   void Add(const Vector3& pt,int id=-1);
+  ///Replaces the contents with the points pts, with the given ids or the
+  ///point indices if ids is empty.  The points are sorted in bulk by a
+  ///LinearOctreePointSet on numThreads threads, and the cells that it splits
+  ///are split here, which is much faster than calling Add for each point.
+  ///The root's box becomes the linear tree's box around the points, and
+  ///non-finite points are skipped.
+  void Build(const vector<Vector3>& pts,const vector<int>& ids,int numThreads=0);
+  void Build(const vector<Vector3>& pts,int numThreads=0);
   void BoxQuery(const Vector3& bmin,const Vector3& bmax,vector<Vector3>& points,vector<int>& ids) const;
   void BoxQuery(const Box3D& b,vector<Vector3>& points,vector<int>& ids) const;
   void BallQuery(const Vector3& c,Real r,vector<Vector3>& points,vector<int>& ids) const;
@@ -133,6 +153,8 @@ class OctreePointSet : public Octree
   ///subdivision property will no longer hold.
   void FitToPoints();
   const Sphere3D& Ball(int index) const { return balls[index]; }
+  virtual bool Read(File& f);
+  virtual bool Write(File& f) const;
 
  protected:
   Real _NearestNeighbor(const OctreeNode& n,const Vector3& c,Vector3& closest,int& id,Real minDist) const;
@@ -151,6 +173,65 @@ class OctreePointSet : public Octree
   bool fit;
 };
 
+/** @brief A linear (pointerless) octree over a point set, for point sets
+ * that are built all at once, e.g., from each new sensor scan.
+ *
+ * Points are sorted by the 63-bit Morton code of their position in the
+ * bounding box with a parallel radix sort, so each node's points are
+ * contiguous in points / ids.  Nodes are stored in preorder, which is the
+ * order of their Morton keys, and only nonempty nodes are stored.  Each
+ * node stores the index one past its last descendant, so queries run
+ * iteratively by skipping the subtrees they prune.  Build is O(n log n).
+ *
+ * Unlike OctreePointSet, points cannot be added after construction.
+ */
+class LinearOctreePointSet
+{
+ public:
+  struct Node
+  {
+    ///Morton code of the node's cell among the 8^depth cells at its depth
+    unsigned long long key;
+    int depth;
+    ///The node's points are points[pointStart],...,points[pointEnd-1]
+    int pointStart,pointEnd;
+    ///Index one past the node's last descendant in nodes
+    int subtreeEnd;
+  };
+
+  LinearOctreePointSet();
+  void Clear();
+  ///Builds the octree from pts, splitting cells with more than
+  ///maxPointsPerCell points until cells are smaller than minCellSize.  If
+  ///ids is empty, the ids are the point indices.  Non-finite points are
+  ///skipped.
+  void Build(const vector<Vector3>& pts,const vector<int>& ids,int maxPointsPerCell=1,Real minCellSize=0,int numThreads=0);
+  void Build(const vector<Vector3>& pts,int maxPointsPerCell=1,Real minCellSize=0,int numThreads=0);
+  int NumNodes() const { return (int)nodes.size(); }
+  int Size() const { return NumNodes(); }
+  bool IsLeaf(int node) const { return nodes[node].subtreeEnd == node+1; }
+  int MaxDepth() const;
+  ///Returns the bounding box of the given node
+  void NodeBounds(int node,AABB3D& bb) const;
+  ///Returns the leaf containing point, or -1 if it's outside of the tree
+  int Lookup(const Vector3& point) const;
+  void GetPoints(int node,vector<Vector3>& pts) const;
+  void GetPointIDs(int node,vector<int>& ids) const;
+  void BoxQuery(const Vector3& bmin,const Vector3& bmax,vector<Vector3>& points,vector<int>& ids) const;
+  void BallQuery(const Vector3& c,Real r,vector<Vector3>& points,vector<int>& ids) const;
+  bool NearestNeighbor(const Vector3& c,Vector3& closest,int& id) const;
+  ///Compares the queries against OctreePointSet and brute force on random
+  ///point sets
+  static void SelfTest();
+
+  ///The (slightly expanded) bounding box of the points
+  AABB3D bb;
+  vector<Node> nodes;
+  ///Points and ids, sorted in Morton order
+  vector<Vector3> points;
+  vector<int> ids;
+};
+
 /** @brief Stores a function f(x) on an octree grid.  Allows for O(d) setting,
  * sub O(d) testing of f(x) in range [a,b], O(d h) selection of nodes with
  * values in range [a,b]
@@ -207,6 +288,50 @@ class OctreeScalarField : public Octree
   vector<Data> data;
 };
 
+/** @brief A linear (pointerless) octree storing a function f(x) sampled
+ * at a point set, for fields that are rebuilt all at once, e.g., occupancy
+ * from each new sensor scan.
+ *
+ * The samples are arranged in a LinearOctreePointSet.  Each leaf's value is
+ * the average of its samples, and each node stores the average, min, and
+ * max of the samples below it.  Space without samples takes defaultValue.
+ */
+class LinearOctreeScalarField
+{
+ public:
+  struct Data {
+    ///The average of the samples in the node
+    Real value;
+    ///The min / max sample value
+    Real valueMin,valueMax;
+  };
+
+  LinearOctreeScalarField(Real defaultValue = -Inf);
+  void Clear();
+  ///Builds the field from the samples values[i] at pts[i], with the same
+  ///cell splitting rules as LinearOctreePointSet::Build
+  void Build(const vector<Vector3>& pts,const vector<Real>& values,int maxPointsPerCell=1,Real minCellSize=0,int numThreads=0);
+  int NumNodes() const { return tree.NumNodes(); }
+  ///Returns the value of the leaf containing pt, or defaultValue if no leaf
+  ///contains it
+  Real Value(const Vector3& pt) const;
+  ///Returns true if Value(pt) is in the range [valueMin,valueMax]
+  bool ValueIn(const Vector3& pt,Real valueMin,Real valueMax) const;
+  bool ValueGreater(const Vector3& pt,Real bound) const;
+  bool ValueLess(const Vector3& pt,Real bound) const;
+  ///Returns all leaves that overlap the bbox [bmin,bmax] AND whose values
+  ///are within [valueMin,valueMax] (if inclusive=true) or
+  ///(valueMin,valueMax) (if inclusive=false).  Only leaves with samples are
+  ///returned; use tree.NodeBounds to get their boxes.
+  void BoxLookupRange(const Vector3& bmin,const Vector3& bmax,Real valueMin,Real valueMax,vector<int>& nodeIndices,bool inclusive=true) const;
+  void BoxLookupGreater(const Vector3& bmin,const Vector3& bmax,Real bound,vector<int>& nodeIndices) const;
+  void BoxLookupLess(const Vector3& bmin,const Vector3& bmax,Real bound,vector<int>& nodeIndices) const;
+
+  Real defaultValue;
+  LinearOctreePointSet tree;
+  vector<Data> data;
+};
+
 } //namespcae Geometry
 
 #endif
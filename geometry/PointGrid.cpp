@@ -0,0 +1,176 @@
+#include "PointGrid.h"
+#include <utils/bits.h>
+#include <utils/ioutils.h>
+#include <math/infnan.h>
+#include <myfile.h>
+#include <errors.h>
+#include <algorithm>
+#include <climits>
+using namespace std;
+
+namespace Geometry {
+
+inline size_t CellHash(const IntTriple& c)
+{
+  return size_t((unsigned int)c.a*73856093u ^ (unsigned int)c.b*19349663u ^ (unsigned int)c.c*83492791u);
+}
+
+//cell indices beyond this are clamped, which keeps queries with huge or
+//infinite boxes well-defined
+static const Real kMaxCellIndex = 1<<30;
+
+inline int ClampedFloor(Real x)
+{
+  if(!(x > -kMaxCellIndex)) return -(1<<30);
+  if(!(x < kMaxCellIndex)) return 1<<30;
+  return (int)Floor(x);
+}
+
+PointGrid3D::PointGrid3D()
+  :h(1),hinv(1)
+{}
+
+void PointGrid3D::Clear()
+{
+  cells.clear();
+  cellStart.clear();
+  pointIndices.clear();
+  table.clear();
+}
+
+IntTriple PointGrid3D::PointToIndex(const Vector3& p) const
+{
+  return IntTriple(ClampedFloor(p.x*hinv),ClampedFloor(p.y*hinv),ClampedFloor(p.z*hinv));
+}
+
+void PointGrid3D::CellBounds(const IntTriple& c,AABB3D& bb) const
+{
+  bb.bmin.set(c.a*h,c.b*h,c.c*h);
+  bb.bmax = bb.bmin + Vector3(h);
+}
+
+int PointGrid3D::FindCell(const IntTriple& c) const
+{
+  if(table.empty()) return -1;
+  size_t mask = table.size()-1;
+  size_t i = CellHash(c) & mask;
+  while(table[i] >= 0) {
+    if(cells[table[i]] == c) return table[i];
+    i = (i+1) & mask;
+  }
+  return -1;
+}
+
+void PointGrid3D::BuildTable()
+{
+  //load factor <= 0.5
+  size_t tsize = 16;
+  while(tsize < cells.size()*2) tsize *= 2;
+  table.assign(tsize,-1);
+  size_t mask = tsize-1;
+  for(size_t k=0;k<cells.size();k++) {
+    size_t i = CellHash(cells[k]) & mask;
+    while(table[i] >= 0) i = (i+1) & mask;
+    table[i] = (int)k;
+  }
+}
+
+void PointGrid3D::Build(const vector<Vector3>& points,Real _h)
+{
+  Assert(_h > 0);
+  h = _h;
+  hinv = 1.0/h;
+  Clear();
+  //sort points by the Morton code of their cell, relative to the minimum
+  //cell so the codes are nonnegative
+  vector<IntTriple> pcells(points.size());
+  IntTriple cmin(INT_MAX,INT_MAX,INT_MAX);
+  for(size_t i=0;i<points.size();i++) {
+    if(!IsFinite(points[i].x) || !IsFinite(points[i].y) || !IsFinite(points[i].z)) {
+      pcells[i].a = INT_MIN;
+      continue;
+    }
+    pcells[i] = PointToIndex(points[i]);
+    cmin.a = Min(cmin.a,pcells[i].a);
+    cmin.b = Min(cmin.b,pcells[i].b);
+    cmin.c = Min(cmin.c,pcells[i].c);
+  }
+  IntTriple cmax(INT_MIN,INT_MIN,INT_MIN);
+  vector<pair<unsigned long long,int> > keys;
+  keys.reserve(points.size());
+  for(size_t i=0;i<points.size();i++) {
+    if(pcells[i].a == INT_MIN) continue;
+    cmax.a = Max(cmax.a,pcells[i].a);
+    cmax.b = Max(cmax.b,pcells[i].b);
+    cmax.c = Max(cmax.c,pcells[i].c);
+    keys.push_back(pair<unsigned long long,int>(MortonCode3(pcells[i].a-cmin.a,pcells[i].b-cmin.b,pcells[i].c-cmin.c),(int)i));
+  }
+  const int kMortonMax = (1<<21)-1;
+  if(keys.empty() || (cmax.a-cmin.a <= kMortonMax && cmax.b-cmin.b <= kMortonMax && cmax.c-cmin.c <= kMortonMax))
+    sort(keys.begin(),keys.end());
+  else {
+    //Morton codes only hold 21 bits per axis; fall back to lexicographic
+    //order so that each cell's points are still contiguous
+    sort(keys.begin(),keys.end(),[&](const pair<unsigned long long,int>& x,const pair<unsigned long long,int>& y) {
+	const IntTriple& cx = pcells[x.second], &cy = pcells[y.second];
+	if(cx.a != cy.a) return cx.a < cy.a;
+	if(cx.b != cy.b) return cx.b < cy.b;
+	if(cx.c != cy.c) return cx.c < cy.c;
+	return x.second < y.second;
+      });
+  }
+  pointIndices.resize(keys.size());
+  for(size_t i=0;i<keys.size();i++) {
+    pointIndices[i] = keys[i].second;
+    const IntTriple& c = pcells[keys[i].second];
+    if(i == 0 || !(c == cells.back())) {
+      cells.push_back(c);
+      cellStart.push_back((int)i);
+    }
+  }
+  cellStart.push_back((int)keys.size());
+  BuildTable();
+}
+
+bool PointGrid3D::Read(File& f)
+{
+  Clear();
+  if(!ReadFile(f,h)) return false;
+  if(!(h > 0)) return false;
+  hinv = 1.0/h;
+  int ncells,npoints;
+  if(!ReadFile(f,ncells)) return false;
+  if(!ReadFile(f,npoints)) return false;
+  if(ncells < 0 || npoints < 0) return false;
+  cells.resize(ncells);
+  cellStart.resize(ncells+1);
+  pointIndices.resize(npoints);
+  if(ncells > 0 && !ReadArrayFile(f,&cells[0].a,ncells*3)) return false;
+  if(!ReadArrayFile(f,&cellStart[0],ncells+1)) return false;
+  if(npoints > 0 && !ReadArrayFile(f,&pointIndices[0],npoints)) return false;
+  if(cellStart[0] != 0 || cellStart[ncells] != npoints) return false;
+  for(int k=0;k<ncells;k++)
+    if(cellStart[k] > cellStart[k+1]) return false;
+  BuildTable();
+  return true;
+}
+
+bool PointGrid3D::Write(File& f) const
+{
+  if(!WriteFile(f,h)) return false;
+  int ncells = (int)cells.size(), npoints = (int)pointIndices.size();
+  if(!WriteFile(f,ncells)) return false;
+  if(!WriteFile(f,npoints)) return false;
+  if(ncells > 0 && !WriteArrayFile(f,&cells[0].a,ncells*3)) return false;
+  if(!cellStart.empty()) {
+    if(!WriteArrayFile(f,&cellStart[0],ncells+1)) return false;
+  }
+  else {
+    int zero = 0;
+    if(!WriteFile(f,zero)) return false;
+  }
+  if(npoints > 0 && !WriteArrayFile(f,&pointIndices[0],npoints)) return false;
+  return true;
+}
+
+} //namespace Geometry
@@ -0,0 +1,111 @@
+#ifndef GEOMETRY_POINT_GRID_H
+#define GEOMETRY_POINT_GRID_H
+
+#include <KrisLibrary/math3d/primitives.h>
+#include <KrisLibrary/math3d/AABB3D.h>
+#include <KrisLibrary/utils/IntTriple.h>
+#include <vector>
+
+class File;
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+/** @ingroup Geometry
+ * @brief A compact index of 3D points in a uniform grid.
+ *
+ * Point indices are stored sorted by cell, with cells in Morton (Z-curve)
+ * order, so the points of a cell are contiguous and nearby cells are
+ * usually nearby in memory.  cellStart gives the offset of each cell's
+ * points in pointIndices.  Cells are looked up by an open-addressing hash
+ * table of integer 3-tuples.
+ *
+ * Unlike GridSubdivision, there is no per-cell allocation; the index takes
+ * one int per point plus a few ints per nonempty cell.
+ */
+class PointGrid3D
+{
+public:
+  PointGrid3D();
+  void Clear();
+  ///Builds the index of points with cells of width h.  Non-finite points
+  ///are skipped.
+  void Build(const std::vector<Vector3>& points,Real h);
+  bool Empty() const { return cells.empty(); }
+  size_t NumCells() const { return cells.size(); }
+  ///Returns the cell containing p
+  IntTriple PointToIndex(const Vector3& p) const;
+  ///Returns the bounding box of cell c
+  void CellBounds(const IntTriple& c,AABB3D& bb) const;
+  ///Returns the index of cell c in cells, or -1 if it's empty
+  int FindCell(const IntTriple& c) const;
+  ///Returns the number of points in the k'th cell; its points are
+  ///pointIndices[cellStart[k]],...,pointIndices[cellStart[k+1]-1]
+  int CellSize(int k) const { return cellStart[k+1]-cellStart[k]; }
+  ///Calls f(pointIndex) for each point in a cell overlapping the box
+  ///[bmin,bmax].  f returns false to stop enumerating, in which case this
+  ///returns false.
+  template <class F>
+  bool BoxQuery(const Vector3& bmin,const Vector3& bmax,F f) const;
+  ///Same as BoxQuery, but calls f(k) for each nonempty cell index k
+  template <class F>
+  bool CellQuery(const Vector3& bmin,const Vector3& bmax,F f) const;
+
+  bool Read(File& f);
+  bool Write(File& f) const;
+
+  Real h,hinv;
+  ///Nonempty cells, in Morton order
+  std::vector<IntTriple> cells;
+  ///Offsets of each cell's points in pointIndices (size cells.size()+1)
+  std::vector<int> cellStart;
+  ///Point indices, sorted by cell
+  std::vector<int> pointIndices;
+  ///Open-addressing hash table mapping cells to their index in cells, -1
+  ///for empty slots.  The size is a power of 2.
+  std::vector<int> table;
+
+ private:
+  void BuildTable();
+};
+
+template <class F>
+bool PointGrid3D::CellQuery(const Vector3& bmin,const Vector3& bmax,F f) const
+{
+  if(cells.empty()) return true;
+  IntTriple imin = PointToIndex(bmin), imax = PointToIndex(bmax);
+  if(imax.a < imin.a || imax.b < imin.b || imax.c < imin.c) return true;
+  double numQueryCells = double(imax.a-imin.a+1)*double(imax.b-imin.b+1)*double(imax.c-imin.c+1);
+  if(numQueryCells > cells.size()) {
+    //cheaper to scan the nonempty cells
+    for(size_t k=0;k<cells.size();k++) {
+      const IntTriple& c = cells[k];
+      if(c.a < imin.a || c.a > imax.a || c.b < imin.b || c.b > imax.b || c.c < imin.c || c.c > imax.c) continue;
+      if(!f((int)k)) return false;
+    }
+    return true;
+  }
+  IntTriple c;
+  for(c.a=imin.a;c.a<=imax.a;c.a++)
+    for(c.b=imin.b;c.b<=imax.b;c.b++)
+      for(c.c=imin.c;c.c<=imax.c;c.c++) {
+        int k = FindCell(c);
+        if(k >= 0 && !f(k)) return false;
+      }
+  return true;
+}
+
+template <class F>
+bool PointGrid3D::BoxQuery(const Vector3& bmin,const Vector3& bmax,F f) const
+{
+  return CellQuery(bmin,bmax,[&](int k) {
+      for(int i=cellStart[k];i<cellStart[k+1];i++)
+        if(!f(pointIndices[i])) return false;
+      return true;
+    });
+}
+
+} //namespace Geometry
+
+#endif
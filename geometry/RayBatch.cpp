@@ -0,0 +1,46 @@
+#include "RayBatch.h"
+#include <KrisLibrary/math3d/AABB3D.h>
+#include <utils/bits.h>
+#include <algorithm>
+using namespace std;
+
+namespace Geometry {
+
+//quantizes x in [0,1] to nbits bits
+inline unsigned int Quantize(Real x,int nbits)
+{
+  unsigned int nmax = (1u<<nbits)-1;
+  if(!(x > 0)) return 0;
+  if(x >= 1) return nmax;
+  return (unsigned int)(x*nmax);
+}
+
+void CoherentRayOrder(const vector<Ray3D>& rays,vector<int>& order)
+{
+  order.resize(rays.size());
+  if(rays.empty()) return;
+  AABB3D bb;
+  bb.minimize();
+  for(size_t i=0;i<rays.size();i++)
+    bb.expand(rays[i].source);
+  Vector3 dims = bb.bmax-bb.bmin;
+  for(int k=0;k<3;k++)
+    if(dims[k] <= 0) dims[k] = 1;
+  //10 bits per axis for the direction, 11 for the source
+  vector<pair<unsigned long long,int> > keys(rays.size());
+  for(size_t i=0;i<rays.size();i++) {
+    Vector3 d = rays[i].direction;
+    Real n = d.norm();
+    if(n > 0) d /= n;
+    unsigned long long dcode = MortonCode3(Quantize(0.5*(d.x+1),10),Quantize(0.5*(d.y+1),10),Quantize(0.5*(d.z+1),10));
+    Vector3 s = rays[i].source-bb.bmin;
+    unsigned long long scode = MortonCode3(Quantize(s.x/dims.x,11),Quantize(s.y/dims.y,11),Quantize(s.z/dims.z,11));
+    keys[i].first = (dcode << 33) | scode;
+    keys[i].second = (int)i;
+  }
+  sort(keys.begin(),keys.end());
+  for(size_t i=0;i<keys.size();i++)
+    order[i] = keys[i].second;
+}
+
+} //namespace Geometry
@@ -0,0 +1,37 @@
+#ifndef GEOMETRY_RAY_BATCH_H
+#define GEOMETRY_RAY_BATCH_H
+
+#include <KrisLibrary/math3d/primitives.h>
+#include <KrisLibrary/math3d/Ray3D.h>
+#include <vector>
+
+/** @file geometry/RayBatch.h
+ * @ingroup Geometry
+ * @brief Utilities shared by the batch ray casting routines.
+ */
+
+namespace Geometry {
+
+  using namespace Math3D;
+
+/** @addtogroup Geometry */
+/*@{*/
+
+///Number of rays that traverse a bounding volume hierarchy together
+#define RAY_PACKET_SIZE 8
+
+/** @brief Computes an ordering of rays in which consecutive rays have
+ * similar directions and sources.
+ *
+ * Rays are sorted by a Morton code of their normalized direction, with
+ * ties broken by a Morton code of their source within the bounding box of
+ * all sources.  Packets of consecutive rays in this order tend to visit the
+ * same parts of a hierarchy.
+ */
+void CoherentRayOrder(const std::vector<Ray3D>& rays,std::vector<int>& order);
+
+/*@}*/
+
+} //namespace Geometry
+
+#endif
@@ -0,0 +1,529 @@
+#include <log4cxx/logger.h>
+#include <KrisLibrary/Logger.h>
+#include "TiledPointCloud.h"
+#include <KrisLibrary/camera/clip.h>
+#include <utils/fileutils.h>
+#include <utils/stringutils.h>
+#include <myfile.h>
+#include <math/random.h>
+#include <errors.h>
+#include <fstream>
+#include <sstream>
+using namespace Geometry;
+
+//index file header
+static const char* kIndexMagic = "TiledPointCloud";
+static const int kIndexVersion = 1;
+
+TiledPointCloud::TiledPointCloud()
+  :Octree(AABB3D()),maxTilePoints(100000),maxBufferPoints(4000000),maxCachePoints(10000000),maxDepth(20),tileFormat("binary"),
+   building(false),stride(3),numBuffered(0),numCached(0)
+{
+  Reset(AABB3D());
+}
+
+int TiledPointCloud::AddNode(int parent)
+{
+  int res = Octree::AddNode(parent);
+  if(res >= (int)numPoints.size()) {
+    numPoints.resize(res+1,0);
+    pointBounds.resize(res+1);
+    buffers.resize(res+1);
+    cache.resize(res+1);
+    lruPos.resize(res+1,lru.end());
+  }
+  numPoints[res] = 0;
+  pointBounds[res].minimize();
+  return res;
+}
+
+void TiledPointCloud::Reset(const AABB3D& bounds)
+{
+  ClearCache();
+  nodes.clear();
+  freeNodes.clear();
+  numPoints.clear();
+  pointBounds.clear();
+  buffers.clear();
+  cache.clear();
+  lruPos.clear();
+  AddNode(-1);
+  nodes[0].bb = bounds;
+  numBuffered = 0;
+}
+
+std::string TiledPointCloud::TileFile(int tile) const
+{
+  stringstream ss;
+  ss<<directory<<"/tile"<<tile<<".pcd";
+  return ss.str();
+}
+
+std::string TiledPointCloud::TempFile(int tile) const
+{
+  stringstream ss;
+  ss<<directory<<"/tile"<<tile<<".tmp";
+  return ss.str();
+}
+
+std::string TiledPointCloud::IndexFile() const
+{
+  return directory + "/index.bin";
+}
+
+bool TiledPointCloud::Create(const char* dir,const AABB3D& bounds,const vector<string>& _propertyNames)
+{
+  if(!FileUtils::IsDirectory(dir) && !FileUtils::MakeDirectoryRecursive(dir)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Create: could not create directory "<<dir);
+    return false;
+  }
+  directory = dir;
+  //remove the tiles of a previous store, and temporary files left by an
+  //interrupted build, which would otherwise be appended to
+  vector<string> items;
+  if(FileUtils::ListDirectory(dir,items)) {
+    for(size_t i=0;i<items.size();i++) {
+      const char* item = items[i].c_str();
+      if(items[i] == "index.bin" ||
+         (StartsWith(item,"tile") && (EndsWith(item,".tmp") || EndsWith(item,".pcd")))) {
+        string fn = directory + "/" + items[i];
+        if(!FileUtils::Delete(fn.c_str())) {
+          LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Create: could not remove stale file "<<fn);
+          return false;
+        }
+      }
+    }
+  }
+  propertyNames = _propertyNames;
+  stride = 3+(int)propertyNames.size();
+  Reset(bounds);
+  building = true;
+  return true;
+}
+
+bool TiledPointCloud::Add(const Meshing::PointCloud3D& pc)
+{
+  if(!building) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Add: Create must be called first");
+    return false;
+  }
+  if(pc.propertyNames != propertyNames) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Add: point cloud has different properties than the store");
+    return false;
+  }
+  if(!propertyNames.empty() && pc.properties.size() != pc.points.size()) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Add: point cloud has "<<pc.properties.size()<<" property vectors for "<<pc.points.size()<<" points");
+    return false;
+  }
+  for(size_t i=0;i<pc.points.size();i++) {
+    const Vector3& p = pc.points[i];
+    int n = 0;
+    while(!IsLeaf(nodes[n]))
+      n = nodes[n].childIndices[Child(nodes[n],p)];
+    vector<Real>& buf = buffers[n];
+    buf.push_back(p.x);
+    buf.push_back(p.y);
+    buf.push_back(p.z);
+    for(size_t k=0;k<propertyNames.size();k++)
+      buf.push_back(pc.properties.Get(i,k));
+    numPoints[n]++;
+    numBuffered++;
+    if(numPoints[n] > maxTilePoints && Depth(nodes[n]) < maxDepth) {
+      if(!SplitTile(n)) return false;
+    }
+    if(numBuffered > maxBufferPoints) {
+      if(!FlushBuffers()) return false;
+    }
+  }
+  return true;
+}
+
+bool TiledPointCloud::ReadTempTile(int tile,vector<Real>& data)
+{
+  data.resize(0);
+  size_t numFlushed = numPoints[tile] - buffers[tile].size()/stride;
+  if(numFlushed > 0) {
+    string fn = TempFile(tile);
+    ifstream in(fn.c_str(),ios::in|ios::binary);
+    data.resize(numFlushed*stride);
+    in.read((char*)&data[0],data.size()*sizeof(Real));
+    if(!in) {
+      LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud: error reading temporary file "<<fn);
+      return false;
+    }
+    in.close();
+    FileUtils::Delete(fn.c_str());
+  }
+  data.insert(data.end(),buffers[tile].begin(),buffers[tile].end());
+  numBuffered -= buffers[tile].size()/stride;
+  vector<Real>().swap(buffers[tile]);
+  return true;
+}
+
+bool TiledPointCloud::SplitTile(int tile)
+{
+  vector<Real> data;
+  if(!ReadTempTile(tile,data)) return false;
+  Octree::Split(tile);
+  numPoints[tile] = 0;
+  Vector3 p;
+  for(size_t i=0;i<data.size();i+=stride) {
+    p.set(data[i],data[i+1],data[i+2]);
+    int c = nodes[tile].childIndices[Child(nodes[tile],p)];
+    buffers[c].insert(buffers[c].end(),data.begin()+i,data.begin()+i+stride);
+    numPoints[c]++;
+    numBuffered++;
+  }
+  vector<Real>().swap(data);
+  //all points may have landed in one child
+  for(int k=0;k<8;k++) {
+    int c = nodes[tile].childIndices[k];
+    if(numPoints[c] > maxTilePoints && Depth(nodes[c]) < maxDepth)
+      if(!SplitTile(c)) return false;
+  }
+  return true;
+}
+
+bool TiledPointCloud::FlushBuffers()
+{
+  for(size_t i=0;i<buffers.size();i++) {
+    if(buffers[i].empty()) continue;
+    string fn = TempFile((int)i);
+    ofstream out(fn.c_str(),ios::out|ios::binary|ios::app);
+    out.write((const char*)&buffers[i][0],buffers[i].size()*sizeof(Real));
+    if(!out) {
+      LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud: error writing temporary file "<<fn);
+      return false;
+    }
+    vector<Real>().swap(buffers[i]);
+  }
+  numBuffered = 0;
+  return true;
+}
+
+bool TiledPointCloud::Finish()
+{
+  if(!building) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Finish: Create must be called first");
+    return false;
+  }
+  building = false;
+  //write the leaves
+  vector<Real> data;
+  Meshing::PointCloud3D pc;
+  for(size_t i=0;i<nodes.size();i++) {
+    if(!IsLeaf(nodes[i]) || numPoints[i] == 0) continue;
+    if(!ReadTempTile((int)i,data)) return false;
+    size_t n = data.size()/stride;
+    pc.Clear();
+    pc.propertyNames = propertyNames;
+    pc.points.resize(n);
+    if(!propertyNames.empty()) {
+      pc.properties.resize(n);
+      for(size_t k=0;k<propertyNames.size();k++)
+        pc.properties.AddColumn(false);
+    }
+    for(size_t j=0;j<n;j++) {
+      const Real* row = &data[j*stride];
+      pc.points[j].set(row[0],row[1],row[2]);
+      pointBounds[i].expand(pc.points[j]);
+      for(size_t k=0;k<propertyNames.size();k++)
+        pc.properties.Set(j,k,row[3+k]);
+    }
+    string fn = TileFile((int)i);
+    if(!pc.SavePCL(fn.c_str(),tileFormat,tileFieldTypes)) {
+      LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Finish: error writing tile "<<fn);
+      return false;
+    }
+  }
+  vector<vector<Real> >().swap(buffers);
+  buffers.resize(nodes.size());
+  //children come after their parents
+  for(size_t i=nodes.size();i-- > 1;) {
+    if(numPoints[i] == 0) continue;
+    int p = nodes[i].parentIndex;
+    numPoints[p] += numPoints[i];
+    pointBounds[p].setUnion(pointBounds[i]);
+  }
+
+  File f;
+  string fn = IndexFile();
+  if(!f.Open(fn.c_str(),FILEWRITE)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Finish: could not open "<<fn);
+    return false;
+  }
+  bool res = f.WriteString(kIndexMagic) && WriteFile(f,kIndexVersion) && Octree::Write(f);
+  int numProperties = (int)propertyNames.size();
+  res = res && WriteFile(f,numProperties);
+  for(int k=0;k<numProperties && res;k++)
+    res = f.WriteString(propertyNames[k].c_str());
+  for(size_t i=0;i<nodes.size() && res;i++) {
+    unsigned long long n = numPoints[i];
+    res = WriteFile(f,n) && pointBounds[i].Write(f);
+  }
+  f.Close();
+  if(!res) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Finish: error writing "<<fn);
+    return false;
+  }
+  return true;
+}
+
+bool TiledPointCloud::Open(const char* dir)
+{
+  building = false;
+  directory = dir;
+  File f;
+  string fn = IndexFile();
+  if(!f.Open(fn.c_str(),FILEREAD)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Open: could not open "<<fn);
+    return false;
+  }
+  char buf[256];
+  int version;
+  if(!f.ReadString(buf,256) || string(buf) != kIndexMagic || !ReadFile(f,version) || version != kIndexVersion) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Open: "<<fn<<" is not a tiled point cloud index");
+    return false;
+  }
+  Reset(AABB3D());
+  if(!Octree::Read(f)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Open: error reading octree from "<<fn);
+    return false;
+  }
+  int numProperties;
+  if(!ReadFile(f,numProperties) || numProperties < 0) return false;
+  propertyNames.resize(numProperties);
+  for(int k=0;k<numProperties;k++) {
+    if(!f.ReadString(buf,256)) return false;
+    propertyNames[k] = buf;
+  }
+  stride = 3+numProperties;
+  numPoints.resize(nodes.size());
+  pointBounds.resize(nodes.size());
+  buffers.resize(nodes.size());
+  cache.resize(nodes.size());
+  lruPos.resize(nodes.size(),lru.end());
+  for(size_t i=0;i<nodes.size();i++) {
+    unsigned long long n;
+    if(!ReadFile(f,n) || !pointBounds[i].Read(f)) {
+      LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::Open: error reading node "<<i<<" from "<<fn);
+      return false;
+    }
+    numPoints[i] = (size_t)n;
+  }
+  return true;
+}
+
+void TiledPointCloud::TileLookup(const AABB3D& bb,vector<int>& tiles) const
+{
+  tiles.resize(0);
+  if(nodes.empty()) return;
+  vector<int> stack(1,0);
+  while(!stack.empty()) {
+    int n = stack.back();
+    stack.pop_back();
+    if(numPoints[n] == 0 || !pointBounds[n].intersects(bb)) continue;
+    if(IsLeaf(nodes[n])) tiles.push_back(n);
+    else {
+      for(int k=7;k>=0;k--) stack.push_back(nodes[n].childIndices[k]);
+    }
+  }
+}
+
+void TiledPointCloud::TileLookup(const ConvexVolume& vol,vector<int>& tiles) const
+{
+  tiles.resize(0);
+  if(nodes.empty()) return;
+  vector<int> stack(1,0);
+  while(!stack.empty()) {
+    int n = stack.back();
+    stack.pop_back();
+    if(numPoints[n] == 0) continue;
+    int overlap = vol.AABBOverlap(pointBounds[n].bmin,pointBounds[n].bmax);
+    if(overlap == EXCLUSION) continue;
+    if(IsLeaf(nodes[n])) tiles.push_back(n);
+    else {
+      for(int k=7;k>=0;k--) stack.push_back(nodes[n].childIndices[k]);
+    }
+  }
+}
+
+void TiledPointCloud::Touch(int tile)
+{
+  if(lruPos[tile] != lru.end()) lru.erase(lruPos[tile]);
+  lru.push_front(tile);
+  lruPos[tile] = lru.begin();
+}
+
+shared_ptr<CollisionPointCloud> TiledPointCloud::LoadTile(int tile)
+{
+  if(tile < 0 || tile >= (int)nodes.size() || !IsLeaf(nodes[tile]) || numPoints[tile] == 0) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::LoadTile: "<<tile<<" is not a nonempty tile");
+    return NULL;
+  }
+  if(cache[tile]) {
+    Touch(tile);
+    return cache[tile];
+  }
+  shared_ptr<CollisionPointCloud> pc(new CollisionPointCloud);
+  string fn = TileFile(tile);
+  if(!pc->LoadPCL(fn.c_str())) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"TiledPointCloud::LoadTile: error loading "<<fn);
+    return NULL;
+  }
+  pc->InitCollisions();
+  //evict the least recently used tiles
+  while(!lru.empty() && numCached + pc->points.size() > maxCachePoints) {
+    int t = lru.back();
+    lru.pop_back();
+    lruPos[t] = lru.end();
+    numCached -= cache[t]->points.size();
+    cache[t] = NULL;
+  }
+  cache[tile] = pc;
+  numCached += pc->points.size();
+  Touch(tile);
+  return pc;
+}
+
+void TiledPointCloud::ClearCache()
+{
+  for(size_t i=0;i<cache.size();i++) cache[i] = NULL;
+  lru.clear();
+  for(size_t i=0;i<lruPos.size();i++) lruPos[i] = lru.end();
+  numCached = 0;
+}
+
+//Loads tiles one at a time and calls f on them
+template <class Region>
+static bool QueryTiles(TiledPointCloud& store,const Region& region,const std::function<bool(const shared_ptr<CollisionPointCloud>&)>& f)
+{
+  vector<int> tiles;
+  store.TileLookup(region,tiles);
+  for(size_t i=0;i<tiles.size();i++) {
+    shared_ptr<CollisionPointCloud> pc = store.LoadTile(tiles[i]);
+    if(!pc) return false;
+    if(!f(pc)) break;
+  }
+  return true;
+}
+
+bool TiledPointCloud::Query(const AABB3D& bb,const std::function<bool(const shared_ptr<CollisionPointCloud>&)>& f)
+{
+  return QueryTiles(*this,bb,f);
+}
+
+bool TiledPointCloud::Query(const ConvexVolume& vol,const std::function<bool(const shared_ptr<CollisionPointCloud>&)>& f)
+{
+  return QueryTiles(*this,vol,f);
+}
+
+bool TiledPointCloud::Query(const AABB3D& bb,vector<shared_ptr<CollisionPointCloud> >& tiles)
+{
+  tiles.resize(0);
+  return QueryTiles(*this,bb,[&](const shared_ptr<CollisionPointCloud>& pc) { tiles.push_back(pc); return true; });
+}
+
+bool TiledPointCloud::Query(const ConvexVolume& vol,vector<shared_ptr<CollisionPointCloud> >& tiles)
+{
+  tiles.resize(0);
+  return QueryTiles(*this,vol,[&](const shared_ptr<CollisionPointCloud>& pc) { tiles.push_back(pc); return true; });
+}
+
+void TiledPointCloud::SelfTest()
+{
+  //colors with and without the sign bit of the packed rgba set, and ids to
+  //match the loaded points to the originals
+  int n = 20000;
+  Meshing::PointCloud3D pc;
+  pc.points.resize(n);
+  vector<Vector4> colors(n);
+  vector<Real> ids(n);
+  for(int i=0;i<n;i++) {
+    pc.points[i].set(Rand(-1,1),Rand(-1,1),Rand(-1,1));
+    colors[i].set(RandInt(256)/255.0,RandInt(256)/255.0,RandInt(256)/255.0,RandInt(256)/255.0);
+    ids[i] = i;
+  }
+  //outside of the bounds
+  pc.points[0].set(2,0,0);
+  pc.SetColors(colors,true);
+  pc.SetProperty("id",ids);
+  vector<Real> rgba;
+  pc.GetProperty("rgba",rgba);
+  AABB3D bounds(Vector3(-1.0),Vector3(1.0));
+
+  char dir[1024];
+  Assert(FileUtils::TempName(dir,NULL,"tpc"));
+  const char* colorTypes[3] = {"","U4","F4"};
+  for(int t=0;t<3;t++) {
+    TiledPointCloud store;
+    store.maxTilePoints = 1000;
+    store.maxBufferPoints = 3000;
+    if(colorTypes[t][0] != 0) store.tileFieldTypes["rgba"] = colorTypes[t];
+    Assert(store.Create(dir,bounds,pc.propertyNames));
+    //add in chunks
+    Meshing::PointCloud3D chunk;
+    chunk.propertyNames = pc.propertyNames;
+    for(int i=0;i<n;i++) {
+      chunk.points.push_back(pc.points[i]);
+      chunk.properties.push_back(pc.properties[i]);
+      if(chunk.points.size() == 2500 || i+1 == n) {
+        Assert(store.Add(chunk));
+        chunk.points.clear();
+        chunk.properties.clear();
+      }
+    }
+    Assert(store.Finish());
+
+    TiledPointCloud opened;
+    Assert(opened.Open(dir));
+    Assert(opened.NumPoints() == (size_t)n);
+    Assert(opened.propertyNames == pc.propertyNames);
+    vector<shared_ptr<CollisionPointCloud> > tiles;
+    AABB3D all(Vector3(-3.0),Vector3(3.0));
+    Assert(opened.Query(all,tiles));
+    Assert(tiles.size() > 1);
+    vector<int> count(n,0);
+    vector<Real> tileIds,tileRgba;
+    for(size_t k=0;k<tiles.size();k++) {
+      Assert(tiles[k]->GetProperty("id",tileIds));
+      Assert(tiles[k]->GetProperty("rgba",tileRgba));
+      for(size_t j=0;j<tiles[k]->points.size();j++) {
+        int id = (int)tileIds[j];
+        Assert(id >= 0 && id < n);
+        count[id]++;
+        Assert(tiles[k]->points[j].distance(pc.points[id]) < 1e-5);
+        Assert(tileRgba[j] == rgba[id]);
+      }
+      vector<Vector4> tileColors;
+      Assert(tiles[k]->GetColors(tileColors));
+      for(size_t j=0;j<tileColors.size();j++)
+        Assert(tileColors[j].distance(colors[(int)tileIds[j]]) < 1e-3);
+    }
+    for(int i=0;i<n;i++) Assert(count[i] == 1);
+
+    //a box query returns every point in the box
+    AABB3D box(Vector3(0.2,-0.5,-1.0),Vector3(0.6,0.1,0.0));
+    Assert(opened.Query(box,tiles));
+    int numInBox = 0,numFound = 0;
+    for(int i=0;i<n;i++)
+      if(box.contains(pc.points[i])) numInBox++;
+    for(size_t k=0;k<tiles.size();k++) {
+      Assert(tiles[k]->GetProperty("id",tileIds));
+      for(size_t j=0;j<tileIds.size();j++)
+        if(box.contains(pc.points[(int)tileIds[j]])) numFound++;
+    }
+    Assert(numFound == numInBox);
+  }
+
+  //clean up the files
+  vector<string> items;
+  if(FileUtils::ListDirectory(dir,items)) {
+    for(size_t i=0;i<items.size();i++) {
+      if(items[i] == "." || items[i] == "..") continue;
+      string fn = string(dir) + "/" + items[i];
+      FileUtils::Delete(fn.c_str());
+    }
+  }
+  LOG4CXX_INFO(KrisLibrary::logger(),"TiledPointCloud self test passed"<<"\n");
+}
@@ -0,0 +1,118 @@
+#ifndef GEOMETRY_TILED_POINT_CLOUD_H
+#define GEOMETRY_TILED_POINT_CLOUD_H
+
+#include "CollisionPointCloud.h"
+#include "Octree.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <map>
+class ConvexVolume;
+
+/** @file geometry/TiledPointCloud.h
+ * @ingroup Geometry
+ * @brief An out-of-core point cloud stored as octree tiles on disk.
+ */
+
+namespace Geometry {
+
+/** @ingroup Geometry
+ * @brief A point cloud too large for memory, stored in a directory as one
+ * PCD file per octree leaf ("tile<i>.pcd") and an index file ("index.bin")
+ * holding the octree, the number of points, and the bounding box of the
+ * points under each node.
+ *
+ * To build, call Create with the bounds of the cloud, Add the points in
+ * any number of chunks (e.g., from PointCloud3D::LoadPCL(fn,chunkSize,f)),
+ * then Finish.  A leaf is split when it has more than maxTilePoints points,
+ * and the points of each leaf are buffered in memory and appended to a
+ * temporary file when more than maxBufferPoints points are buffered in
+ * total, so building also uses bounded memory.  Points outside of the
+ * bounds are put in the nearest leaf.
+ *
+ * To query, Open the directory and use Query, which streams the tiles
+ * whose points' bounding boxes intersect a box or convex volume (e.g., a
+ * Camera::Frustum) as CollisionPointCloud's in world coordinates.  Loaded
+ * tiles are kept in an LRU cache of up to maxCachePoints points.  Tiles are
+ * shared_ptrs, so tiles held by the caller stay valid after they're evicted.
+ *
+ * Tiles are saved with tileFormat and tileFieldTypes, see
+ * PointCloud3D::SavePCL.  The default saves coordinates as F4 and packed
+ * rgb / rgba colors as I4, so colors are exact; use F8 for x, y, z if the
+ * coordinates are large.  Not thread-safe.
+ */
+class TiledPointCloud : public Octree
+{
+ public:
+  TiledPointCloud();
+  ///Starts building a new store in the directory dir, which is created if
+  ///needed.  Tile, index and temporary files of a previous store in dir are
+  ///deleted.  All points added must have the given properties.
+  bool Create(const char* dir,const AABB3D& bounds,const vector<string>& propertyNames);
+  bool Add(const Meshing::PointCloud3D& pc);
+  ///Writes the tiles and the index
+  bool Finish();
+  ///Opens a store written by Finish
+  bool Open(const char* dir);
+  ///Returns the total number of points
+  size_t NumPoints() const { return numPoints.empty() ? 0 : numPoints[0]; }
+  ///Returns the indices of the nonempty tiles whose points' bounding boxes
+  ///overlap bb / vol
+  void TileLookup(const AABB3D& bb,vector<int>& tiles) const;
+  void TileLookup(const ConvexVolume& vol,vector<int>& tiles) const;
+  ///Returns the given tile, loading it if it's not cached.  Returns NULL on
+  ///error.
+  shared_ptr<CollisionPointCloud> LoadTile(int tile);
+  ///Calls f on each tile overlapping bb / vol, loaded one at a time.  f may
+  ///return false to stop.  Returns false if a tile can't be loaded.
+  bool Query(const AABB3D& bb,const std::function<bool(const shared_ptr<CollisionPointCloud>&)>& f);
+  bool Query(const ConvexVolume& vol,const std::function<bool(const shared_ptr<CollisionPointCloud>&)>& f);
+  ///Returns all tiles overlapping bb / vol
+  bool Query(const AABB3D& bb,vector<shared_ptr<CollisionPointCloud> >& tiles);
+  bool Query(const ConvexVolume& vol,vector<shared_ptr<CollisionPointCloud> >& tiles);
+  void ClearCache();
+  std::string TileFile(int tile) const;
+  ///Builds, opens and queries stores of random colored points in a
+  ///temporary directory, checking the points and colors that come back
+  static void SelfTest();
+
+  std::string directory;
+  vector<string> propertyNames;
+  size_t maxTilePoints;     ///< default 100000
+  size_t maxBufferPoints;   ///< default 4M
+  size_t maxCachePoints;    ///< default 10M
+  int maxDepth;             ///< leaves at this depth are not split, default 20
+  std::string tileFormat;   ///< default "binary"
+  std::map<std::string,std::string> tileFieldTypes;
+
+  ///Number of points under each node
+  vector<size_t> numPoints;
+  ///Bounding box of the points under each node
+  vector<AABB3D> pointBounds;
+
+ protected:
+  virtual int AddNode(int parent=-1);
+  void Reset(const AABB3D& bounds);
+  bool SplitTile(int tile);
+  bool FlushBuffers();
+  bool ReadTempTile(int tile,vector<Real>& data);
+  std::string TempFile(int tile) const;
+  std::string IndexFile() const;
+  void Touch(int tile);
+
+  //building state
+  bool building;
+  int stride;
+  vector<vector<Real> > buffers;
+  size_t numBuffered;
+
+  //cache state
+  vector<shared_ptr<CollisionPointCloud> > cache;
+  list<int> lru;
+  vector<list<int>::iterator> lruPos;
+  size_t numCached;
+};
+
+} //namespace Geometry
+
+#endif
@@ -9,6 +9,8 @@
 #include "differentiation.h"
 #include "quadrature.h"
 #include "LUDecomposition.h"
+#include "CholeskyDecomposition.h"
+#include "SparseCholeskyDecomposition.h"
 #include "BlockTridiagonalMatrix.h"
 #include "BlockPrinter.h"
 #include "BLASInterface.h"
@@ -70,6 +72,7 @@ void SelfTest()
   QuadratureSelfTest();
   BlockVectorSelfTest();
   BlockMatrixSelfTest();
+  SparseCholeskySelfTest();
 }
 
 void BasicSelfTest()
@@ -347,6 +350,68 @@ void BLASSelfTest()
   Assert(FuzzyEquals(vref.dot(vref2),BLASInterface::Dot(vref,vref2)));
 }
 
+//Random symmetric, diagonally dominant (so positive definite) matrix with
+//about nnzPerRow off-diagonal entries per row
+static void RandomSparseSPD(int n,int nnzPerRow,Matrix& A)
+{
+  A.resize(n,n,Zero);
+  for(int i=0;i<n;i++)
+    for(int k=0;k<nnzPerRow/2;k++) {
+      int j = RandInt(n);
+      if(j == i) continue;
+      A(i,j) = A(j,i) = Rand(-One,One);
+    }
+  for(int i=0;i<n;i++) {
+    Real sum = 0;
+    for(int j=0;j<n;j++)
+      if(j != i) sum += Abs(A(i,j));
+    A(i,i) = sum + Rand(0.1,1.0);
+  }
+}
+
+void SparseCholeskySelfTest()
+{
+  LOG4CXX_INFO(KrisLibrary::logger(),"Self-testing sparse Cholesky decomposition"<<"\n");
+  int n = 80;
+  Matrix A;
+  RandomSparseSPD(n,6,A);
+  SparseMatrixTemplate_CR<Real> sA;
+  sA.set(A);
+  Vector b(n),x,xdense,temp;
+  for(int i=0;i<n;i++) b(i) = Rand(-One,One);
+
+  CholeskyDecomposition<Real> chol;
+  Assert(chol.set(A));
+  chol.backSub(b,xdense);
+  SparseCholeskyDecomposition<Real> schol;
+  Assert(schol.set(sA));
+  Assert((int)schol.perm.size() == n);
+  schol.backSub(b,x);
+  Assert(x.isEqual(xdense,1e-8));
+  sA.mul(x,temp);
+  Assert(temp.isEqual(b,1e-8));
+
+  //same pattern, different values: the symbolic factorization is reused
+  for(int i=0;i<n;i++)
+    for(int j=0;j<n;j++)
+      A(i,j) *= (i == j ? 2.0 : 0.5);
+  SparseMatrixTemplate_CR<Real> sA2;
+  sA2.set(A);
+  Assert(sA2.num_entries == sA.num_entries);
+  std::vector<int> perm = schol.perm;
+  Assert(schol.setNumeric(sA2));
+  Assert(schol.perm == perm);
+  Assert(chol.set(A));
+  chol.backSub(b,xdense);
+  schol.backSub(b,x);
+  Assert(x.isEqual(xdense,1e-8));
+
+  //an indefinite matrix with the same pattern is rejected
+  for(int i=0;i<n;i++) *sA2.getEntry(i,i) = -One;
+  Assert(!schol.setNumeric(sA2));
+  LOG4CXX_INFO(KrisLibrary::logger(),"Done"<<"\n");
+}
+
 //void LAPACKSelfTest();
 
 
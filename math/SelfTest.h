@@ -17,6 +17,7 @@ void QuadratureSelfTest();
 void BlockVectorSelfTest();
 void BlockMatrixSelfTest();
 void BLASSelfTest();
+void SparseCholeskySelfTest();
 void LAPACKSelfTest();
 
 class RealFunction;
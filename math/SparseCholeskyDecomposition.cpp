@@ -0,0 +1,199 @@
+#include <log4cxx/logger.h>
+#include <KrisLibrary/Logger.h>
+#include "SparseCholeskyDecomposition.h"
+#include <errors.h>
+#include <algorithm>
+#include <set>
+using namespace std;
+
+namespace Math {
+
+template <class T>
+void MinimumDegreeOrdering(const SparseMatrixTemplate_CR<T>& A,vector<int>& perm)
+{
+  Assert(A.m == A.n);
+  int n = A.m;
+  //the elimination graph; adjacency lists are kept sorted
+  vector<vector<int> > adj(n);
+  for(int i=0;i<n;i++) {
+    for(int k=A.row_offsets[i];k<A.row_offsets[i+1];k++)
+      if(A.col_indices[k] != i) adj[i].push_back(A.col_indices[k]);
+  }
+  set<pair<int,int> > queue;
+  for(int i=0;i<n;i++) queue.insert(pair<int,int>((int)adj[i].size(),i));
+  perm.resize(0);
+  perm.reserve(n);
+  vector<int> merged;
+  while(!queue.empty()) {
+    int v = queue.begin()->second;
+    queue.erase(queue.begin());
+    perm.push_back(v);
+    //eliminating v makes its neighbors a clique
+    const vector<int>& nv = adj[v];
+    for(size_t j=0;j<nv.size();j++) {
+      int u = nv[j];
+      queue.erase(pair<int,int>((int)adj[u].size(),u));
+      merged.resize(0);
+      vector<int>::const_iterator a=adj[u].begin(),b=nv.begin();
+      while(a != adj[u].end() || b != nv.end()) {
+        int w;
+        if(b == nv.end() || (a != adj[u].end() && *a < *b)) w = *a++;
+        else if(a == adj[u].end() || *b < *a) w = *b++;
+        else { w = *a++; b++; }
+        if(w != u && w != v) merged.push_back(w);
+      }
+      adj[u].swap(merged);
+      queue.insert(pair<int,int>((int)adj[u].size(),u));
+    }
+    vector<int>().swap(adj[v]);
+  }
+}
+
+template <class T>
+SparseCholeskyDecomposition<T>::SparseCholeskyDecomposition()
+{}
+
+template <class T>
+void SparseCholeskyDecomposition<T>::clear()
+{
+  perm.clear();
+  invPerm.clear();
+  parent.clear();
+  LT.clear();
+}
+
+template <class T>
+bool SparseCholeskyDecomposition<T>::set(const SparseMatrixT& A)
+{
+  clear();
+  if(A.m != A.n) return false;
+  int n = A.m;
+  MinimumDegreeOrdering(A,perm);
+  invPerm.resize(n);
+  for(int i=0;i<n;i++) invPerm[perm[i]] = i;
+
+  //elimination tree of C = PAP^t, from the lower triangle of each row
+  parent.assign(n,-1);
+  vector<int> ancestor(n,-1);
+  for(int k=0;k<n;k++) {
+    int r = perm[k];
+    for(int p=A.row_offsets[r];p<A.row_offsets[r+1];p++) {
+      int i = invPerm[A.col_indices[p]];
+      while(i != -1 && i < k) {
+        int next = ancestor[i];
+        ancestor[i] = k;
+        if(next == -1) parent[i] = k;
+        i = next;
+      }
+    }
+  }
+  //the pattern of row k of L is the set of nodes reached from the nonzeros
+  //of row k of C by walking up the tree
+  vector<int> counts(n,1),mark(n,-1);
+  for(int k=0;k<n;k++) {
+    int r = perm[k];
+    mark[k] = k;
+    for(int p=A.row_offsets[r];p<A.row_offsets[r+1];p++) {
+      for(int i=invPerm[A.col_indices[p]];i < k && mark[i] != k;i=parent[i]) {
+        counts[i]++;
+        mark[i] = k;
+      }
+    }
+  }
+  int nnz = 0;
+  for(int i=0;i<n;i++) nnz += counts[i];
+  LT.initialize(n,n,nnz);
+  for(int i=0;i<n;i++) LT.row_offsets[i+1] = LT.row_offsets[i]+counts[i];
+  if(!setNumeric(A)) {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+template <class T>
+bool SparseCholeskyDecomposition<T>::setNumeric(const SparseMatrixT& A)
+{
+  int n = (int)perm.size();
+  if(A.m != n || A.n != n || LT.m != n) return false;
+  vector<T> x(n,T(0));
+  vector<int> next(n),mark(n,-1),stack(n),path(n);
+  for(int k=0;k<n;k++) {
+    //nonzero pattern of row k of L in topological order, in stack[top..n-1]
+    int r = perm[k];
+    int top = n;
+    mark[k] = k;
+    for(int p=A.row_offsets[r];p<A.row_offsets[r+1];p++) {
+      int i = invPerm[A.col_indices[p]];
+      if(i > k) continue;
+      x[i] += A.val_array[p];
+      int len = 0;
+      for(;mark[i] != k;i=parent[i]) {
+        path[len++] = i;
+        mark[i] = k;
+      }
+      while(len > 0) stack[--top] = path[--len];
+    }
+    T d = x[k];
+    x[k] = 0;
+    for(int s=top;s<n;s++) {
+      int i = stack[s];
+      T* Li = LT.rowValues(i);
+      int* Ji = LT.rowIndices(i);
+      T lki = x[i]/Li[0];
+      x[i] = 0;
+      //next[i] is the number of entries of column i of L filled so far
+      for(int q=1;q<next[i];q++)
+        x[Ji[q]] -= Li[q]*lki;
+      d -= lki*lki;
+      Ji[next[i]] = k;
+      Li[next[i]] = lki;
+      next[i]++;
+    }
+    if(!(d > 0)) {
+      LOG4CXX_WARN(KrisLibrary::logger(),"SparseCholeskyDecomposition: matrix is not positive definite at row "<<k);
+      return false;
+    }
+    LT.rowIndices(k)[0] = k;
+    LT.rowValues(k)[0] = Sqrt(d);
+    next[k] = 1;
+  }
+  return true;
+}
+
+template <class T>
+void SparseCholeskyDecomposition<T>::backSub(const VectorT& b,VectorT& x) const
+{
+  int n = (int)perm.size();
+  Assert(b.n == n);
+  vector<T> y(n);
+  for(int k=0;k<n;k++) y[k] = b(perm[k]);
+  //solve Ly = Pb by columns of L
+  for(int j=0;j<n;j++) {
+    const T* Lj = LT.rowValues(j);
+    const int* Ij = LT.rowIndices(j);
+    int num = LT.numRowEntries(j);
+    y[j] /= Lj[0];
+    for(int q=1;q<num;q++)
+      y[Ij[q]] -= Lj[q]*y[j];
+  }
+  //solve L^t z = y by rows of L^t
+  for(int j=n-1;j>=0;j--) {
+    const T* Lj = LT.rowValues(j);
+    const int* Ij = LT.rowIndices(j);
+    int num = LT.numRowEntries(j);
+    T sum = y[j];
+    for(int q=1;q<num;q++)
+      sum -= Lj[q]*y[Ij[q]];
+    y[j] = sum/Lj[0];
+  }
+  x.resize(n);
+  for(int k=0;k<n;k++) x(perm[k]) = y[k];
+}
+
+template class SparseCholeskyDecomposition<float>;
+template class SparseCholeskyDecomposition<double>;
+template void MinimumDegreeOrdering(const SparseMatrixTemplate_CR<float>& A,vector<int>& perm);
+template void MinimumDegreeOrdering(const SparseMatrixTemplate_CR<double>& A,vector<int>& perm);
+
+} //namespace Math
@@ -0,0 +1,54 @@
+#ifndef MATH_SPARSE_CHOLESKY_DECOMPOSITION_H
+#define MATH_SPARSE_CHOLESKY_DECOMPOSITION_H
+
+#include "SparseMatrixTemplate.h"
+#include "vector.h"
+#include <vector>
+
+namespace Math {
+
+/** @ingroup Math
+ * @brief Performs the sparse Cholesky decomposition PAP^t = LL^t of a
+ * symmetric positive definite matrix.
+ *
+ * set() computes a minimum degree ordering P of the rows to reduce the
+ * fill of L, the elimination tree, and the nonzero pattern of L, then
+ * factors A row by row (up-looking).  setNumeric() refactors a matrix with
+ * the same nonzero pattern as the last set() call, reusing the ordering and
+ * pattern.
+ *
+ * A must store both triangles.  backSub only reads the factorization, so
+ * several threads may solve with different right hand sides at once.
+ */
+template <class T>
+class SparseCholeskyDecomposition
+{
+public:
+  typedef SparseMatrixTemplate_CR<T> SparseMatrixT;
+  typedef VectorTemplate<T> VectorT;
+
+  SparseCholeskyDecomposition();
+  ///Returns false if A is not positive definite
+  bool set(const SparseMatrixT& A);
+  bool setNumeric(const SparseMatrixT& A);
+  void clear();
+  inline bool isEmpty() const { return perm.empty(); }
+  ///Solves Ax=b
+  void backSub(const VectorT& b,VectorT& x) const;
+
+  ///Row i of PAP^t is row perm[i] of A, and invPerm is the inverse
+  std::vector<int> perm,invPerm;
+  ///Elimination tree of PAP^t
+  std::vector<int> parent;
+  ///L^t stored by rows (i.e., L by columns), with the diagonal first
+  SparseMatrixT LT;
+};
+
+///Computes a minimum degree ordering of the rows of the symmetric matrix A,
+///which stores both triangles.  Ties are broken by lowest index.
+template <class T>
+void MinimumDegreeOrdering(const SparseMatrixTemplate_CR<T>& A,std::vector<int>& perm);
+
+} //namespace Math
+
+#endif
@@ -3,6 +3,7 @@
 #include "SparseMatrixTemplate.h"
 #include "complex.h"
 #include <iostream>
+#include <algorithm>
 using namespace std;
 
 namespace Math {
@@ -537,6 +538,293 @@ std::istream& operator >> (std::istream& in, SparseMatrixTemplate_RM<T>& A)
 }
 
 
+template <class T>
+SparseMatrixTemplate_CR<T>::SparseMatrixTemplate_CR()
+  :row_offsets(NULL),col_indices(NULL),val_array(NULL),m(0),n(0),num_entries(0)
+{}
+
+template <class T>
+SparseMatrixTemplate_CR<T>::SparseMatrixTemplate_CR(const MyT& A)
+  :row_offsets(NULL),col_indices(NULL),val_array(NULL),m(0),n(0),num_entries(0)
+{
+  copy(A);
+}
+
+template <class T>
+SparseMatrixTemplate_CR<T>::~SparseMatrixTemplate_CR()
+{
+  clear();
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::initialize(int _m,int _n,int _num_entries)
+{
+  clear();
+  m = _m;
+  n = _n;
+  num_entries = _num_entries;
+  row_offsets = new int[m+1];
+  col_indices = new int[num_entries];
+  val_array = new T[num_entries];
+  for(int i=0;i<=m;i++) row_offsets[i] = 0;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::resize(int _m,int _n,int _num_entries)
+{
+  if(m != _m || n != _n || num_entries != _num_entries)
+    initialize(_m,_n,_num_entries);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::clear()
+{
+  SafeArrayDelete(row_offsets);
+  SafeArrayDelete(col_indices);
+  SafeArrayDelete(val_array);
+  m = n = num_entries = 0;
+}
+
+template <class T>
+T* SparseMatrixTemplate_CR<T>::getEntry(int i,int j)
+{
+  Assert(isValidIndex(i,j));
+  int* begin = rowIndices(i);
+  int* end = begin + numRowEntries(i);
+  int* it = std::lower_bound(begin,end,j);
+  if(it == end || *it != j) return NULL;
+  return rowValues(i) + (it-begin);
+}
+
+template <class T>
+const T* SparseMatrixTemplate_CR<T>::getEntry(int i,int j) const
+{
+  Assert(isValidIndex(i,j));
+  const int* begin = rowIndices(i);
+  const int* end = begin + numRowEntries(i);
+  const int* it = std::lower_bound(begin,end,j);
+  if(it == end || *it != j) return NULL;
+  return rowValues(i) + (it-begin);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::copy(const MyT& A)
+{
+  if(this == &A) return;
+  if(A.row_offsets == NULL) {
+    clear();
+    return;
+  }
+  resize(A.m,A.n,A.num_entries);
+  std::copy(A.row_offsets,A.row_offsets+m+1,row_offsets);
+  std::copy(A.col_indices,A.col_indices+num_entries,col_indices);
+  std::copy(A.val_array,A.val_array+num_entries,val_array);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::set(const MatrixT& A,T zeroTol)
+{
+  int nnz=0;
+  for(int i=0;i<A.m;i++)
+    for(int j=0;j<A.n;j++)
+      if(!FuzzyZero(A(i,j),zeroTol)) nnz++;
+  resize(A.m,A.n,nnz);
+  int k=0;
+  for(int i=0;i<m;i++) {
+    row_offsets[i] = k;
+    for(int j=0;j<n;j++)
+      if(!FuzzyZero(A(i,j),zeroTol)) {
+        col_indices[k] = j;
+        val_array[k] = A(i,j);
+        k++;
+      }
+  }
+  row_offsets[m] = k;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::get(MatrixT& A) const
+{
+  A.resize(m,n,Zero);
+  for(int i=0;i<m;i++)
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+      A(i,col_indices[k]) = val_array[k];
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mul(const MyT& A,T s)
+{
+  copy(A);
+  inplaceMul(s);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mul(const VectorT& a,VectorT& x) const
+{
+  if(x.n == 0) x.resize(m);
+  if(x.n != m) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  if(a.n != n) {
+    FatalError("Source vector has incorrect dimensions");
+  }
+  for(int i=0;i<m;i++)
+    x(i) = dotRow(i,a);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mulTranspose(const VectorT& a,VectorT& x) const
+{
+  if(x.n == 0) x.resize(n);
+  if(x.n != n) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  x.setZero();
+  maddTranspose(a,x);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::madd(const VectorT& a,VectorT& x) const
+{
+  if(x.n != m) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  if(a.n != n) {
+    FatalError("Source vector has incorrect dimensions");
+  }
+  for(int i=0;i<m;i++)
+    x(i) += dotRow(i,a);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::maddTranspose(const VectorT& a,VectorT& x) const
+{
+  if(x.n != n) {
+    FatalError("Destination vector has incorrect dimensions");
+  }
+  if(a.n != m) {
+    FatalError("Source vector has incorrect dimensions");
+  }
+  for(int i=0;i<m;i++)
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+      x(col_indices[k]) += val_array[k]*a(i);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mul(const MatrixT& w,MatrixT& v) const
+{
+  Assert(w.m == n);
+  v.resize(m,w.n,Zero);
+  for(int i=0;i<m;i++)
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+      for(int j=0;j<w.n;j++)
+        v(i,j) += val_array[k]*w(col_indices[k],j);
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::mulTranspose(const MatrixT& w,MatrixT& v) const
+{
+  Assert(w.m == m);
+  v.resize(n,w.n,Zero);
+  for(int i=0;i<m;i++)
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+      for(int j=0;j<w.n;j++)
+        v(col_indices[k],j) += val_array[k]*w(i,j);
+}
+
+template <class T>
+T SparseMatrixTemplate_CR<T>::dotRow(int i,const VectorT& v) const
+{
+  Assert(isValidRow(i));
+  Assert(v.n == n);
+  T sum=0;
+  for(int k=row_offsets[i];k<row_offsets[i+1];k++)
+    sum += val_array[k]*v(col_indices[k]);
+  return sum;
+}
+
+template <class T>
+T SparseMatrixTemplate_CR<T>::dotCol(int j,const VectorT& v) const
+{
+  Assert(isValidCol(j));
+  Assert(v.n == m);
+  T sum=0;
+  for(int i=0;i<m;i++) {
+    const T* e = getEntry(i,j);
+    if(e) sum += v(i)*(*e);
+  }
+  return sum;
+}
+
+template <class T>
+T SparseMatrixTemplate_CR<T>::dotSymmL(int i,const VectorT& v) const
+{
+  Assert(isValidRow(i));
+  Assert(isSquare());
+  T sum=0;
+  for(int k=row_offsets[i];k<row_offsets[i+1] && col_indices[k]<=i;k++)
+    sum += val_array[k]*v(col_indices[k]);
+  for(int j=i+1;j<m;j++) {
+    const T* e = getEntry(j,i);
+    if(e) sum += v(j)*(*e);
+  }
+  return sum;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceMul(T c)
+{
+  for(int k=0;k<num_entries;k++) val_array[k] *= c;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceDiv(T c)
+{
+  for(int k=0;k<num_entries;k++) val_array[k] /= c;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceMulRow(int i,T c)
+{
+  Assert(isValidRow(i));
+  for(int k=row_offsets[i];k<row_offsets[i+1];k++) val_array[k] *= c;
+}
+
+template <class T>
+void SparseMatrixTemplate_CR<T>::inplaceMulCol(int j,T c)
+{
+  Assert(isValidCol(j));
+  for(int k=0;k<num_entries;k++)
+    if(col_indices[k] == j) val_array[k] *= c;
+}
+
+template <class T>
+bool SparseMatrixTemplate_CR<T>::isValid() const
+{
+  if(m < 0 || n < 0 || num_entries < 0) return false;
+  if(m == 0) return true;
+  if(row_offsets[0] != 0 || row_offsets[m] != num_entries) return false;
+  for(int i=0;i<m;i++) {
+    if(row_offsets[i] > row_offsets[i+1]) return false;
+    for(int k=row_offsets[i];k<row_offsets[i+1];k++) {
+      if(!isValidCol(col_indices[k])) return false;
+      if(k > row_offsets[i] && col_indices[k-1] >= col_indices[k]) return false;
+    }
+  }
+  return true;
+}
+
+template <class T>
+std::ostream& operator << (std::ostream& out, const SparseMatrixTemplate_CR<T>& A)
+{
+  out<<A.m<<" "<<A.n<<" "<<A.num_entries<<endl;
+  for(int i=0;i<A.m;i++)
+    for(int k=A.row_offsets[i];k<A.row_offsets[i+1];k++)
+      out<<i<<" "<<A.col_indices[k]<<"   "<<A.val_array[k]<<endl;
+  return out;
+}
+
+
 //specialization for complex
 template <> void SparseMatrixTemplate_RM<Complex>::setAdjoint(const MyT& A)
 {
@@ -549,12 +837,18 @@ template <> void SparseMatrixTemplate_RM<Complex>::setAdjoint(const MyT& A)
 template class SparseMatrixTemplate_RM<float>;
 template class SparseMatrixTemplate_RM<double>;
 template class SparseMatrixTemplate_RM<Complex>;
+template class SparseMatrixTemplate_CR<float>;
+template class SparseMatrixTemplate_CR<double>;
+template class SparseMatrixTemplate_CR<Complex>;
 template ostream& operator << (ostream& out, const SparseMatrixTemplate_RM<float>& v);
 template ostream& operator << (ostream& out, const SparseMatrixTemplate_RM<double>& v);
 template ostream& operator << (ostream& out, const SparseMatrixTemplate_RM<Complex>& v);
 template istream& operator >> (istream& in, SparseMatrixTemplate_RM<float>& v);
 template istream& operator >> (istream& in, SparseMatrixTemplate_RM<double>& v);
 template istream& operator >> (istream& in, SparseMatrixTemplate_RM<Complex>& v);
+template ostream& operator << (ostream& out, const SparseMatrixTemplate_CR<float>& v);
+template ostream& operator << (ostream& out, const SparseMatrixTemplate_CR<double>& v);
+template ostream& operator << (ostream& out, const SparseMatrixTemplate_CR<Complex>& v);
 
 template void SparseMatrixTemplate_RM<float>::copy(const SparseMatrixTemplate_RM<double>& a);
 template void SparseMatrixTemplate_RM<double>::copy(const SparseMatrixTemplate_RM<float>& a);
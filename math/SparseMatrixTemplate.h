@@ -130,7 +130,9 @@ class SparseMatrixTemplate_CR
   typedef MatrixTemplate<T> MatrixT;
 
   SparseMatrixTemplate_CR();
+  SparseMatrixTemplate_CR(const MyT&);
   ~SparseMatrixTemplate_CR();
+  const MyT& operator = (const MyT& A) { copy(A); return *this; }
   void initialize(int m, int n, int num_entries);
   void resize(int m, int n, int num_entries);
   void clear();
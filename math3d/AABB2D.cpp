@@ -21,14 +21,14 @@ bool AABB2D::Read(File& f)
 {
   if(!ReadFile(f,bmin)) return false;
   if(!ReadFile(f,bmax)) return false;
-  return false;
+  return true;
 }
 
 bool AABB2D::Write(File& f) const
 {
   if(!WriteFile(f,bmin)) return false;
   if(!WriteFile(f,bmax)) return false;
-  return false;
+  return true;
 }
 
 void AABB2D::maximize()
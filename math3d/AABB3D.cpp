@@ -22,14 +22,14 @@ bool AABB3D::Read(File& f)
 {
   if(!ReadFile(f,bmin)) return false;
   if(!ReadFile(f,bmax)) return false;
-  return false;
+  return true;
 }
 
 bool AABB3D::Write(File& f) const
 {
   if(!WriteFile(f,bmin)) return false;
   if(!WriteFile(f,bmax)) return false;
-  return false;
+  return true;
 }
 
 void AABB3D::Print(ostream& out) const 
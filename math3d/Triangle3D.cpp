@@ -646,9 +646,9 @@ Real Triangle3D::distance(const Triangle3D& other,Vector3& P,Vector3& Q) const
       // Find closest points on edges i & j, plus the 
       // vector (and distance squared) between these points
       s1.a = S[i];
-      s1.b = Sv[i];
+      s1.b = S[(i+1)%3];
       s2.a = T[j];
-      s2.b = Tv[j];
+      s2.b = T[(j+1)%3];
       Real t1,t2;
       s1.closestPoint(s2,t1,t2);
       s1.eval(t1,P);
@@ -673,7 +673,7 @@ Real Triangle3D::distance(const Triangle3D& other,Vector3& P,Vector3& Q) const
 
         if ((a <= 0) && (b >= 0)) return sqrt(dd);
 
-        Real p = V.dot(VEC);
+        Real p = VEC.dot(VEC);
 
         if (a < 0) a = 0;
         if (b > 0) b = 0;
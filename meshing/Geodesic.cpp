@@ -1,6 +1,10 @@
 #include <log4cxx/logger.h>
 #include <KrisLibrary/Logger.h>
 #include "Geodesic.h"
+#include "MeshPrimitives.h"
+#include <utils/threadutils.h>
+#include <errors.h>
+#include <algorithm>
 using namespace Meshing;
 
 //assumes a is at the origin, b is on the x axis
@@ -480,3 +484,203 @@ Real ApproximateGeodesic::Distance(int tri,const Vector3& pt) const
 				       pt,triangleWeights[tri]);
   }
 }
+
+
+
+//builds a CR matrix from lists of (column,value) entries for each row,
+//summing duplicates
+static void BuildCRMatrix(vector<vector<pair<int,Real> > >& rows,Math::SparseMatrixTemplate_CR<Real>& A)
+{
+  int n=(int)rows.size();
+  int nnz=0;
+  for(int i=0;i<n;i++) {
+    vector<pair<int,Real> >& r=rows[i];
+    sort(r.begin(),r.end());
+    size_t k=0;
+    for(size_t j=0;j<r.size();j++) {
+      if(k > 0 && r[k-1].first == r[j].first) r[k-1].second += r[j].second;
+      else r[k++] = r[j];
+    }
+    r.resize(k);
+    nnz += (int)k;
+  }
+  A.initialize(n,n,nnz);
+  for(int i=0;i<n;i++) {
+    A.row_offsets[i+1] = A.row_offsets[i]+(int)rows[i].size();
+    for(size_t j=0;j<rows[i].size();j++) {
+      A.rowIndices(i)[j] = rows[i][j].first;
+      A.rowValues(i)[j] = rows[i][j].second;
+    }
+  }
+}
+
+HeatGeodesic::HeatGeodesic(const TriMesh& mesh,Real timeScale)
+  :verts(mesh.verts),tris(mesh.tris)
+{
+  int n=(int)verts.size();
+  int nt=(int)tris.size();
+  triAreas.resize(nt);
+  triNormals.resize(nt);
+  triCotangents.resize(nt);
+  mass.assign(n,0);
+  vector<vector<pair<int,Real> > > rows(n);
+  Real sumEdgeLength=0;
+  int numEdges=0;
+  for(int i=0;i<nt;i++) {
+    const IntTriple& tri=tris[i];
+    const Vector3& a=verts[tri.a],&b=verts[tri.b],&c=verts[tri.c];
+    Vector3 normal;
+    normal.setCross(b-a,c-a);
+    Real len=normal.norm();
+    triAreas[i]=Half*len;
+    triNormals[i].setZero();
+    triCotangents[i].setZero();
+    sumEdgeLength += a.distance(b)+b.distance(c)+c.distance(a);
+    numEdges += 3;
+    if(len == 0) continue;
+    triNormals[i]=normal/len;
+    //cot of an angle is dot(u,v)/|cross(u,v)|, and |cross(u,v)| = 2*area
+    triCotangents[i].set(dot(b-a,c-a)/len,dot(c-b,a-b)/len,dot(a-c,b-c)/len);
+    for(int j=0;j<3;j++) mass[tri[j]] += triAreas[i]/3;
+    for(int j=0;j<3;j++) {
+      //the edge opposite vertex j gets half the cotangent of the angle at j
+      int u=tri[(j+1)%3],v=tri[(j+2)%3];
+      Real w=Half*triCotangents[i][j];
+      rows[u].push_back(pair<int,Real>(v,-w));
+      rows[v].push_back(pair<int,Real>(u,-w));
+      rows[u].push_back(pair<int,Real>(u,w));
+      rows[v].push_back(pair<int,Real>(v,w));
+    }
+  }
+  if(numEdges == 0) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"HeatGeodesic: empty mesh");
+    return;
+  }
+  Real h=sumEdgeLength/numEdges;
+  t=timeScale*h*h;
+  //vertices not on any nondegenerate triangle get a nominal mass so the
+  //systems stay positive definite
+  Real traceM=0,traceK=0;
+  for(int i=0;i<n;i++) traceM += mass[i];
+  Real defaultMass=(n > 0 ? traceM/n : One);
+  for(int i=0;i<n;i++) {
+    if(mass[i] == 0) {
+      mass[i]=defaultMass;
+      traceM += defaultMass;
+      rows[i].push_back(pair<int,Real>(i,0));
+    }
+  }
+  BuildCRMatrix(rows,K);
+  for(int i=0;i<n;i++) traceK += *K.getEntry(i,i);
+
+  //heat flow system M + tK, then K + eps M, which has the same pattern
+  Math::SparseMatrixTemplate_CR<Real> A;
+  A.copy(K);
+  A.inplaceMul(t);
+  for(int i=0;i<n;i++) *A.getEntry(i,i) += mass[i];
+  if(!heatSolver.set(A)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"HeatGeodesic: could not factor the heat flow system");
+    return;
+  }
+  Real eps=1e-8*traceK/traceM;
+  A.copy(K);
+  for(int i=0;i<n;i++) *A.getEntry(i,i) += eps*mass[i];
+  //the same pattern, so the ordering is reused
+  poissonSolver.perm=heatSolver.perm;
+  poissonSolver.invPerm=heatSolver.invPerm;
+  poissonSolver.parent=heatSolver.parent;
+  poissonSolver.LT.copy(heatSolver.LT);
+  if(!poissonSolver.setNumeric(A)) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"HeatGeodesic: could not factor the Poisson system");
+    poissonSolver.clear();
+    return;
+  }
+}
+
+void HeatGeodesic::Solve(const vector<int>& sources,vector<Real>& distances) const
+{
+  Assert(IsValid());
+  int n=(int)verts.size();
+  //integrate heat flow from the sources
+  Math::VectorTemplate<Real> b(n,Zero),u;
+  for(size_t i=0;i<sources.size();i++) {
+    Assert(sources[i] >= 0 && sources[i] < n);
+    b(sources[i]) = One;
+  }
+  heatSolver.backSub(b,u);
+  //divergence of the normalized, negated heat gradient
+  b.setZero();
+  for(size_t i=0;i<tris.size();i++) {
+    if(triAreas[i] == 0) continue;
+    const IntTriple& tri=tris[i];
+    Vector3 grad(Zero),temp;
+    for(int j=0;j<3;j++) {
+      const Vector3& p=verts[tri[(j+1)%3]],&q=verts[tri[(j+2)%3]];
+      temp.setCross(triNormals[i],q-p);
+      grad.madd(temp,u(tri[j]));
+    }
+    Real len=grad.norm();
+    if(len == 0) continue;
+    Vector3 X=grad/(-len);
+    for(int j=0;j<3;j++) {
+      int k1=(j+1)%3,k2=(j+2)%3;
+      const Vector3& p=verts[tri[j]];
+      Vector3 e1=verts[tri[k1]]-p,e2=verts[tri[k2]]-p;
+      b(tri[j]) += Half*(triCotangents[i][k2]*dot(e1,X)+triCotangents[i][k1]*dot(e2,X));
+    }
+  }
+  //K phi = -div X
+  b.inplaceNegative();
+  poissonSolver.backSub(b,u);
+  Real umin=Inf;
+  for(size_t i=0;i<sources.size();i++) umin=Min(umin,u(sources[i]));
+  if(sources.empty()) umin=0;
+  distances.resize(n);
+  for(int i=0;i<n;i++) distances[i]=u(i)-umin;
+}
+
+void HeatGeodesic::Solve(const vector<vector<int> >& sourceSets,vector<vector<Real> >& distances,int numThreads) const
+{
+  distances.resize(sourceSets.size());
+  ParallelFor((int)sourceSets.size(),[&](int i) {
+    Solve(sourceSets[i],distances[i]);
+  },numThreads);
+}
+
+void HeatGeodesic::SelfTest()
+{
+  //a 41x41 vertex grid over [0,2]x[0,2], with the source at the center
+  int m = 40;
+  TriMesh mesh;
+  MakeTriPlane(m,m,2.0,2.0,mesh);
+  int source = -1;
+  for(size_t i=0;i<mesh.verts.size();i++)
+    if(mesh.verts[i].distanceSquared(Vector3(1,1,0)) < 1e-12) source = (int)i;
+  Assert(source >= 0);
+  HeatGeodesic geodesic(mesh);
+  Assert(geodesic.IsValid());
+  //the mesh may go away, the solver keeps its own copy
+  mesh.verts.clear();
+  mesh.tris.clear();
+  vector<int> sources(1,source);
+  vector<Real> distances;
+  geodesic.Solve(sources,distances);
+  Assert(distances.size() == geodesic.verts.size());
+  Assert(distances[source] == 0);
+  Real maxerr = 0, sumerr = 0;
+  for(size_t i=0;i<distances.size();i++) {
+    Real d = geodesic.verts[i].distance(geodesic.verts[source]);
+    maxerr = Max(maxerr,Abs(distances[i]-d));
+    sumerr += Abs(distances[i]-d);
+  }
+  Real meanerr = sumerr/distances.size();
+  LOG4CXX_INFO(KrisLibrary::logger(),"HeatGeodesic::SelfTest: max error "<<maxerr<<", mean error "<<meanerr);
+  Assert(maxerr < 0.1);
+  Assert(meanerr < 0.03);
+  //the batch version gives the same results
+  vector<vector<int> > sourceSets(3,sources);
+  vector<vector<Real> > batchDistances;
+  geodesic.Solve(sourceSets,batchDistances);
+  for(size_t k=0;k<sourceSets.size();k++)
+    Assert(batchDistances[k] == distances);
+}
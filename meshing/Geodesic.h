@@ -3,6 +3,7 @@
 
 #include "TriMeshTopology.h"
 #include <KrisLibrary/structs/FixedSizeHeap.h>
+#include <KrisLibrary/math/SparseCholeskyDecomposition.h>
 
 namespace Meshing {
 
@@ -39,6 +40,51 @@ class ApproximateGeodesic
   vector<vector<int> > incomingVirtualEdges; 
 };
 
+/** @ingroup Meshing
+ * @brief Computes geodesic distances over a mesh from sets of source
+ * vertices with the heat method (Crane et al. 2013).
+ *
+ * The constructor builds the cotangent Laplacian and the lumped mass matrix
+ * and factors the heat flow and Poisson systems once, so each Solve only
+ * costs two sparse back substitutions.  Solve is const, so many source sets
+ * can be solved in parallel.
+ *
+ * timeScale multiplies the heat flow time, which is the squared mean edge
+ * length.  Larger values give smoother distances.  Distances at vertices
+ * that are not on any nondegenerate triangle are meaningless.
+ *
+ * The vertices and triangles are copied, so the mesh need not outlive this
+ * object.
+ */
+class HeatGeodesic
+{
+ public:
+  HeatGeodesic(const TriMesh& mesh,Real timeScale=1);
+  ///Returns false if the factorization failed, e.g., the mesh is degenerate
+  inline bool IsValid() const { return !heatSolver.isEmpty() && !poissonSolver.isEmpty(); }
+  ///Computes the distance of each vertex to the nearest source vertex
+  void Solve(const vector<int>& sources,vector<Real>& distances) const;
+  ///Solves for several source sets at once, using numThreads threads (0
+  ///uses all hardware threads)
+  void Solve(const vector<vector<int> >& sourceSets,vector<vector<Real> >& distances,int numThreads=0) const;
+  ///Compares the distances on a flat grid mesh against Euclidean distances
+  static void SelfTest();
+
+  vector<Vector3> verts;
+  vector<IntTriple> tris;
+  Real t;
+  ///Lumped (diagonal) mass matrix, the vertex areas
+  vector<Real> mass;
+  ///Cotangent stiffness matrix (the positive semidefinite Laplacian)
+  Math::SparseMatrixTemplate_CR<Real> K;
+  ///Per triangle area, unit normal, and cotangents of the angles at each vertex
+  vector<Real> triAreas;
+  vector<Vector3> triNormals;
+  vector<Vector3> triCotangents;
+  ///Factorizations of M + tK and K + eps M
+  Math::SparseCholeskyDecomposition<Real> heatSolver,poissonSolver;
+};
+
 } //namespace Meshing
 
 #endif
@@ -5,8 +5,11 @@
 #include <log4cxx/logger.h>
 #include <KrisLibrary/Logger.h>
 #include "MarchingCubes.h"
+#include "SparseVolumeGrid.h"
 #include <math3d/interpolate.h>
 #include <math/function.h>
+#include <utils/threadutils.h>
+#include <utils/stl_tr1.h>
 
 namespace Meshing {
 
@@ -607,97 +610,68 @@ void MarchingCubes(Real (*input)(Real,Real,Real),Real isoLevel,const AABB3D& bb,
 }
 
 
-void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,TriMesh& m)
+//For each edge of the marching cubes cube, the axis of the grid edge and the
+//offset of its lower endpoint from the cube's corner
+static const int MCEdgeGrid[12][4] = {
+  {0,0,0,0},{2,1,0,0},{0,0,0,1},{2,0,0,0},
+  {0,0,1,0},{2,1,1,0},{0,0,1,1},{2,0,1,0},
+  {1,0,0,0},{1,1,0,0},{1,1,0,1},{1,0,0,1}
+};
+
+//Output of marching cubes on a slab of the grid.  firstPlane and lastPlane
+//hold the vertex made on each y and z grid edge of the slab's bounding
+//planes (index 2*(j*p+k)+axis-1), or -1, so that slabs can be welded.
+struct MarchingCubesSlab
 {
-  m.verts.resize(0);
-  m.tris.resize(0);
-  m.verts.reserve(input.m*input.n);
-  m.tris.reserve(input.m*input.n);
+  TriMesh mesh;
+  std::vector<int> firstPlane,lastPlane;
+};
+
+//Runs marching cubes on the cubes with first index in [i0,i1).  Each
+//crossed grid edge gets a single vertex, interpolated from its lower
+//endpoint so that neighboring slabs compute identical vertices.
+static void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,const Vector3& dh,int i0,int i1,MarchingCubesSlab& slab)
+{
+  int n=input.n,p=input.p;
+  int np=n*p;
+  TriMesh& m = slab.mesh;
+  //vertices on the x edges of the current layer, and on the y,z edges of
+  //the planes at its two sides
+  std::vector<int> xedges(np),planes[2];
+  planes[0].assign(2*np,-1);
+  planes[1].assign(2*np,-1);
+  int cur=0;
   Real vals[8];
-  Vector3 verts[12];
   int vertMap[12];
-  Vector3 x;
-  Vector3 dh(bb.bmax-bb.bmin);
-  dh.x /= Real(input.m-1);
-  dh.y /= Real(input.n-1);
-  dh.z /= Real(input.p-1);
-
   IntTriple tri;
-  x = bb.bmin;
-  for (int i=0;i<input.m-1;i++,x.x += dh.x) {
-    x.y = bb.bmin.y;
-    for (int j=0;j<input.n-1;j++,x.y += dh.y) {
-      x.z = bb.bmin.z;
-      for (int k=0;k<input.p-1;k++,x.z += dh.z) {
+  for(int i=i0;i<i1;i++) {
+    std::fill(xedges.begin(),xedges.end(),-1);
+    int* sides[2] = {&planes[cur][0],&planes[1-cur][0]};
+    for (int j=0;j<n-1;j++) {
+      for (int k=0;k<p-1;k++) {
 	EvaluateCube(input,i,j,k,vals);
-	
-	int cubeIndex = 0;
-	if (vals[0] < isoLevel) cubeIndex |= 1;
-	if (vals[1] < isoLevel) cubeIndex |= 2;
-	if (vals[2] < isoLevel) cubeIndex |= 4;
-	if (vals[3] < isoLevel) cubeIndex |= 8;
-	if (vals[4] < isoLevel) cubeIndex |= 16;
-	if (vals[5] < isoLevel) cubeIndex |= 32;
-	if (vals[6] < isoLevel) cubeIndex |= 64;
-	if (vals[7] < isoLevel) cubeIndex |= 128;
-
-	if (MCEdgeTable[cubeIndex] == 0) {
-	  continue;
-	}
-
-	if (MCEdgeTable[cubeIndex] & 1) {
-	  Real u=SegmentCrossing(vals[0], vals[1], isoLevel);
-	  verts[0] = EvalCubeEdge(x,dh,u,0,1);
-	}
-	if (MCEdgeTable[cubeIndex] & 2) {
-	  Real u=SegmentCrossing(vals[1], vals[2], isoLevel);
-	  verts[1] = EvalCubeEdge(x,dh,u,1,2);
-	}
-	if (MCEdgeTable[cubeIndex] & 4) {
-	  Real u=SegmentCrossing(vals[2], vals[3], isoLevel);
-	  verts[2] = EvalCubeEdge(x,dh,u,2,3);
-	}
-	if (MCEdgeTable[cubeIndex] & 8) {
-	  Real u=SegmentCrossing(vals[3], vals[0], isoLevel);
-	  verts[3] = EvalCubeEdge(x,dh,u,3,0);
-	}
-	if (MCEdgeTable[cubeIndex] & 16) {
-	  Real u=SegmentCrossing(vals[4], vals[5], isoLevel);
-	  verts[4] = EvalCubeEdge(x,dh,u,4,5);
-	}
-	if (MCEdgeTable[cubeIndex] & 32) {
-	  Real u=SegmentCrossing(vals[5], vals[6], isoLevel);
-	  verts[5] = EvalCubeEdge(x,dh,u,5,6);
-	}
-	if (MCEdgeTable[cubeIndex] & 64) {
-	  Real u=SegmentCrossing(vals[6], vals[7], isoLevel);
-	  verts[6] = EvalCubeEdge(x,dh,u,6,7);
-	}
-	if (MCEdgeTable[cubeIndex] & 128) {
-	  Real u=SegmentCrossing(vals[7], vals[4], isoLevel);
-	  verts[7] = EvalCubeEdge(x,dh,u,7,4);
-	}
-	if (MCEdgeTable[cubeIndex] & 256) {
-	  Real u=SegmentCrossing(vals[0], vals[4], isoLevel);
-	  verts[8] = EvalCubeEdge(x,dh,u,0,4);
-	}
-	if (MCEdgeTable[cubeIndex] & 512) {
-	  Real u=SegmentCrossing(vals[1], vals[5], isoLevel);
-	  verts[9] = EvalCubeEdge(x,dh,u,1,5);
-	}
-	if (MCEdgeTable[cubeIndex] & 1024) {
-	  Real u=SegmentCrossing(vals[2], vals[6], isoLevel);
-	  verts[10] = EvalCubeEdge(x,dh,u,2,6);
-	}
-	if (MCEdgeTable[cubeIndex] & 2048) {
-	  Real u=SegmentCrossing(vals[3], vals[7], isoLevel);
-	  verts[11] = EvalCubeEdge(x,dh,u,3,7);
-	}
 
-	//get the mapping from tri vertices to mesh vertices
-	for(int* t=MCTriTable[cubeIndex];*t!=-1; t++) {
-	  vertMap[*t] = (int)m.verts.size();
-	  m.verts.push_back(verts[*t]);
+	int cubeIndex = 0;
+	for(int v=0;v<8;v++)
+	  if (vals[v] < isoLevel) cubeIndex |= (1<<v);
+	int edges = MCEdgeTable[cubeIndex];
+	if (edges == 0) continue;
+
+	for(int e=0;e<12;e++) {
+	  if(!(edges & (1<<e))) continue;
+	  const int* g = MCEdgeGrid[e];
+	  int a = (j+g[2])*p+k+g[3];
+	  int* slot = (g[0]==0 ? &xedges[a] : &sides[g[1]][2*a+g[0]-1]);
+	  if(*slot < 0) {
+	    IntTriple lo(i+g[1],j+g[2],k+g[3]),hi=lo;
+	    hi[g[0]]++;
+	    Real u=SegmentCrossing(input(lo),input(hi),isoLevel);
+	    Vector3 x(bb.bmin.x+lo.a*dh.x,bb.bmin.y+lo.b*dh.y,bb.bmin.z+lo.c*dh.z);
+	    x[g[0]] += u*dh[g[0]];
+	    *slot = (int)m.verts.size();
+	    m.verts.push_back(x);
+	  }
+	  vertMap[e] = *slot;
 	}
 	for(int* t=MCTriTable[cubeIndex];*t!=-1; t+=3) {
 	  tri.a = vertMap[*t];
@@ -707,22 +681,70 @@ void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,Tri
 	}
       }
     }
+    if(i == i0) slab.firstPlane = planes[cur];
+    cur = 1-cur;
+    if(i+1 < i1) std::fill(planes[1-cur].begin(),planes[1-cur].end(),-1);
   }
-
-  //TODO: merge vertices
+  slab.lastPlane.swap(planes[cur]);
 }
 
-void CubeToMesh(const Real origvals[8],Real isoLevel,const AABB3D& bb,TriMesh& m)
+void MarchingCubes(const Array3D<Real>& input,Real isoLevel,const AABB3D& bb,TriMesh& m,int numThreads)
 {
   m.verts.resize(0);
   m.tris.resize(0);
-  Real vals[8];
-  for(int i=0;i<8;i++)
-    vals[regularCubeIndexToMCIndex[i]] = origvals[i];
+  if(input.m < 2 || input.n < 2 || input.p < 2) return;
+  Vector3 dh(bb.bmax-bb.bmin);
+  dh.x /= Real(input.m-1);
+  dh.y /= Real(input.n-1);
+  dh.z /= Real(input.p-1);
+
+  if(numThreads <= 0) numThreads = NumHardwareThreads();
+  int numCubes = input.m-1;
+  int numSlabs = (numThreads > 1 ? Min(numCubes,numThreads*4) : 1);
+  std::vector<MarchingCubesSlab> slabs(numSlabs);
+  ParallelFor(numSlabs,[&](int s) {
+      MarchingCubes(input,isoLevel,bb,dh,numCubes*s/numSlabs,numCubes*(s+1)/numSlabs,slabs[s]);
+    },numThreads);
+
+  //merge the slabs, welding the vertices on the planes between them
+  size_t nv=0,nt=0;
+  for(int s=0;s<numSlabs;s++) {
+    nv += slabs[s].mesh.verts.size();
+    nt += slabs[s].mesh.tris.size();
+  }
+  m.verts.reserve(nv);
+  m.tris.reserve(nt);
+  std::vector<int> remap,prevLast;
+  for(int s=0;s<numSlabs;s++) {
+    TriMesh& sm = slabs[s].mesh;
+    remap.assign(sm.verts.size(),-1);
+    if(s > 0) {
+      const std::vector<int>& first = slabs[s].firstPlane;
+      for(size_t e=0;e<first.size();e++)
+        if(first[e] >= 0 && prevLast[e] >= 0) remap[first[e]] = prevLast[e];
+    }
+    for(size_t v=0;v<sm.verts.size();v++) {
+      if(remap[v] >= 0) continue;
+      remap[v] = (int)m.verts.size();
+      m.verts.push_back(sm.verts[v]);
+    }
+    for(size_t t=0;t<sm.tris.size();t++)
+      m.tris.push_back(IntTriple(remap[sm.tris[t].a],remap[sm.tris[t].b],remap[sm.tris[t].c]));
+    const std::vector<int>& last = slabs[s].lastPlane;
+    prevLast.resize(last.size());
+    for(size_t e=0;e<last.size();e++)
+      prevLast[e] = (last[e] >= 0 ? remap[last[e]] : -1);
+    sm.verts.clear();
+    sm.tris.clear();
+  }
+}
+
+//Appends the triangles of one cube with corner x and size dh to m; vals are
+//in marching cubes order
+static void AppendCube(const Real vals[8],Real isoLevel,const Vector3& x,const Vector3& dh,TriMesh& m)
+{
   Vector3 verts[12];
   int vertMap[12];
-  const Vector3& x=bb.bmin;
-  Vector3 dh=bb.bmax-bb.bmin;
 
   IntTriple tri;
   int cubeIndex = 0;
@@ -801,4 +823,101 @@ void CubeToMesh(const Real origvals[8],Real isoLevel,const AABB3D& bb,TriMesh& m
   }
 }
 
+void CubeToMesh(const Real origvals[8],Real isoLevel,const AABB3D& bb,TriMesh& m)
+{
+  m.verts.resize(0);
+  m.tris.resize(0);
+  Real vals[8];
+  for(int i=0;i<8;i++)
+    vals[regularCubeIndexToMCIndex[i]] = origvals[i];
+  AppendCube(vals,isoLevel,bb.bmin,bb.bmax-bb.bmin,m);
+}
+
+//returns true if block a comes before block b in lexicographic order
+inline bool BlockLess(const IntTriple& a,const IntTriple& b)
+{
+  if(a.a != b.a) return a.a < b.a;
+  if(a.b != b.b) return a.b < b.b;
+  return a.c < b.c;
+}
+
+void MarchingCubes(const SparseVolumeGrid& grid,Real isoLevel,TriMesh& m)
+{
+  m.verts.resize(0);
+  m.tris.resize(0);
+  if(grid.m < 2 || grid.n < 2 || grid.p < 2) return;
+  Vector3 dh = grid.GetCellSize();
+  //the vertex on each crossed grid edge, keyed by 3*(index of the edge's
+  //lower endpoint)+axis, so that cubes in different blocks share vertices
+  UNORDERED_MAP_TEMPLATE<int64_t,int> edgeVerts;
+  int64_t np = int64_t(grid.n)*int64_t(grid.p);
+  Real vals[8],cvals[8];
+  int vertMap[12];
+  IntTriple imin,imax,c,tri;
+  for(size_t bi=0;bi<grid.blocks.size();bi++) {
+    const SparseVolumeGrid::Block& b = grid.blocks[bi];
+    if(b.offset < 0) continue;
+    grid.GetBlockRange(b.index,imin,imax);
+    //cubes touching the block; a cube that touches several full blocks is
+    //meshed by the lexicographically first one
+    for(c.a=Max(imin.a-1,0);c.a<=Min(imax.a,grid.m-2);c.a++) {
+      for(c.b=Max(imin.b-1,0);c.b<=Min(imax.b,grid.n-2);c.b++) {
+        for(c.c=Max(imin.c-1,0);c.c<=Min(imax.c,grid.p-2);c.c++) {
+          bool interior = (c.a >= imin.a && c.a < imax.a && c.b >= imin.b && c.b < imax.b && c.c >= imin.c && c.c < imax.c);
+          if(!interior) {
+            IntTriple owner = b.index;
+            for(int v=0;v<8;v++) {
+              IntTriple nb = SparseVolumeGrid::BlockIndex(c.a+(v>>2),c.b+((v>>1)&1),c.c+(v&1));
+              if(!BlockLess(nb,owner)) continue;
+              int k = grid.FindBlock(nb);
+              if(k >= 0 && grid.blocks[k].offset >= 0) owner = nb;
+            }
+            if(!(owner == b.index)) continue;
+            for(int v=0;v<8;v++)
+              cvals[v] = grid.GetValue(c.a+(v>>2),c.b+((v>>1)&1),c.c+(v&1));
+          }
+          else {
+            const Real* bvals = &grid.values[b.offset];
+            for(int v=0;v<8;v++)
+              cvals[v] = bvals[(((c.a+(v>>2))&7)<<6) | (((c.b+((v>>1)&1))&7)<<3) | ((c.c+(v&1))&7)];
+          }
+          for(int v=0;v<8;v++)
+            vals[regularCubeIndexToMCIndex[v]] = cvals[v];
+
+          int cubeIndex = 0;
+          for(int v=0;v<8;v++)
+            if (vals[v] < isoLevel) cubeIndex |= (1<<v);
+          int edges = MCEdgeTable[cubeIndex];
+          if (edges == 0) continue;
+          for(int e=0;e<12;e++) {
+            if(!(edges & (1<<e))) continue;
+            const int* g = MCEdgeGrid[e];
+            IntTriple lo(c.a+g[1],c.b+g[2],c.c+g[3]);
+            int64_t key = 3*(int64_t(lo.a)*np+int64_t(lo.b)*grid.p+lo.c)+g[0];
+            int& vert = edgeVerts.insert(std::make_pair(key,-1)).first->second;
+            if(vert < 0) {
+              //interpolated from the lower endpoint, as in the dense version
+              int vlo = (g[1]<<2)|(g[2]<<1)|g[3];
+              int vhi = vlo | (4>>g[0]);
+              Real u=SegmentCrossing(cvals[vlo],cvals[vhi],isoLevel);
+              Vector3 x;
+              grid.GetCenter(lo,x);
+              x[g[0]] += u*dh[g[0]];
+              vert = (int)m.verts.size();
+              m.verts.push_back(x);
+            }
+            vertMap[e] = vert;
+          }
+          for(int* t=MCTriTable[cubeIndex];*t!=-1; t+=3) {
+            tri.a = vertMap[*t];
+            tri.b = vertMap[*(t+1)];
+            tri.c = vertMap[*(t+2)];
+            m.tris.push_back(tri);
+          }
+        }
+      }
+    }
+  }
+}
+
 } //namespace Meshing
@@ -16,6 +16,8 @@ namespace Math {
 
 namespace Meshing {
 
+  class SparseVolumeGrid;
+
   /** @addtogroup Meshing */
   /*@{*/
 
@@ -27,8 +29,17 @@ void MarchingCubes(Real (*f)(Real,Real,Real),Real isoval,const AABB3D& bb,const
 
 /// Takes a 3D grid as input, meshes the isosurface at f(x)=isoval.
 /// Assumes the input values are defined at the vertices of a grid with
-/// m-1 x n-1 x p-1 cells
-void MarchingCubes(const Array3D<Real>& input,Real isoval,const AABB3D& bb,TriMesh& m);
+/// m-1 x n-1 x p-1 cells.  Vertices shared between cubes are emitted once.
+/// The grid is split into slabs that are meshed on numThreads threads (0
+/// uses all hardware threads) and welded together.
+void MarchingCubes(const Array3D<Real>& input,Real isoval,const AABB3D& bb,TriMesh& m,int numThreads=0);
+
+/// Takes a sparse grid as input, meshes the isosurface at f(x)=isoval.
+/// Unlike the Array3D version, values are defined at cell centers.  Only
+/// cubes touching a full block are meshed, so the isosurface must not pass
+/// through tiles or the background.  Each crossed grid edge gets a single
+/// vertex, so the output is welded.
+void MarchingCubes(const SparseVolumeGrid& grid,Real isoval,TriMesh& m);
 
 /// Takes values of a function f at a cube's vertices as input,
 /// meshes the isosurface at f(x)=isoval
@@ -160,9 +160,9 @@ int SplitTriangle(const Triangle2D& _t,const Plane2D& p,Vector2 newPts[2],IntTri
   Triangle2D t; //=_t; 
   int indices[3]; //={0,1,2}
   Real d[3];
-  d[0] = p.distance(t.a);
-  d[1] = p.distance(t.b);
-  d[2] = p.distance(t.c);
+  d[0] = p.distance(_t.a);
+  d[1] = p.distance(_t.b);
+  d[2] = p.distance(_t.c);
   //find the "odd man" on the opposite side of the plane as the other 2
   //rotate the points so index 0 is the odd man
   int oddman = OddMan(d[0],d[1],d[2],tol);
@@ -4,14 +4,18 @@
 #include <iostream>
 #include <math3d/AABB3D.h>
 #include <math3d/rotation.h>
+#include <math/random.h>
 #include <utils/SimpleParser.h>
 #include <utils/stringutils.h>
 #include <utils/ioutils.h>
+#include <utils/lzf.h>
 #include <errors.h>
 #include <sstream>
 #include <fstream>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <functional>
 
 using namespace Meshing;
 
@@ -22,13 +26,237 @@ string IntToStr(int i)
   return ss.str();
 }
 
+void PointCloudProperties::clear()
+{
+  numRows = 0;
+  columns.clear();
+}
+
+void PointCloudProperties::reserve(size_t n)
+{
+  for(size_t k=0;k<columns.size();k++) {
+    if(columns[k].isFloat) columns[k].floatValues.reserve(n);
+    else columns[k].values.reserve(n);
+  }
+}
+
+void PointCloudProperties::resize(size_t n)
+{
+  numRows = n;
+  for(size_t k=0;k<columns.size();k++) {
+    if(columns[k].isFloat) columns[k].floatValues.resize(n,0);
+    else columns[k].values.resize(n,0);
+  }
+}
+
+void PointCloudProperties::resize(size_t n,const Vector& v)
+{
+  if(numRows == 0 && NumColumns() != v.n) {
+    columns.resize(0);
+    for(int k=0;k<v.n;k++) AddColumn(floatStorage);
+  }
+  Assert(v.n == NumColumns());
+  for(size_t k=0;k<columns.size();k++) {
+    if(columns[k].isFloat) columns[k].floatValues.resize(n,float(v(k)));
+    else columns[k].values.resize(n,v(k));
+  }
+  numRows = n;
+}
+
+void PointCloudProperties::push_back(const Vector& v)
+{
+  if(numRows == 0 && NumColumns() != v.n) {
+    columns.resize(0);
+    for(int k=0;k<v.n;k++) AddColumn(floatStorage);
+  }
+  Assert(v.n == NumColumns());
+  for(size_t k=0;k<columns.size();k++) {
+    if(columns[k].isFloat) columns[k].floatValues.push_back(float(v(k)));
+    else columns[k].values.push_back(v(k));
+  }
+  numRows++;
+}
+
+void PointCloudProperties::GetRow(size_t i,Vector& v) const
+{
+  v.resize(NumColumns());
+  for(int k=0;k<NumColumns();k++) v(k) = Get(i,k);
+}
+
+void PointCloudProperties::SetRow(size_t i,const Vector& v)
+{
+  Assert(v.n == NumColumns());
+  for(int k=0;k<NumColumns();k++) Set(i,k,v(k));
+}
+
+void PointCloudProperties::AppendRow(const PointCloudProperties& other,size_t i)
+{
+  if(numRows == 0 && NumColumns() != other.NumColumns()) {
+    columns.resize(other.columns.size());
+    for(size_t k=0;k<columns.size();k++) {
+      columns[k].isFloat = other.columns[k].isFloat;
+      columns[k].values.clear();
+      columns[k].floatValues.clear();
+    }
+  }
+  Assert(other.NumColumns() == NumColumns());
+  for(size_t k=0;k<columns.size();k++) {
+    if(columns[k].isFloat) columns[k].floatValues.push_back(float(other.Get(i,k)));
+    else columns[k].values.push_back(other.Get(i,k));
+  }
+  numRows++;
+}
+
+void PointCloudProperties::AddColumn(bool isFloat)
+{
+  columns.resize(columns.size()+1);
+  columns.back().isFloat = isFloat;
+  if(isFloat) columns.back().floatValues.resize(numRows,0);
+  else columns.back().values.resize(numRows,0);
+}
+
+void PointCloudProperties::RemoveColumn(int k)
+{
+  columns.erase(columns.begin()+k);
+}
+
+void PointCloudProperties::GetColumn(int k,vector<Real>& items) const
+{
+  const Column& c = columns[k];
+  if(c.isFloat) items.assign(c.floatValues.begin(),c.floatValues.end());
+  else items = c.values;
+}
+
+void PointCloudProperties::SetColumn(int k,const vector<Real>& items)
+{
+  Assert(items.size() == numRows);
+  Column& c = columns[k];
+  if(c.isFloat) c.floatValues.assign(items.begin(),items.end());
+  else c.values = items;
+}
+
+void PointCloudProperties::SetFloatStorage(int k,bool isFloat)
+{
+  Column& c = columns[k];
+  if(c.isFloat == isFloat) return;
+  if(isFloat) {
+    c.floatValues.assign(c.values.begin(),c.values.end());
+    vector<Real>().swap(c.values);
+  }
+  else {
+    c.values.assign(c.floatValues.begin(),c.floatValues.end());
+    vector<float>().swap(c.floatValues);
+  }
+  c.isFloat = isFloat;
+}
+
+//packed colors are kept in double precision
+static bool IsPackedColor(const string& name)
+{
+  return name == "rgb" || name == "rgba";
+}
+
+//Returns the 32 bits of a packed color value.  Colors are stored as signed
+//ints, but unsigned values from other writers are accepted too.
+static int PackedColorBits(Real value)
+{
+  return int(uint32_t(int64_t(value)));
+}
+
+//Returns true if PCD fields can have the given TYPE and SIZE
+static bool IsValidPCDType(char type,int size)
+{
+  if(type == 'F') return size == 4 || size == 8;
+  if(type == 'U' || type == 'I') return size == 1 || size == 2 || size == 4 || size == 8;
+  return false;
+}
+
+template <class T,class S>
+static void LoadPCDField(const char* data,size_t stride,size_t n,S* values)
+{
+  T v;
+  for(size_t i=0;i<n;i++,data+=stride) {
+    memcpy(&v,data,sizeof(T));
+    values[i] = S(v);
+  }
+}
+
+//Converts n values of a PCD field, stride bytes apart, to values
+template <class S>
+static void LoadPCDField(const char* data,size_t stride,size_t n,char type,int size,S* values)
+{
+  if(type == 'F') {
+    if(size == 4) LoadPCDField<float>(data,stride,n,values);
+    else LoadPCDField<double>(data,stride,n,values);
+  }
+  else if(type == 'U') {
+    if(size == 1) LoadPCDField<uint8_t>(data,stride,n,values);
+    else if(size == 2) LoadPCDField<uint16_t>(data,stride,n,values);
+    else if(size == 4) LoadPCDField<uint32_t>(data,stride,n,values);
+    else LoadPCDField<uint64_t>(data,stride,n,values);
+  }
+  else {
+    if(size == 1) LoadPCDField<int8_t>(data,stride,n,values);
+    else if(size == 2) LoadPCDField<int16_t>(data,stride,n,values);
+    else if(size == 4) LoadPCDField<int32_t>(data,stride,n,values);
+    else LoadPCDField<int64_t>(data,stride,n,values);
+  }
+}
+
+template <class T>
+static void SavePCDFloatField(const Real* values,size_t n,char* data,size_t stride)
+{
+  for(size_t i=0;i<n;i++,data+=stride) {
+    T v = T(values[i]);
+    memcpy(data,&v,sizeof(T));
+  }
+}
+
+//integer fields are rounded; negative values are wrapped for unsigned
+//fields
+template <class T>
+static void SavePCDIntField(const Real* values,size_t n,char* data,size_t stride)
+{
+  for(size_t i=0;i<n;i++,data+=stride) {
+    T v = T(int64_t(Floor(values[i]+0.5)));
+    memcpy(data,&v,sizeof(T));
+  }
+}
+
+//Converts n values to a PCD field, stride bytes apart
+static void SavePCDField(const Real* values,size_t n,char type,int size,char* data,size_t stride)
+{
+  if(type == 'F') {
+    if(size == 4) SavePCDFloatField<float>(values,n,data,stride);
+    else SavePCDFloatField<double>(values,n,data,stride);
+  }
+  else if(type == 'U') {
+    if(size == 1) SavePCDIntField<uint8_t>(values,n,data,stride);
+    else if(size == 2) SavePCDIntField<uint16_t>(values,n,data,stride);
+    else if(size == 4) SavePCDIntField<uint32_t>(values,n,data,stride);
+    else SavePCDIntField<uint64_t>(values,n,data,stride);
+  }
+  else {
+    if(size == 1) SavePCDIntField<int8_t>(values,n,data,stride);
+    else if(size == 2) SavePCDIntField<int16_t>(values,n,data,stride);
+    else if(size == 4) SavePCDIntField<int32_t>(values,n,data,stride);
+    else SavePCDIntField<int64_t>(values,n,data,stride);
+  }
+}
+
 class PCLParser : public SimpleParser
 {
 public:
   enum {NORMAL, READING_FIELDS, READING_TYPES, READING_SIZES, READING_COUNTS };
   PCLParser(istream& in,PointCloud3D& _pc)
-    :SimpleParser(in),pc(_pc),state(NORMAL),numPoints(-1)
+    :SimpleParser(in),pc(_pc),state(NORMAL),numPoints(-1),chunkSize(0)
   {}
+  //called after each point is read; hands off the points read so far if
+  //there are chunkSize of them.  Returns false to stop reading.
+  bool EndChunk() {
+    if(chunkSize == 0 || pc.properties.size() < chunkSize) return true;
+    return onChunk();
+  }
   virtual bool IsComment(char c) const { return c=='#'; }
   virtual bool IsToken(char c) const { return !IsSpace(c) && !IsComment(c); }
   virtual bool IsPunct(char c) const { return !IsSpace(c) && !IsComment(c) && !IsToken(c); }
@@ -104,11 +332,11 @@ public:
         string datatype;
         if(!ReadLine(datatype)) return Error;
         datatype = Strip(datatype);
-        if(datatype == "binary") {
+        if(datatype == "binary" || datatype == "binary_compressed") {
           //pull in the endline
           int c = in.get();
           if(c != '\n') {
-            LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: DATA binary not followed immediately by endline");
+            LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: DATA "<<datatype<<" not followed immediately by endline");
             return Error;
           }
           //read in binary data
@@ -124,78 +352,100 @@ public:
             LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Invalid number of TYPE elements");
             return Error;
           }
-          int pointsize = 0;
-          for(size_t i=0;i<sizes.size();i++)
+          size_t pointsize = 0;
+          for(size_t i=0;i<sizes.size();i++) {
+            if(!IsValidPCDType(types[i][0],sizes[i])) {
+              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Invalid "<<types[i]<<" size "<<sizes[i]);
+              return Error;
+            }
+            //4-byte packed colors, whether F (PCL's bit cast), U, or I,
+            //are read as their signed 32 bits
+            if(sizes[i] == 4 && IsPackedColor(pc.propertyNames[i])) types[i] = "I";
             pointsize += sizes[i];
-
-          streampos fcur = in.tellg();
-          in.seekg( 0, std::ios::end );
-          streampos fsize = in.tellg() - fcur;
-          in.seekg( fcur );
-          if(fsize-streampos(pointsize*numPoints) != 0) {
-            cout<<"Size of point "<<pointsize<<" x "<<numPoints<<" points"<<endl;
-            cout<<"Remaining bytes left: "<<fsize<<", we'll probably have "<<fsize-streampos(pointsize*numPoints)<<" left?"<<endl;
-            for(int i=0;i<int(fsize)-pointsize*numPoints;i++) {
-              if(in.peek() != 0) {
-                cout<<"Hmmm... what's this wasted space? stopped on "<<i<<endl;
+          }
+          if(numPoints == 0 || pointsize == 0) return Stop;
+          pc.properties.reserve(chunkSize > 0 ? Min((size_t)numPoints,chunkSize) : (size_t)numPoints);
+          //points are read and converted field by field in blocks
+          size_t block = (chunkSize > 0 ? chunkSize : 65536);
+          vector<size_t> offsets(sizes.size()),strides(sizes.size());
+          if(datatype == "binary") {
+            //field j of point i is at i*pointsize + offsets[j]
+            streampos fcur = in.tellg();
+            in.seekg( 0, std::ios::end );
+            streampos fsize = in.tellg() - fcur;
+            in.seekg( fcur );
+            streamoff extra = streamoff(fsize) - streamoff(pointsize)*numPoints;
+            if(extra < 0) {
+              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Binary data has "<<streamoff(fsize)<<" bytes, expected "<<streamoff(pointsize)*numPoints);
+              return Error;
+            }
+            if(extra > 0) {
+              //skip padding before the point data
+              bool nonzero = false;
+              for(streamoff i=0;i<extra;i++) {
+                if(in.peek() != 0) nonzero = true;
+                in.get();
               }
-              in.get();
+              if(nonzero)
+                LOG4CXX_WARN(KrisLibrary::logger(),"PCD parser: Skipped "<<extra<<" bytes of non-zero data before the binary points");
+            }
+            size_t ofs = 0;
+            for(size_t j=0;j<sizes.size();j++) {
+              offsets[j] = ofs;
+              strides[j] = pointsize;
+              ofs += sizes[j];
+            }
+            vector<char> buffer;
+            for(size_t i=0;i<(size_t)numPoints;i+=block) {
+              size_t n = Min(block,(size_t)numPoints-i);
+              buffer.resize(n*pointsize);
+              in.read(&buffer[0],n*pointsize);
+              if(!in) {
+                LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Error reading data for point "<<i+in.gcount()/pointsize);
+                return Error;
+              }
+              AppendPoints(&buffer[0],n,offsets,strides);
+              if(!EndChunk()) return Stop;
             }
           }
-
-          vector<char> buffer(pointsize);
-          for(int i=0;i<numPoints;i++) {
-            in.read(&buffer[0],pointsize);
+          else {
+            //LZF-compressed, with field j of point i at
+            //numPoints*offsets[j] + i*sizes[j]
+            uint32_t compressedSize,uncompressedSize;
+            in.read((char*)&compressedSize,sizeof(uint32_t));
+            in.read((char*)&uncompressedSize,sizeof(uint32_t));
+            if(!in) {
+              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Error reading compressed data size");
+              return Error;
+            }
+            if(uncompressedSize != pointsize*numPoints) {
+              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Compressed data has "<<uncompressedSize<<" bytes, expected "<<pointsize*numPoints);
+              return Error;
+            }
+            vector<char> compressed(compressedSize),buffer(uncompressedSize);
+            in.read(&compressed[0],compressedSize);
             if(!in) {
-              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Error reading data for point "<<i);
+              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Premature end of compressed data");
+              return Error;
+            }
+            if(LZFDecompress(&compressed[0],compressedSize,&buffer[0],uncompressedSize) != uncompressedSize) {
+              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Corrupt compressed data");
               return Error;
             }
-            //parse the point and add it
-            Vector v(pc.propertyNames.size());
-            int ofs = 0;
+            vector<char>().swap(compressed);
+            size_t ofs = 0;
             for(size_t j=0;j<sizes.size();j++) {
-              if(types[j] == "F") {
-                if(sizes[j] == 4) {
-                  float f;
-                  memcpy(&f,&buffer[ofs],sizes[j]);
-                  v[j] = f;
-                  /*
-                  if(i % 10000 == 0)
-                    printf("%s Buffer %x => float %f\n",pc.propertyNames[j].c_str(),*((unsigned int*)&buffer[ofs]),f);
-                    */
-                }
-                else if(sizes[j] == 8) {
-                  double f;
-                  memcpy(&f,&buffer[ofs],sizes[j]);
-                  v[j] = f;
-                }
-                else {
-                  LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Invalid float size "<<sizes[j]);
-                  return Error;
-                }
-              }
-              else if(types[j] == "U") {
-                if(sizes[j] > 4) {
-                  LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Invalid unsigned int size "<<sizes[j]);
-                  return Error;       
-                }
-                unsigned i=0;
-                memcpy(&i,&buffer[ofs],sizes[j]);
-                v[j] = Real(i);
-              }
-              else if(types[j] == "I") {
-                LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Invalid int size "<<sizes[j]);
-                int i=0;
-                memcpy(&i,&buffer[ofs],sizes[j]);
-                v[j] = Real(i);
-              }
-              else {
-                LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Invalid type "<<types[i].c_str());
-                return Error;
-              }
+              offsets[j] = ofs*numPoints;
+              strides[j] = sizes[j];
               ofs += sizes[j];
             }
-            pc.properties.push_back(v);
+            for(size_t i=0;i<(size_t)numPoints;i+=block) {
+              size_t n = Min(block,(size_t)numPoints-i);
+              AppendPoints(&buffer[0],n,offsets,strides);
+              for(size_t j=0;j<sizes.size();j++)
+                offsets[j] += n*strides[j];
+              if(!EndChunk()) return Stop;
+            }
           }
           return Stop;
         }
@@ -205,6 +455,9 @@ public:
             return Error;
           }
           string line;
+          Vector v(pc.propertyNames.size());
+          InitColumns();
+          pc.properties.reserve(chunkSize > 0 ? Min((size_t)numPoints,chunkSize) : (size_t)numPoints);
           for(int i=0;i<numPoints;i++) {
             int c = in.get();
             assert(c=='\n' || c==EOF);
@@ -217,17 +470,28 @@ public:
               LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Error reading point "<<i);
               return Error;
             }
-            vector<string> elements = Split(line," ");
-            if(elements.size() != pc.propertyNames.size()) {
-              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: DATA element "<<i<<" has length "<<elements.size()<<", but "<<pc.propertyNames.size());
-              return Error;
+            //strtod also parses nan and inf
+            const char* str = line.c_str();
+            int k = 0;
+            while(true) {
+              while(*str == ' ' || *str == '\t' || *str == '\r') str++;
+              if(*str == 0) break;
+              char* end;
+              Real x = strtod(str,&end);
+              if(end == str) {
+                LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Invalid value on DATA element "<<i);
+                return Error;
+              }
+              if(k < v.n) v[k] = x;
+              k++;
+              str = end;
             }
-            Vector v(elements.size());
-            for(size_t k=0;k<elements.size();k++) {
-              stringstream ss(elements[k]);
-              SafeInputFloat(ss,v[k]);
+            if(k != v.n) {
+              LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: DATA element "<<i<<" has length "<<k<<", but "<<pc.propertyNames.size());
+              return Error;
             }
             pc.properties.push_back(v);
+            if(!EndChunk()) return Stop;
           }
         }
         else {
@@ -263,6 +527,34 @@ public:
     return Continue;
   }
 
+  //Sets up one column per field, keeping packed colors in double precision
+  void InitColumns()
+  {
+    PointCloudProperties& props = pc.properties;
+    if(props.empty() && props.NumColumns() != (int)pc.propertyNames.size()) {
+      props.clear();
+      for(size_t j=0;j<pc.propertyNames.size();j++)
+        props.AddColumn(props.floatStorage && !IsPackedColor(pc.propertyNames[j]));
+    }
+  }
+
+  //Appends n points of binary data, with field j of point i at
+  //data + offsets[j] + i*strides[j]
+  void AppendPoints(const char* data,size_t n,const vector<size_t>& offsets,const vector<size_t>& strides)
+  {
+    PointCloudProperties& props = pc.properties;
+    InitColumns();
+    size_t start = props.size();
+    props.resize(start+n);
+    for(size_t j=0;j<offsets.size();j++) {
+      PointCloudProperties::Column& c = props.columns[j];
+      if(c.isFloat)
+        LoadPCDField(data+offsets[j],strides[j],n,types[j][0],sizes[j],&c.floatValues[start]);
+      else
+        LoadPCDField(data+offsets[j],strides[j],n,types[j][0],sizes[j],&c.values[start]);
+    }
+  }
+
   void ConvertToSingleCounts()
   {
     size_t i=0;
@@ -293,43 +585,17 @@ public:
   vector<string> types;
   vector<int> sizes;
   vector<int> counts;
+  //for streaming
+  size_t chunkSize;
+  std::function<bool()> onChunk;
 };
 
-
-void PointCloud3D::Clear()
-{
-  points.clear();
-  propertyNames.clear();
-  properties.clear();
-  settings.clear();
-}
-
-bool PointCloud3D::LoadPCL(const char* fn)
-{
-  ifstream in(fn,ios::in);
-  if(!in) return false;
-  if(!LoadPCL(in)) return false;
-  settings["file"] = fn;
-  in.close();
-  return true;
-}
-
-bool PointCloud3D::SavePCL(const char* fn) const
-{
-  ofstream out(fn,ios::out);
-  if(!out) return false;
-  if(!SavePCL(out)) return false;
-  out.close();
-  return true;
-}
-
-bool PointCloud3D::LoadPCL(istream& in)
+//Fills in pc.points from the x, y, z properties read by the parser
+static bool ExtractPCLPoints(PointCloud3D& pc,const vector<string>& types)
 {
-  PCLParser parser(in,*this);
-  if(!parser.Read()) {
-        LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Unable to parse PCD file");
-    return false;
-  }
+  vector<string>& propertyNames = pc.propertyNames;
+  PointCloudProperties& properties = pc.properties;
+  vector<Vector3>& points = pc.points;
   int elemIndex[3] = {-1,-1,-1};
   for(size_t i=0;i<propertyNames.size();i++) {
     if(propertyNames[i]=="x") elemIndex[0] = (int)i;
@@ -342,18 +608,22 @@ bool PointCloud3D::LoadPCL(istream& in)
     for(size_t i=0;i<propertyNames.size();i++)
             LOG4CXX_ERROR(KrisLibrary::logger()," \""<<propertyNames[i].c_str());
         LOG4CXX_ERROR(KrisLibrary::logger(),"");
-    return true;
+    return false;
   }
 
   //HACK: for float RGB and RGBA elements, convert float bytes
   //to integer via memory cast
-  Assert(propertyNames.size() == parser.types.size());
+  Assert(propertyNames.size() == types.size());
   for(size_t k=0;k<propertyNames.size();k++) {
-    if(parser.types[k] == "F" && (propertyNames[k] == "rgb" || propertyNames[k] == "rgba")) { 
+    if(types[k] == "U" && IsPackedColor(propertyNames[k])) {
+      //unsigned colors are converted to the signed ints used by GetColors
+      for(size_t i=0;i<properties.size();i++)
+        properties.Set(i,k,(Real)PackedColorBits(properties.Get(i,k)));
+    }
+    if(types[k] == "F" && (propertyNames[k] == "rgb" || propertyNames[k] == "rgba")) { 
       bool docast = false;
       for(size_t i=0;i<properties.size();i++) {
-    Vector& v = properties[i];
-    float f = float(v[k]);
+    float f = float(properties.Get(i,k));
     if(f < 1.0 && f > 0.0) {
       docast=true;
       break;
@@ -361,11 +631,12 @@ bool PointCloud3D::LoadPCL(istream& in)
       }
       if(docast) {
         //LOG4CXX_ERROR(KrisLibrary::logger(),"PointCloud::LoadPCL: Warning, casting RGB colors to integers via direct memory cast");
+    //the integers need double precision
+    properties.SetFloatStorage((int)k,false);
     for(size_t i=0;i<properties.size();i++) {
-      Vector& v = properties[i];
-      float f = float(v[k]);
+      float f = float(properties.Get(i,k));
       int rgb = *((int*)&f);
-      v[k] = (Real)rgb;
+      properties.Set(i,k,(Real)rgb);
     }
       }
     }
@@ -374,66 +645,243 @@ bool PointCloud3D::LoadPCL(istream& in)
   //parse out the points
   points.resize(properties.size());
   for(size_t i=0;i<properties.size();i++) {
-    points[i].set(properties[i][elemIndex[0]],properties[i][elemIndex[1]],properties[i][elemIndex[2]]);
+    points[i].set(properties.Get(i,elemIndex[0]),properties.Get(i,elemIndex[1]),properties.Get(i,elemIndex[2]));
   }
   //LOG4CXX_INFO(KrisLibrary::logger(),"PCD parser: "<<points.size());
 
-  if(properties.size()==3 && elemIndex[0]==0 && elemIndex[1]==1 && elemIndex[2]==2) {
+  if(propertyNames.size()==3 && elemIndex[0]==0 && elemIndex[1]==1 && elemIndex[2]==2) {
     //x,y,z are the only properties, go ahead and take them out
     propertyNames.resize(0);
-    properties.resize(0);
+    properties.clear();
   }
   return true;
 }
 
+
+void PointCloud3D::Clear()
+{
+  points.clear();
+  propertyNames.clear();
+  properties.clear();
+  settings.clear();
+}
+
+bool PointCloud3D::LoadPCL(const char* fn)
+{
+  ifstream in(fn,ios::in|ios::binary);
+  if(!in) return false;
+  if(!LoadPCL(in)) return false;
+  settings["file"] = fn;
+  in.close();
+  return true;
+}
+
+bool PointCloud3D::SavePCL(const char* fn) const
+{
+  return SavePCL(fn,"ascii");
+}
+
+bool PointCloud3D::SavePCL(const char* fn,const string& format,const map<string,string>& fieldTypes) const
+{
+  ofstream out(fn,ios::out|ios::binary);
+  if(!out) return false;
+  if(!SavePCL(out,format,fieldTypes)) return false;
+  out.close();
+  return true;
+}
+
+bool PointCloud3D::LoadPCL(istream& in)
+{
+  PCLParser parser(in,*this);
+  if(!parser.Read()) {
+        LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Unable to parse PCD file");
+    return false;
+  }
+  ExtractPCLPoints(*this,parser.types);
+  return true;
+}
+
+bool PointCloud3D::LoadPCL(const char* fn,size_t chunkSize,const std::function<bool(PointCloud3D&)>& f)
+{
+  ifstream in(fn,ios::in|ios::binary);
+  if(!in) return false;
+  Clear();
+  settings["file"] = fn;
+  return LoadPCL(in,chunkSize,f);
+}
+
+bool PointCloud3D::LoadPCL(istream& in,size_t chunkSize,const std::function<bool(PointCloud3D&)>& f)
+{
+  points.clear();
+  propertyNames.clear();
+  properties.clear();
+  PCLParser parser(in,*this);
+  bool stopped = false, failed = false;
+  //hands the chunk to f, and returns false to stop reading
+  auto emit = [&]() {
+    //the property names are needed to parse the following chunks
+    vector<string> names = propertyNames;
+    bool res = false;
+    if(!ExtractPCLPoints(*this,parser.types)) failed = true;
+    else if(f(*this)) res = true;
+    else stopped = true;
+    propertyNames = names;
+    points.resize(0);
+    properties.resize(0);
+    return res;
+  };
+  parser.chunkSize = Max(chunkSize,(size_t)1);
+  parser.onChunk = emit;
+  if(!parser.Read()) {
+        LOG4CXX_ERROR(KrisLibrary::logger(),"PCD parser: Unable to parse PCD file");
+    return false;
+  }
+  if(!failed && !stopped && !properties.empty()) emit();
+  return !failed;
+}
+
 bool PointCloud3D::SavePCL(ostream& out) const
 {
+  return SavePCL(out,"ascii");
+}
+
+bool PointCloud3D::SavePCL(ostream& out,const string& format,const map<string,string>& fieldTypes) const
+{
+  if(format != "ascii" && format != "binary" && format != "binary_compressed") {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"PointCloud3D::SavePCL: Invalid format "<<format<<", must be ascii, binary, or binary_compressed");
+    return false;
+  }
+  bool addxyz = !HasXYZAsProperties();
+  vector<string> fields;
+  if(addxyz) {
+    fields.push_back("x");
+    fields.push_back("y");
+    fields.push_back("z");
+  }
+  fields.insert(fields.end(),propertyNames.begin(),propertyNames.end());
+  vector<char> types(fields.size());
+  vector<int> sizes(fields.size());
+  for(size_t i=0;i<fields.size();i++) {
+    map<string,string>::const_iterator t = fieldTypes.find(fields[i]);
+    if(t != fieldTypes.end()) {
+      const string& type = t->second;
+      if(type.length() < 2 || !IsValidInteger(type.c_str()+1) || !IsValidPCDType(type[0],atoi(type.c_str()+1))) {
+        LOG4CXX_ERROR(KrisLibrary::logger(),"PointCloud3D::SavePCL: Invalid type "<<type<<" for field "<<fields[i]);
+        return false;
+      }
+      types[i] = type[0];
+      sizes[i] = atoi(type.c_str()+1);
+    }
+    else {
+      types[i] = (IsPackedColor(fields[i]) ? 'I' : 'F');
+      sizes[i] = 4;
+    }
+  }
+  size_t n = (properties.empty() ? points.size() : properties.size());
+
   out<<"# .PCD v0.7 - Point Cloud Data file format"<<endl;
   if(settings.find("pcd_version") != settings.end())
     out<<"VERSION "<<settings.find("pcd_version")->second<<endl;
   else
     out<<"VERSION 0.7"<<endl;
-  bool addxyz = !HasXYZAsProperties();
-
   out<<"FIELDS";
-  if(addxyz)
-    out<<" x y z";
-  for(size_t i=0;i<propertyNames.size();i++)
-    out<<" "<<propertyNames[i];
+  for(size_t i=0;i<fields.size();i++)
+    out<<" "<<fields[i];
+  out<<"\n";
+  out<<"SIZE";
+  for(size_t i=0;i<fields.size();i++)
+    out<<" "<<sizes[i];
   out<<"\n";
   out<<"TYPE";
-  if(addxyz)
-    out<<" F F F";
-  for(size_t i=0;i<propertyNames.size();i++)
-    out<<" F";
+  for(size_t i=0;i<fields.size();i++)
+    out<<" "<<types[i];
   out<<"\n";
-
-  if(!properties.empty())
-    out<<"POINTS "<<properties.size()<<"\n";
-  else 
-    out<<"POINTS "<<points.size()<<"\n";
-
+  out<<"COUNT";
+  for(size_t i=0;i<fields.size();i++)
+    out<<" 1";
+  out<<"\n";
+  out<<"POINTS "<<n<<"\n";
   for(map<string,string>::const_iterator i=settings.begin();i!=settings.end();i++) {
     if(i->first == "pcd_version" || i->first == "file") continue;
     string key = i->first;
     Uppercase(key);
     out<<key<<" "<<i->second<<"\n";
   }
-  out<<"DATA ascii"<<"\n";  
-  if(propertyNames.empty()) {
-    for(size_t i=0;i<points.size();i++) 
-      out<<points[i]<<"\n";
+  //PCL readers need the width and height
+  if(settings.find("width") == settings.end())
+    out<<"WIDTH "<<n<<"\n";
+  if(settings.find("height") == settings.end())
+    out<<"HEIGHT 1\n";
+  out<<"DATA "<<format<<"\n";
+  if(format == "ascii") {
+    if(propertyNames.empty()) {
+      for(size_t i=0;i<points.size();i++) 
+        out<<points[i]<<"\n";
+    }
+    else {
+      for(size_t i=0;i<properties.size();i++) {
+        if(addxyz)
+          out<<points[i]<<" ";
+        for(int j=0;j<properties.NumColumns();j++) {
+          int k = (addxyz ? j+3 : j);
+          Real v = properties.Get(i,j);
+          //integers are written exactly, wrapping negative values for U
+          //fields.  Packed colors saved as F are written as their integer
+          //value.
+          if(types[k] == 'U') {
+            uint64_t u = uint64_t(int64_t(Floor(v+0.5)));
+            if(sizes[k] < 8) u &= (uint64_t(1)<<(8*sizes[k]))-1;
+            out<<u<<" ";
+          }
+          else if(types[k] == 'I' || IsPackedColor(fields[k]))
+            out<<int64_t(Floor(v+0.5))<<" ";
+          else
+            out<<v<<" ";
+        }
+        out<<"\n";
+      }
+    }
+    return true;
   }
-  else {
-    for(size_t i=0;i<properties.size();i++) {
-      if(addxyz)
-    out<<points[i]<<" ";
-      for(int j=0;j<properties[i].n;j++)
-    out<<properties[i][j]<<" ";
-      out<<"\n";
+
+  //binary data is written field by field: point-major for binary, and
+  //field-major for binary_compressed
+  size_t pointsize = 0;
+  for(size_t i=0;i<fields.size();i++)
+    pointsize += sizes[i];
+  bool fieldMajor = (format == "binary_compressed");
+  vector<char> buffer(n*pointsize);
+  vector<Real> values(n);
+  size_t ofs = 0;
+  for(size_t i=0;i<fields.size();i++) {
+    if(addxyz && i < 3) {
+      for(size_t k=0;k<n;k++) values[k] = points[k][i];
+    }
+    else
+      properties.GetColumn(int(addxyz ? i-3 : i),values);
+    //packed colors saved as F4 are bit casts of their integer value
+    char type = types[i];
+    if(type == 'F' && sizes[i] == 4 && IsPackedColor(fields[i])) type = 'I';
+    if(n > 0) {
+      if(fieldMajor) SavePCDField(&values[0],n,type,sizes[i],&buffer[ofs*n],sizes[i]);
+      else SavePCDField(&values[0],n,type,sizes[i],&buffer[ofs],pointsize);
     }
+    ofs += sizes[i];
   }
-  return true;
+  if(!fieldMajor) {
+    if(!buffer.empty()) out.write(&buffer[0],buffer.size());
+  }
+  else {
+    vector<char> compressed(LZFCompressBound(buffer.size()));
+    uint32_t uncompressedSize = (uint32_t)buffer.size();
+    uint32_t compressedSize = 0;
+    if(!buffer.empty())
+      compressedSize = (uint32_t)LZFCompress(&buffer[0],buffer.size(),&compressed[0],compressed.size());
+    out.write((const char*)&compressedSize,sizeof(uint32_t));
+    out.write((const char*)&uncompressedSize,sizeof(uint32_t));
+    if(compressedSize > 0) out.write(&compressed[0],compressedSize);
+  }
+  return (bool)out;
 }
 
 bool PointCloud3D::IsStructured() const
@@ -549,9 +997,11 @@ void PointCloud3D::Transform(const Matrix4& mat)
     //transform normals if this has them
     if(hasNormals) {
       Vector3 temp2;
-      temp.set(properties[i][nxind],properties[i][nyind],properties[i][nzind]);
+      temp.set(properties.Get(i,nxind),properties.Get(i,nyind),properties.Get(i,nzind));
       mat.mulVector(temp,temp2);
-      temp2.get(properties[i][nxind],properties[i][nyind],properties[i][nzind]);
+      properties.Set(i,nxind,temp2.x);
+      properties.Set(i,nyind,temp2.y);
+      properties.Set(i,nzind,temp2.z);
     }
   }
 }
@@ -581,22 +1031,11 @@ void PointCloud3D::SetXYZAsProperties(bool isprop)
     if(propertyNames[i]=="z") elemIndex[2] = (int)i;
   }
   if(isprop) { //add
-    int numprops = propertyNames.size();
-    for(int i=0;i<3;i++)
-      if(elemIndex[i] < 0) {
-    propertyNames.push_back(elementNames[i]);
-    elemIndex[i] = numprops;
-    numprops++;
-      }
-    if(properties.empty()) 
-      properties.resize(points.size());
-    for(size_t i=0;i<points.size();i++) {
-      Vector oldprops = properties[i];
-      properties[i].resize(numprops);
-      properties[i].copySubVector(0,oldprops);
-      properties[i][elemIndex[0]] = points[i].x;
-      properties[i][elemIndex[1]] = points[i].y;
-      properties[i][elemIndex[2]] = points[i].z;
+    vector<Real> items(points.size());
+    for(int k=0;k<3;k++) {
+      for(size_t i=0;i<points.size();i++)
+        items[i] = points[i][k];
+      SetProperty(elementNames[k],items);
     }
   }
   else {
@@ -618,27 +1057,20 @@ bool PointCloud3D::GetNormals(vector<Vector3>& normals) const
   if(nx < 0 || ny < 0 || nz < 0) return false;
   normals.resize(properties.size());
   for(size_t i=0;i<properties.size();i++)
-    normals[i].set(properties[i][nx],properties[i][ny],properties[i][nz]);
+    normals[i].set(properties.Get(i,nx),properties.Get(i,ny),properties.Get(i,nz));
   return true;
 }
 
 void PointCloud3D::SetNormals(const vector<Vector3>& normals)
 {
-  int nx=PropertyIndex("normal_x"),ny=PropertyIndex("normal_y"),nz=PropertyIndex("normal_z");
-  if(nx < 0) {
-    vector<Real> items(points.size());
-    SetProperty("normal_x",items);
+  Assert(normals.size() == points.size());
+  vector<Real> items(normals.size());
+  const char* names[3] = {"normal_x","normal_y","normal_z"};
+  for(int k=0;k<3;k++) {
+    for(size_t i=0;i<normals.size();i++)
+      items[i] = normals[i][k];
+    SetProperty(names[k],items);
   }
-  if(ny < 0) {
-    vector<Real> items(points.size());
-    SetProperty("normal_y",items);
-  }
-  if(nz < 0) {
-    vector<Real> items(points.size());
-    SetProperty("normal_z",items);
-  }
-  for(size_t i=0;i<properties.size();i++)
-    normals[i].get(properties[i][nx],properties[i][ny],properties[i][nz]);
 }
 bool PointCloud3D::HasColor() const
 {
@@ -722,7 +1154,7 @@ bool PointCloud3D::GetColors(vector<Vector4>& out) const
     //convert real to hex to GLcolor
     out.resize(rgb.size());
     for(size_t i=0;i<rgb.size();i++) {
-      int col = (int)rgb[i];
+      int col = PackedColorBits(rgb[i]);
       Real r=((col&0xff0000)>>16) / 255.0;
       Real g=((col&0xff00)>>8) / 255.0;
       Real b=(col&0xff) / 255.0;
@@ -735,7 +1167,7 @@ bool PointCloud3D::GetColors(vector<Vector4>& out) const
     //following PCD, this is actuall A-RGB
     out.resize(rgb.size());
     for(size_t i=0;i<rgb.size();i++) {
-      int col = (int)rgb[i];
+      int col = PackedColorBits(rgb[i]);
       Real r = ((col&0xff0000)>>16) / 255.0;
       Real g = ((col&0xff00)>>8) / 255.0;
       Real b = (col&0xff) / 255.0;
@@ -770,7 +1202,7 @@ bool PointCloud3D::GetColors(vector<Real>& r,vector<Real>& g,vector<Real>& b,vec
     a.resize(rgb.size());
     fill(a.begin(),a.end(),1.0);
     for(size_t i=0;i<rgb.size();i++) {
-      int col = (int)rgb[i];
+      int col = PackedColorBits(rgb[i]);
       r[i]=((col&0xff0000)>>16) / 255.0;
       g[i]=((col&0xff00)>>8) / 255.0;
       b[i]=(col&0xff) / 255.0;
@@ -785,7 +1217,7 @@ bool PointCloud3D::GetColors(vector<Real>& r,vector<Real>& g,vector<Real>& b,vec
     b.resize(rgb.size());
     a.resize(rgb.size());
     for(size_t i=0;i<rgb.size();i++) {
-      int col = (int)rgb[i];
+      int col = PackedColorBits(rgb[i]);
       r[i] = ((col&0xff0000)>>16) / 255.0;
       g[i] = ((col&0xff00)>>8) / 255.0;
       b[i] = (col&0xff) / 255.0;
@@ -907,6 +1339,13 @@ bool PointCloud3D::GetUV(vector<Vector2>& uvs) const
   return false;
 }
 
+void PointCloud3D::SetFloatStorage(bool isFloat)
+{
+  properties.floatStorage = isFloat;
+  for(size_t k=0;k<propertyNames.size();k++)
+    properties.SetFloatStorage((int)k,isFloat && !IsPackedColor(propertyNames[k]));
+}
+
 int PointCloud3D::PropertyIndex(const string& name) const
 {
   for(size_t i=0;i<propertyNames.size();i++) {
@@ -919,41 +1358,28 @@ bool PointCloud3D::GetProperty(const string& name,vector<Real>& items) const
 {
   int i = PropertyIndex(name);
   if(i < 0) return false;
-  items.resize(properties.size());
-  for(size_t k=0;k<properties.size();k++)
-    items[k] = properties[k][i];
+  properties.GetColumn(i,items);
   return true;
 }
 
 void PointCloud3D::SetProperty(const string& name,const vector<Real>& items)
 {
   int i = PropertyIndex(name);
-  if(i >= 0) {
-    for(size_t k=0;k<properties.size();k++) {
-      properties[k][i] = items[k];
-    }
-    return;
-  }
-  else {
+  if(i < 0) {
     //add it
+    if(properties.NumColumns() == 0)
+      properties.resize(items.size());
     propertyNames.push_back(name);
-    for(size_t k=0;k<properties.size();k++) {
-      Vector oldval = properties[k];
-      properties[k].resize(propertyNames.size());
-      properties[k].copySubVector(0,oldval);
-      properties[k][propertyNames.size()-1] = items[k];
-    }
+    properties.AddColumn(properties.floatStorage && !IsPackedColor(name));
+    i = properties.NumColumns()-1;
   }
+  properties.SetColumn(i,items);
 }
 void PointCloud3D::RemoveProperty(const string& name)
 {
   int i = PropertyIndex(name);
   if(i >= 0) {
-    for(size_t k=0;k<properties.size();k++) {
-      for(size_t j=i+1;j<propertyNames.size();j++)
-    properties[k][j-1] = properties[k][j];
-      properties[k].n--;
-    }
+    properties.RemoveColumn(i);
     propertyNames.erase(propertyNames.begin()+i);
     return;
   }
@@ -970,7 +1396,7 @@ void PointCloud3D::GetSubCloud(const Vector3& bmin,const Vector3& bmax,PointClou
   for(size_t i=0;i<points.size();i++)
     if(bb.contains(points[i])) {
       subcloud.points.push_back(points[i]);
-      subcloud.properties.push_back(properties[i]);
+      if(!properties.empty()) subcloud.properties.AppendRow(properties,i);
     }
 }
 
@@ -988,21 +1414,21 @@ void PointCloud3D::GetSubCloud(const string& property,Real minValue,Real maxValu
     for(size_t i=0;i<points.size();i++)
       if(minValue <= points[i].x && points[i].x <= maxValue) {
     subcloud.points.push_back(points[i]);
-    subcloud.properties.push_back(properties[i]);
+    if(!properties.empty()) subcloud.properties.AppendRow(properties,i);
       }
   }
   else if(property == "y") {
     for(size_t i=0;i<points.size();i++)
       if(minValue <= points[i].y && points[i].y <= maxValue) {
     subcloud.points.push_back(points[i]);
-    subcloud.properties.push_back(properties[i]);
+    if(!properties.empty()) subcloud.properties.AppendRow(properties,i);
       }
   }
   else if(property == "z") {
     for(size_t i=0;i<points.size();i++)
       if(minValue <= points[i].z && points[i].z <= maxValue) {
     subcloud.points.push_back(points[i]);
-    subcloud.properties.push_back(properties[i]);
+    if(!properties.empty()) subcloud.properties.AppendRow(properties,i);
       }
   }
   else {
@@ -1012,9 +1438,70 @@ void PointCloud3D::GetSubCloud(const string& property,Real minValue,Real maxValu
       return;
     }
     for(size_t k=0;k<properties.size();k++)
-      if(minValue <= properties[k][i] && properties[k][i] <= maxValue) {
+      if(minValue <= properties.Get(k,i) && properties.Get(k,i) <= maxValue) {
     subcloud.points.push_back(points[k]);
-    subcloud.properties.push_back(properties[k]);
+    subcloud.properties.AppendRow(properties,k);
       }
   }
 }
+
+void PointCloud3D::SelfTest()
+{
+  //opaque, transparent, and half-transparent colors, including channels
+  //that set the sign bit of a packed rgba
+  PointCloud3D pc;
+  int n = 100;
+  pc.points.resize(n);
+  vector<Vector4> colors(n);
+  vector<Real> intensity(n);
+  for(int i=0;i<n;i++) {
+    pc.points[i].set(Rand(-1,1),Rand(-1,1),Rand(-1,1));
+    Real a = (i%3==0 ? 1.0 : (i%3==1 ? 0.0 : 0.5));
+    colors[i].set(RandInt(256)/255.0,RandInt(256)/255.0,RandInt(256)/255.0,a);
+    intensity[i] = RandInt(1000);
+  }
+  colors[0].set(1,0.5,0.25,1);
+  pc.SetColors(colors,true);
+  pc.SetProperty("intensity",intensity);
+  vector<Real> rgba,rgb;
+  pc.GetProperty("rgba",rgba);
+  PointCloud3D pcrgb = pc;
+  pcrgb.RemoveProperty("rgba");
+  pcrgb.SetColors(colors,false);
+  pcrgb.GetProperty("rgb",rgb);
+
+  const char* formats[3] = {"ascii","binary","binary_compressed"};
+  const char* colorTypes[4] = {"","I4","U4","F4"};
+  for(int storage=0;storage<2;storage++) {
+    for(int f=0;f<3;f++) {
+      for(int t=0;t<4;t++) {
+        for(int alpha=0;alpha<2;alpha++) {
+          PointCloud3D src = (alpha ? pc : pcrgb);
+          const char* colorName = (alpha ? "rgba" : "rgb");
+          const vector<Real>& packed = (alpha ? rgba : rgb);
+          src.SetFloatStorage(storage==1);
+          map<string,string> fieldTypes;
+          if(colorTypes[t][0] != 0) fieldTypes[colorName] = colorTypes[t];
+          stringstream ss;
+          Assert(src.SavePCL(ss,formats[f],fieldTypes));
+          PointCloud3D loaded;
+          loaded.properties.floatStorage = (storage==1);
+          Assert(loaded.LoadPCL(ss));
+          Assert(loaded.points.size() == pc.points.size());
+          for(int i=0;i<n;i++)
+            Assert(loaded.points[i].distance(pc.points[i]) < 1e-5);
+          vector<Real> values;
+          Assert(loaded.GetProperty(colorName,values));
+          Assert(values == packed);
+          Assert(loaded.GetProperty("intensity",values));
+          Assert(values == intensity);
+          vector<Vector4> srcColors,loadedColors;
+          Assert(src.GetColors(srcColors));
+          Assert(loaded.GetColors(loadedColors));
+          Assert(loadedColors == srcColors);
+          if(alpha) Assert(loadedColors[0].distance(Vector4(1,0.5,0.25,1)) < 0.01);
+        }
+      }
+    }
+  }
+}
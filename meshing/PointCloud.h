@@ -6,6 +6,7 @@
 #include <KrisLibrary/utils/PropertyMap.h>
 #include <vector>
 #include <iosfwd>
+#include <functional>
 #include <string>
 
 namespace Meshing {
@@ -13,6 +14,126 @@ namespace Meshing {
 using namespace Math3D;
 using namespace std;
 
+/** @brief The per-point properties of a PointCloud3D, stored column-wise.
+ *
+ * Each property is one contiguous array of values.  Columns are stored in
+ * double precision by default, or in single precision if they are created
+ * while floatStorage is true or converted with SetFloatStorage.
+ *
+ * For compatibility with code written for row-wise storage, this also acts
+ * like a vector of property Vectors: properties.size() is the number of
+ * points, and properties[i][k], properties.push_back(v), properties.resize(n)
+ * etc. work through row proxies.  The column accessors are much faster.
+ */
+class PointCloudProperties
+{
+ public:
+  struct Column
+  {
+    Column() : isFloat(false) {}
+    bool isFloat;
+    vector<Real> values;
+    vector<float> floatValues;
+  };
+
+  ///Reference to the value of one property of one point
+  class ElementRef
+  {
+   public:
+    ElementRef(PointCloudProperties* _table,size_t _index,int _column) : table(_table),index(_index),column(_column) {}
+    inline operator Real() const { return table->Get(index,column); }
+    inline ElementRef& operator = (Real v) { table->Set(index,column,v); return *this; }
+    inline ElementRef& operator = (const ElementRef& e) { return operator = (Real(e)); }
+    inline ElementRef& operator += (Real v) { return operator = (Real(*this)+v); }
+    inline ElementRef& operator -= (Real v) { return operator = (Real(*this)-v); }
+    inline ElementRef& operator *= (Real v) { return operator = (Real(*this)*v); }
+    inline ElementRef& operator /= (Real v) { return operator = (Real(*this)/v); }
+   private:
+    PointCloudProperties* table;
+    size_t index;
+    int column;
+  };
+
+  ///The properties of one point
+  class Row
+  {
+   public:
+    Row(PointCloudProperties* _table,size_t _index) : table(_table),index(_index),n(_table->NumColumns()) {}
+    inline ElementRef operator [] (int k) const { return ElementRef(table,index,k); }
+    inline ElementRef operator () (int k) const { return ElementRef(table,index,k); }
+    inline operator Vector() const { Vector v; table->GetRow(index,v); return v; }
+    inline const Row& operator = (const Vector& v) const { table->SetRow(index,v); return *this; }
+    inline const Row& operator = (const Row& r) const { return operator = (Vector(r)); }
+   private:
+    PointCloudProperties* table;
+    size_t index;
+   public:
+    int n;
+  };
+
+  class ConstRow
+  {
+   public:
+    ConstRow(const PointCloudProperties* _table,size_t _index) : table(_table),index(_index),n(_table->NumColumns()) {}
+    inline Real operator [] (int k) const { return table->Get(index,k); }
+    inline Real operator () (int k) const { return table->Get(index,k); }
+    inline operator Vector() const { Vector v; table->GetRow(index,v); return v; }
+   private:
+    const PointCloudProperties* table;
+    size_t index;
+   public:
+    int n;
+  };
+
+  PointCloudProperties() : numRows(0),floatStorage(false) {}
+
+  //row-wise access
+  inline size_t size() const { return numRows; }
+  inline bool empty() const { return numRows == 0; }
+  ///Removes all rows and columns
+  void clear();
+  void reserve(size_t n);
+  ///Resizes all columns to n rows, filling new rows with 0
+  void resize(size_t n);
+  ///Resizes to n rows, filling new rows with v.  If there are no rows, the
+  ///number of columns is set to v.n.
+  void resize(size_t n,const Vector& v);
+  ///Adds a row.  If there are no rows, the number of columns is set to v.n.
+  void push_back(const Vector& v);
+  inline Row operator [] (size_t i) { return Row(this,i); }
+  inline ConstRow operator [] (size_t i) const { return ConstRow(this,i); }
+  inline Row back() { return Row(this,numRows-1); }
+  inline ConstRow back() const { return ConstRow(this,numRows-1); }
+  void GetRow(size_t i,Vector& v) const;
+  void SetRow(size_t i,const Vector& v);
+  ///Appends row i of other, which must have the same number of columns
+  void AppendRow(const PointCloudProperties& other,size_t i);
+
+  //column-wise access
+  inline int NumColumns() const { return (int)columns.size(); }
+  inline Real Get(size_t i,int k) const {
+    const Column& c = columns[k];
+    return c.isFloat ? Real(c.floatValues[i]) : c.values[i];
+  }
+  inline void Set(size_t i,int k,Real v) {
+    Column& c = columns[k];
+    if(c.isFloat) c.floatValues[i] = float(v);
+    else c.values[i] = v;
+  }
+  ///Adds a column of zeros, in single precision if isFloat is true
+  void AddColumn(bool isFloat);
+  void RemoveColumn(int k);
+  void GetColumn(int k,vector<Real>& items) const;
+  void SetColumn(int k,const vector<Real>& items);
+  ///Converts column k to single or double precision
+  void SetFloatStorage(int k,bool isFloat);
+
+  size_t numRows;
+  ///Whether new columns are created in single precision
+  bool floatStorage;
+  vector<Column> columns;
+};
+
 /** @brief A 3D point cloud class.
  *
  * Points may have optional associated floating point properties
@@ -42,6 +163,8 @@ using namespace std;
  * - u,v: a (u,v) coordinate in range [0,1]^2 mapping into some other image (usually RGB color)
  * When drawn via the GeometryAppearance class, these properties will be
  * properly interpreted to color the point cloud display.
+ *
+ * Properties are stored column-wise in properties, see PointCloudProperties.
  */
 class PointCloud3D
 {
@@ -51,6 +174,21 @@ class PointCloud3D
   bool SavePCL(const char* fn) const;
   bool LoadPCL(istream& in);
   bool SavePCL(ostream& out) const;
+  ///Saves a PCD file with the given DATA format: "ascii", "binary", or
+  ///"binary_compressed" (LZF).  fieldTypes optionally maps field names to
+  ///PCD types, e.g., "F4", "F8", "U1", "I2", "U4".  Other fields are saved
+  ///as F4, except packed rgb / rgba colors which are saved as I4.  Packed
+  ///colors saved as binary F4 are bit casts of their integer value, as in
+  ///PCL.
+  bool SavePCL(const char* fn,const string& format,const map<string,string>& fieldTypes=map<string,string>()) const;
+  bool SavePCL(ostream& out,const string& format,const map<string,string>& fieldTypes=map<string,string>()) const;
+  ///Reads a PCD file in chunks of up to chunkSize points, which is useful
+  ///for files that don't fit in memory.  After each chunk is read, this
+  ///cloud holds the chunk and f(*this) is called; f may return false to
+  ///stop reading.  The chunk's points are cleared afterwards, but the
+  ///settings and property names are kept.
+  bool LoadPCL(const char* fn,size_t chunkSize,const std::function<bool(PointCloud3D&)>& f);
+  bool LoadPCL(istream& in,size_t chunkSize,const std::function<bool(PointCloud3D&)>& f);
   void GetAABB(Vector3& bmin,Vector3& bmax) const;
   void Transform(const Matrix4& mat);
   bool IsStructured() const;
@@ -90,10 +228,17 @@ class PointCloud3D
   bool HasUV() const;
   bool GetUV(vector<Vector2>& uvs) const;
   void SetUV(const vector<Vector2>& uvs);
+  ///Stores properties in single precision, halving their memory, or in
+  ///double precision.  Packed rgb and rgba colors stay in double precision
+  ///since 32-bit colors aren't exactly representable as floats.
+  void SetFloatStorage(bool isFloat);
+  ///Round-trips points and colors through SavePCL and LoadPCL in each
+  ///format, with double and float storage
+  static void SelfTest();
 
   vector<Vector3> points;
   vector<string> propertyNames;
-  vector<Vector> properties;
+  PointCloudProperties properties;
   PropertyMap settings;
 };
 
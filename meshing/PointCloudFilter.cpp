@@ -0,0 +1,252 @@
+#include <log4cxx/logger.h>
+#include <KrisLibrary/Logger.h>
+#include "PointCloudFilter.h"
+#include <KrisLibrary/geometry/KDTree.h>
+#include <KrisLibrary/math/random.h>
+#include <KrisLibrary/utils/threadutils.h>
+#include <errors.h>
+using namespace Meshing;
+using namespace std;
+
+//Number of buckets that voxels are partitioned into; a power of 2
+static const int kNumVoxelBuckets = 64;
+
+inline unsigned int VoxelHash(const IntTriple& c)
+{
+  return (unsigned int)c.a*73856093u ^ (unsigned int)c.b*19349663u ^ (unsigned int)c.c*83492791u;
+}
+
+//the table uses the low bits of the hash, so the buckets use the high bits
+inline int VoxelBucket(const IntTriple& c)
+{
+  return (int)((VoxelHash(c)*2654435761u) >> 26);
+}
+
+//Returns the index of voxel c in b, adding it if it isn't there
+static int FindOrAddVoxel(VoxelGridFilter::Bucket& b,const IntTriple& c,int stride)
+{
+  if(b.voxels.size()*2 >= b.table.size()) {
+    //grow the table
+    size_t size = Max(b.table.size()*2,(size_t)64);
+    b.table.assign(size,-1);
+    size_t mask = size-1;
+    for(size_t k=0;k<b.voxels.size();k++) {
+      size_t i = VoxelHash(b.voxels[k]) & mask;
+      while(b.table[i] >= 0) i = (i+1) & mask;
+      b.table[i] = (int)k;
+    }
+  }
+  size_t mask = b.table.size()-1;
+  size_t i = VoxelHash(c) & mask;
+  while(b.table[i] >= 0) {
+    if(b.voxels[b.table[i]] == c) return b.table[i];
+    i = (i+1) & mask;
+  }
+  int k = (int)b.voxels.size();
+  b.table[i] = k;
+  b.voxels.push_back(c);
+  b.counts.push_back(0);
+  b.sums.resize(b.sums.size()+stride,0);
+  return k;
+}
+
+VoxelGridFilter::VoxelGridFilter(Real _voxelSize)
+  :voxelSize(_voxelSize),stride(3)
+{
+  Assert(voxelSize > 0);
+  buckets.resize(kNumVoxelBuckets);
+}
+
+void VoxelGridFilter::Clear()
+{
+  propertyNames.clear();
+  settings.clear();
+  channels.clear();
+  stride = 3;
+  buckets.clear();
+  buckets.resize(kNumVoxelBuckets);
+}
+
+size_t VoxelGridFilter::NumVoxels() const
+{
+  size_t n=0;
+  for(size_t i=0;i<buckets.size();i++) n += buckets[i].voxels.size();
+  return n;
+}
+
+void VoxelGridFilter::Add(const PointCloud3D& pc,int numThreads)
+{
+  if(NumVoxels() == 0 && propertyNames.empty()) {
+    propertyNames = pc.propertyNames;
+    settings = pc.settings;
+    channels.resize(propertyNames.size());
+    stride = 3;
+    for(size_t i=0;i<propertyNames.size();i++) {
+      if(propertyNames[i] == "rgb") channels[i] = 3;
+      else if(propertyNames[i] == "rgba") channels[i] = 4;
+      else channels[i] = 1;
+      stride += channels[i];
+    }
+  }
+  else if(pc.propertyNames != propertyNames) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"VoxelGridFilter: chunk has different properties than the first chunk");
+    return;
+  }
+  if(!pc.properties.empty() && pc.properties.size() != pc.points.size()) {
+    LOG4CXX_ERROR(KrisLibrary::logger(),"VoxelGridFilter: point cloud has "<<pc.properties.size()<<" property vectors for "<<pc.points.size()<<" points");
+    return;
+  }
+  //partition the points into buckets
+  int n = (int)pc.points.size();
+  vector<IntTriple> voxels(n);
+  vector<int> bucketIndex(n);
+  ParallelFor(n,[&](int i) {
+      const Vector3& p = pc.points[i];
+      voxels[i].set((int)Floor(p.x/voxelSize),(int)Floor(p.y/voxelSize),(int)Floor(p.z/voxelSize));
+      bucketIndex[i] = VoxelBucket(voxels[i]);
+    },numThreads,4096);
+  vector<int> bucketStart(kNumVoxelBuckets+1,0),order(n);
+  for(int i=0;i<n;i++) bucketStart[bucketIndex[i]+1]++;
+  for(int b=0;b<kNumVoxelBuckets;b++) bucketStart[b+1] += bucketStart[b];
+  vector<int> fill(bucketStart.begin(),bucketStart.end()-1);
+  for(int i=0;i<n;i++) order[fill[bucketIndex[i]]++] = i;
+  //accumulate each bucket on its own thread
+  bool hasProperties = !pc.properties.empty();
+  ParallelFor(kNumVoxelBuckets,[&](int b) {
+      Bucket& bucket = buckets[b];
+      for(int j=bucketStart[b];j<bucketStart[b+1];j++) {
+        int i = order[j];
+        int k = FindOrAddVoxel(bucket,voxels[i],stride);
+        bucket.counts[k]++;
+        Real* sum = &bucket.sums[size_t(k)*stride];
+        sum[0] += pc.points[i].x;
+        sum[1] += pc.points[i].y;
+        sum[2] += pc.points[i].z;
+        if(!hasProperties) continue;
+        int ofs = 3;
+        for(size_t p=0;p<channels.size();p++) {
+          Real value = pc.properties.Get(i,p);
+          if(channels[p] == 1)
+            sum[ofs] += value;
+          else {
+            //packed colors may be stored as signed or unsigned integers
+            unsigned int c = (value < 0 ? (unsigned int)(int)value : (unsigned int)value);
+            for(int ch=0;ch<channels[p];ch++)
+              sum[ofs+ch] += Real((c >> (8*ch)) & 0xff);
+          }
+          ofs += channels[p];
+        }
+      }
+    },numThreads);
+}
+
+void VoxelGridFilter::GetResult(PointCloud3D& out) const
+{
+  out.Clear();
+  out.propertyNames = propertyNames;
+  out.settings = settings;
+  size_t n = NumVoxels();
+  out.points.resize(n);
+  if(!propertyNames.empty()) {
+    out.properties.resize(n);
+    for(size_t p=0;p<propertyNames.size();p++)
+      out.properties.AddColumn(false);
+  }
+  size_t index = 0;
+  for(size_t b=0;b<buckets.size();b++) {
+    const Bucket& bucket = buckets[b];
+    for(size_t k=0;k<bucket.voxels.size();k++,index++) {
+      const Real* sum = &bucket.sums[k*stride];
+      Real scale = 1.0/bucket.counts[k];
+      out.points[index].set(sum[0]*scale,sum[1]*scale,sum[2]*scale);
+      if(propertyNames.empty()) continue;
+      int ofs = 3;
+      for(size_t p=0;p<channels.size();p++) {
+        if(channels[p] == 1)
+          out.properties.Set(index,p,sum[ofs]*scale);
+        else {
+          unsigned int c = 0;
+          for(int ch=0;ch<channels[p];ch++)
+            c |= ((unsigned int)(sum[ofs+ch]*scale+0.5)) << (8*ch);
+          out.properties.Set(index,p,Real((int)c));
+        }
+        ofs += channels[p];
+      }
+    }
+  }
+  //the result is unstructured
+  if(out.settings.find("width") != out.settings.end() || out.settings.find("height") != out.settings.end()) {
+    out.settings.set("width",(int)n);
+    out.settings.set("height",1);
+  }
+}
+
+void Meshing::VoxelGridDownsample(const PointCloud3D& pc,Real voxelSize,PointCloud3D& out,int numThreads)
+{
+  VoxelGridFilter filter(voxelSize);
+  filter.Add(pc,numThreads);
+  filter.GetResult(out);
+}
+
+void Meshing::GetSubCloud(const PointCloud3D& pc,const vector<int>& indices,PointCloud3D& out)
+{
+  out.Clear();
+  out.propertyNames = pc.propertyNames;
+  out.settings = pc.settings;
+  out.points.resize(indices.size());
+  for(size_t i=0;i<indices.size();i++)
+    out.points[i] = pc.points[indices[i]];
+  if(!pc.properties.empty()) {
+    out.properties.reserve(indices.size());
+    for(size_t i=0;i<indices.size();i++)
+      out.properties.AppendRow(pc.properties,indices[i]);
+  }
+  if(out.settings.find("width") != out.settings.end() || out.settings.find("height") != out.settings.end()) {
+    out.settings.set("width",(int)indices.size());
+    out.settings.set("height",1);
+  }
+}
+
+void Meshing::RandomDownsample(const PointCloud3D& pc,Real fraction,PointCloud3D& out)
+{
+  vector<int> keep;
+  keep.reserve((size_t)(pc.points.size()*Clamp(fraction,0.0,1.0)*1.1));
+  for(size_t i=0;i<pc.points.size();i++)
+    if(RandBool(fraction)) keep.push_back((int)i);
+  GetSubCloud(pc,keep,out);
+}
+
+void Meshing::StatisticalOutlierRemoval(const PointCloud3D& pc,int k,Real stdMultiplier,PointCloud3D& out,int numThreads)
+{
+  int n = (int)pc.points.size();
+  if(n <= 1 || k <= 0) {
+    out = pc;
+    return;
+  }
+  vector<Real> coords(size_t(n)*3);
+  for(int i=0;i<n;i++)
+    pc.points[i].get(coords[i*3],coords[i*3+1],coords[i*3+2]);
+  Geometry::FlatKDTree tree;
+  tree.Build(&coords[0],n,3,8,numThreads);
+  //the point itself is its own nearest neighbor
+  int kq = Min(k+1,n);
+  vector<Real> meanDist(n);
+  ParallelFor(n,[&](int i) {
+      vector<Real> dist(kq);
+      vector<int> idx(kq);
+      tree.KClosestPoints(&coords[size_t(i)*3],kq,&dist[0],&idx[0]);
+      Real sum = 0;
+      for(int j=1;j<kq;j++) sum += dist[j];
+      meanDist[i] = sum/(kq-1);
+    },numThreads,256);
+  Real mean = 0, var = 0;
+  for(int i=0;i<n;i++) mean += meanDist[i];
+  mean /= n;
+  for(int i=0;i<n;i++) var += Sqr(meanDist[i]-mean);
+  var /= n;
+  Real threshold = mean + stdMultiplier*Sqrt(var);
+  vector<int> keep;
+  for(int i=0;i<n;i++)
+    if(meanDist[i] <= threshold) keep.push_back(i);
+  GetSubCloud(pc,keep,out);
+}
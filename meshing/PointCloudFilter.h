@@ -0,0 +1,89 @@
+#ifndef MESHING_POINT_CLOUD_FILTER_H
+#define MESHING_POINT_CLOUD_FILTER_H
+
+#include "PointCloud.h"
+#include <KrisLibrary/utils/IntTriple.h>
+
+/** @file meshing/PointCloudFilter.h
+ * @ingroup Meshing
+ * @brief Downsampling and denoising filters for point clouds.
+ */
+
+namespace Meshing {
+
+/** @addtogroup Meshing */
+/*@{*/
+
+/** @brief Streaming voxel grid downsampling.
+ *
+ * Replaces all the points in each voxel of size voxelSize by a single point
+ * at their centroid, whose properties are the average of theirs.  Packed
+ * rgb and rgba colors are averaged per channel.
+ *
+ * Points may be added in any number of chunks with the same properties,
+ * e.g., as they are read by PointCloud3D::LoadPCL(fn,chunkSize,f), so the
+ * memory used is proportional to the number of voxels rather than the
+ * number of points.  Voxels are partitioned into buckets by hash, and the
+ * buckets of a chunk are accumulated on numThreads threads (0 uses all
+ * hardware threads).
+ */
+class VoxelGridFilter
+{
+ public:
+  VoxelGridFilter(Real voxelSize);
+  void Clear();
+  void Add(const PointCloud3D& pc,int numThreads=0);
+  ///Returns the number of voxels (i.e., output points) so far
+  size_t NumVoxels() const;
+  ///Sets out to the voxel centroids
+  void GetResult(PointCloud3D& out) const;
+
+  struct Bucket
+  {
+    std::vector<IntTriple> voxels;
+    std::vector<int> counts;
+    ///The sums of the point coordinates and property channels, stride
+    ///values per voxel
+    std::vector<Real> sums;
+    ///Open-addressing hash table mapping voxels to their index in voxels,
+    ///-1 for empty slots
+    std::vector<int> table;
+  };
+
+  Real voxelSize;
+  std::vector<std::string> propertyNames;
+  PropertyMap settings;
+  ///Number of channels of each property: 1, or 3 / 4 for packed rgb / rgba
+  std::vector<int> channels;
+  int stride;
+  std::vector<Bucket> buckets;
+};
+
+///Downsamples pc to the centroids of the occupied voxels of the given size.
+///See VoxelGridFilter for details.
+void VoxelGridDownsample(const PointCloud3D& pc,Real voxelSize,PointCloud3D& out,int numThreads=0);
+
+///Keeps each point of pc with probability fraction.  Since points are kept
+///independently this can be applied chunk by chunk.
+void RandomDownsample(const PointCloud3D& pc,Real fraction,PointCloud3D& out);
+
+/** @brief Statistical outlier removal.
+ *
+ * Computes the mean distance of each point to its k nearest neighbors, and
+ * removes the points whose mean distance is more than stdMultiplier
+ * standard deviations above the average over the cloud.  The neighbors
+ * are found on numThreads threads.
+ *
+ * This needs the whole cloud, so for large streamed clouds it's usually run
+ * after VoxelGridFilter.
+ */
+void StatisticalOutlierRemoval(const PointCloud3D& pc,int k,Real stdMultiplier,PointCloud3D& out,int numThreads=0);
+
+///Sets out to the points of pc with the given indices, with their properties
+void GetSubCloud(const PointCloud3D& pc,const std::vector<int>& indices,PointCloud3D& out);
+
+/*@}*/
+
+} //namespace Meshing
+
+#endif
@@ -24,8 +24,10 @@ void CropTriangles(vector<Triangle2D>& tris,const Plane2D& p)
   bool triPositive[3];
   size_t n=tris.size();
   for(size_t i=0;i<n;i++) {
-    int nt=SplitTriangle(tris[i],p,newPts,newTris,triPositive,1e-5);
-    const Vector2* p[5]={&tris[i].a,&tris[i].b,&tris[i].c,&newPts[0],&newPts[1]};
+    //copy, since pushing to tris may invalidate references to tris[i]
+    Triangle2D t = tris[i];
+    int nt=SplitTriangle(t,p,newPts,newTris,triPositive,1e-5);
+    const Vector2* p[5]={&t.a,&t.b,&t.c,&newPts[0],&newPts[1]};
     for(int k=0;k<nt;k++)
       if(triPositive[k]) {
 	Triangle2D temp;
@@ -668,6 +670,13 @@ void Rasterizer2D::ClippedRasterize(const Triangle2D& t,const AABB2D& aabb)
   bary[0].b.set(0,1,0);
   bary[0].c.set(0,0,1);
   Clip(aabb,tris,bary);
+  //Clip doesn't track the barycentric coordinates of the pieces
+  bary.resize(tris.size());
+  for(size_t i=0;i<tris.size();i++) {
+    bary[i].a = t.barycentricCoords(tris[i].a);
+    bary[i].b = t.barycentricCoords(tris[i].b);
+    bary[i].c = t.barycentricCoords(tris[i].c);
+  }
   for(size_t i=0;i<tris.size();i++) {
     Rasterize(tris[i],bary[i].a,bary[i].b,bary[i].c);
   }
@@ -0,0 +1,432 @@
+#include "SparseVolumeGrid.h"
+#include "VolumeGrid.h"
+#include <math/infnan.h>
+#include <myfile.h>
+#include <errors.h>
+using namespace std;
+
+namespace Meshing {
+
+inline size_t BlockHash(const IntTriple& b)
+{
+  return size_t((unsigned int)b.a*73856093u ^ (unsigned int)b.b*19349663u ^ (unsigned int)b.c*83492791u);
+}
+
+//index of cell (i,j,k) within its block
+inline int LocalIndex(int i,int j,int k)
+{
+  return ((i&7)<<6) | ((j&7)<<3) | (k&7);
+}
+
+SparseVolumeGridIterator::SparseVolumeGridIterator(const SparseVolumeGrid& _grid)
+  :grid(_grid),block(0),local(0),value(NULL)
+{
+  seek();
+}
+
+void SparseVolumeGridIterator::seek()
+{
+  while(block < (int)grid.blocks.size()) {
+    const SparseVolumeGrid::Block& b = grid.blocks[block];
+    if(b.offset >= 0) {
+      for(;local<512;local++) {
+        index.a = b.index.a*8 + (local>>6);
+        index.b = b.index.b*8 + ((local>>3)&7);
+        index.c = b.index.c*8 + (local&7);
+        if(index.a < grid.m && index.b < grid.n && index.c < grid.p) {
+          value = const_cast<Real*>(&grid.values[b.offset+local]);
+          return;
+        }
+      }
+    }
+    block++;
+    local = 0;
+  }
+  block = -1;
+  value = NULL;
+}
+
+void SparseVolumeGridIterator::operator ++()
+{
+  local++;
+  seek();
+}
+
+void SparseVolumeGridIterator::getCell(AABB3D& cell) const
+{
+  grid.GetCell(index,cell);
+}
+
+void SparseVolumeGridIterator::getCellCenter(Vector3& c) const
+{
+  grid.GetCenter(index,c);
+}
+
+
+SparseVolumeGrid::SparseVolumeGrid()
+  :m(0),n(0),p(0),background(0)
+{}
+
+void SparseVolumeGrid::Clear()
+{
+  blocks.clear();
+  values.clear();
+  table.clear();
+}
+
+void SparseVolumeGrid::Resize(int _m,int _n,int _p)
+{
+  Clear();
+  m = _m;
+  n = _n;
+  p = _p;
+}
+
+void SparseVolumeGrid::ResizeByResolution(const Vector3& res)
+{
+  Assert(res.x > 0 && res.y > 0 && res.z > 0);
+  Resize((int)Ceil((bb.bmax.x-bb.bmin.x)/res.x),
+         (int)Ceil((bb.bmax.y-bb.bmin.y)/res.y),
+         (int)Ceil((bb.bmax.z-bb.bmin.z)/res.z));
+}
+
+Vector3 SparseVolumeGrid::GetCellSize() const
+{
+  Vector3 size=bb.bmax-bb.bmin;
+  size.x /= Real(m);
+  size.y /= Real(n);
+  size.z /= Real(p);
+  return size;
+}
+
+void SparseVolumeGrid::GetCell(int i,int j,int k,AABB3D& cell) const
+{
+  Vector3 size = bb.bmax-bb.bmin;
+  cell.bmin.x = bb.bmin.x + Real(i)/Real(m)*size.x;
+  cell.bmin.y = bb.bmin.y + Real(j)/Real(n)*size.y;
+  cell.bmin.z = bb.bmin.z + Real(k)/Real(p)*size.z;
+  cell.bmax.x = bb.bmin.x + Real(i+1)/Real(m)*size.x;
+  cell.bmax.y = bb.bmin.y + Real(j+1)/Real(n)*size.y;
+  cell.bmax.z = bb.bmin.z + Real(k+1)/Real(p)*size.z;
+}
+
+void SparseVolumeGrid::GetCellCenter(int i,int j,int k,Vector3& center) const
+{
+  Vector3 size = bb.bmax-bb.bmin;
+  center.x = bb.bmin.x + (Real(i)+0.5)/Real(m)*size.x;
+  center.y = bb.bmin.y + (Real(j)+0.5)/Real(n)*size.y;
+  center.z = bb.bmin.z + (Real(k)+0.5)/Real(p)*size.z;
+}
+
+void SparseVolumeGrid::GetIndex(const Vector3& pt,int& i,int& j,int& k) const
+{
+  i = (int)Floor((pt.x - bb.bmin.x)/(bb.bmax.x-bb.bmin.x)*m);
+  j = (int)Floor((pt.y - bb.bmin.y)/(bb.bmax.y-bb.bmin.y)*n);
+  k = (int)Floor((pt.z - bb.bmin.z)/(bb.bmax.z-bb.bmin.z)*p);
+}
+
+void SparseVolumeGrid::GetIndexAndParams(const Vector3& pt,IntTriple& index,Vector3& params) const
+{
+  Real u=(pt.x - bb.bmin.x)/(bb.bmax.x-bb.bmin.x)*m;
+  Real v=(pt.y - bb.bmin.y)/(bb.bmax.y-bb.bmin.y)*n;
+  Real w=(pt.z - bb.bmin.z)/(bb.bmax.z-bb.bmin.z)*p;
+  Real ri = Floor(u);
+  Real rj = Floor(v);
+  Real rk = Floor(w);
+  params.x = u - ri;
+  params.y = v - rj;
+  params.z = w - rk;
+  index.a = (int)ri;
+  index.b = (int)rj;
+  index.c = (int)rk;
+}
+
+void SparseVolumeGrid::GetIndexRange(const AABB3D& range,IntTriple& imin,IntTriple& imax) const
+{
+  GetIndex(range.bmin,imin);
+  GetIndex(range.bmax,imax);
+}
+
+void SparseVolumeGrid::GetBlockRange(const IntTriple& b,IntTriple& imin,IntTriple& imax) const
+{
+  imin.set(b.a*8,b.b*8,b.c*8);
+  imax.set(Min(imin.a+7,m-1),Min(imin.b+7,n-1),Min(imin.c+7,p-1));
+}
+
+void SparseVolumeGrid::BuildTable()
+{
+  //load factor <= 0.5
+  size_t tsize = 16;
+  while(tsize < blocks.size()*2) tsize *= 2;
+  table.assign(tsize,-1);
+  size_t mask = tsize-1;
+  for(size_t k=0;k<blocks.size();k++) {
+    size_t i = BlockHash(blocks[k].index) & mask;
+    while(table[i] >= 0) i = (i+1) & mask;
+    table[i] = (int)k;
+  }
+}
+
+int SparseVolumeGrid::FindBlock(const IntTriple& b) const
+{
+  if(table.empty()) return -1;
+  size_t mask = table.size()-1;
+  size_t i = BlockHash(b) & mask;
+  while(table[i] >= 0) {
+    if(blocks[table[i]].index == b) return table[i];
+    i = (i+1) & mask;
+  }
+  return -1;
+}
+
+int SparseVolumeGrid::MakeBlock(const IntTriple& b)
+{
+  int k = FindBlock(b);
+  if(k >= 0) return k;
+  Block block;
+  block.index = b;
+  block.offset = -1;
+  block.tileValue = background;
+  blocks.push_back(block);
+  k = (int)blocks.size()-1;
+  if(blocks.size()*2 > table.size())
+    BuildTable();
+  else {
+    size_t mask = table.size()-1;
+    size_t i = BlockHash(b) & mask;
+    while(table[i] >= 0) i = (i+1) & mask;
+    table[i] = k;
+  }
+  return k;
+}
+
+void SparseVolumeGrid::MakeBlockFull(int k)
+{
+  Block& b = blocks[k];
+  if(b.offset >= 0) return;
+  b.offset = (int)values.size();
+  values.resize(values.size()+512,b.tileValue);
+}
+
+void SparseVolumeGrid::MakeBlockTile(int k,Real v)
+{
+  Block& b = blocks[k];
+  b.tileValue = v;
+  if(b.offset < 0) return;
+  //move the last full block's values into the hole
+  int last = (int)values.size()-512;
+  if(b.offset != last) {
+    for(size_t i=0;i<blocks.size();i++) {
+      if(blocks[i].offset == last) {
+        copy(values.begin()+last,values.end(),values.begin()+b.offset);
+        blocks[i].offset = b.offset;
+        break;
+      }
+    }
+  }
+  values.resize(last);
+  b.offset = -1;
+}
+
+Real SparseVolumeGrid::GetValue(int i,int j,int k) const
+{
+  int bi = FindBlock(BlockIndex(i,j,k));
+  if(bi < 0) return background;
+  const Block& b = blocks[bi];
+  if(b.offset < 0) return b.tileValue;
+  return values[b.offset+LocalIndex(i,j,k)];
+}
+
+void SparseVolumeGrid::SetValue(int i,int j,int k,Real v)
+{
+  int bi = MakeBlock(BlockIndex(i,j,k));
+  MakeBlockFull(bi);
+  values[blocks[bi].offset+LocalIndex(i,j,k)] = v;
+}
+
+//Gets the values at the 8 corners of the cube with cell centers (i1,j1,k1)
+//and (i2,j2,k2), in xyz bit order.  Most cubes lie in a single block, which
+//takes one lookup.
+static void GetCubeValues(const SparseVolumeGrid& grid,int i1,int j1,int k1,int i2,int j2,int k2,Real vals[8])
+{
+  IntTriple b = SparseVolumeGrid::BlockIndex(i1,j1,k1);
+  if(b == SparseVolumeGrid::BlockIndex(i2,j2,k2)) {
+    int bi = grid.FindBlock(b);
+    if(bi < 0 || grid.blocks[bi].offset < 0) {
+      Real v = (bi < 0 ? grid.background : grid.blocks[bi].tileValue);
+      for(int c=0;c<8;c++) vals[c] = v;
+      return;
+    }
+    const Real* bvals = &grid.values[grid.blocks[bi].offset];
+    for(int c=0;c<8;c++)
+      vals[c] = bvals[LocalIndex((c&4 ? i2 : i1),(c&2 ? j2 : j1),(c&1 ? k2 : k1))];
+    return;
+  }
+  for(int c=0;c<8;c++)
+    vals[c] = grid.GetValue((c&4 ? i2 : i1),(c&2 ? j2 : j1),(c&1 ? k2 : k1));
+}
+
+//Gets the cube around pt for trilinear interpolation; u,v,w are the
+//interpolation parameters and du,dv,dw are 1 along axes that aren't clamped
+static void GetInterpolationCube(const SparseVolumeGrid& grid,const Vector3& pt,int& i1,int& j1,int& k1,int& i2,int& j2,int& k2,Real& u,Real& v,Real& w,Real& du,Real& dv,Real& dw)
+{
+  //continuous index relative to cell centers
+  u = (pt.x - grid.bb.bmin.x)/(grid.bb.bmax.x-grid.bb.bmin.x)*grid.m - 0.5;
+  v = (pt.y - grid.bb.bmin.y)/(grid.bb.bmax.y-grid.bb.bmin.y)*grid.n - 0.5;
+  w = (pt.z - grid.bb.bmin.z)/(grid.bb.bmax.z-grid.bb.bmin.z)*grid.p - 0.5;
+  du = (u > 0 && u < grid.m-1 ? 1 : 0);
+  dv = (v > 0 && v < grid.n-1 ? 1 : 0);
+  dw = (w > 0 && w < grid.p-1 ? 1 : 0);
+  u = (u > 0 ? Min(u,Real(grid.m-1)) : 0);
+  v = (v > 0 ? Min(v,Real(grid.n-1)) : 0);
+  w = (w > 0 ? Min(w,Real(grid.p-1)) : 0);
+  i1 = Min((int)u,Max(grid.m-2,0));
+  j1 = Min((int)v,Max(grid.n-2,0));
+  k1 = Min((int)w,Max(grid.p-2,0));
+  u -= i1;
+  v -= j1;
+  w -= k1;
+  i2 = Min(i1+1,grid.m-1);
+  j2 = Min(j1+1,grid.n-1);
+  k2 = Min(k1+1,grid.p-1);
+}
+
+Real SparseVolumeGrid::TrilinearInterpolate(const Vector3& pt) const
+{
+  int i1,j1,k1,i2,j2,k2;
+  Real u,v,w,du,dv,dw;
+  GetInterpolationCube(*this,pt,i1,j1,k1,i2,j2,k2,u,v,w,du,dv,dw);
+  Real c[8];
+  GetCubeValues(*this,i1,j1,k1,i2,j2,k2,c);
+  Real v00 = c[0] + w*(c[1]-c[0]);
+  Real v01 = c[2] + w*(c[3]-c[2]);
+  Real v10 = c[4] + w*(c[5]-c[4]);
+  Real v11 = c[6] + w*(c[7]-c[6]);
+  Real w0 = v00 + v*(v01-v00);
+  Real w1 = v10 + v*(v11-v10);
+  return w0 + u*(w1-w0);
+}
+
+void SparseVolumeGrid::Gradient(const Vector3& pt,Vector3& grad) const
+{
+  int i1,j1,k1,i2,j2,k2;
+  Real u,v,w,du,dv,dw;
+  GetInterpolationCube(*this,pt,i1,j1,k1,i2,j2,k2,u,v,w,du,dv,dw);
+  Real c[8];
+  GetCubeValues(*this,i1,j1,k1,i2,j2,k2,c);
+  Vector3 h = GetCellSize();
+  Real v00 = c[0] + w*(c[1]-c[0]);
+  Real v01 = c[2] + w*(c[3]-c[2]);
+  Real v10 = c[4] + w*(c[5]-c[4]);
+  Real v11 = c[6] + w*(c[7]-c[6]);
+  Real w0 = v00 + v*(v01-v00);
+  Real w1 = v10 + v*(v11-v10);
+  Real e0 = (c[1]-c[0]) + v*((c[3]-c[2])-(c[1]-c[0]));
+  Real e1 = (c[5]-c[4]) + v*((c[7]-c[6])-(c[5]-c[4]));
+  grad.x = (w1-w0)*du/h.x;
+  grad.y = ((v01-v00) + u*((v11-v10)-(v01-v00)))*dv/h.y;
+  grad.z = (e0 + u*(e1-e0))*dw/h.z;
+}
+
+void SparseVolumeGrid::SetFromDense(const VolumeGrid& grid,Real band)
+{
+  Assert(band > 0);
+  bb = grid.bb;
+  Resize(grid.value.m,grid.value.n,grid.value.p);
+  background = band;
+  IntTriple nb((m+7)/8,(n+7)/8,(p+7)/8);
+  IntTriple b,imin,imax;
+  for(b.a=0;b.a<nb.a;b.a++) {
+    for(b.b=0;b.b<nb.b;b.b++) {
+      for(b.c=0;b.c<nb.c;b.c++) {
+        GetBlockRange(b,imin,imax);
+        //the samples bordering the block are included, so that a sign
+        //change between two blocks makes both of them full
+        bool inBand = false, below = false, above = false;
+        for(int i=Max(imin.a-1,0);i<=Min(imax.a+1,m-1) && !inBand;i++)
+          for(int j=Max(imin.b-1,0);j<=Min(imax.b+1,n-1) && !inBand;j++)
+            for(int k=Max(imin.c-1,0);k<=Min(imax.c+1,p-1);k++) {
+              Real v = grid.value(i,j,k);
+              if(v < -band) below = true;
+              else if(v > band) above = true;
+              else { inBand = true; break; }
+            }
+        if(inBand || (below && above)) {
+          int bi = MakeBlock(b);
+          MakeBlockFull(bi);
+          Real* bvals = &values[blocks[bi].offset];
+          for(int i=imin.a;i<=imax.a;i++)
+            for(int j=imin.b;j<=imax.b;j++)
+              for(int k=imin.c;k<=imax.c;k++)
+                bvals[LocalIndex(i,j,k)] = grid.value(i,j,k);
+        }
+        else if(below)
+          blocks[MakeBlock(b)].tileValue = -band;
+      }
+    }
+  }
+}
+
+void SparseVolumeGrid::GetDense(VolumeGrid& grid) const
+{
+  grid.bb = bb;
+  grid.Resize(m,n,p);
+  grid.value.set(background);
+  IntTriple imin,imax;
+  for(size_t bi=0;bi<blocks.size();bi++) {
+    const Block& b = blocks[bi];
+    GetBlockRange(b.index,imin,imax);
+    for(int i=imin.a;i<=imax.a;i++)
+      for(int j=imin.b;j<=imax.b;j++)
+        for(int k=imin.c;k<=imax.c;k++)
+          grid.value(i,j,k) = (b.offset < 0 ? b.tileValue : values[b.offset+LocalIndex(i,j,k)]);
+  }
+}
+
+bool SparseVolumeGrid::Read(File& f)
+{
+  Clear();
+  if(!ReadArrayFile(f,&bb.bmin.x,3)) return false;
+  if(!ReadArrayFile(f,&bb.bmax.x,3)) return false;
+  if(!ReadFile(f,m)) return false;
+  if(!ReadFile(f,n)) return false;
+  if(!ReadFile(f,p)) return false;
+  if(!ReadFile(f,background)) return false;
+  int nblocks,nvalues;
+  if(!ReadFile(f,nblocks)) return false;
+  if(!ReadFile(f,nvalues)) return false;
+  if(m < 0 || n < 0 || p < 0 || nblocks < 0 || nvalues < 0 || nvalues%512 != 0) return false;
+  blocks.resize(nblocks);
+  for(int i=0;i<nblocks;i++) {
+    if(!ReadArrayFile(f,&blocks[i].index.a,3)) return false;
+    if(!ReadFile(f,blocks[i].offset)) return false;
+    if(!ReadFile(f,blocks[i].tileValue)) return false;
+    if(blocks[i].offset >= 0 && (blocks[i].offset >= nvalues || blocks[i].offset%512 != 0)) return false;
+  }
+  values.resize(nvalues);
+  if(nvalues > 0 && !ReadArrayFile(f,&values[0],nvalues)) return false;
+  BuildTable();
+  return true;
+}
+
+bool SparseVolumeGrid::Write(File& f) const
+{
+  if(!WriteArrayFile(f,&bb.bmin.x,3)) return false;
+  if(!WriteArrayFile(f,&bb.bmax.x,3)) return false;
+  if(!WriteFile(f,m)) return false;
+  if(!WriteFile(f,n)) return false;
+  if(!WriteFile(f,p)) return false;
+  if(!WriteFile(f,background)) return false;
+  int nblocks = (int)blocks.size(), nvalues = (int)values.size();
+  if(!WriteFile(f,nblocks)) return false;
+  if(!WriteFile(f,nvalues)) return false;
+  for(int i=0;i<nblocks;i++) {
+    if(!WriteArrayFile(f,&blocks[i].index.a,3)) return false;
+    if(!WriteFile(f,blocks[i].offset)) return false;
+    if(!WriteFile(f,blocks[i].tileValue)) return false;
+  }
+  if(nvalues > 0 && !WriteArrayFile(f,&values[0],nvalues)) return false;
+  return true;
+}
+
+} //namespace Meshing
@@ -0,0 +1,147 @@
+#ifndef SPARSE_VOLUME_GRID_H
+#define SPARSE_VOLUME_GRID_H
+
+#include <KrisLibrary/math3d/AABB3D.h>
+#include <KrisLibrary/math3d/primitives.h>
+#include <KrisLibrary/utils/IntTriple.h>
+#include <vector>
+
+class File;
+
+namespace Meshing {
+
+  using namespace Math3D;
+
+  class VolumeGrid;
+  class SparseVolumeGrid;
+
+/** @ingroup Meshing
+ * @brief Iterator over the stored cells of a SparseVolumeGrid.
+ *
+ * Visits every cell of the full (non-tile) blocks that lies within the
+ * grid's dimensions.  Use the ++ operator until isDone() return true.
+ */
+struct SparseVolumeGridIterator
+{
+  SparseVolumeGridIterator(const SparseVolumeGrid& grid);
+  inline Real& operator *() const { return *value; }
+  inline const IntTriple& getIndex() const { return index; }
+  void operator ++();
+  inline bool isDone() const { return block < 0; }
+  void getCell(AABB3D& cell) const;
+  void getCellCenter(Vector3& c) const;
+
+  const SparseVolumeGrid& grid;
+  int block,local;
+  IntTriple index;
+  Real* value;
+
+ private:
+  //moves to the first valid cell at or after (block,local)
+  void seek();
+};
+
+/** @ingroup Meshing
+ * @brief A sparse version of VolumeGrid stored in blocks of 8x8x8 cells.
+ *
+ * The grid has the same layout as VolumeGrid: bb is divided into m x n x p
+ * cells, and values are defined at cell centers.  Only some blocks are
+ * stored, and each stored block is either a full block of 512 values or a
+ * constant tile.  Cells in blocks that aren't stored take the background
+ * value.
+ *
+ * For signed distance fields the usual setup is a narrow band of full
+ * blocks around the zero level set, tiles of -band for blocks deep inside,
+ * and a background of +band (see SetFromDense).
+ *
+ * Blocks are looked up by an open-addressing hash table.
+ */
+class SparseVolumeGrid
+{
+ public:
+  struct Block
+  {
+    IntTriple index;
+    ///Offset of the block's values in values, or -1 if it's a constant tile
+    int offset;
+    Real tileValue;
+  };
+
+  SparseVolumeGrid();
+  bool IsEmpty() const { return m==0 || n==0 || p==0; }
+  ///Removes all blocks
+  void Clear();
+  ///Sets the number of cells on each axis and removes all blocks
+  void Resize(int m,int n,int p);
+  void ResizeByResolution(const Vector3& res);
+  void GetCell(int i,int j,int k,AABB3D& cell) const;
+  void GetCellCenter(int i,int j,int k,Vector3& center) const;
+  Vector3 GetCellSize() const;
+  void GetIndex(const Vector3& pt,int& i,int& j,int& k) const;
+  void GetIndexAndParams(const Vector3& pt,IntTriple& index,Vector3& params) const;
+  void GetIndexRange(const AABB3D& range,IntTriple& imin,IntTriple& imax) const;
+  inline void GetCell(const IntTriple& index,AABB3D& cell) const { GetCell(index.a,index.b,index.c,cell); }
+  inline void GetCenter(const IntTriple& index,Vector3& center) const { GetCellCenter(index.a,index.b,index.c,center); }
+  inline void GetIndex(const Vector3& pt,IntTriple& index) const { GetIndex(pt,index.a,index.b,index.c); }
+
+  ///Returns the index of the block containing cell (i,j,k)
+  static inline IntTriple BlockIndex(int i,int j,int k) { return IntTriple(i>>3,j>>3,k>>3); }
+  ///Returns the cell range [imin,imax] of block b, clipped to the grid
+  void GetBlockRange(const IntTriple& b,IntTriple& imin,IntTriple& imax) const;
+  ///Returns the index of block b in blocks, or -1 if it isn't stored
+  int FindBlock(const IntTriple& b) const;
+  ///Returns the index of block b in blocks, adding it as a tile of the
+  ///background value if it isn't stored
+  int MakeBlock(const IntTriple& b);
+  ///Makes blocks[k] a full block, filled with its tile value
+  void MakeBlockFull(int k);
+  ///Makes blocks[k] a constant tile with value v
+  void MakeBlockTile(int k,Real v);
+  size_t NumBlocks() const { return blocks.size(); }
+  ///Returns the number of full blocks
+  size_t NumFullBlocks() const { return values.size()/512; }
+
+  Real GetValue(int i,int j,int k) const;
+  inline Real GetValue(const IntTriple& index) const { return GetValue(index.a,index.b,index.c); }
+  ///Sets the value of cell (i,j,k), converting its block to a full block if
+  ///needed
+  void SetValue(int i,int j,int k,Real v);
+  inline void SetValue(const IntTriple& index,Real v) { SetValue(index.a,index.b,index.c,v); }
+
+  ///Computes the trilinear interpolation of the field at pt, assuming values are sampled exactly at cell centers
+  Real TrilinearInterpolate(const Vector3& pt) const;
+  ///Returns the gradient of the trilinear interpolation at pt
+  void Gradient(const Vector3& pt,Vector3& grad) const;
+
+  ///Copies the layout of grid and stores each block that has a value in
+  ///[-band,band] or a sign change, counting the samples bordering the
+  ///block.  Blocks entirely below -band become tiles of -band, and the
+  ///background is set to band.  band must be positive.
+  void SetFromDense(const VolumeGrid& grid,Real band);
+  ///Fills grid with all the values of this grid
+  void GetDense(VolumeGrid& grid) const;
+
+  bool Read(File& f);
+  bool Write(File& f) const;
+
+  typedef SparseVolumeGridIterator iterator;
+  iterator getIterator() const { return iterator(*this); }
+
+  AABB3D bb;
+  int m,n,p;
+  ///Value of cells outside of any stored block
+  Real background;
+  std::vector<Block> blocks;
+  ///Values of the full blocks, 512 per block indexed by (i*8+j)*8+k
+  std::vector<Real> values;
+  ///Open-addressing hash table mapping block indices to their index in
+  ///blocks, -1 for empty slots.  The size is a power of 2.
+  std::vector<int> table;
+
+ private:
+  void BuildTable();
+};
+
+} //namespace Meshing
+
+#endif
@@ -410,7 +410,7 @@ void VolumeGrid::Gradient(const Vector3& pt,Vector3& grad) const
   Vector3 h = GetCellSize();
   //u = x/h.x+bx, v = y/h.y+by, w = z/h.z+bz
   //res = (1-u)*w1(v,w) + u*w2(v,w)
-  if(u==0.5 || v==0.5 || v==0.5 || i1==i2 || j1==j2 || k1==k2) {
+  if(u==0.5 || v==0.5 || w==0.5 || i1==i2 || j1==j2 || k1==k2) {
     Gradient_CenteredDifference(ind,grad);
   }
   if(u != 0.5 && i1 != i2) 
@@ -427,7 +427,7 @@ void VolumeGrid::Gradient(const Vector3& pt,Vector3& grad) const
     Real dv22 = value(i2,j2,k2)-value(i2,j2,k1);
     Real dw1 = (1-v)*dv11+v*dv12;
     Real dw2 = (1-v)*dv21+v*dv22;
-    grad.z = ((1-u)*dw1 + u*dw2)/h.y;
+    grad.z = ((1-u)*dw1 + u*dw2)/h.z;
   }
 }
 
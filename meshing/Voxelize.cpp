@@ -4,6 +4,7 @@
 #include "Rasterize.h"
 #include "ClosestPoint.h"
 #include "VolumeGrid.h"
+#include "SparseVolumeGrid.h"
 #include <structs/FixedSizeHeap.h>
 #include <structs/Heap.h>
 #include <math/cast.h>
@@ -12,6 +13,8 @@
 #include <geometry/primitives.h>
 #include <math/random.h>
 #include <Timer.h>
+#include <utils/threadutils.h>
+#include <algorithm>
 #include <list>
 #include <set>
 using namespace Geometry;
@@ -670,52 +673,281 @@ void GetTriangleCells2(const Triangle3D& torig,const Array3D<T>& grid,const AABB
   GetTriangleCells2(torig,grid.m,grid.n,grid.p,bb,cells);
 }
 
-void SurfaceOccupancyGrid(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb)
+//Bins triangles into numBins bins.  bins(t,out) lists the bins that
+//triangle t overlaps.  On return the triangles in bin b are
+//binTris[binStart[b]],...,binTris[binStart[b+1]-1], in increasing order.
+template <class F>
+static void BinTriangles(int numTris,int numBins,F bins,vector<int>& binStart,vector<int>& binTris,int numThreads)
 {
-  if(bb.bmin.x > bb.bmax.x || bb.bmin.y > bb.bmax.y || bb.bmin.z > bb.bmax.z)
-    FitGridToMesh(occupied,bb,m);
-  occupied.set(false);
+  const int chunk = 4096;
+  int numChunks = (numTris+chunk-1)/chunk;
+  vector<vector<pair<int,int> > > pairs(numChunks);
+  ParallelFor(numChunks,[&](int c) {
+      vector<int> tbins;
+      int tend = Min(numTris,(c+1)*chunk);
+      for(int t=c*chunk;t<tend;t++) {
+        bins(t,tbins);
+        for(size_t i=0;i<tbins.size();i++)
+          pairs[c].push_back(pair<int,int>(tbins[i],t));
+      }
+    },numThreads);
+  binStart.assign(numBins+1,0);
+  for(int c=0;c<numChunks;c++)
+    for(size_t i=0;i<pairs[c].size();i++)
+      binStart[pairs[c][i].first+1]++;
+  for(int b=0;b<numBins;b++)
+    binStart[b+1] += binStart[b];
+  binTris.resize(binStart[numBins]);
+  vector<int> pos(binStart.begin(),binStart.end()-1);
+  for(int c=0;c<numChunks;c++)
+    for(size_t i=0;i<pairs[c].size();i++)
+      binTris[pos[pairs[c][i].first]++] = pairs[c][i].second;
+}
+
+//A grid of m x n x p cells over bb, split into bricks of bsize cells
+struct BrickGrid
+{
+  BrickGrid(int _m,int _n,int _p,const AABB3D& _bb,const IntTriple& _bsize)
+    :m(_m),n(_n),p(_p),bb(_bb),bsize(_bsize)
+  {
+    cellSize.x = (bb.bmax.x-bb.bmin.x)/m;
+    cellSize.y = (bb.bmax.y-bb.bmin.y)/n;
+    cellSize.z = (bb.bmax.z-bb.bmin.z)/p;
+    nb.set((m+bsize.a-1)/bsize.a,(n+bsize.b-1)/bsize.b,(p+bsize.c-1)/bsize.c);
+  }
+  int NumBricks() const { return nb.a*nb.b*nb.c; }
+  IntTriple BrickIndex(int b) const { return IntTriple(b/(nb.b*nb.c),(b/nb.c)%nb.b,b%nb.c); }
+  void BrickRange(int b,IntTriple& lo,IntTriple& hi) const {
+    IntTriple bi = BrickIndex(b);
+    lo.set(bi.a*bsize.a,bi.b*bsize.b,bi.c*bsize.c);
+    hi.set(Min(lo.a+bsize.a,m)-1,Min(lo.b+bsize.b,n)-1,Min(lo.c+bsize.c,p)-1);
+  }
+  void Cell(int i,int j,int k,AABB3D& cell) const {
+    cell.bmin.set(bb.bmin.x+i*cellSize.x,bb.bmin.y+j*cellSize.y,bb.bmin.z+k*cellSize.z);
+    cell.bmax = cell.bmin + cellSize;
+  }
+  int m,n,p;
+  AABB3D bb;
+  IntTriple bsize,nb;
+  Vector3 cellSize;
+};
+
+//Bins the triangles of mesh into the bricks of g that they overlap
+static void BinTrianglesToBricks(const TriMesh& mesh,const BrickGrid& g,vector<int>& brickStart,vector<int>& brickTris,int numThreads)
+{
+  BinTriangles((int)mesh.tris.size(),g.NumBricks(),[&](int t,vector<int>& bins) {
+      bins.resize(0);
+      Triangle3D tri;
+      mesh.GetTriangle(t,tri);
+      AABB3D query;
+      query.setPoint(tri.a);
+      query.expand(tri.b);
+      query.expand(tri.c);
+      IntTriple lo,hi;
+      if(!QueryGrid(g.m,g.n,g.p,g.bb,query,lo,hi)) return;
+      IntTriple blo(lo.a/g.bsize.a,lo.b/g.bsize.b,lo.c/g.bsize.c);
+      IntTriple bhi(hi.a/g.bsize.a,hi.b/g.bsize.b,hi.c/g.bsize.c);
+      bool single = (blo == bhi);
+      AABB3D brick,cmax;
+      for(int a=blo.a;a<=bhi.a;a++)
+        for(int b=blo.b;b<=bhi.b;b++)
+          for(int c=blo.c;c<=bhi.c;c++) {
+            int index = (a*g.nb.b+b)*g.nb.c+c;
+            if(!single) {
+              IntTriple clo,chi;
+              g.BrickRange(index,clo,chi);
+              g.Cell(clo.a,clo.b,clo.c,brick);
+              g.Cell(chi.a,chi.b,chi.c,cmax);
+              brick.bmax = cmax.bmax;
+              if(!tri.intersects(brick)) continue;
+            }
+            bins.push_back(index);
+          }
+    },brickStart,brickTris,numThreads);
+}
+
+//Calls set(i,j,k) for each cell of brick b that one of its triangles
+//overlaps
+template <class F>
+static void RasterizeBrick(const TriMesh& mesh,const BrickGrid& g,int b,const vector<int>& brickStart,const vector<int>& brickTris,F set)
+{
+  IntTriple blo,bhi,lo,hi;
+  g.BrickRange(b,blo,bhi);
   Triangle3D tri;
   AABB3D query,cell;
-  IntTriple hi,lo;
-  for(size_t i=0;i<m.tris.size();i++) {
-    m.GetTriangle(i,tri);
+  for(int t=brickStart[b];t<brickStart[b+1];t++) {
+    mesh.GetTriangle(brickTris[t],tri);
     query.setPoint(tri.a);
     query.expand(tri.b);
     query.expand(tri.c);
-    bool q=QueryGrid(occupied,bb,query,lo,hi);
-    if(!q) continue;
-    //if(KrisLibrary::logger()->isEnabledFor(log4cxx::Level::ERROR_INT)) getchar();
-    VolumeGridIterator<bool> it(occupied,bb);
-    it.setRange(lo,hi);
-    for(;!it.isDone();++it) {
-      it.getCell(cell);
-      if(tri.intersects(cell))
-        occupied(it.index)=true;
-    }
-    /*
-    IntTriple index=lo;
-    while(index.a <= hi.a) {
-      while(index.b <= hi.b) {
-        while(index.c <= hi.c) {
-          if(!occupied(index)) {
-            GetGridCell(occupied,bb,index,cell);
-            if(tri.intersects(cell)) {
-              occupied(index)=true;
-            }
-          }
-          index.c++;
+    if(!QueryGrid(g.m,g.n,g.p,g.bb,query,lo,hi)) continue;
+    for(int i=Max(lo.a,blo.a);i<=Min(hi.a,bhi.a);i++)
+      for(int j=Max(lo.b,blo.b);j<=Min(hi.b,bhi.b);j++)
+        for(int k=Max(lo.c,blo.c);k<=Min(hi.c,bhi.c);k++) {
+          g.Cell(i,j,k,cell);
+          if(tri.intersects(cell)) set(i,j,k);
         }
-        index.b++;
-        index.c = lo.c;
-      }
-      index.a++;
-      index.b = lo.b;
-    }
-    */
   }
 }
 
+void SurfaceOccupancyGrid(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb,int numThreads)
+{
+  if(bb.bmin.x > bb.bmax.x || bb.bmin.y > bb.bmax.y || bb.bmin.z > bb.bmax.z)
+    FitGridToMesh(occupied,bb,m);
+  occupied.set(false);
+  if(occupied.empty()) return;
+  BrickGrid g(occupied.m,occupied.n,occupied.p,bb,IntTriple(8,8,8));
+  vector<int> brickStart,brickTris;
+  BinTrianglesToBricks(m,g,brickStart,brickTris,numThreads);
+  ParallelFor(g.NumBricks(),[&](int b) {
+      RasterizeBrick(m,g,b,brickStart,brickTris,[&](int i,int j,int k) { occupied(i,j,k) = true; });
+    },numThreads);
+}
+
+void SurfaceOccupancyGrid(const TriMesh& m,BitArray3D& occupied,AABB3D& bb,int numThreads)
+{
+  if(bb.bmin.x > bb.bmax.x || bb.bmin.y > bb.bmax.y || bb.bmin.z > bb.bmax.z)
+    FitGridToMesh(occupied.m,occupied.n,occupied.p,bb,m);
+  occupied.set(false);
+  if(occupied.empty()) return;
+  //bricks span one word of each row, so they never share a word
+  BrickGrid g(occupied.m,occupied.n,occupied.p,bb,IntTriple(8,8,64));
+  vector<int> brickStart,brickTris;
+  BinTrianglesToBricks(m,g,brickStart,brickTris,numThreads);
+  ParallelFor(g.NumBricks(),[&](int b) {
+      RasterizeBrick(m,g,b,brickStart,brickTris,[&](int i,int j,int k) { occupied.set(i,j,k,true); });
+    },numThreads);
+}
+
+void SurfaceOccupancyGrid(const TriMesh& m,SparseVolumeGrid& occupied,int numThreads)
+{
+  if(occupied.bb.bmin.x > occupied.bb.bmax.x || occupied.bb.bmin.y > occupied.bb.bmax.y || occupied.bb.bmin.z > occupied.bb.bmax.z)
+    FitGridToMesh(occupied.m,occupied.n,occupied.p,occupied.bb,m);
+  occupied.Clear();
+  occupied.background = 0;
+  if(occupied.IsEmpty()) return;
+  BrickGrid g(occupied.m,occupied.n,occupied.p,occupied.bb,IntTriple(8,8,8));
+  vector<int> brickStart,brickTris;
+  BinTrianglesToBricks(m,g,brickStart,brickTris,numThreads);
+  //the bricks are the grid's blocks; create them up front so the parallel
+  //pass only writes values
+  vector<Real*> blockValues(g.NumBricks(),NULL);
+  vector<int> blockIndex(g.NumBricks(),-1);
+  for(int b=0;b<g.NumBricks();b++) {
+    if(brickStart[b] == brickStart[b+1]) continue;
+    blockIndex[b] = occupied.MakeBlock(g.BrickIndex(b));
+    occupied.MakeBlockFull(blockIndex[b]);
+  }
+  for(int b=0;b<g.NumBricks();b++)
+    if(blockIndex[b] >= 0) blockValues[b] = &occupied.values[occupied.blocks[blockIndex[b]].offset];
+  ParallelFor(g.NumBricks(),[&](int b) {
+      Real* vals = blockValues[b];
+      if(!vals) return;
+      RasterizeBrick(m,g,b,brickStart,brickTris,[&](int i,int j,int k) { vals[((i&7)<<6)|((j&7)<<3)|(k&7)] = 1; });
+    },numThreads);
+}
+
+inline Real EdgeFunction(const Vector3& p,const Vector3& q,Real x,Real y)
+{
+  return (q.x-p.x)*(y-p.y)-(q.y-p.y)*(x-p.x);
+}
+
+//Top-left rule: a point exactly on an edge shared by two triangles is
+//counted for only one of them
+inline bool EdgeContains(Real w,const Vector3& p,const Vector3& q)
+{
+  if(w != 0) return w > 0;
+  return (q.y < p.y) || (q.y == p.y && q.x > p.x);
+}
+
+//Returns true if the vertical line through (x,y) crosses the triangle, with
+//the height of the crossing in z
+static bool ColumnCrossing(const Vector3& a,const Vector3& b,const Vector3& c,Real x,Real y,Real& z)
+{
+  Real area = EdgeFunction(a,b,c.x,c.y);
+  if(area == 0) return false;
+  const Vector3 *p0=&a,*p1=&b,*p2=&c;
+  if(area < 0) { std::swap(p1,p2); area = -area; }
+  Real w0 = EdgeFunction(*p1,*p2,x,y);
+  if(!EdgeContains(w0,*p1,*p2)) return false;
+  Real w1 = EdgeFunction(*p2,*p0,x,y);
+  if(!EdgeContains(w1,*p2,*p0)) return false;
+  Real w2 = EdgeFunction(*p0,*p1,x,y);
+  if(!EdgeContains(w2,*p0,*p1)) return false;
+  z = (w0*p0->z + w1*p1->z + w2*p2->z)/area;
+  return true;
+}
+
+//Scanline interior fill: casts a line along z through each column of cell
+//centers and calls fill(i,j,k0,k1) for each run of cells [k0,k1) whose
+//centers are inside the mesh by crossing parity.  Columns with different i
+//are processed in parallel.
+template <class F>
+static void ScanlineFill(const TriMesh& mesh,int m,int n,int p,const AABB3D& bb,F fill,int numThreads)
+{
+  Vector3 h((bb.bmax.x-bb.bmin.x)/m,(bb.bmax.y-bb.bmin.y)/n,(bb.bmax.z-bb.bmin.z)/p);
+  vector<int> colStart,colTris;
+  BinTriangles((int)mesh.tris.size(),m*n,[&](int t,vector<int>& bins) {
+      bins.resize(0);
+      Triangle3D tri;
+      mesh.GetTriangle(t,tri);
+      Real xmin = Min(tri.a.x,tri.b.x,tri.c.x), xmax = Max(tri.a.x,tri.b.x,tri.c.x);
+      Real ymin = Min(tri.a.y,tri.b.y,tri.c.y), ymax = Max(tri.a.y,tri.b.y,tri.c.y);
+      //columns whose centers lie in the triangle's xy bounding box
+      int i0 = Max(0,(int)Ceil((xmin-bb.bmin.x)/h.x-0.5)), i1 = Min(m-1,(int)Floor((xmax-bb.bmin.x)/h.x-0.5));
+      int j0 = Max(0,(int)Ceil((ymin-bb.bmin.y)/h.y-0.5)), j1 = Min(n-1,(int)Floor((ymax-bb.bmin.y)/h.y-0.5));
+      for(int i=i0;i<=i1;i++)
+        for(int j=j0;j<=j1;j++)
+          bins.push_back(i*n+j);
+    },colStart,colTris,numThreads);
+  ParallelFor(m,[&](int i) {
+      vector<Real> zs;
+      Triangle3D tri;
+      Real x = bb.bmin.x+(i+0.5)*h.x;
+      for(int j=0;j<n;j++) {
+        int col = i*n+j;
+        if(colStart[col] == colStart[col+1]) continue;
+        Real y = bb.bmin.y+(j+0.5)*h.y;
+        zs.resize(0);
+        for(int t=colStart[col];t<colStart[col+1];t++) {
+          mesh.GetTriangle(colTris[t],tri);
+          Real z;
+          if(ColumnCrossing(tri.a,tri.b,tri.c,x,y,z)) zs.push_back(z);
+        }
+        std::sort(zs.begin(),zs.end());
+        for(size_t t=0;t+1<zs.size();t+=2) {
+          int k0 = (int)Ceil((zs[t]-bb.bmin.z)/h.z-0.5);
+          int k1 = (int)Ceil((zs[t+1]-bb.bmin.z)/h.z-0.5);
+          k0 = Max(k0,0);
+          k1 = Min(k1,p);
+          if(k0 < k1) fill(i,j,k0,k1);
+        }
+      }
+    },numThreads);
+}
+
+void VolumeOccupancyGrid_Scanline(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb,int numThreads)
+{
+  if(bb.bmin.x > bb.bmax.x || bb.bmin.y > bb.bmax.y || bb.bmin.z > bb.bmax.z)
+    FitGridToMesh(occupied,bb,m);
+  occupied.set(false);
+  if(occupied.empty()) return;
+  ScanlineFill(m,occupied.m,occupied.n,occupied.p,bb,[&](int i,int j,int k0,int k1) {
+      for(int k=k0;k<k1;k++) occupied(i,j,k) = true;
+    },numThreads);
+}
+
+void VolumeOccupancyGrid_Scanline(const TriMesh& m,BitArray3D& occupied,AABB3D& bb,int numThreads)
+{
+  if(bb.bmin.x > bb.bmax.x || bb.bmin.y > bb.bmax.y || bb.bmin.z > bb.bmax.z)
+    FitGridToMesh(occupied.m,occupied.n,occupied.p,bb,m);
+  occupied.set(false);
+  if(occupied.empty()) return;
+  ScanlineFill(m,occupied.m,occupied.n,occupied.p,bb,[&](int i,int j,int k0,int k1) {
+      occupied.setRange(i,j,k0,k1,true);
+    },numThreads);
+}
+
 void VolumeOccupancyGrid_FloodFill(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb,const IntTriple& seed,bool seedOccupied)
 {
   if(bb.bmin.x > bb.bmax.x || bb.bmin.y > bb.bmax.y || bb.bmin.z > bb.bmax.z)
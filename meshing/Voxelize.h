@@ -5,6 +5,7 @@
 #include "TriMeshTopology.h"
 #include <KrisLibrary/math3d/Segment3D.h>
 #include <KrisLibrary/structs/array3d.h>
+#include <KrisLibrary/structs/bitarray3d.h>
 
 /** @file meshing/Rasterize.h
  * @ingroup Meshing
@@ -13,6 +14,8 @@
 
 namespace Meshing {
 
+  class SparseVolumeGrid;
+
 /** @ingroup Meshing
  * @brief Returns a list of cells that the segment overlaps, given
  * an infinite unit grid.
@@ -44,7 +47,24 @@ void GetTriangleCells(const Triangle3D& tri,int m,int n,int p,const AABB3D& bb,v
  * If bb is empty, automatically fits the bounding box to contain the mesh
  * in the non-border cells of the grid.
  */
-void SurfaceOccupancyGrid(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb);
+void SurfaceOccupancyGrid(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb,int numThreads=0);
+
+/** @ingroup Meshing
+ * @brief Same as above, but with 1 bit per cell.
+ *
+ * Triangles are binned into bricks of 8x8x64 cells, and the bricks are
+ * rasterized on numThreads threads (0 uses all hardware threads).  The
+ * Array3D<bool> version works the same way with 8x8x8 bricks.
+ */
+void SurfaceOccupancyGrid(const TriMesh& m,BitArray3D& occupied,AABB3D& bb,int numThreads=0);
+
+/** @ingroup Meshing
+ * @brief Same as above, but only the 8x8x8 blocks of the sparse grid that
+ * the surface touches are stored.  Occupied cells are set to 1 and all
+ * others are 0.  The grid's size and bb must be set beforehand; if bb is
+ * empty it is fit to the mesh.
+ */
+void SurfaceOccupancyGrid(const TriMesh& m,SparseVolumeGrid& occupied,int numThreads=0);
 
 /** @ingroup Meshing
  * @brief Sets cells of a boolean 3D grid (occupied,bb) to true
@@ -61,6 +81,20 @@ void VolumeOccupancyGrid_FloodFill(const TriMesh& m,Array3D<bool>& occupied,AABB
  */
 void VolumeOccupancyGrid_CenterShooting(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb,int shootDirection=0);
 
+/** @ingroup Meshing
+ * @brief Sets cells of a boolean 3D grid (occupied,bb) to true
+ * if the cell's center is in the interior of the mesh, and false otherwise.
+ *
+ * Occupancy is determined by the parity of crossings of lines along z
+ * through the cell centers, so the mesh should be closed.  Triangles are
+ * binned by column and the columns are filled on numThreads threads (0 uses
+ * all hardware threads).
+ */
+void VolumeOccupancyGrid_Scanline(const TriMesh& m,Array3D<bool>& occupied,AABB3D& bb,int numThreads=0);
+
+///Same as above, but with 1 bit per cell
+void VolumeOccupancyGrid_Scanline(const TriMesh& m,BitArray3D& occupied,AABB3D& bb,int numThreads=0);
+
 /** @ingroup Meshing
  * @brief From one "visible" side of the grid, sweeps the visibility across
  * the volume until a mesh surface is hit.  After that, visible is marked
@@ -0,0 +1,42 @@
+#include "ContinuousEdgeChecker.h"
+#include "RigidBodyCSpace.h"
+#include <errors.h>
+using namespace std;
+using namespace Geometry;
+
+SE3ContinuousEdgeChecker::SE3ContinuousEdgeChecker(CSpace* _space,const Config& a,const Config& b,
+						   AnyCollisionGeometry3D* _robot,
+						   const vector<AnyCollisionGeometry3D*>& _obstacles,
+						   Real _tol)
+  :EdgeChecker(_space,a,b),robot(_robot),obstacles(_obstacles),tol(_tol),contactTime(-1),contactObstacle(-1)
+{}
+
+bool SE3ContinuousEdgeChecker::IsVisible()
+{
+  Assert(robot != NULL);
+  RigidTransform Ta,Tb;
+  SE3CSpace::GetTransform(path->Start(),Ta);
+  SE3CSpace::GetTransform(path->End(),Tb);
+  contactTime = -1;
+  contactObstacle = -1;
+  for(size_t i=0;i<obstacles.size();i++) {
+    RigidTransform Tobs = obstacles[i]->GetTransform();
+    AnyCollisionQuery q(*robot,*obstacles[i]);
+    Real t = q.FirstContactTime(Ta,Tb,Tobs,Tobs,tol);
+    if(t >= 0 && (contactTime < 0 || t < contactTime)) {
+      contactTime = t;
+      contactObstacle = (int)i;
+    }
+  }
+  return contactTime < 0;
+}
+
+EdgePlannerPtr SE3ContinuousEdgeChecker::Copy() const
+{
+  return make_shared<SE3ContinuousEdgeChecker>(space,path->Start(),path->End(),robot,obstacles,tol);
+}
+
+EdgePlannerPtr SE3ContinuousEdgeChecker::ReverseCopy() const
+{
+  return make_shared<SE3ContinuousEdgeChecker>(space,path->End(),path->Start(),robot,obstacles,tol);
+}
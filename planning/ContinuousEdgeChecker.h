@@ -0,0 +1,42 @@
+#ifndef PLANNING_CONTINUOUS_EDGE_CHECKER_H
+#define PLANNING_CONTINUOUS_EDGE_CHECKER_H
+
+#include "EdgePlanner.h"
+#include <KrisLibrary/geometry/AnyGeometry.h>
+#include <vector>
+
+/** @ingroup MotionPlanning
+ * @brief Edge checker for a rigid body in SE(3) that uses a single swept
+ * (continuous) collision query per obstacle rather than checking
+ * configurations at epsilon resolution.
+ *
+ * Configurations are converted to transforms with SE3CSpace::GetTransform,
+ * and the body is assumed to move along the straight line between the
+ * endpoints, with linear translation and geodesic rotation, as given by
+ * SE3CSpace::Interpolate.  Only the robot's transform is modified during
+ * checking, and it is restored afterwards.  The geometry pointers are not
+ * owned by the checker.
+ */
+class SE3ContinuousEdgeChecker : public EdgeChecker
+{
+public:
+  SE3ContinuousEdgeChecker(CSpace* space,const Config& a,const Config& b,
+			   Geometry::AnyCollisionGeometry3D* robot,
+			   const std::vector<Geometry::AnyCollisionGeometry3D*>& obstacles,
+			   Real tol=1e-3);
+  virtual bool IsVisible();
+  virtual EdgePlannerPtr Copy() const;
+  virtual EdgePlannerPtr ReverseCopy() const;
+
+  Geometry::AnyCollisionGeometry3D* robot;
+  std::vector<Geometry::AnyCollisionGeometry3D*> obstacles;
+  ///Contact distance passed to AnyCollisionQuery::FirstContactTime
+  Real tol;
+  ///After IsVisible is called, the first time of contact along the edge,
+  ///or -1 if the edge is collision free
+  Real contactTime;
+  ///After IsVisible is called, the index of the obstacle hit first, or -1
+  int contactObstacle;
+};
+
+#endif
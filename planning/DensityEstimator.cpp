@@ -59,9 +59,8 @@ void GridDensityEstimator::Add(const Math::Vector& x,void* data)
   for(size_t i=0;i<mappedDims.size();i++)
     temp[i] = x[mappedDims[i]];
 
-  GridSubdivision::Index index;
-  subdiv.PointToIndex(temp,index);
-  subdiv.Insert(index,data);
+  subdiv.PointToIndex(temp,tempIndex);
+  subdiv.Insert(tempIndex,data);
 }
 
 void GridDensityEstimator::Remove(const Math::Vector& x,void* data)
@@ -70,9 +69,8 @@ void GridDensityEstimator::Remove(const Math::Vector& x,void* data)
   for(size_t i=0;i<mappedDims.size();i++)
     temp[i] = x[mappedDims[i]];
 
-  GridSubdivision::Index index;
-  subdiv.PointToIndex(temp,index);
-  bool res=subdiv.Erase(index,data);
+  subdiv.PointToIndex(temp,tempIndex);
+  bool res=subdiv.Erase(tempIndex,data);
   Assert(res == true);
 }
 
@@ -82,9 +80,8 @@ double GridDensityEstimator::Density(const Config& x)
   for(size_t i=0;i<mappedDims.size();i++)
     temp[i] = x[mappedDims[i]];
 
-  GridSubdivision::Index index;
-  subdiv.PointToIndex(temp,index);
-  GridSubdivision::ObjectSet* objs = subdiv.GetObjectSet(index);
+  subdiv.PointToIndex(temp,tempIndex);
+  GridSubdivision::ObjectSet* objs = subdiv.GetObjectSet(tempIndex);
   if(!objs) return 0;
   return objs->size();
 }
@@ -115,9 +112,8 @@ void* GridDensityEstimator::RandomNear(const Math::Vector& x)
   for(size_t i=0;i<mappedDims.size();i++)
     temp[i] = x[mappedDims[i]];
 
-  GridSubdivision::Index index;
-  subdiv.PointToIndex(temp,index);
-  GridSubdivision::ObjectSet* objs = subdiv.GetObjectSet(index);
+  subdiv.PointToIndex(temp,tempIndex);
+  GridSubdivision::ObjectSet* objs = subdiv.GetObjectSet(tempIndex);
   if(!objs) return NULL;
 
   return RandomObject(*objs); 
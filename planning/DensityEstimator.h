@@ -61,6 +61,7 @@ public:
 
   //temporary
   Math::Vector temp;
+  Geometry::GridSubdivision::Index tempIndex;
   std::vector<Geometry::GridSubdivision::ObjectSet*> flattenedBuckets;
 };
 
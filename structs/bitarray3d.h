@@ -0,0 +1,85 @@
+#ifndef BITARRAY3D_H
+#define BITARRAY3D_H
+
+#include <KrisLibrary/utils/IntTriple.h>
+#include <KrisLibrary/errors.h>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+/** @brief A three-dimensional m x n x p array of bits.
+ *
+ * Bits are packed 64 to a word along the last index, and each (i,j) row
+ * starts on a new word, so row (i,j) occupies words
+ * [(i*n+j)*rowWords, (i*n+j+1)*rowWords).  Rows (or aligned 64-bit spans of
+ * rows) can therefore be written by different threads without conflict.
+ */
+class BitArray3D
+{
+ public:
+  BitArray3D() : m(0),n(0),p(0),rowWords(0) {}
+  BitArray3D(int _m,int _n,int _p) { resize(_m,_n,_p); }
+
+  ///Resizes the array and clears all bits
+  void resize(int _m,int _n,int _p) {
+    m=_m; n=_n; p=_p;
+    rowWords = (p+63)/64;
+    words.assign(size_t(m)*size_t(n)*size_t(rowWords),0);
+  }
+  void clear() { m=n=p=rowWords=0; words.clear(); }
+  inline bool empty() const { return m==0&&n==0&&p==0; }
+  inline IntTriple size() const { return IntTriple(m,n,p); }
+  ///Sets all bits to value
+  void set(bool value) {
+    if(!value) { std::fill(words.begin(),words.end(),0); return; }
+    for(int i=0;i<m;i++)
+      for(int j=0;j<n;j++)
+        setRange(i,j,0,p,true);
+  }
+
+  inline uint64_t* row(int i,int j) { return &words[(size_t(i)*n+j)*rowWords]; }
+  inline const uint64_t* row(int i,int j) const { return &words[(size_t(i)*n+j)*rowWords]; }
+  inline bool get(int i,int j,int k) const {
+    Assert(i>=0&&i<m); Assert(j>=0&&j<n); Assert(k>=0&&k<p);
+    return (row(i,j)[k>>6] >> (k&63)) & 1;
+  }
+  inline bool get(const IntTriple& t) const { return get(t.a,t.b,t.c); }
+  inline void set(int i,int j,int k,bool value) {
+    Assert(i>=0&&i<m); Assert(j>=0&&j<n); Assert(k>=0&&k<p);
+    uint64_t bit = uint64_t(1) << (k&63);
+    if(value) row(i,j)[k>>6] |= bit;
+    else row(i,j)[k>>6] &= ~bit;
+  }
+  inline void set(const IntTriple& t,bool value) { set(t.a,t.b,t.c,value); }
+  ///Sets bits k0,...,k1-1 of row (i,j) to value
+  void setRange(int i,int j,int k0,int k1,bool value) {
+    if(k0 < 0) k0 = 0;
+    if(k1 > p) k1 = p;
+    if(k0 >= k1) return;
+    uint64_t* r = row(i,j);
+    int w0 = k0>>6, w1 = (k1-1)>>6;
+    for(int w=w0;w<=w1;w++) {
+      uint64_t mask = ~uint64_t(0);
+      if(w == w0) mask &= (~uint64_t(0)) << (k0&63);
+      if(w == w1 && (k1&63) != 0) mask &= (~uint64_t(0)) >> (64-(k1&63));
+      if(value) r[w] |= mask;
+      else r[w] &= ~mask;
+    }
+  }
+  ///Returns the number of set bits
+  size_t count() const {
+    size_t c=0;
+    for(size_t i=0;i<words.size();i++) {
+      uint64_t w = words[i];
+      while(w) { w &= w-1; c++; }
+    }
+    return c;
+  }
+
+  int m,n,p;
+  ///Number of words in each (i,j) row
+  int rowWords;
+  std::vector<uint64_t> words;
+};
+
+#endif
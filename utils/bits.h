@@ -104,6 +104,49 @@ inline int GetGreatestBit(unsigned int x)
     return GetGreatestBit16(x);
 }
 
+/** @brief Spreads the low 21 bits of x so that there are two zero bits
+ * between each pair of consecutive bits.
+ */
+inline unsigned long long MortonSpread3(unsigned int x)
+{
+  unsigned long long v = x & 0x1fffff;
+  v = (v | (v << 32)) & 0x1f00000000ffffULL;
+  v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+  v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+  v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+  v = (v | (v << 2)) & 0x1249249249249249ULL;
+  return v;
+}
+
+/** @brief Inverse of MortonSpread3
+ */
+inline unsigned int MortonCompact3(unsigned long long v)
+{
+  v &= 0x1249249249249249ULL;
+  v = (v | (v >> 2)) & 0x10c30c30c30c30c3ULL;
+  v = (v | (v >> 4)) & 0x100f00f00f00f00fULL;
+  v = (v | (v >> 8)) & 0x1f0000ff0000ffULL;
+  v = (v | (v >> 16)) & 0x1f00000000ffffULL;
+  v = (v | (v >> 32)) & 0x1fffffULL;
+  return (unsigned int)v;
+}
+
+/** @brief Returns the 63-bit Morton (Z-order) code interleaving the low 21
+ * bits of x, y, and z.  x occupies the least significant bit.
+ */
+inline unsigned long long MortonCode3(unsigned int x,unsigned int y,unsigned int z)
+{
+  return MortonSpread3(x) | (MortonSpread3(y) << 1) | (MortonSpread3(z) << 2);
+}
+
+/** @brief Inverse of MortonCode3
+ */
+inline void MortonDecode3(unsigned long long code,unsigned int& x,unsigned int& y,unsigned int& z)
+{
+  x = MortonCompact3(code);
+  y = MortonCompact3(code >> 1);
+  z = MortonCompact3(code >> 2);
+}
 
 /** @brief For integer iterators in the range [begin,end),
  * sets the bits corresponding to the indices.
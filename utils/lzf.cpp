@@ -0,0 +1,107 @@
+#include "lzf.h"
+#include <vector>
+#include <string.h>
+
+//LZF blocks consist of a control byte c followed by either c+1 literal
+//bytes (c < 32), or a back reference of length (c>>5)+2, with length 7
+//extended by the next byte, to offset ((c&0x1f)<<8) + next byte + 1.
+static const int kHashLog = 14;
+static const size_t kMaxLiteral = 32;
+static const size_t kMaxOffset = 1<<13;
+static const size_t kMaxRef = (1<<8) + (1<<3);
+
+inline unsigned int LZFHash(const unsigned char* p)
+{
+  unsigned int v = (unsigned int)p[0]<<16 | (unsigned int)p[1]<<8 | p[2];
+  return (v*2654435761u) >> (32-kHashLog);
+}
+
+size_t LZFCompress(const void* _in,size_t n,void* _out,size_t outSize)
+{
+  const unsigned char* in = (const unsigned char*)_in;
+  unsigned char* out = (unsigned char*)_out;
+  if(n == 0) return 0;
+  std::vector<size_t> table(1<<kHashLog,(size_t)-1);
+  //a literal run is started by reserving its control byte
+  size_t ip = 0, op = 1, lit = 0;
+  if(outSize < 1) return 0;
+  while(ip < n) {
+    size_t ref = (size_t)-1;
+    if(ip + 2 < n) {
+      unsigned int h = LZFHash(in+ip);
+      ref = table[h];
+      table[h] = ip;
+    }
+    if(ref != (size_t)-1 && ip-ref-1 < kMaxOffset && in[ref]==in[ip] && in[ref+1]==in[ip+1] && in[ref+2]==in[ip+2]) {
+      size_t off = ip-ref-1;
+      size_t maxLen = n-ip;
+      if(maxLen > kMaxRef) maxLen = kMaxRef;
+      size_t len = 3;
+      while(len < maxLen && in[ref+len]==in[ip+len]) len++;
+      //close the literal run, or drop its control byte if it's empty
+      if(lit > 0) out[op-lit-1] = (unsigned char)(lit-1);
+      else op--;
+      if(op + 4 > outSize) return 0;
+      size_t l = len-2;
+      if(l < 7) out[op++] = (unsigned char)((off>>8) + (l<<5));
+      else {
+        out[op++] = (unsigned char)((off>>8) + (7<<5));
+        out[op++] = (unsigned char)(l-7);
+      }
+      out[op++] = (unsigned char)(off & 0xff);
+      op++;
+      lit = 0;
+      //index the positions inside the match
+      for(size_t k=ip+1;k<ip+len && k+2<n;k++)
+        table[LZFHash(in+k)] = k;
+      ip += len;
+    }
+    else {
+      if(op >= outSize) return 0;
+      out[op++] = in[ip++];
+      lit++;
+      if(lit == kMaxLiteral) {
+        out[op-lit-1] = (unsigned char)(lit-1);
+        lit = 0;
+        op++;
+      }
+    }
+  }
+  if(lit > 0) out[op-lit-1] = (unsigned char)(lit-1);
+  else op--;
+  if(op > outSize) return 0;
+  return op;
+}
+
+size_t LZFDecompress(const void* _in,size_t n,void* _out,size_t outSize)
+{
+  const unsigned char* in = (const unsigned char*)_in;
+  unsigned char* out = (unsigned char*)_out;
+  size_t ip = 0, op = 0;
+  while(ip < n) {
+    size_t c = in[ip++];
+    if(c < 32) {
+      c++;
+      if(ip + c > n || op + c > outSize) return 0;
+      memcpy(out+op,in+ip,c);
+      ip += c;
+      op += c;
+    }
+    else {
+      size_t len = c>>5;
+      if(len == 7) {
+        if(ip >= n) return 0;
+        len += in[ip++];
+      }
+      len += 2;
+      if(ip >= n) return 0;
+      size_t off = ((c & 0x1f)<<8) + in[ip++] + 1;
+      if(off > op || op + len > outSize) return 0;
+      //the reference may overlap the output, so copy byte by byte
+      unsigned char* ref = out+op-off;
+      for(size_t k=0;k<len;k++) out[op+k] = ref[k];
+      op += len;
+    }
+  }
+  return op;
+}
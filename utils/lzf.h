@@ -0,0 +1,29 @@
+#ifndef UTILS_LZF_H
+#define UTILS_LZF_H
+
+#include <stddef.h>
+
+/** @file utils/lzf.h
+ * @ingroup Utils
+ * @brief LZF compression, compatible with liblzf (and hence with the
+ * binary_compressed PCD format).
+ */
+
+/** @addtogroup Utils */
+/*@{*/
+
+///Returns an output size that LZFCompress never exceeds for n input bytes
+inline size_t LZFCompressBound(size_t n) { return n + n/32 + 16; }
+
+///Compresses the n bytes in in into out, which has room for outSize bytes.
+///Returns the compressed size, or 0 if it doesn't fit.
+size_t LZFCompress(const void* in,size_t n,void* out,size_t outSize);
+
+///Decompresses the n bytes in in into out, which has room for outSize
+///bytes.  Returns the decompressed size, or 0 if the data is corrupt or
+///doesn't fit.
+size_t LZFDecompress(const void* in,size_t n,void* out,size_t outSize);
+
+/*@}*/
+
+#endif
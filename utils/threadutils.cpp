@@ -4,4 +4,24 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 void ThreadSleep(double duration) { Sleep(int(duration*1000)); }
-#endif
\ No newline at end of file
+#endif
+
+#if USE_CPP_THREADS
+int NumHardwareThreads()
+{
+  unsigned int n = std::thread::hardware_concurrency();
+  return (n == 0 ? 1 : (int)n);
+}
+#elif USE_BOOST_THREADS
+int NumHardwareThreads()
+{
+  unsigned int n = boost::thread::hardware_concurrency();
+  return (n == 0 ? 1 : (int)n);
+}
+#else
+int NumHardwareThreads()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n <= 0 ? 1 : (int)n);
+}
+#endif
@@ -104,6 +104,63 @@ struct Condition
 
 #endif //USE_PTHREADS
 
+///Returns the number of hardware threads, or 1 if it can't be determined
+int NumHardwareThreads();
+
+#include <vector>
+#include <atomic>
+
+template <class F>
+struct ParallelForData
+{
+  F* f;
+  int n,chunk;
+  std::atomic<int> next;
+};
+
+template <class F>
+void* ParallelForThreadFunc(void* vdata)
+{
+  ParallelForData<F>* data = (ParallelForData<F>*)vdata;
+  while(true) {
+    int begin = data->next.fetch_add(data->chunk);
+    if(begin >= data->n) break;
+    int end = (begin + data->chunk < data->n ? begin + data->chunk : data->n);
+    for(int i=begin;i<end;i++) (*data->f)(i);
+  }
+  return NULL;
+}
+
+/** @brief Calls f(i) for i=0,...,n-1 on numThreads threads, including the
+ * calling thread.  If numThreads <= 0, NumHardwareThreads() is used.
+ *
+ * Threads take chunks of chunk consecutive indices at a time, so uneven
+ * workloads are balanced.  f must be safe to call concurrently for
+ * different i.
+ */
+template <class F>
+void ParallelFor(int n,F f,int numThreads=0,int chunk=1)
+{
+  if(numThreads <= 0) numThreads = NumHardwareThreads();
+  if(chunk < 1) chunk = 1;
+  if(numThreads > (n+chunk-1)/chunk) numThreads = (n+chunk-1)/chunk;
+  if(numThreads <= 1) {
+    for(int i=0;i<n;i++) f(i);
+    return;
+  }
+  ParallelForData<F> data;
+  data.f = &f;
+  data.n = n;
+  data.chunk = chunk;
+  data.next = 0;
+  std::vector<Thread> threads(numThreads-1);
+  for(size_t i=0;i<threads.size();i++)
+    threads[i] = ThreadStart(ParallelForThreadFunc<F>,&data);
+  ParallelForThreadFunc<F>(&data);
+  for(size_t i=0;i<threads.size();i++)
+    ThreadJoin(threads[i]);
+}
+
 #ifdef WIN32
 void ThreadSleep(double duration);
 #else